@@ -11,9 +11,18 @@
 #include <ntifs.h>
 #include <wdm.h>
 #include <Ntstrsafe.h>
+#include "hpcring.h"
+#include "hpclog.h"
+#include "hpclive.h"
+#include "hpcmatch.h"
+#include "hpcvirt.h"
+#include "hpcconf.h"
+#include "hpcpmu.h"
+#include "hpcstats.h"
 
 
 /***************Configurable parameters***********************/
+//These are the defaults of the run-time configuration; tools/hpcctl changes them through IOCTLs without a rebuild
 
 //a) Choose mode either as SAMPLING_MODE or POLLING_MODE
 #define SAMPLING_MODE	// SAMPLING_MODE or POLLING_MODE
@@ -26,12 +35,16 @@
 	//b) set threshold as 0
 	INT32 pmiThreshold = 0;
 #endif
+//   pmiThreshold is the default; the threshold of the current run is hpcConfig.pmiThreshold
 
 //c) Test process/application that has to be monitored
 #define TEST_APP "test.exe"
 
-//d) change output file path
-#define LOG_FILE L"\\DosDevices\\C:\\Users\\Sanjeev\\Desktop\\hpcoutput.csv"
+//   further applications can be monitored at the same time by adding them here
+char *testApps[] = { TEST_APP };
+
+//d) change output file path; the binary log is converted to CSV with tools/hpcdump
+#define LOG_FILE L"\\DosDevices\\C:\\Users\\Sanjeev\\Desktop\\hpcoutput.bin"
 
 //Configure HPC events to monitor userspace events
 #define EVENT0	0x004100C4 		//Branch instruction retired
@@ -39,31 +52,43 @@
 #define EVENT2	0x00414F2E 		//LLC cache reference
 #define EVENT3	0x0041412E 		//LLC misses
 
-//maximum number of PMI that can be recorded, depends on how much memory can be used by Win kernel driver
-#define MAXVAL 1000000
+//number of samples buffered per CPU before new samples are dropped, must be a power of two
+#define RING_CAPACITY SAMPLE_RING_CAPACITY
+
+//how often the drain thread flushes the sample rings into the output file
+#define DRAIN_INTERVAL_MS 100
 
-//buffer size required for writing/reading into the file
-#define BUFFER_SIZE 500
+//size of one write into the output file, a multiple of SAMPLE_LOG_ALIGN
+#define LOG_BLOCK_SIZE SAMPLE_LOG_BLOCK_SIZE
+
+//1: start monitoring with the defaults above when the driver is loaded; 0: wait for "hpcctl start"
+#define AUTO_START 1
 
 /************************************************************/
 
 
 /* Windows OS Function Prototypes for KMDF */
 NTSTATUS MyDriverUnsupportedFunction(PDEVICE_OBJECT DeviceObject, PIRP Irp);
+NTSTATUS MyDriverCreateClose(PDEVICE_OBJECT DeviceObject, PIRP Irp);
+NTSTATUS MyDriverCleanup(PDEVICE_OBJECT DeviceObject, PIRP Irp);
+NTSTATUS MyDriverDeviceControl(PDEVICE_OBJECT DeviceObject, PIRP Irp);
 DRIVER_UNLOAD MyDriverUnload;
 VOID MyDriverUnload(PDRIVER_OBJECT  DriverObject);
 NTSTATUS DriverEntry(PDRIVER_OBJECT  pDriverObject, PUNICODE_STRING  pRegistryPath);
 NTKERNELAPI void KiDispatchInterrupt(void);
+KSTART_ROUTINE DrainThread;
+KIPI_BROADCAST_WORKER StartCountersIpi;
+KIPI_BROADCAST_WORKER StopCountersIpi;
+KIPI_BROADCAST_WORKER HookISRIpi;
+KIPI_BROADCAST_WORKER PatchSwapContextIpi;
+NTKERNELAPI PCHAR PsGetProcessImageFileName(PEPROCESS Process);
+NTKERNELAPI NTSTATUS PsGetProcessExitStatus(PEPROCESS Process);
 
 
 typedef unsigned short	WORD;
 typedef unsigned char	BYTE;
 typedef unsigned long	ULONG;
 
-#define SIOCTL_TYPE 40000
-#define IOCTL_HELLO\
- CTL_CODE( SIOCTL_TYPE, 0x800, METHOD_BUFFERED, FILE_READ_DATA|FILE_WRITE_DATA)
-
 /* Compile directives. */
 #pragma alloc_text(INIT, DriverEntry)
 #pragma alloc_text(PAGE, MyDriverUnload)
@@ -97,76 +122,680 @@ UINT32 oldISRAddressTrap = NULL;
 
 
 
-//some flags used for logic
-int IsHpcStoredAtContextSwitch = 0;
-int IsTestAppRunning = 0; 
-int IsCurrentProcessTestApp = 0; 	
-
-int trapCount = 0;					// counts number of "int 2e" in source code 
-int perfCounterId = 0; 				// identifies the counter of the 7 HPCs.
-int hpcCount = 0; 					// no. of times record were taken
-
-//64 bit is required for recording counter values: ecx.eax
-UINT64 hpcData[7][MAXVAL+1];
-
-//Used to store/restore values at context switch
-UINT32  counter0LowVal = 0, counter0HighVal = 0, counter1LowVal = 0, counter1HighVal = 0, \
-counter2LowVal = 0, counter2HighVal = 0, counter3LowVal = 0, counter3HighVal = 0, \
-counter4LowVal = 0, counter4HighVal = 0, counter5LowVal = 0, counter5HighVal = 0, \
-counter6LowVal = 0, counter6HighVal = 0;
+volatile LONG trapCount = 0;			// counts number of "int 2e" in source code, on all CPUs
+
+//one entry per CPU, indexed by KeGetCurrentProcessorNumber
+PCPU_STATE cpuStates = NULL;
+ULONG cpuCount = 0;
+
+//the sample rings of all CPUs, which IOCTL_HPC_MAP_LIVE maps into observers (hpclive.h);
+//allocated once and kept until unload, so that the mappings stay valid across runs
+PHPC_LIVE_HEADER liveRegion = NULL;
+
+//mapping of the live region into a process, the FsContext of its handle until IRP_MJ_CLEANUP
+typedef struct _LIVE_MAPPING {
+	PMDL mdl;
+	PVOID address;
+	PEPROCESS process;
+} LIVE_MAPPING, *PLIVE_MAPPING;
+
+//drain thread writing the samples into the output file while the test app runs
+PKTHREAD drainThread = NULL;
+KEVENT drainStopEvent;
+UINT8 *logBlocks = NULL;			//staging buffers of the drain thread: one log block per CPU, then the header scratch
+PSAMPLE_LOG_STREAM logStreams = NULL;	//one log stream per CPU
+SAMPLE_LOG_HEADER runHeader;			//header of the output file; with its self stats too large for a kernel stack
+SAMPLE_LOG runLog;						//log of the drain thread, holds a copy of the header
+
+//output=stats: distributions of the samples instead of the log, filled by the drain thread
+PSAMPLE_STATS sampleStats = NULL;
+UINT32 sampleStatsSize = 0;			//allocated bytes, the image rounded up to SAMPLE_LOG_ALIGN for the unbuffered write
+FAST_MUTEX statsLock;				//serializes the drain thread and IOCTL_HPC_QUERY_STATS
+
+//EPROCESS pointers of the running test processes, looked up by the context switch hook
+TARGET_SET targetSet;
+KSPIN_LOCK targetLock;		//serializes writers of targetSet
+BOOLEAN isProcessNotifyRegistered = FALSE;
+
+//the PMU of the current CPU; the counter logic of the handlers in hpcpmu.c only accesses it through these
+UINT64 PmuReadMSR(void *context, UINT32 msr);
+void PmuWriteMSR(void *context, UINT32 msr, UINT64 value);
+void PmuReadPMCs(void *context, UINT64 *values);
+UINT64 PmuReadTSC(void *context);
+PMU_CAPS pmuCaps;					//counters of the PMU, from CPUID at load
+PMU_OPS pmuOps = { PmuReadMSR, PmuWriteMSR, PmuReadPMCs, PmuReadTSC, NULL, &pmuCaps };
+
+//per-thread counter values of the test threads, saved/restored at context switch
+COUNTER_VIRT counterVirt;
+PTHREAD_CONTEXT threadContexts = NULL;
+PREGION_STACK regionStacks = NULL;		//polling mode: open regions of the thread of the thread context with the same index
+volatile LONG regionDrops = 0;			//region traps of threads without a thread context
+BOOLEAN isThreadNotifyRegistered = FALSE;
+
+//run-time configuration, changed by IOCTL_HPC_CONFIGURE while monitoring is stopped
+HPC_CONFIG hpcConfig;
+KMUTEX controlLock;					//serializes the IOCTLs and unload
+BOOLEAN isRunning = FALSE;
+UINT64 lastSamples = 0;				//sample and drop counts of the last run, for IOCTL_HPC_QUERY_STATUS
+UINT64 lastDropped = 0;
+SELF_STATS lastSelf;					//cost of the handlers in the last run
+UINT64 runStartTsc = 0;				//time stamp of the start of the current run
+
+//SwapContext inline hook, patched in and out at every start/stop
+PUCHAR swapContext = NULL;
+PEX_RUNDOWN_REF_CACHE_AWARE swapContextRundown = NULL;	//waits for the CPUs still inside SaveRestoreCounters at stop
  
 
 void InitializeCounters();
 void WriteMSR(int lowVal, int highVal, int addr);
 INT64 ReadMSR(int addr);  
-void RecordHPC(int addr);
-void RecordFinalSample(int lowVal, int highVal);
+UINT64 ReadTSC();
+
+/*
+*	execute CPUID for the given leaf; regs receives eax, ebx, ecx, edx
+*/
+void ReadCpuId(UINT32 leaf, UINT32 *regs){
+	UINT32 eaxVal, ebxVal, ecxVal, edxVal;
+
+	__asm{
+		mov eax, leaf
+		xor ecx, ecx
+		cpuid
+		mov eaxVal, eax
+		mov ebxVal, ebx
+		mov ecxVal, ecx
+		mov edxVal, edx
+	}
+	regs[0] = eaxVal;
+	regs[1] = ebxVal;
+	regs[2] = ecxVal;
+	regs[3] = edxVal;
+}
+
+/*
+*	discover the counters of the PMU; the CPUs of one system have the same PMU
+*/
+void ReadPmuCaps(){
+	UINT32 leaf0[4], leaf1[4], leafA[4] = { 0 };
+
+	ReadCpuId(0, leaf0);
+	ReadCpuId(1, leaf1);
+	if(leaf0[0] >= 0xA)
+		ReadCpuId(0xA, leafA);
+	if(PmuCapsFromCpuid(&pmuCaps, leaf0, leaf1, leafA) != 0)
+		DbgPrint("No architectural PMU, the driver cannot start\r\n");
+	else
+		DbgPrint("PMU version %u: %u of %u programmable counters of %u bits, fixed counters 0x%x of %u bits\r\n",
+			pmuCaps.version, pmuCaps.usedProgrammable, pmuCaps.programmable, pmuCaps.programmableWidth,
+			pmuCaps.fixedMask, pmuCaps.fixedWidth);
+}
+
+/*
+*	describe the experiment in the log header
+*/
+void FillLogHeader(PSAMPLE_LOG_HEADER header){
+	UINT32 regs[4];
+	UINT32 leaf;
+
+	SampleLogInitHeader(header);
+	header->mode = hpcConfig.mode;		//HPC_MODE_* equal SAMPLE_LOG_MODE_*
+	header->pmiThreshold = hpcConfig.pmiThreshold;
+	RtlCopyMemory(header->eventSel, hpcConfig.eventSel[0], sizeof(header->eventSel));
+	header->groupCount = hpcConfig.groupCount;
+	header->groupPeriod = hpcConfig.groupPeriod;
+	RtlCopyMemory(header->groupEventSel, hpcConfig.eventSel, sizeof(header->groupEventSel));
+	RtlStringCbCopyA(header->testApp, sizeof(header->testApp), hpcConfig.testApps[0]);
+	header->cpuCount = cpuCount;
+	if(hpcConfig.freeze)
+		header->flags |= SAMPLE_LOG_FLAG_FREEZE;
+	header->jitter = hpcConfig.jitter;
+	header->target = hpcConfig.target;
+	header->budget = hpcConfig.budget;
+	header->pmuVersion = pmuCaps.version;
+	header->columns = pmuCaps.columns;
+	header->programmableWidth = pmuCaps.programmableWidth;
+	header->fixedWidth = pmuCaps.fixedWidth;
+
+	ReadCpuId(1, regs);
+	header->cpuSignature = regs[0];
+
+	//brand string is held by the extended leaves 0x80000002-0x80000004
+	ReadCpuId(0x80000000, regs);
+	if(regs[0] >= 0x80000004){
+		for(leaf = 0; leaf < 3; leaf++){
+			ReadCpuId(0x80000002 + leaf, regs);
+			RtlCopyMemory(header->cpuModel + 16 * leaf, regs, 16);
+		}
+		header->cpuModel[sizeof(header->cpuModel) - 1] = 0;
+	}
+}
+
+/*
+*	write callback of the sample log: one aligned chunk at the given file offset
+*/
+int WriteLogChunk(void *context, UINT64 offset, const void *buffer, UINT32 len){
+	IO_STATUS_BLOCK ioStatusBlock;
+	LARGE_INTEGER byteOffset;
+	NTSTATUS ntStatus;
+
+	byteOffset.QuadPart = offset;
+	ntStatus = ZwWriteFile((HANDLE)context, NULL, NULL, NULL, &ioStatusBlock, (PVOID)buffer, len, &byteOffset, NULL);
+	return NT_SUCCESS(ntStatus) ? 0 : -1;
+}
 
 /*
-*	log HPC counter values in an output file;
+*	create the output file; returns NULL on failure.
+*	The log only issues sector-aligned writes, so the file cache is bypassed.
 */
-int LogHPCData(){
+HANDLE OpenLogFile(){
 	UNICODE_STRING uniName;
 	OBJECT_ATTRIBUTES objAttr;
 	HANDLE handle;
 	NTSTATUS ntStatus;
 	IO_STATUS_BLOCK ioStatusBlock;
-	CHAR buffer[BUFFER_SIZE];
-	size_t cb;
-	int i = 0;
 
-	RtlInitUnicodeString(&uniName, LOG_FILE);
+	RtlInitUnicodeString(&uniName, (PCWSTR)hpcConfig.logFile);
 	InitializeObjectAttributes(&objAttr, &uniName,OBJ_CASE_INSENSITIVE | OBJ_KERNEL_HANDLE, NULL, NULL);
 
 	// Do not try to perform any file operations at higher IRQL levels.
 	if(KeGetCurrentIrql() != PASSIVE_LEVEL)
-		return STATUS_INVALID_DEVICE_STATE;
+		return NULL;
 
 	//creates an output file
-	ntStatus = ZwCreateFile(&handle,GENERIC_WRITE,&objAttr, &ioStatusBlock, NULL,FILE_ATTRIBUTE_NORMAL, 0,FILE_OVERWRITE_IF,FILE_SYNCHRONOUS_IO_NONALERT, NULL, 0);
-
-	//write recorded HPC values into an output file
-	if(NT_SUCCESS(ntStatus)){
-		ntStatus = RtlStringCbPrintfA(buffer, sizeof(buffer),"ins,l_cycle,ref_cycle,event1,event2,event3,event4\r\n");
-		if(NT_SUCCESS(ntStatus)) {
-			ntStatus = RtlStringCbLengthA(buffer, sizeof(buffer), &cb);
-			if(NT_SUCCESS(ntStatus)) {
-				ntStatus = ZwWriteFile(handle, NULL, NULL, NULL, &ioStatusBlock, buffer, cb, NULL, NULL);
-			}
+	ntStatus = ZwCreateFile(&handle,GENERIC_WRITE,&objAttr, &ioStatusBlock, NULL,FILE_ATTRIBUTE_NORMAL, 0,FILE_OVERWRITE_IF,FILE_SYNCHRONOUS_IO_NONALERT | FILE_NO_INTERMEDIATE_BUFFERING, NULL, 0);
+	if(!NT_SUCCESS(ntStatus))
+		return NULL;
+	return handle;
+}
+
+/*
+*	move all committed samples from the per-CPU rings into the log stream of their CPU,
+*	or into the stats when only their distributions are kept
+*/
+void DrainSampleRings(PSAMPLE_LOG_STREAM streams, PSAMPLE_STATS stats){
+	KFLOATING_SAVE floatSave;
+	PHPC_RECORD first;
+	HPC_SAMPLE sample;
+	UINT32 count, i;
+	ULONG cpu;
+
+	//the running means of the stats use the FPU, whose state kernel code has to save on x86
+	if(stats != NULL){
+		ExAcquireFastMutex(&statsLock);
+		if(!NT_SUCCESS(KeSaveFloatingPointState(&floatSave))){
+			ExReleaseFastMutex(&statsLock);
+			return;		//the samples stay in the rings until the next drain
 		}
-		for(i=0; i<hpcCount; i++){
-			ntStatus = RtlStringCbPrintfA(buffer, sizeof(buffer),"%llu,%llu,%llu,%llu,%llu,%llu,%llu\r\n", hpcData[0][i],hpcData[1][i],hpcData[2][i],hpcData[3][i],hpcData[4][i],hpcData[5][i],hpcData[6][i]);
-			if(NT_SUCCESS(ntStatus)) {
-				ntStatus = RtlStringCbLengthA(buffer, sizeof(buffer), &cb);
-				if(NT_SUCCESS(ntStatus)) {
-					ntStatus = ZwWriteFile(handle, NULL, NULL, NULL, &ioStatusBlock, buffer, cb, NULL, NULL);
-				}
+	}
+
+	for(cpu = 0; cpu < cpuCount; cpu++){
+		while((count = SampleRingPeek(&cpuStates[cpu].ring, &first)) != 0){
+			for(i = 0; i < count && (streams != NULL || stats != NULL); i++){
+				SampleRecordUnpack(&first[i], (UINT16)cpu, &sample);
+				if(streams != NULL)
+					SampleLogAppend(&streams[cpu], &sample);
+				else
+					StatsAddSample(stats, &sample);
 			}
+			SampleRingRelease(&cpuStates[cpu].ring, count);
 		}
+	}
+
+	if(stats != NULL){
+		KeRestoreFloatingPointState(&floatSave);
+		ExReleaseFastMutex(&statsLock);
+	}
+}
+
+/*
+*	samples lost to full rings so far
+*/
+UINT64 CountDropped(){
+	UINT64 dropped = 0;
+	ULONG cpu;
+
+	for(cpu = 0; cpu < cpuCount; cpu++)
+		dropped += cpuStates[cpu].ring.dropped;
+	return dropped;
+}
+
+/*
+*	cost of the handlers on all CPUs since the start of the run
+*/
+void CollectSelfStats(PSELF_STATS self){
+	ULONG cpu;
+
+	RtlZeroMemory(self, sizeof(*self));
+	for(cpu = 0; cpu < cpuCount; cpu++)
+		SelfMerge(self, &cpuStates[cpu].self);
+	self->dropped = CountDropped();
+	self->runCycles = ReadTSC() - runStartTsc;
+}
+
+/*
+*	copy the stats of the current run into buffer; returns the bytes copied
+*/
+UINT32 CopyStats(PVOID buffer){
+	UINT32 size;
+
+	ExAcquireFastMutex(&statsLock);
+	sampleStats->log.dropped = CountDropped();
+	CollectSelfStats(&sampleStats->log.self);
+	size = StatsSize(sampleStats->groupCount);
+	RtlCopyMemory(buffer, sampleStats, size);
+	ExReleaseFastMutex(&statsLock);
+	return size;
+}
+
+/*
+*	passive-level thread that periodically drains the sample rings while the test app runs;
+*	it drains one last time and closes the output file when drainStopEvent is set
+*/
+VOID DrainThread(PVOID context){
+	LARGE_INTEGER interval;
+	NTSTATUS ntStatus;
+	HANDLE handle;
+	PSAMPLE_LOG_STREAM streams = NULL;
+	UINT64 dropped;
+	ULONG cpu;
+
+	UNREFERENCED_PARAMETER(context);
+	interval.QuadPart = -10000 * (LONGLONG)DRAIN_INTERVAL_MS;	//relative time in 100ns units
+
+	handle = OpenLogFile();
+	if(handle != NULL && sampleStats == NULL){
+		FillLogHeader(&runHeader);
+		runHeader.blockSize = LOG_BLOCK_SIZE;
+		if(SampleLogOpen(&runLog, &runHeader, logBlocks + cpuCount * LOG_BLOCK_SIZE, WriteLogChunk, handle) == 0){
+			//every CPU gets its own stream so that its samples stay in the order it took them
+			for(cpu = 0; cpu < cpuCount; cpu++)
+				SampleLogStreamInit(&logStreams[cpu], &runLog, cpu, logBlocks + cpu * LOG_BLOCK_SIZE);
+			streams = logStreams;
+		}
+	}
+	if(handle == NULL || (streams == NULL && sampleStats == NULL))
+		DbgPrint("Could not create the output file, samples will be discarded.\r\n");
+
+	do{
+		ntStatus = KeWaitForSingleObject(&drainStopEvent, Executive, KernelMode, FALSE, &interval);
+		DrainSampleRings(streams, sampleStats);
+	}while(ntStatus == STATUS_TIMEOUT);
+
+	//the hooks are removed by now, so the cost of the handlers is final
+	dropped = CountDropped();
+	if(streams != NULL){
+		for(cpu = 0; cpu < cpuCount; cpu++)
+			SampleLogFlush(&streams[cpu]);
+		CollectSelfStats(&runLog.header.self);
+		if(SampleLogClose(&runLog, dropped) != 0)
+			DbgPrint("Writing the output file failed.\r\n");
+	}else if(sampleStats != NULL && handle != NULL){
+		//the image was allocated and zeroed rounded up to the alignment of unbuffered writes
+		sampleStats->log.dropped = dropped;
+		CollectSelfStats(&sampleStats->log.self);
+		if(WriteLogChunk(handle, 0, sampleStats, sampleStatsSize) != 0)
+			DbgPrint("Writing the output file failed.\r\n");
+	}
+	if(handle != NULL)
 		ZwClose(handle);
+	PsTerminateSystemThread(STATUS_SUCCESS);
+}
+
+/*
+*	allocate the live region with a sample ring for every possible CPU, once
+*/
+NTSTATUS AllocateLiveRegion(){
+	UINT32 cpuOffset, slotOffset, size;
+	ULONG cpus;
+
+	if(liveRegion != NULL)
+		return STATUS_SUCCESS;
+	cpus = KeQueryMaximumProcessorCount();
+	size = LiveLayout(cpus, RING_CAPACITY, &cpuOffset, &slotOffset);
+	liveRegion = (PHPC_LIVE_HEADER)ExAllocatePoolWithTag(NonPagedPool, size, 'Hliv');	//page aligned
+	if(liveRegion == NULL)
+		return STATUS_INSUFFICIENT_RESOURCES;
+	RtlZeroMemory(liveRegion, size);
+	LiveInit(liveRegion, cpus, RING_CAPACITY);
+	return STATUS_SUCCESS;
+}
+
+/*
+*	map the live region into the calling process until it closes its handle; returns the user address
+*/
+NTSTATUS MapLiveRegion(PFILE_OBJECT fileObject, UINT64 *address){
+	PLIVE_MAPPING mapping = (PLIVE_MAPPING)fileObject->FsContext;
+	PVOID user = NULL;
+	NTSTATUS ntStatus;
+
+	if(mapping == NULL){
+		ntStatus = AllocateLiveRegion();
+		if(!NT_SUCCESS(ntStatus))
+			return ntStatus;
+		mapping = (PLIVE_MAPPING)ExAllocatePoolWithTag(NonPagedPool, sizeof(LIVE_MAPPING), 'Hmap');
+		if(mapping == NULL)
+			return STATUS_INSUFFICIENT_RESOURCES;
+		mapping->mdl = IoAllocateMdl(liveRegion, liveRegion->size, FALSE, FALSE, NULL);
+		if(mapping->mdl == NULL){
+			ExFreePoolWithTag(mapping, 'Hmap');
+			return STATUS_INSUFFICIENT_RESOURCES;
+		}
+		MmBuildMdlForNonPagedPool(mapping->mdl);
+
+		//a user-mode mapping raises an exception when it fails; the pages of a
+		//nonpaged pool MDL cannot be mapped read-only on Windows 7, observers must not write
+		__try{
+			user = MmMapLockedPagesSpecifyCache(mapping->mdl, UserMode, MmCached, NULL, FALSE, NormalPagePriority);
+		}__except(EXCEPTION_EXECUTE_HANDLER){
+			user = NULL;
+		}
+		if(user == NULL){
+			IoFreeMdl(mapping->mdl);
+			ExFreePoolWithTag(mapping, 'Hmap');
+			return STATUS_INSUFFICIENT_RESOURCES;
+		}
+		mapping->address = user;
+		mapping->process = PsGetCurrentProcess();
+		ObReferenceObject(mapping->process);
+		fileObject->FsContext = mapping;
+	}
+	*address = (UINT64)(UINT_PTR)mapping->address;
+	return STATUS_SUCCESS;
+}
+
+/*
+*	remove the mapping of a handle from the process that made it
+*/
+void UnmapLiveRegion(PFILE_OBJECT fileObject){
+	PLIVE_MAPPING mapping = (PLIVE_MAPPING)fileObject->FsContext;
+	KAPC_STATE apcState;
+
+	if(mapping == NULL)
+		return;
+	//the last handle may be closed by a process it was duplicated into
+	if(PsGetCurrentProcess() != mapping->process){
+		KeStackAttachProcess((PRKPROCESS)mapping->process, &apcState);
+		MmUnmapLockedPages(mapping->address, mapping->mdl);
+		KeUnstackDetachProcess(&apcState);
+	}else
+		MmUnmapLockedPages(mapping->address, mapping->mdl);
+	ObDereferenceObject(mapping->process);
+	IoFreeMdl(mapping->mdl);
+	ExFreePoolWithTag(mapping, 'Hmap');
+	fileObject->FsContext = NULL;
+}
+
+/*
+*	allocate the state of every CPU, set up its sample ring in the live region and start the drain thread
+*/
+NTSTATUS StartSampleCollection(){
+	HANDLE threadHandle;
+	NTSTATUS ntStatus;
+	ULONG cpu;
+
+	ntStatus = AllocateLiveRegion();
+	if(!NT_SUCCESS(ntStatus))
+		return ntStatus;
+	cpuCount = KeQueryActiveProcessorCount(NULL);
+	cpuStates = (PCPU_STATE)ExAllocatePoolWithTag(NonPagedPool, cpuCount * sizeof(CPU_STATE), 'Hcpu');
+	logBlocks = (UINT8*)ExAllocatePoolWithTag(NonPagedPool, cpuCount * LOG_BLOCK_SIZE + SAMPLE_LOG_ALIGN, 'Hlog');	//page aligned
+	logStreams = (PSAMPLE_LOG_STREAM)ExAllocatePoolWithTag(NonPagedPool, cpuCount * sizeof(SAMPLE_LOG_STREAM), 'Hstr');
+	//StopSampleCollection sums the rings and the self stats even if the start fails below
+	if(cpuStates != NULL)
+		RtlZeroMemory(cpuStates, cpuCount * sizeof(CPU_STATE));
+	if(cpuStates == NULL || logBlocks == NULL || logStreams == NULL)
+		return STATUS_INSUFFICIENT_RESOURCES;
+
+	//the stats replace the log; their size only depends on the number of event groups
+	if(hpcConfig.output == HPC_OUTPUT_STATS){
+		sampleStatsSize = (StatsSize(hpcConfig.groupCount) + SAMPLE_LOG_ALIGN - 1) & ~(SAMPLE_LOG_ALIGN - 1);
+		sampleStats = (PSAMPLE_STATS)ExAllocatePoolWithTag(NonPagedPool, sampleStatsSize, 'Hsta');	//page aligned
+		if(sampleStats == NULL)
+			return STATUS_INSUFFICIENT_RESOURCES;
+		RtlZeroMemory(sampleStats, sampleStatsSize);
+		FillLogHeader(&runHeader);
+		StatsInit(sampleStats, &runHeader);
+	}
+
+	for(cpu = 0; cpu < cpuCount; cpu++){
+		SampleRingInit(&cpuStates[cpu].ring, LiveSlots(liveRegion, cpu), RING_CAPACITY);
+		SampleRingPublish(&cpuStates[cpu].ring, &LiveCpu(liveRegion, cpu)->head);
+		cpuStates[cpu].isTestThread = 0;
+		cpuStates[cpu].thread = NULL;
+		cpuStates[cpu].tid = 0;
+		cpuStates[cpu].group = 0;
+		cpuStates[cpu].number = (UINT16)cpu;
+	}
+	runStartTsc = ReadTSC();
+
+	//observers see the new run once the heads are reset
+	FillLogHeader(&liveRegion->log);
+	HpcStoreRelease(&liveRegion->run, liveRegion->run + 1);
+	liveRegion->running = 1;
+
+	KeInitializeEvent(&drainStopEvent, NotificationEvent, FALSE);
+	ntStatus = PsCreateSystemThread(&threadHandle, THREAD_ALL_ACCESS, NULL, NULL, NULL, DrainThread, NULL);
+	if(!NT_SUCCESS(ntStatus))
+		return ntStatus;
+
+	ntStatus = ObReferenceObjectByHandle(threadHandle, THREAD_ALL_ACCESS, NULL, KernelMode, (PVOID*)&drainThread, NULL);
+	ZwClose(threadHandle);
+	return ntStatus;
+}
+
+/*
+*	stop the drain thread, which flushes the remaining samples, and free the state of the CPUs
+*/
+void StopSampleCollection(){
+	ULONG cpu;
+
+	if(drainThread != NULL){
+		KeSetEvent(&drainStopEvent, IO_NO_INCREMENT, FALSE);
+		KeWaitForSingleObject(drainThread, Executive, KernelMode, FALSE, NULL);
+		ObDereferenceObject(drainThread);
+		drainThread = NULL;
+	}
+	if(liveRegion != NULL)
+		liveRegion->running = 0;
+
+	if(cpuStates != NULL){
+		lastSamples = 0;
+		lastDropped = 0;
+		CollectSelfStats(&lastSelf);
+		for(cpu = 0; cpu < cpuCount; cpu++){
+			if(cpuStates[cpu].ring.dropped != 0)
+				DbgPrint("CPU %u: %u samples dropped, ring was full.\r\n", cpu, cpuStates[cpu].ring.dropped);
+			lastSamples += cpuStates[cpu].ring.head;
+			lastDropped += cpuStates[cpu].ring.dropped;
+		}
+		ExFreePoolWithTag(cpuStates, 'Hcpu');
+		cpuStates = NULL;
+	}
+	if(logBlocks != NULL){
+		ExFreePoolWithTag(logBlocks, 'Hlog');
+		logBlocks = NULL;
+	}
+	if(logStreams != NULL){
+		ExFreePoolWithTag(logStreams, 'Hstr');
+		logStreams = NULL;
+	}
+	if(sampleStats != NULL){
+		ExFreePoolWithTag(sampleStats, 'Hsta');
+		sampleStats = NULL;
+	}
+	cpuCount = 0;
+}
+
+/*
+*	add a process to targetSet if it runs one of the configured test applications
+*/
+void AddTargetProcess(PEPROCESS process){
+	KIRQL irql;
+	int rc;
+
+	if(!HpcConfigIsTestApp(&hpcConfig, PsGetProcessImageFileName(process)))
+		return;
+
+	KeAcquireSpinLock(&targetLock, &irql);
+	rc = TargetSetAdd(&targetSet, (UINT_PTR)process, (UINT_PTR)PsGetProcessId(process));
+	KeReleaseSpinLock(&targetLock, irql);
+	if(rc != 0)
+		DbgPrint("Too many test processes, %p is not monitored.\r\n", process);
+}
+
+/*
+*	remove an exiting process from targetSet, so that a new EPROCESS at the same address is not matched;
+*	by its id, which stays valid in the notify routine while a lookup of the process may already fail
+*/
+void RemoveTargetProcess(HANDLE processId){
+	KIRQL irql;
+
+	KeAcquireSpinLock(&targetLock, &irql);
+	TargetSetRemove(&targetSet, (UINT_PTR)processId);
+	KeReleaseSpinLock(&targetLock, irql);
+}
+
+/*
+*	process notify routine: resolve test processes once when they start and forget them when they exit
+*/
+VOID ProcessNotify(HANDLE ParentId, HANDLE ProcessId, BOOLEAN Create){
+	PEPROCESS process;
+
+	UNREFERENCED_PARAMETER(ParentId);
+	if(!Create){
+		RemoveTargetProcess(ProcessId);
+		return;
+	}
+	if(!NT_SUCCESS(PsLookupProcessByProcessId(ProcessId, &process)))
+		return;
+	AddTargetProcess(process);
+	ObDereferenceObject(process);
+}
+
+/*
+*	thread notify routine: drop the saved counters of an exiting thread
+*/
+VOID ThreadNotify(HANDLE ProcessId, HANDLE ThreadId, BOOLEAN Create){
+	PETHREAD thread;
+	KIRQL irql;
+
+	UNREFERENCED_PARAMETER(ProcessId);
+	if(Create)
+		return;
+	if(NT_SUCCESS(PsLookupThreadByThreadId(ThreadId, &thread))){
+		//runs in the exiting thread; DISPATCH_LEVEL keeps it on the CPU whose state it clears
+		KeRaiseIrql(DISPATCH_LEVEL, &irql);
+		PmuThreadExit(&counterVirt, &cpuStates[KeGetCurrentProcessorNumber()], (UINT_PTR)thread);
+		KeLowerIrql(irql);
+		ObDereferenceObject(thread);
+	}
+}
+
+/*
+*	COUNTER_OPS callbacks: save/restore the 7 HPCs of the current CPU
+*/
+void ReadCounters(void *context, UINT64 *values){
+	PmuSaveWindow((const PMU_OPS *)context, &hpcConfig, &cpuStates[KeGetCurrentProcessorNumber()], values);
+}
+
+void WriteCounters(void *context, const UINT64 *values){
+	PmuRestoreWindow((const PMU_OPS *)context, &hpcConfig, &cpuStates[KeGetCurrentProcessorNumber()], values);
+}
+
+/*
+*	start tracking test processes, including those already running when the driver is loaded,
+*	and the counters of their threads
+*/
+NTSTATUS StartProcessTracking(){
+	PEPROCESS process;
+	NTSTATUS ntStatus;
+	ULONG pid;
+	COUNTER_OPS ops;
+	UINT64 initial[HPC_NUM_COUNTERS] = { 0 };
+
+	TargetSetInit(&targetSet);
+	KeInitializeSpinLock(&targetLock);
+
+	//a new thread starts with a full PMI window and zeroed counters
+	initial[0] = PmuPreload(&pmuCaps, &hpcConfig, 0);
+	ops.read = ReadCounters;
+	ops.write = WriteCounters;
+	ops.context = &pmuOps;
+	threadContexts = (PTHREAD_CONTEXT)ExAllocatePoolWithTag(NonPagedPool, THREAD_TABLE_SIZE * sizeof(THREAD_CONTEXT), 'Hthr');
+	if(threadContexts == NULL)
+		return STATUS_INSUFFICIENT_RESOURCES;
+	CounterVirtInit(&counterVirt, threadContexts, THREAD_TABLE_SIZE, &ops, initial);
+
+	//the stacks are claimed by the region trap of their thread, see RecordTrap
+	if(hpcConfig.mode == HPC_MODE_POLLING){
+		regionStacks = (PREGION_STACK)ExAllocatePoolWithTag(NonPagedPool, THREAD_TABLE_SIZE * sizeof(REGION_STACK), 'Hreg');
+		if(regionStacks == NULL)
+			return STATUS_INSUFFICIENT_RESOURCES;
+		RtlZeroMemory(regionStacks, THREAD_TABLE_SIZE * sizeof(REGION_STACK));
+	}
+
+	ntStatus = PsSetCreateThreadNotifyRoutine(ThreadNotify);
+	if(!NT_SUCCESS(ntStatus))
+		return ntStatus;
+	isThreadNotifyRegistered = TRUE;
+
+	ntStatus = PsSetCreateProcessNotifyRoutine(ProcessNotify, FALSE);
+	if(!NT_SUCCESS(ntStatus))
+		return ntStatus;
+	isProcessNotifyRegistered = TRUE;
+
+	//process ids are multiples of 4; skip processes that already exited
+	for(pid = 8; pid < 0x10000; pid += 4){
+		if(NT_SUCCESS(PsLookupProcessByProcessId((HANDLE)(ULONG_PTR)pid, &process))){
+			if(PsGetProcessExitStatus(process) == STATUS_PENDING)
+				AddTargetProcess(process);
+			ObDereferenceObject(process);
+		}
+	}
+	return STATUS_SUCCESS;
+}
+
+/*
+*	print the region markers that could not be measured in the last run
+*/
+void ReportRegionErrors(){
+	UINT32 i, overflows = 0, mismatches = 0, open = 0;
+
+	for(i = 0; i < THREAD_TABLE_SIZE; i++){
+		overflows += regionStacks[i].overflows;
+		mismatches += regionStacks[i].mismatches;
+		open += regionStacks[i].depth;
 	}
-	return 1;
- }
+	if(overflows != 0 || mismatches != 0 || open != 0 || regionDrops != 0)
+		DbgPrint("Regions: %u nested too deep, %u unmatched markers, %u still open, %d traps of threads without context.\r\n",
+			overflows, mismatches, open, regionDrops);
+	regionDrops = 0;
+}
+
+/*
+*	stop tracking test processes and free the thread contexts
+*/
+void StopProcessTracking(){
+	if(isProcessNotifyRegistered){
+		PsSetCreateProcessNotifyRoutine(ProcessNotify, TRUE);
+		isProcessNotifyRegistered = FALSE;
+	}
+	if(isThreadNotifyRegistered){
+		PsRemoveCreateThreadNotifyRoutine(ThreadNotify);
+		isThreadNotifyRegistered = FALSE;
+	}
+	if(threadContexts != NULL){
+		if(counterVirt.overflows != 0)
+			DbgPrint("%u context switches were not virtualized, thread table was full.\r\n", counterVirt.overflows);
+		ExFreePoolWithTag(threadContexts, 'Hthr');
+		threadContexts = NULL;
+	}
+	if(regionStacks != NULL){
+		ReportRegionErrors();
+		ExFreePoolWithTag(regionStacks, 'Hreg');
+		regionStacks = NULL;
+	}
+}
 
 /*
  * Get the address of IDT table.
@@ -215,30 +844,45 @@ UINT32 GetISRAddress(UINT16 service) {
   isrAddr += descAddr->offset00;
   DbgPrint("Address of the ISR is: %x.\r\n", isrAddr);
 
-  /* store old ISR address in global variable, so we can use it later */
-  if (service == 0xfe)
-	oldISRAddressPmi = isrAddr;
-  else
-	oldISRAddressTrap = isrAddr;
+  /* store old ISR address in global variable, so we can use it later;
+     only the first address is the OS handler, afterwards the ISR is our hook */
+  if (service == 0xfe) {
+	if (oldISRAddressPmi == NULL)
+		oldISRAddressPmi = isrAddr;
+  } else {
+	if (oldISRAddressTrap == NULL)
+		oldISRAddressTrap = isrAddr;
+  }
 
   return isrAddr;
 }
 
 /*
- * Records HPC data
+ * Counter logic of a trap; magic and marker are the ebx and ecx of the trap, see hpcregion.h,
+ * eip and cs the return address of the int 2e and the code segment of the caller
  */
-void RecordHPCSample(INT64 combinedVal) {
-	
-	if(perfCounterId == 0){
-		#ifdef SAMPLING_MODE
-			hpcData[perfCounterId][hpcCount] = abs((INT32)pmiThreshold-combinedVal);
-		#else
-			hpcData[perfCounterId][hpcCount] = combinedVal;
-		#endif
-	}else{
-		hpcData[perfCounterId][hpcCount] = combinedVal;	
+void RecordTrap(UINT32 magic, UINT32 marker, UINT32 eip, UINT32 cs){
+	PCPU_STATE cpu;
+	PREGION_STACK stack;
+
+	cpu = &cpuStates[KeGetCurrentProcessorNumber()];
+	if(magic != HPC_REGION_MAGIC){
+		//record the interval between the first two traps, as the original driver did
+		PmuHandleTrap(&pmuOps, &hpcConfig, cpu, InterlockedIncrement(&trapCount) == 2, (UINT32)(ULONG_PTR)PsGetCurrentThreadId(), eip, cs);
+		return;
 	}
-	perfCounterId++;
+
+	//region traps of other processes are ignored; the stack of a thread lives next to its counters
+	if(!cpu->isTestThread)
+		return;
+	if(cpu->thread == NULL){
+		InterlockedIncrement(&regionDrops);
+		return;
+	}
+	stack = &regionStacks[cpu->thread - threadContexts];
+	if(stack->tid != cpu->tid)
+		RegionStackInit(stack, cpu->tid);		//first region of this thread, or a new thread in the context of an exited one
+	PmuHandleRegion(&pmuOps, cpu, stack, marker);
 }
 
 /*
@@ -252,29 +896,20 @@ __declspec(naked) HookTrap() {
 		push fs
 		push ds
 		push es
-	}
 
-	trapCount++;
-	if (trapCount == 2){
-		perfCounterId = 0;
-		RecordHPC(0x309);
-		RecordHPC(0x30A);
-		RecordHPC(0x30B);
-		RecordHPC(0xC1);
-		RecordHPC(0xC2);
-		RecordHPC(0xC3);
-		RecordHPC(0xC4);
-		hpcCount++;
-	}
-
-	//zero out counters
-	WriteMSR(0x00000000, 0x00000000, 0x309);
-	WriteMSR(0x00000000, 0x00000000, 0x30A);
-	WriteMSR(0x00000000, 0x00000000, 0x30B);
-	WriteMSR(0x00000000, 0x00000000, 0xC1);
-	WriteMSR(0x00000000, 0x00000000, 0xC2);
-	WriteMSR(0x00000000, 0x00000000, 0xC3);
-	WriteMSR(0x00000000, 0x00000000, 0xC4);
+	//the trap comes from user mode, where fs points to the TEB instead of the KPCR
+		mov ax, 30h
+		mov fs, ax
+
+	//RecordTrap(ebx, ecx, eip, cs); ebx and ecx are still those of the trap, the interrupt
+	//frame with eip and cs lies above the 48 bytes saved here, one slot further per push
+		push dword ptr [esp + 52]
+		push dword ptr [esp + 52]
+		push ecx
+		push ebx
+		call RecordTrap
+		add esp, 16
+	}
 
 	__asm{
 	//Retrieve the context of hardware interrupt
@@ -287,6 +922,14 @@ __declspec(naked) HookTrap() {
 	}
 }
 
+/*
+ * Counter logic of a PMI; eip and cs are those of the interrupted code
+ */
+void RecordPmi(UINT32 eip, UINT32 cs){
+	//record the window of the test thread, set the threshold for fixed_ctr0 and clear the overflow flag
+	PmuHandlePmi(&pmuOps, &hpcConfig, &cpuStates[KeGetCurrentProcessorNumber()], eip, cs);
+}
+
 /*
  * Record HPC values at PMI
  */
@@ -298,33 +941,17 @@ __declspec(naked) HookPMI() {
 		push fs
 		push ds
 		push es
-	}
-
-	if(IsCurrentProcessTestApp==1 && hpcCount<=MAXVAL){
-		perfCounterId = 0;
-		RecordHPC(0x309);
-		RecordHPC(0x30A);
-		RecordHPC(0x30B);
-		RecordHPC(0xC1);
-		RecordHPC(0xC2);
-		RecordHPC(0xC3);
-		RecordHPC(0xC4);
-		hpcCount++;
-	}
-
-	//set threshold for fixed_ctr0
-	WriteMSR(pmiThreshold, 0x0000FFFF, 0x309);
 
-	//Zero out remaining counters
-	WriteMSR(0x00000000, 0x00000000, 0x30A);
-	WriteMSR(0x00000000, 0x00000000, 0x30B);
-	WriteMSR(0x00000000, 0x00000000, 0xC1);
-	WriteMSR(0x00000000, 0x00000000, 0xC2);
-	WriteMSR(0x00000000, 0x00000000, 0xC3);
-	WriteMSR(0x00000000, 0x00000000, 0xC4);
+	//the PMI may interrupt user mode, where fs points to the TEB instead of the KPCR
+		mov ax, 30h
+		mov fs, ax
 
-	//Clear the overflow flag via IA32_PERF_GLOBAL_OVF_CTRL MSR
-	WriteMSR(0x00000000, 0x00000001, 0x390);
+	//RecordPmi(eip, cs) of the interrupt frame above the 48 bytes saved here
+		push dword ptr [esp + 52]
+		push dword ptr [esp + 52]
+		call RecordPmi
+		add esp, 8
+	}
 
 	__asm{
 		//Retrieve the context of hardware interrupt
@@ -339,151 +966,114 @@ __declspec(naked) HookPMI() {
 	}
 }
 
+/* argument of HookISRIpi */
+typedef struct _ISR_HOOK {
+  UINT16 service;
+  UINT32 hookaddr;
+} ISR_HOOK, *PISR_HOOK;
+
 /*
- * Hook the interrupt descriptor by overwriting its ISR pointer.
+ * Overwrite the ISR pointer of the descriptor in the IDT of the current CPU.
+ * Runs on every CPU at once through KeIpiGenericCall.
+ */
+ULONG_PTR HookISRIpi(ULONG_PTR argument) {
+  PISR_HOOK hook = (PISR_HOOK)argument;
+  IDTR idtrAddr;
+  PDESC descAddr;
+
+  /* every CPU has its own IDT */
+  __asm {
+    pushfd
+    cli
+    sidt idtrAddr
+  }
+  descAddr = (PDESC)(idtrAddr.addr + hook->service * 0x8);
+  descAddr->offset00 = (UINT16)hook->hookaddr;
+  descAddr->offset16 = (UINT16)(hook->hookaddr >> 16);
+  __asm { popfd }
+  return 0;
+}
+
+/*
+ * Hook the interrupt descriptor of all CPUs by overwriting its ISR pointer.
  */
 void HookISR(UINT16 service, UINT32 hookaddr) {
   UINT32 isrAddr; 
-  UINT16 hookAddrLow;
-  UINT16 hookAddrHigh;
-  PDESC descAddr;
+  ISR_HOOK hook;
 
   /* check if the ISR was already hooked */
   isrAddr = GetISRAddress(service);
   if(isrAddr == hookaddr) {
     DbgPrint("The service %x already hooked.\r\n", service);
   } else {
-    DbgPrint("Hooking interrupt %x: ISR %x --> %x.\r\n", service, isrAddr, hookaddr);
-    descAddr  = GetDescriptorAddress(service);
-    DbgPrint("Hook Address: %x\r\n", hookaddr);
-    hookAddrLow = (UINT16)hookaddr;
-    hookaddr = hookaddr >> 16;
-    hookAddrHigh = (UINT16)hookaddr;
-    DbgPrint("descAddr: %x\r\n", descAddr->offset00);
-    DbgPrint("descAddr: %x\r\n", descAddr->offset16);
-
-    __asm { cli }
-    descAddr->offset00 = hookAddrLow;
-    descAddr->offset16 = hookAddrHigh;
-    __asm { sti }
+    DbgPrint("Hooking interrupt %x on %u CPUs: ISR %x --> %x.\r\n", service, cpuCount, isrAddr, hookaddr);
+    hook.service = service;
+    hook.hookaddr = hookaddr;
+    KeIpiGenericCall(HookISRIpi, (ULONG_PTR)&hook);
   }
 }
 
 /*
-	Find a relevant process and re/store performance counter values
+	Find a relevant process and re/store performance counter values of its threads
 */
 void SaveRestoreCounters(){
 	PUCHAR pKTHREADCurr, pKTHREADNext;
 	PUCHAR ProcessCurr, ProcessNext;
-	PUCHAR ImageFileNameCurr, ImageFileNameNext;
+	PCPU_STATE cpu;
+	UINT64 start;
+	int matched = 0;
 
-	//check the exiting process and store HPC values if it is our test process
 	//edi: points to the exiting thread
 	//esi: points to the incoming thread
-
 	__asm{
-		// obtain exiting process
 		mov pKTHREADCurr, edi
-		mov ecx, CR3;
+		mov pKTHREADNext, esi
 	}
+
+	start = ReadTSC();
+
+	//StopMonitoring frees the thread contexts once no CPU is inside this function anymore
+	if(!ExAcquireRundownProtectionCacheAware(swapContextRundown))
+		return;
+
+	//SwapContext runs at DISPATCH_LEVEL, so the thread stays on this CPU until the switch is done
+	cpu = &cpuStates[KeGetCurrentProcessorNumber()];
+
+	//KTHREAD.ApcState.Process; the test processes were resolved to their EPROCESS by ProcessNotify,
+	//so matching is a pointer lookup without any allocation or string compare
 	ProcessCurr = *(PUCHAR*)(pKTHREADCurr + 0x50);
-	ImageFileNameCurr = (PUCHAR)ExAllocatePoolWithTag(NonPagedPool,16,'Hbf1');
-	if(ImageFileNameCurr != NULL){
-		/*Copy the image name to an allocated space*/
-		strncpy((char*)ImageFileNameCurr,(char*)(ProcessCurr+0x16c), 16);
-
-		//If the exiting process is a test process, we store the performance counter values
-		if(!strcmp((char*)ImageFileNameCurr, TEST_APP)){
-
-			__asm{
-			//Store HPC values into memory
-				mov ecx, 0x309
-				rdmsr
-				mov counter0LowVal, eax
-				mov counter0HighVal, edx
-
-				mov ecx, 0x30A
-				rdmsr
-				mov counter1LowVal, eax
-				mov counter1HighVal, edx
-
-				mov ecx, 0x30B
-				rdmsr
-				mov counter2LowVal, eax
-				mov counter2HighVal, edx
-
-				mov ecx, 0xC1
-				rdmsr
-				mov counter3LowVal, eax
-				mov counter3HighVal, edx
-
-				mov ecx, 0xC2
-				rdmsr
-				mov counter4LowVal, eax
-				mov counter4HighVal, edx
-
-				mov ecx, 0xC3
-				rdmsr
-				mov counter5LowVal, eax
-				mov counter5HighVal, edx
-
-				mov ecx, 0xC4
-				rdmsr
-				mov counter6LowVal, eax
-				mov counter6HighVal, edx
-
-				mov ecx, 1
-				mov IsHpcStoredAtContextSwitch, ecx
+	ProcessNext = *(PUCHAR*)(pKTHREADNext + 0x50);
 
-			}
-		}
-	}else{
-			goto TestRegistrycleanup;
+	//If the exiting thread belongs to a test process, we store its performance counter values
+	if(TargetSetContains(&targetSet, (UINT_PTR)ProcessCurr)){
+		CounterVirtSwitchOut(&counterVirt, (UINT_PTR)pKTHREADCurr);
+		matched = 1;
 	}
 
-	//check the incoming process and restore HPC values if the process is our test process
-	__asm{
-		mov pKTHREADNext, esi
-	}
-	ProcessNext = *(PUCHAR*)(pKTHREADNext + 0x50);
-	ImageFileNameNext = (PUCHAR)ExAllocatePoolWithTag(NonPagedPool,16, 'Hbf2');
-	if(ImageFileNameNext != NULL){
-		strncpy((char*)ImageFileNameNext,(char*)(ProcessNext+0x16c), 16);
-
-		if(!strcmp((char*)ImageFileNameNext,TEST_APP)){
-			if(IsTestAppRunning==0){
-				//If the test process is going to run for the first time, start HPC monitoring
-				IsTestAppRunning=1;
-				InitializeCounters();
-			}
-			IsCurrentProcessTestApp = 1;	//indicates that the current process is a test process
-
-			if (IsHpcStoredAtContextSwitch==1){
-				IsHpcStoredAtContextSwitch=0;
-				WriteMSR(counter0LowVal, counter0HighVal, 0x309);
-				WriteMSR(counter1LowVal, counter1HighVal, 0x30A);
-				WriteMSR(counter2LowVal, counter2HighVal, 0x30B);
-				WriteMSR(counter3LowVal, counter3HighVal, 0xC1);
-				WriteMSR(counter4LowVal, counter4HighVal, 0xC2);
-				WriteMSR(counter5LowVal, counter5HighVal, 0xC3);
-				WriteMSR(counter6LowVal, counter6HighVal, 0xC4);
-			}
+	//If the incoming thread belongs to a test process, we restore its performance counter values
+	if(TargetSetContains(&targetSet, (UINT_PTR)ProcessNext)){
+		matched = 1;
+		cpu->isTestThread = 1;	//indicates that the current process is a test process
 
-		}
-		else
-			IsCurrentProcessTestApp = 0;
+		cpu->tid = (UINT32)(ULONG_PTR)PsGetThreadId((PETHREAD)pKTHREADNext);
+		cpu->thread = CounterVirtSwitchIn(&counterVirt, (UINT_PTR)pKTHREADNext, cpu->tid);
+
+		//the restored counters belong to the event group of the thread
+		if(cpu->thread != NULL && cpu->thread->group != cpu->group)
+			PmuProgramGroup(&pmuOps, &hpcConfig, cpu, cpu->thread->group);
+
+		//and to the sampling window of the thread, whose period may differ from that of the last one
+		if(cpu->thread != NULL)
+			PmuResumeWindow(&pmuCaps, &hpcConfig, cpu, cpu->thread->period);
 	}
 	else{
-			goto TestRegistrycleanup;
+		cpu->isTestThread = 0;
+		cpu->thread = NULL;
 	}
 
-	//free runtime memory
-	TestRegistrycleanup:
-		if(ImageFileNameCurr != NULL)
-			ExFreePoolWithTag(ImageFileNameCurr, 'Hbf1');
-		if(ImageFileNameNext != NULL)
-			ExFreePoolWithTag(ImageFileNameNext, 'Hbf2');
-
+	cpu->self.matched += matched;
+	SelfRecord(&cpu->self.handler[SELF_SWITCH], ReadTSC() - start);
+	ExReleaseRundownProtectionCacheAware(swapContextRundown);
 }
 
 /*
@@ -516,74 +1106,39 @@ __declspec(naked) void HooKCS(){
 }
 
 /*
-	Read the leftover counter values of a process that were stored during context switch for the last PMI window
+	Read the leftover counter values of the test threads that were stored during context switch for their last PMI window
 */
 void ReadFinalSample(){
- 	__asm {
-
-	//checkmaxval1:
-	//don't exceed the maximum times that we can monitor; only required for offline analysis; limitation comes from how much data can a kernel driver hold
-		mov ecx, hpcCount
-		cmp ecx, MAXVAL
-		jae terminateRead
-
-	//restore values only when store has been done at context switch
-		mov ecx, IsHpcStoredAtContextSwitch
-		cmp ecx, 1
-		jne terminateRead
-
-	//readleftover:
-		mov ecx, 0
-		mov IsHpcStoredAtContextSwitch, ecx
-
-		mov DWORD PTR [perfCounterId], 0
-
-		mov eax, counter0LowVal
-		mov edx, edx
-		push edx
-		push eax
-		call RecordFinalSample
-
-		mov eax, counter1LowVal
-		mov edx, counter1HighVal
-		push edx
-		push eax
-		call RecordFinalSample
-
-		mov eax, counter2LowVal
-		mov edx, counter2HighVal
-		push edx
-		push eax
-		call RecordFinalSample
-
-		mov eax, counter3LowVal
-		mov edx, counter3HighVal
-		push edx
-		push eax
-		call RecordFinalSample
-
-		mov eax, counter4LowVal
-		mov edx, counter4HighVal
-		push edx
-		push eax
-		call RecordFinalSample
-
-		mov eax, counter5LowVal
-		mov edx, counter5HighVal
-		push edx
-		push eax
-		call RecordFinalSample
-
-		mov eax, counter6LowVal
-		mov edx, counter6HighVal
-		push edx
-		push eax
-		call RecordFinalSample
-
-		inc DWORD PTR [hpcCount] 	//counts the no. of times reading were taken
-
-	terminateRead:
-
+	PSAMPLE_RING ring;
+	PHPC_RECORD record;
+	PTHREAD_CONTEXT ctx;
+	ULONG cpu;
+	UINT32 i;
+	int j;
+
+	//the counters are stopped and the hooks removed, so no handler writes into this ring concurrently
+	cpu = KeGetCurrentProcessorNumber();
+	ring = &cpuStates[cpu].ring;
+	for(i = 0; i < THREAD_TABLE_SIZE; i++){
+		ctx = &threadContexts[i];
+
+		//restore values only when store has been done at context switch
+		if(ctx->thread == THREAD_SLOT_EMPTY || ctx->thread == THREAD_SLOT_REMOVED || ctx->state != THREAD_STATE_SAVED)
+			continue;
+		ctx->state = THREAD_STATE_FRESH;
+
+		record = SampleRingReserve(ring);
+		if(record == NULL)
+			return;
+		for(j = 0; j < HPC_NUM_COUNTERS; j++)
+			SampleRecordSetCounter(record, j, PmuCounterValue(&pmuCaps, &hpcConfig, j, ctx->ctr[j]));
+		record->tsc = ReadTSC();
+		record->tid = ctx->tid;
+		record->ip = 0;
+		SampleRecordSetGroup(record, ctx->group, 0);
+		record->region = 0;
+		record->depth = 0;
+		SampleRingCommit(ring);
 	}
 }
 
@@ -600,12 +1155,18 @@ void WriteMSR(int lowVal, int highVal, int addr){
 }
 
 /*
-* Record HPC value, and store the HPC count into array
+* Read the time stamp counter; it is synchronized across CPUs (invariant TSC),
+* which lets the per-CPU sample streams be merged by time
 */
-void RecordHPC(int addr){
-	INT64 combinedVal = 0;
-	combinedVal = ReadMSR(addr);
-	RecordHPCSample(combinedVal);
+UINT64 ReadTSC(){
+	UINT32 lowVal, highVal;
+
+	__asm{
+		rdtsc
+		mov lowVal, eax
+		mov highVal, edx
+	}
+	return ((UINT64)highVal << 32) | lowVal;
 }
 
 /*
@@ -615,19 +1176,10 @@ INT64 Extract48BitVal(int lowVal, int highVal){
 	INT64 combinedHPCVal = 0;
 	combinedHPCVal = (0x0000ffff & highVal);
 	combinedHPCVal <<= 32;
-	combinedHPCVal = combinedHPCVal + lowVal;
+	combinedHPCVal = combinedHPCVal + (UINT32)lowVal;	//low half is unsigned, do not sign-extend it
 	return combinedHPCVal;
 }
 
-/*
-* Store HPC values for final sample into array
-*/
-void RecordFinalSample(int lowVal, int highVal){
-	INT64 combinedVal = 0;
-	combinedVal = Extract48BitVal(lowVal, highVal);
-	RecordHPCSample(combinedVal);
-}
-	
 /*
 * Read MSR registers
 */
@@ -649,85 +1201,107 @@ INT64 ReadMSR(int addr){
 * initializatizing HPCs
 */
 void InitializeCounters(){
-	#ifdef SAMPLING_MODE	
-		WriteMSR(0x0000022A, 0x00000000, 0x38D);
-		WriteMSR(pmiThreshold, 0x0000FFFF, 0x309);
-	#else			// polling_mode
-		WriteMSR(0x00000222, 0x00000000, 0x38D);
-		WriteMSR(0x00000000, 0x00000000, 0x309);
-	#endif
-	
-	//Configure programmable counters for different events
-	WriteMSR(EVENT0, 0x00000000, 0x186);
-	WriteMSR(EVENT1, 0x00000000, 0x187);
-	WriteMSR(EVENT2, 0x00000000, 0x188);
-	WriteMSR(EVENT3, 0x00000000, 0x189);
+	PmuStart(&pmuOps, &hpcConfig, &cpuStates[KeGetCurrentProcessorNumber()]);
+}
 
-	//Zero out remaining counters
-	WriteMSR(0x00000000, 0x00000000, 0x30A);
-	WriteMSR(0x00000000, 0x00000000, 0x30B);
+/*
+*	PMU_OPS of the hardware
+*/
+UINT64 PmuReadMSR(void *context, UINT32 msr){
+	UNREFERENCED_PARAMETER(context);
+	return (UINT64)ReadMSR((int)msr);
+}
 
-	WriteMSR(0x00000000, 0x00000000, 0xC1);
-	WriteMSR(0x00000000, 0x00000000, 0xC2);
-	WriteMSR(0x00000000, 0x00000000, 0xC3);
-	WriteMSR(0x00000000, 0x00000000, 0xC4);
+void PmuWriteMSR(void *context, UINT32 msr, UINT64 value){
+	UNREFERENCED_PARAMETER(context);
+	WriteMSR((int)(UINT32)value, (int)(UINT32)(value >> 32), (int)msr);
+}
 
-	WriteMSR(0x0000000F, 0x00000007, 0x38F); //Enable counter globally - IA32_PERF_GLOBAL_CTRL MSR
+/*
+*	the counters of pmuCaps with rdpmc, which is cheaper than rdmsr and always allowed in kernel mode;
+*	ecx selects PMCx, or fixed counter x with bit 30 set
+*/
+void PmuReadPMCs(void *context, UINT64 *values){
+	const PMU_COUNTER *counter;
+	UINT32 i, selector, low, high;
+
+	UNREFERENCED_PARAMETER(context);
+	for(i = 0; i < pmuCaps.count; i++){
+		counter = &pmuCaps.counter[i];
+		selector = counter->rdpmc;
+		__asm{
+			mov ecx, selector
+			rdpmc
+			mov low, eax
+			mov high, edx
+		}
+		values[counter->column] = ((UINT64)high << 32) | low;
+	}
+}
 
+UINT64 PmuReadTSC(void *context){
+	UNREFERENCED_PARAMETER(context);
+	return ReadTSC();
 }
 
 /*
- * DriverEntry: entry point for drivers.
- */
-NTSTATUS DriverEntry(PDRIVER_OBJECT  pDriverObject, PUNICODE_STRING  pRegistryPath) {
-    NTSTATUS NtStatus = STATUS_SUCCESS;
-    unsigned int uiIndex = 0;
-    PDEVICE_OBJECT pDeviceObject = NULL;
-    UNICODE_STRING usDriverName, usDosDeviceName;
+* IPI routines: start/stop the HPCs on all CPUs at once
+*/
+ULONG_PTR StartCountersIpi(ULONG_PTR argument){
+	UNREFERENCED_PARAMETER(argument);
+	InitializeCounters();
+	//rdpmc=on: CR4.PCE (bit 8) lets the test programs read the counters themselves (tools/hpcpmc.h)
+	if(hpcConfig.rdpmc){
+		__asm{
+			push eax
+			mov eax,CR4
+			or eax,0x100
+			mov CR4,eax
+			pop eax
+		}
+	}
+	return 0;
+}
 
-	//-----------
-	char detourBytes[] = {0xe9,0xaa,0xbb,0xcc,0xdd,0x90};	//jmp loc_ddccbbaa; nop
+ULONG_PTR StopCountersIpi(ULONG_PTR argument){
+	UNREFERENCED_PARAMETER(argument);
+	PmuStop(&pmuOps);		//Disable counter globally, no more PMIs
+	//from now on an rdpmc in user mode raises #GP again
+	if(hpcConfig.rdpmc){
+		__asm{
+			push eax
+			mov eax,CR4
+			and eax,0xFFFFFEFF
+			mov CR4,eax
+			pop eax
+		}
+	}
+	return 0;
+}
+
+//argument of PatchSwapContextIpi
+typedef struct _SWAP_CONTEXT_PATCH {
+	PUCHAR bytes;					//6 bytes to write at the start of SwapContext
+	volatile LONG arrived;			//CPUs that entered the IPI
+	volatile LONG done;				//set once the bytes are written
+} SWAP_CONTEXT_PATCH, *PSWAP_CONTEXT_PATCH;
+
+/*
+	Fill in the jumps of HooKCS back into SwapContext; done once, when the driver is loaded
+*/
+void PrepareSwapContextHook(){
 	unsigned int savedCR0;
-	KIRQL Irql;
 	int i;
 
 	/*KiDispatchInterrupt is exported*/
 	//obtain address of SwapContext using KiDispatchInterrupt
-	
 	PUCHAR p = (PUCHAR)KiDispatchInterrupt;
 	unsigned int relative = *(unsigned int*)(p + 0xDE);   
-	PUCHAR SwapContext = (PUCHAR)((unsigned int)(p + 0xDD) + relative + 5); //pointer -> SwapContext
 	PUCHAR det =  (PUCHAR)HooKCS; //detour to -> HookCS
-	//-----------
-    
-	DbgPrint("DriverEntry Called \r\n");
-    RtlInitUnicodeString(&usDriverName, L"\\Device\\MyDriver");
-    RtlInitUnicodeString(&usDosDeviceName, L"\\DosDevices\\MyDriver");
-
-    NtStatus = IoCreateDevice(pDriverObject, 0, &usDriverName, FILE_DEVICE_UNKNOWN, FILE_DEVICE_SECURE_OPEN, FALSE, &pDeviceObject);
-
-    if(NtStatus == STATUS_SUCCESS) {
-        /* MajorFunction: is a list of function pointers for entry points into the driver. */
-        for(uiIndex = 0; uiIndex < IRP_MJ_MAXIMUM_FUNCTION; uiIndex++)
-             pDriverObject->MajorFunction[uiIndex] = MyDriverUnsupportedFunction;
-
-		 /* DriverUnload is required to be able to dynamically unload the driver. */
-		pDriverObject->DriverUnload =  MyDriverUnload;
-		pDeviceObject->Flags |= 0;
-		pDeviceObject->Flags &= (~DO_DEVICE_INITIALIZING);
-
-		/* Create a Symbolic Link to the device. MyDriver -> \Device\MyDriver */
-        IoCreateSymbolicLink(&usDosDeviceName, &usDriverName);
-	}
 
-	//------------Hook context switching-------------
-	DbgPrint("KiSwapContext at : %p\n",SwapContext);
-	
-	/*Implement the inline hook*/
-	relative = (unsigned int)HooKCS - (unsigned int)SwapContext - 5; 	//offset of HooKCS relative to SwapContext
+	swapContext = (PUCHAR)((unsigned int)(p + 0xDD) + relative + 5); //pointer -> SwapContext
+	DbgPrint("KiSwapContext at : %p\n",swapContext);
 
-	*(unsigned int*)&detourBytes[1] = relative; //set loc_ddccbbaf = offset -> HooKCS
-	
 	/*Disable write protection*/
 	__asm{
 		push eax
@@ -745,7 +1319,7 @@ NTSTATUS DriverEntry(PDRIVER_OBJECT  pDriverObject, PUNICODE_STRING  pRegistryPa
 	}
 	/*set the relative address for the conditional jump ()*/
 	//je      nt!SwapContext+0xa
-	*(unsigned int*)&det[i] = (unsigned int)((SwapContext+0xa) - (det+i-2) - 6);
+	*(unsigned int*)&det[i] = (unsigned int)((swapContext+0xa) - (det+i-2) - 6);
 	 
 	
 	/*set the relative address for the jump back to SwapContext*/
@@ -754,16 +1328,7 @@ NTSTATUS DriverEntry(PDRIVER_OBJECT  pDriverObject, PUNICODE_STRING  pRegistryPa
 			break;
 	}
 	//jmp SwapContext+6
-	*(unsigned int*)&det[i] = (unsigned int)((SwapContext + 6) - (det+i-1) - 5);
-	
-	/*Raise IRQL to patch safely*/
-	Irql = KeRaiseIrqlToDpcLevel();
-	
-	/*implement the patch*/
-	for(i=0;i<6;i++){
-		SwapContext[i] = detourBytes[i]; 	//jmp loc_ddccbbaf; nop
-	}
-	KeLowerIrql(Irql);
+	*(unsigned int*)&det[i] = (unsigned int)((swapContext + 6) - (det+i-1) - 5);
 	
 	/*restore the write protection*/
 	__asm{
@@ -772,86 +1337,378 @@ NTSTATUS DriverEntry(PDRIVER_OBJECT  pDriverObject, PUNICODE_STRING  pRegistryPa
 		mov CR0,eax
 		pop eax
 	}
-	//------------------------------------
+}
 
-	#ifdef SAMPLING_MODE
-		
-		// We hook the default PMI handling by OS using interrupt descriptor table. "0xFE" is vector for PMI.
-		HookISR(0xfe, (UINT32)HookPMI);
-	#else
-		//Hook the software interrupt
-		HookISR(0x2e, (UINT32)HookTrap);	//Also tested with "0x03" interrupt
-	#endif
+/*
+	Write the first 6 bytes of SwapContext. Runs on all CPUs at once: the last CPU to arrive
+	writes the bytes while the others spin, so that no CPU executes a half-written jump.
+*/
+ULONG_PTR PatchSwapContextIpi(ULONG_PTR argument){
+	PSWAP_CONTEXT_PATCH patch = (PSWAP_CONTEXT_PATCH)argument;
+	unsigned int savedCR0;
+	int i;
 
-	return NtStatus;
+	if((ULONG)InterlockedIncrement(&patch->arrived) == cpuCount){
+		/*Disable write protection of this CPU*/
+		__asm{
+			push eax
+			mov eax,CR0
+			mov savedCR0,eax
+			and eax,0xFFFEFFFF
+			mov CR0,eax
+			pop eax
+		}
+		for(i=0;i<6;i++){
+			swapContext[i] = patch->bytes[i];
+		}
+		__asm{
+			push eax
+			mov eax,savedCR0
+			mov CR0,eax
+			pop eax
+		}
+		InterlockedExchange(&patch->done, 1);
+	}else{
+		while(patch->done == 0)
+			YieldProcessor();
+	}
+	return 0;
 }
 
 /*
-  * MyDriverUnload: called when the driver is unloaded.
-  */
-VOID MyDriverUnload(PDRIVER_OBJECT  DriverObject) {
-	UNICODE_STRING usDosDeviceName;
-	NTSTATUS NtStatus = STATUS_SUCCESS;
-	int i=0;
-
-	//---------For Hooking Context Switch---
-	unsigned int savedCR0;
-	KIRQL Irql;
-	PUCHAR p = (PUCHAR)KiDispatchInterrupt;
-	unsigned int relative = *(unsigned int*)(p + 0xDE);
-	PUCHAR KiSwapContext = (PUCHAR)((unsigned int)(p+0xDD) + relative + 5);
+	Install (hook = TRUE) or remove the inline hook of SwapContext
+*/
+void HookSwapContext(BOOLEAN hook){
+	char detourBytes[] = {0xe9,0xaa,0xbb,0xcc,0xdd,0x90};	//jmp loc_ddccbbaa; nop
 	//807e3900        cmp     byte ptr [esi+39h],0
 	//7404            je      nt!SwapContext+0xa (828bdaea)
 	char savedOps[] = {0x80,0x7e,0x39,0x00,0x74,0x04};		//cmp byte ptr [esi+0x39], 0; je loc_0000000a
-	//------------------------------
+	SWAP_CONTEXT_PATCH patch;
+
+	/*Implement the inline hook*/
+	*(unsigned int*)&detourBytes[1] = (unsigned int)HooKCS - (unsigned int)swapContext - 5; 	//offset of HooKCS relative to SwapContext
 
-	//log the leftover counter values of a process that were stored during context switch for the last PMI window
+	patch.bytes = (PUCHAR)(hook ? detourBytes : savedOps);
+	patch.arrived = 0;
+	patch.done = 0;
+	KeIpiGenericCall(PatchSwapContextIpi, (ULONG_PTR)&patch);
+}
+
+/*
+	Fill hpcConfig with the compile-time defaults of the configurable parameters
+*/
+void SetDefaultConfig(){
+	const WCHAR *logFile = LOG_FILE;
+	ULONG i;
+
+	HpcConfigInit(&hpcConfig);
 	#ifdef SAMPLING_MODE
-		ReadFinalSample();
+		hpcConfig.mode = HPC_MODE_SAMPLING;
+	#else
+		hpcConfig.mode = HPC_MODE_POLLING;
 	#endif
+	hpcConfig.pmiThreshold = pmiThreshold;
+	hpcConfig.eventSel[0][0] = EVENT0;
+	hpcConfig.eventSel[0][1] = EVENT1;
+	hpcConfig.eventSel[0][2] = EVENT2;
+	hpcConfig.eventSel[0][3] = EVENT3;
+	for(i = 0; i < (ULONG)(sizeof(testApps) / sizeof(testApps[0])); i++)
+		HpcConfigAddTestApp(&hpcConfig, testApps[i]);
+	for(i = 0; i < HPC_MAX_PATH - 1 && logFile[i] != 0; i++)
+		hpcConfig.logFile[i] = logFile[i];
+}
+
+/*
+	Start a run with hpcConfig: sample collection, process tracking, hooks and counters on all CPUs.
+	Called with controlLock held.
+*/
+NTSTATUS StartMonitoring(){
+	NTSTATUS ntStatus;
+	int rc;
+
+	if(isRunning)
+		return STATUS_DEVICE_BUSY;
+	rc = PmuCheckConfig(&pmuCaps, &hpcConfig);
+	if(rc != HPC_CONFIG_OK){
+		DbgPrint("Cannot start: %s\r\n", HpcConfigErrorText(rc));
+		return STATUS_NOT_SUPPORTED;
+	}
+	trapCount = 0;
+
+	//------------Start the sample rings and the drain thread before any hook can produce samples-------------
+	//------------and resolve the test processes, so that the context switch hook only compares pointers-------------
+	ntStatus = StartSampleCollection();
+	if(NT_SUCCESS(ntStatus))
+		ntStatus = StartProcessTracking();
+	if(!NT_SUCCESS(ntStatus)){
+		DbgPrint("Could not start sample collection: %x\r\n", ntStatus);
+		StopProcessTracking();
+		StopSampleCollection();
+		return ntStatus;
+	}
 
+	//------------Hook context switching-------------
+	ExReInitializeRundownProtectionCacheAware(swapContextRundown);
+	HookSwapContext(TRUE);
 
-	#ifdef SAMPLING_MODE
+	if(hpcConfig.mode == HPC_MODE_SAMPLING){
+		// We hook the default PMI handling by OS using interrupt descriptor table. "0xFE" is vector for PMI.
+		HookISR(0xfe, (UINT32)HookPMI);
+	}else{
+		//Hook the software interrupt
+		HookISR(0x2e, (UINT32)HookTrap);	//Also tested with "0x03" interrupt
+	}
+
+	//------------Program the HPCs of every CPU once all hooks are in place-------------
+	KeIpiGenericCall(StartCountersIpi, 0);
+	isRunning = TRUE;
+	return STATUS_SUCCESS;
+}
+
+/*
+	End the current run and flush its samples into the output file. Called with controlLock held.
+*/
+void StopMonitoring(){
+	if(!isRunning)
+		return;
+
+	//stop the HPCs of every CPU; once the IPI returns no CPU is inside HookPMI/HookTrap
+	KeIpiGenericCall(StopCountersIpi, 0);
+
+	if(hpcConfig.mode == HPC_MODE_SAMPLING){
 		if(oldISRAddressPmi != NULL) {
 			HookISR(0xfe, (UINT32)oldISRAddressPmi);
 		}
-	#else
+	}else{
 		if(oldISRAddressTrap != NULL) {
 			HookISR(0x2e, (UINT32)oldISRAddressTrap);	//also tested with other interrupts such as "0x03"
 		}
-	#endif
-	//------------------------------
-	
-	/*Restore write protection*/
-	__asm{
-		push eax
-		mov eax,CR0
-		mov savedCR0,eax
-		and eax,0xFFFEFFFF
-		mov CR0,eax
-		pop eax
 	}
-	Irql = KeRaiseIrqlToDpcLevel();
-	for(i=0;i<6;i++){
-		KiSwapContext[i] = savedOps[i];
+
+	//------------Un-hook context switching and wait for the CPUs still in the hook-------------
+	HookSwapContext(FALSE);
+	ExWaitForRundownProtectionReleaseCacheAware(swapContextRundown);
+
+	//log the leftover counter values of the test threads that were stored during context switch for the last PMI window;
+	//done after unhooking so that no PMI writes into the same ring concurrently
+	if(hpcConfig.mode == HPC_MODE_SAMPLING)
+		ReadFinalSample();
+
+	StopProcessTracking();
+
+	//flush the remaining samples into the output file
+	StopSampleCollection();
+	isRunning = FALSE;
+}
+
+/*
+	Report the state of the driver and the counts of the current or last run
+*/
+void QueryStatus(PHPC_STATUS status){
+	ULONG cpu;
+
+	RtlZeroMemory(status, sizeof(*status));
+	status->size = sizeof(*status);
+	status->state = isRunning ? HPC_STATE_RUNNING : HPC_STATE_STOPPED;
+	status->cpuCount = KeQueryActiveProcessorCount(NULL);
+	status->config = hpcConfig;
+	if(isRunning){
+		status->testProcesses = targetSet.count;
+		for(cpu = 0; cpu < cpuCount; cpu++){
+			status->samples += cpuStates[cpu].ring.head;
+			status->dropped += cpuStates[cpu].ring.dropped;
+		}
+		CollectSelfStats(&status->self);
+	}else{
+		status->samples = lastSamples;
+		status->dropped = lastDropped;
+		status->self = lastSelf;
 	}
-	KeLowerIrql(Irql);
-	__asm{
-		push eax
-		mov eax,savedCR0
-		mov CR0,eax
-		pop eax
+}
+
+/*
+ * DriverEntry: entry point for drivers.
+ */
+NTSTATUS DriverEntry(PDRIVER_OBJECT  pDriverObject, PUNICODE_STRING  pRegistryPath) {
+    NTSTATUS NtStatus = STATUS_SUCCESS;
+    unsigned int uiIndex = 0;
+    PDEVICE_OBJECT pDeviceObject = NULL;
+    UNICODE_STRING usDriverName, usDosDeviceName;
+    
+	DbgPrint("DriverEntry Called \r\n");
+    RtlInitUnicodeString(&usDriverName, L"\\Device\\MyDriver");
+    RtlInitUnicodeString(&usDosDeviceName, L"\\DosDevices\\MyDriver");
+
+    NtStatus = IoCreateDevice(pDriverObject, 0, &usDriverName, FILE_DEVICE_UNKNOWN, FILE_DEVICE_SECURE_OPEN, FALSE, &pDeviceObject);
+	if(!NT_SUCCESS(NtStatus))
+		return NtStatus;
+
+    /* MajorFunction: is a list of function pointers for entry points into the driver. */
+    for(uiIndex = 0; uiIndex < IRP_MJ_MAXIMUM_FUNCTION; uiIndex++)
+         pDriverObject->MajorFunction[uiIndex] = MyDriverUnsupportedFunction;
+	pDriverObject->MajorFunction[IRP_MJ_CREATE] = MyDriverCreateClose;
+	pDriverObject->MajorFunction[IRP_MJ_CLEANUP] = MyDriverCleanup;
+	pDriverObject->MajorFunction[IRP_MJ_CLOSE] = MyDriverCreateClose;
+	pDriverObject->MajorFunction[IRP_MJ_DEVICE_CONTROL] = MyDriverDeviceControl;
+
+	 /* DriverUnload is required to be able to dynamically unload the driver. */
+	pDriverObject->DriverUnload =  MyDriverUnload;
+	pDeviceObject->Flags |= DO_BUFFERED_IO;
+	pDeviceObject->Flags &= (~DO_DEVICE_INITIALIZING);
+
+	/* Create a Symbolic Link to the device. MyDriver -> \Device\MyDriver */
+    IoCreateSymbolicLink(&usDosDeviceName, &usDriverName);
+
+	KeInitializeMutex(&controlLock, 0);
+	ExInitializeFastMutex(&statsLock);
+	ReadPmuCaps();
+	SetDefaultConfig();
+	swapContextRundown = ExAllocateCacheAwareRundownProtection(NonPagedPool, 'Hrun');
+	if(swapContextRundown == NULL){
+		IoDeleteSymbolicLink(&usDosDeviceName);
+		IoDeleteDevice(pDeviceObject);
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+	PrepareSwapContextHook();
+
+	#if AUTO_START
+		NtStatus = StartMonitoring();
+		if(!NT_SUCCESS(NtStatus)){
+			ExFreeCacheAwareRundownProtection(swapContextRundown);
+			IoDeleteSymbolicLink(&usDosDeviceName);
+			IoDeleteDevice(pDeviceObject);
+		}
+	#endif
+	return NtStatus;
+}
+
+/*
+  * MyDriverUnload: called when the driver is unloaded.
+  */
+VOID MyDriverUnload(PDRIVER_OBJECT  DriverObject) {
+	UNICODE_STRING usDosDeviceName;
+
+	//end the current run, which unhooks everything and flushes the remaining samples into the output file
+	KeWaitForSingleObject(&controlLock, Executive, KernelMode, FALSE, NULL);
+	StopMonitoring();
+	KeReleaseMutex(&controlLock, FALSE);
+	ExFreeCacheAwareRundownProtection(swapContextRundown);
+
+	//no handle is open anymore, so no process maps the live region
+	if(liveRegion != NULL){
+		ExFreePoolWithTag(liveRegion, 'Hliv');
+		liveRegion = NULL;
 	}
-	//------------Un-hooking context switch ends-------------
 
 	/* delete the driver */
     RtlInitUnicodeString(&usDosDeviceName, L"\\DosDevices\\MyDriver");
     IoDeleteSymbolicLink(&usDosDeviceName);
     IoDeleteDevice(DriverObject->DeviceObject);
 
-	//logs HPC data into output file
-	LogHPCData();
+}
+
+/*
+ * MyDriverCreateClose: opening and closing the control device always succeeds.
+ */
+NTSTATUS MyDriverCreateClose(PDEVICE_OBJECT DeviceObject, PIRP Irp) {
+	UNREFERENCED_PARAMETER(DeviceObject);
+	Irp->IoStatus.Status = STATUS_SUCCESS;
+	Irp->IoStatus.Information = 0;
+	IoCompleteRequest(Irp, IO_NO_INCREMENT);
+	return STATUS_SUCCESS;
+}
 
+/*
+ * MyDriverCleanup: the last handle of a file object is closed, remove its mapping of the live region.
+ */
+NTSTATUS MyDriverCleanup(PDEVICE_OBJECT DeviceObject, PIRP Irp) {
+	PIO_STACK_LOCATION ioStack = IoGetCurrentIrpStackLocation(Irp);
+
+	UNREFERENCED_PARAMETER(DeviceObject);
+	KeWaitForSingleObject(&controlLock, Executive, KernelMode, FALSE, NULL);
+	UnmapLiveRegion(ioStack->FileObject);
+	KeReleaseMutex(&controlLock, FALSE);
+	Irp->IoStatus.Status = STATUS_SUCCESS;
+	Irp->IoStatus.Information = 0;
+	IoCompleteRequest(Irp, IO_NO_INCREMENT);
+	return STATUS_SUCCESS;
+}
+
+/*
+ * MyDriverDeviceControl: configure, start, stop and query the driver, see hpcconf.h.
+ */
+NTSTATUS MyDriverDeviceControl(PDEVICE_OBJECT DeviceObject, PIRP Irp) {
+	PIO_STACK_LOCATION ioStack = IoGetCurrentIrpStackLocation(Irp);
+	PVOID buffer = Irp->AssociatedIrp.SystemBuffer;
+	ULONG inLen = ioStack->Parameters.DeviceIoControl.InputBufferLength;
+	ULONG outLen = ioStack->Parameters.DeviceIoControl.OutputBufferLength;
+	HPC_CONFIG newConfig;
+	NTSTATUS NtStatus;
+	ULONG_PTR info = 0;
+	int rc;
+
+	UNREFERENCED_PARAMETER(DeviceObject);
+	KeWaitForSingleObject(&controlLock, Executive, KernelMode, FALSE, NULL);
+	switch(ioStack->Parameters.DeviceIoControl.IoControlCode){
+	case IOCTL_HPC_CONFIGURE:
+		rc = HpcConfigFromBuffer(&newConfig, buffer, inLen);
+		if(rc == HPC_CONFIG_OK)
+			rc = PmuCheckConfig(&pmuCaps, &newConfig);
+		if(isRunning)
+			NtStatus = STATUS_DEVICE_BUSY;
+		else if(rc != HPC_CONFIG_OK){
+			DbgPrint("Rejected configuration: %s\r\n", HpcConfigErrorText(rc));
+			NtStatus = STATUS_INVALID_PARAMETER;
+		}else{
+			hpcConfig = newConfig;
+			NtStatus = STATUS_SUCCESS;
+		}
+		break;
+	case IOCTL_HPC_START:
+		NtStatus = StartMonitoring();
+		break;
+	case IOCTL_HPC_STOP:
+		StopMonitoring();
+		NtStatus = STATUS_SUCCESS;
+		break;
+	case IOCTL_HPC_QUERY_STATS:
+		if(!isRunning || sampleStats == NULL)
+			NtStatus = STATUS_INVALID_DEVICE_STATE;
+		else if(outLen < StatsSize(sampleStats->groupCount))
+			NtStatus = STATUS_BUFFER_TOO_SMALL;
+		else{
+			info = CopyStats(buffer);
+			NtStatus = STATUS_SUCCESS;
+		}
+		break;
+	case IOCTL_HPC_QUERY_STATUS:
+		if(outLen < sizeof(HPC_STATUS))
+			NtStatus = STATUS_BUFFER_TOO_SMALL;
+		else{
+			QueryStatus((PHPC_STATUS)buffer);
+			info = sizeof(HPC_STATUS);
+			NtStatus = STATUS_SUCCESS;
+		}
+		break;
+	case IOCTL_HPC_MAP_LIVE:
+		if(outLen < sizeof(UINT64))
+			NtStatus = STATUS_BUFFER_TOO_SMALL;
+		else{
+			NtStatus = MapLiveRegion(ioStack->FileObject, (UINT64*)buffer);
+			if(NT_SUCCESS(NtStatus))
+				info = sizeof(UINT64);
+		}
+		break;
+	default:
+		NtStatus = STATUS_INVALID_DEVICE_REQUEST;
+		break;
+	}
+	KeReleaseMutex(&controlLock, FALSE);
+
+	Irp->IoStatus.Status = NtStatus;
+	Irp->IoStatus.Information = info;
+	IoCompleteRequest(Irp, IO_NO_INCREMENT);
+	return NtStatus;
 }
 
 /*
@@ -860,5 +1717,8 @@ VOID MyDriverUnload(PDRIVER_OBJECT  DriverObject) {
 NTSTATUS MyDriverUnsupportedFunction(PDEVICE_OBJECT DeviceObject, PIRP Irp) {
     NTSTATUS NtStatus = STATUS_NOT_SUPPORTED;
 	DbgPrint("MyDriverUnsupportedFunction Called \r\n");
+	Irp->IoStatus.Status = NtStatus;
+	Irp->IoStatus.Information = 0;
+	IoCompleteRequest(Irp, IO_NO_INCREMENT);
     return NtStatus;
 }
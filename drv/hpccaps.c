@@ -0,0 +1,102 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* PMU discovery from CPUID leaf 0xA, see hpccaps.h.
+*/
+
+#include "hpccaps.h"
+
+HPC_INLINE UINT64 WidthMask(UINT32 width){
+	return width >= 64 ? ~(UINT64)0 : ((UINT64)1 << width) - 1;
+}
+
+static void AddCounter(PPMU_CAPS caps, UINT32 column, UINT32 msr, UINT32 rdpmc, UINT32 width){
+	PPMU_COUNTER counter = &caps->counter[caps->count++];
+
+	counter->column = column;
+	counter->msr = msr;
+	counter->rdpmc = rdpmc;
+	counter->width = width;
+	caps->columns |= 1u << column;
+	caps->mask[column] = WidthMask(width);
+}
+
+void PmuCapsInit(PPMU_CAPS caps, UINT32 version, UINT32 programmable, UINT32 programmableWidth, UINT32 fixedMask, UINT32 fixedWidth){
+	UINT32 i;
+
+	memset(caps, 0, sizeof(*caps));
+	caps->version = version;
+	caps->programmable = programmable;
+	caps->programmableWidth = programmableWidth;
+	caps->fixedMask = fixedMask;
+	caps->fixedWidth = fixedWidth;
+	for(i = 0; i < 32; i++){
+		if(fixedMask & (1u << i))
+			caps->fixed = i + 1;
+	}
+
+	//fixed counters first, so fixed counter 0 (instructions) is read first at a PMI
+	for(i = 0; i < HPC_MAX_FIXED; i++){
+		if(!(fixedMask & (1u << i)))
+			continue;
+		AddCounter(caps, (UINT32)HpcFixedColumn((int)i), MSR_FIXED_CTR0 + i, 0x40000000 | i, fixedWidth);
+		caps->globalEnable |= (UINT64)1 << (32 + i);
+	}
+	caps->usedProgrammable = programmable < HPC_MAX_PROGRAMMABLE ? programmable : HPC_MAX_PROGRAMMABLE;
+	for(i = 0; i < caps->usedProgrammable; i++){
+		AddCounter(caps, HPC_COLUMN_PMC0 + i, MSR_PMC0 + i, i, programmableWidth);
+		caps->globalEnable |= (UINT64)1 << i;
+	}
+}
+
+int PmuCapsFromCpuid(PPMU_CAPS caps, const UINT32 leaf0[4], const UINT32 leaf1[4], const UINT32 leafA[4]){
+	UINT32 version = 0, fixed, fixedMask = 0, fixedWidth = 0, eventCount, unavailable;
+
+	//"GenuineIntel" in ebx, edx, ecx; other vendors have no leaf 0xA
+	if(leaf0[0] >= 0xA && leaf0[1] == 0x756E6547 && leaf0[3] == 0x49656E69 && leaf0[2] == 0x6C65746E)
+		version = leafA[0] & 0xFF;
+	if(version == 0){
+		PmuCapsInit(caps, 0, 0, 0, 0, 0);
+		caps->hypervisor = (leaf1[2] >> 31) & 1;
+		return -1;
+	}
+
+	//edx describes the fixed counters from version 2 on, ecx lists them from version 5 on
+	if(version >= 2){
+		fixed = leafA[3] & 0x1F;
+		if(version < 5 && fixed < 3 && !(leaf1[2] & 0x80000000))
+			fixed = 3;
+		fixedMask = (1u << fixed) - 1;
+		if(version >= 5)
+			fixedMask |= leafA[2];
+		fixedWidth = (leafA[3] >> 5) & 0xFF;
+		//assumed fixed counters are as wide as the programmable ones
+		if(fixedWidth == 0)
+			fixedWidth = (leafA[0] >> 16) & 0xFF;
+	}
+	PmuCapsInit(caps, version, (leafA[0] >> 8) & 0xFF, (leafA[0] >> 16) & 0xFF, fixedMask, fixedWidth);
+
+	//bits beyond the length of the ebx vector are not available either
+	eventCount = (leafA[0] >> 24) & 0xFF;
+	unavailable = leafA[1];
+	if(eventCount < 32)
+		unavailable |= ~((1u << eventCount) - 1);
+	caps->eventCount = eventCount;
+	caps->unavailable = unavailable;
+	caps->hypervisor = (leaf1[2] >> 31) & 1;
+	return 0;
+}
+
+UINT64 PmuCapsFixedCtrl(const PMU_CAPS *caps, int pmi){
+	UINT64 ctrl = 0;
+	UINT32 i;
+
+	//4 bits per fixed counter: 0x2 counts in user mode, 0x8 raises a PMI on overflow
+	for(i = 0; i < HPC_MAX_FIXED; i++){
+		if(caps->fixedMask & (1u << i))
+			ctrl |= (UINT64)0x2 << (4 * i);
+	}
+	if(pmi && (caps->fixedMask & 1))
+		ctrl |= 0x8;
+	return ctrl;
+}
@@ -0,0 +1,78 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Counters of the PMU, read from CPUID leaf 0xA (architectural performance monitoring):
+* the version, the number and width of the programmable counters, the number and width
+* of the fixed counters (plus the bit mask of fixed counters of version 5) and the
+* architectural events the processor does not have. Cores have 2 to 8 programmable
+* counters, 8 of them often only when hyperthreading is off, and 3 or 4 fixed counters.
+*
+* PmuCapsFromCpuid only takes the raw registers of the leaves, so the driver feeds it
+* with cpuid and the tools with dumps of other processors (tools/pmucaps.c). Like Linux,
+* it assumes three fixed counters for versions 2 to 4 when the leaf reports none, except
+* in a VM, whose hypervisor may really have none.
+*/
+
+#ifndef HPCCAPS_H
+#define HPCCAPS_H
+
+#include "hpcring.h"
+
+//architectural performance monitoring MSRs
+#define MSR_PMC0					0xC1
+#define MSR_PERFEVTSEL0				0x186
+#define MSR_FIXED_CTR0				0x309
+#define MSR_FIXED_CTR_CTRL			0x38D
+#define MSR_PERF_GLOBAL_STATUS		0x38E
+#define MSR_PERF_GLOBAL_CTRL		0x38F
+#define MSR_PERF_GLOBAL_OVF_CTRL	0x390
+#define MSR_DEBUGCTL				0x1D9
+
+//architectural events of CPUID.0AH:EBX, a set bit means the event is not available
+#define PMU_EVENT_CORE_CYCLES		0
+#define PMU_EVENT_INSTRUCTIONS		1
+#define PMU_EVENT_REF_CYCLES		2
+#define PMU_EVENT_LLC_REFERENCES	3
+#define PMU_EVENT_LLC_MISSES		4
+#define PMU_EVENT_BRANCHES			5
+#define PMU_EVENT_BRANCH_MISSES		6
+#define PMU_EVENT_TOPDOWN_SLOTS		7
+
+//a counter of the PMU that a sample column holds
+typedef struct _PMU_COUNTER {
+	UINT32 column;						//sample column
+	UINT32 msr;							//MSR of the counter
+	UINT32 rdpmc;						//ecx of rdpmc: PMCx, or fixed counter x with bit 30 set
+	UINT32 width;
+} PMU_COUNTER, *PPMU_COUNTER;
+
+typedef struct _PMU_CAPS {
+	UINT32 version;						//architectural performance monitoring version, 0 without a PMU
+	UINT32 programmable;				//programmable counters of the PMU
+	UINT32 programmableWidth;
+	UINT32 fixed;						//fixed counters of the PMU, the highest one + 1
+	UINT32 fixedWidth;
+	UINT32 fixedMask;					//fixed counters that exist
+	UINT32 eventCount;					//architectural events described by unavailable
+	UINT32 unavailable;					//bit PMU_EVENT_* set if the event is not available
+	UINT32 hypervisor;					//CPUID.1:ECX.31, running in a VM
+
+	//the counters used, at most HPC_MAX_PROGRAMMABLE and HPC_MAX_FIXED, in the order the handlers read them
+	UINT32 count;
+	PMU_COUNTER counter[HPC_NUM_COUNTERS];
+	UINT32 columns;						//bit mask of the sample columns held
+	UINT64 mask[HPC_NUM_COUNTERS];		//2^width - 1 of the counter of each column, 0 for columns without one
+	UINT64 globalEnable;				//IA32_PERF_GLOBAL_CTRL value enabling the counters used
+	UINT32 usedProgrammable;			//programmable counters used, PMC0 up to PMCn-1
+} PMU_CAPS, *PPMU_CAPS;
+
+//leaf 0, leaf 1 and leaf 0xA as eax, ebx, ecx, edx; returns 0, or -1 if there is no architectural PMU
+int PmuCapsFromCpuid(PPMU_CAPS caps, const UINT32 leaf0[4], const UINT32 leaf1[4], const UINT32 leafA[4]);
+
+//caps of a PMU with the given counters, e.g. the simulated PMU of the tools
+void PmuCapsInit(PPMU_CAPS caps, UINT32 version, UINT32 programmable, UINT32 programmableWidth, UINT32 fixedMask, UINT32 fixedWidth);
+
+//IA32_FIXED_CTR_CTRL value: the fixed counters used count in user mode, fixed counter 0 also raises PMIs if pmi is set
+UINT64 PmuCapsFixedCtrl(const PMU_CAPS *caps, int pmi);
+
+#endif
@@ -0,0 +1,312 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Run-time configuration parsing and validation, see hpcconf.h.
+* Uses no C library beyond string.h, so it links into the driver as is.
+*/
+
+#include "hpcconf.h"
+
+/*
+* Parse a decimal (optionally negative) or 0x-prefixed hexadecimal number
+* that fits into 32 bits. Returns 0 on success.
+*/
+static int ParseNumber(const char *text, INT64 *value){
+	UINT64 val = 0;
+	UINT32 base = 10, digit;
+	int negative = 0, digits = 0;
+
+	if(*text == '-'){
+		negative = 1;
+		text++;
+	}
+	if(text[0] == '0' && (text[1] == 'x' || text[1] == 'X')){
+		base = 16;
+		text += 2;
+	}
+	for(; *text != 0; text++, digits++){
+		if(*text >= '0' && *text <= '9')
+			digit = *text - '0';
+		else if(base == 16 && *text >= 'a' && *text <= 'f')
+			digit = *text - 'a' + 10;
+		else if(base == 16 && *text >= 'A' && *text <= 'F')
+			digit = *text - 'A' + 10;
+		else
+			return -1;
+		val = val * base + digit;
+		if(val > 0xFFFFFFFF)
+			return -1;
+	}
+	if(digits == 0)
+		return -1;
+	*value = negative ? -(INT64)val : (INT64)val;
+	return 0;
+}
+
+/*
+* Start from an empty configuration
+*/
+void HpcConfigInit(PHPC_CONFIG config){
+	memset(config, 0, sizeof(*config));
+	config->size = sizeof(*config);
+	config->groupCount = 1;
+	config->groupPeriod = 1;
+}
+
+/*
+* Append a test application; names are compared on the 15 characters kept in EPROCESS
+*/
+int HpcConfigAddTestApp(PHPC_CONFIG config, const char *name){
+	size_t len = strlen(name);
+
+	if(len == 0 || len >= HPC_APP_NAME_SIZE)
+		return HPC_CONFIG_BAD_APP;
+	if(config->testAppCount >= HPC_MAX_TEST_APPS)
+		return HPC_CONFIG_TOO_MANY_APPS;
+	memset(config->testApps[config->testAppCount], 0, HPC_APP_NAME_SIZE);
+	memcpy(config->testApps[config->testAppCount], name, len);
+	config->testAppCount++;
+	return HPC_CONFIG_OK;
+}
+
+/*
+* Apply one key=value option:
+*	mode=sampling|polling, threshold=N, event0..event7=N, apps=a.exe[,b.exe...], log=path,
+*	group0..group7=N[,N...] (the events of PMC0 up, at most eight), rotate=N (PMIs per group), output=log|stats,
+*	freeze=on|off, jitter=N, target=N (reference cycles per window), budget=N (per mille), rdpmc=on|off
+* event0..event7 set the events of group 0; groupG makes sure there are at least G+1 groups and leaves
+* the counters after its last event off. Whether the PMU has the counters is checked at the start.
+* The path is widened to UTF-16 character by character, so it must be ASCII.
+*/
+int HpcConfigSet(PHPC_CONFIG config, const char *option){
+	char name[HPC_APP_NAME_SIZE];
+	char text[16];
+	const char *value, *next;
+	size_t keyLen, len, i;
+	UINT32 group, events[HPC_MAX_PROGRAMMABLE];
+	INT64 number;
+	int rc;
+
+	value = strchr(option, '=');
+	if(value == NULL)
+		return HPC_CONFIG_BAD_OPTION;
+	keyLen = value - option;
+	value++;
+
+	if(keyLen == 4 && memcmp(option, "mode", 4) == 0){
+		if(strcmp(value, "sampling") == 0)
+			config->mode = HPC_MODE_SAMPLING;
+		else if(strcmp(value, "polling") == 0)
+			config->mode = HPC_MODE_POLLING;
+		else
+			return HPC_CONFIG_BAD_MODE;
+	}else if(keyLen == 9 && memcmp(option, "threshold", 9) == 0){
+		if(ParseNumber(value, &number) != 0 || number < -(INT64)0x7FFFFFFF || number > 0)
+			return HPC_CONFIG_BAD_THRESHOLD;
+		config->pmiThreshold = (INT32)number;
+	}else if(keyLen == 6 && memcmp(option, "event", 5) == 0 && option[5] >= '0' && option[5] < '0' + HPC_MAX_PROGRAMMABLE){
+		if(ParseNumber(value, &number) != 0 || number < 0)
+			return HPC_CONFIG_BAD_VALUE;
+		config->eventSel[0][option[5] - '0'] = (UINT32)number;
+	}else if(keyLen == 6 && memcmp(option, "group", 5) == 0 && option[5] >= '0' && option[5] < '0' + HPC_MAX_GROUPS){
+		group = option[5] - '0';
+		memset(events, 0, sizeof(events));
+		for(i = 0, next = value; next != NULL; i++){
+			next = strchr(value, ',');
+			len = next != NULL ? (size_t)(next - value) : strlen(value);
+			if(len >= sizeof(text) || i == HPC_MAX_PROGRAMMABLE)
+				return HPC_CONFIG_BAD_GROUP;
+			memcpy(text, value, len);
+			text[len] = 0;
+			if(ParseNumber(text, &number) != 0 || number < 0)
+				return HPC_CONFIG_BAD_VALUE;
+			events[i] = (UINT32)number;
+			if(next != NULL)
+				value = next + 1;
+		}
+		memcpy(config->eventSel[group], events, sizeof(events));
+		if(config->groupCount < group + 1)
+			config->groupCount = group + 1;
+	}else if(keyLen == 6 && memcmp(option, "rotate", 6) == 0){
+		if(ParseNumber(value, &number) != 0 || number < 1)
+			return HPC_CONFIG_BAD_GROUP;
+		config->groupPeriod = (UINT32)number;
+	}else if(keyLen == 4 && memcmp(option, "apps", 4) == 0){
+		config->testAppCount = 0;
+		memset(config->testApps, 0, sizeof(config->testApps));
+		do{
+			next = strchr(value, ',');
+			len = next != NULL ? (size_t)(next - value) : strlen(value);
+			if(len >= sizeof(name))
+				return HPC_CONFIG_BAD_APP;
+			memcpy(name, value, len);
+			name[len] = 0;
+			if((rc = HpcConfigAddTestApp(config, name)) != HPC_CONFIG_OK)
+				return rc;
+			if(next != NULL)
+				value = next + 1;
+		}while(next != NULL);
+	}else if(keyLen == 6 && memcmp(option, "output", 6) == 0){
+		if(strcmp(value, "log") == 0)
+			config->output = HPC_OUTPUT_LOG;
+		else if(strcmp(value, "stats") == 0)
+			config->output = HPC_OUTPUT_STATS;
+		else
+			return HPC_CONFIG_BAD_OUTPUT;
+	}else if(keyLen == 6 && memcmp(option, "freeze", 6) == 0){
+		if(strcmp(value, "on") == 0)
+			config->freeze = 1;
+		else if(strcmp(value, "off") == 0)
+			config->freeze = 0;
+		else
+			return HPC_CONFIG_BAD_FREEZE;
+	}else if(keyLen == 5 && memcmp(option, "rdpmc", 5) == 0){
+		if(strcmp(value, "on") == 0)
+			config->rdpmc = 1;
+		else if(strcmp(value, "off") == 0)
+			config->rdpmc = 0;
+		else
+			return HPC_CONFIG_BAD_RDPMC;
+	}else if(keyLen == 6 && memcmp(option, "jitter", 6) == 0){
+		if(ParseNumber(value, &number) != 0 || number < 0 || number > HPC_MAX_PMI_PERIOD)
+			return HPC_CONFIG_BAD_PERIOD;
+		config->jitter = (UINT32)number;
+	}else if(keyLen == 6 && memcmp(option, "target", 6) == 0){
+		if(ParseNumber(value, &number) != 0 || number < 0 || number > 0xFFFFFFFF)
+			return HPC_CONFIG_BAD_PERIOD;
+		config->target = (UINT32)number;
+	}else if(keyLen == 6 && memcmp(option, "budget", 6) == 0){
+		if(ParseNumber(value, &number) != 0 || number < 0 || number > 1000)
+			return HPC_CONFIG_BAD_PERIOD;
+		config->budget = (UINT32)number;
+	}else if(keyLen == 3 && memcmp(option, "log", 3) == 0){
+		len = strlen(value);
+		if(len == 0 || len >= HPC_MAX_PATH)
+			return HPC_CONFIG_BAD_LOG;
+		for(i = 0; i < HPC_MAX_PATH; i++)
+			config->logFile[i] = i < len ? (UINT8)value[i] : 0;
+	}else
+		return HPC_CONFIG_BAD_OPTION;
+	return HPC_CONFIG_OK;
+}
+
+/*
+* Check a complete configuration before it is used by the driver
+*/
+int HpcConfigValidate(const HPC_CONFIG *config){
+	UINT32 i, j, g;
+	UINT32 evt;
+
+	if(config->size != sizeof(*config))
+		return HPC_CONFIG_BAD_SIZE;
+
+	//sampling counts the period up to the overflow of fixed counter 0, polling reads the counters at traps
+	if(config->mode == HPC_MODE_SAMPLING){
+		if(config->pmiThreshold > -HPC_MIN_PMI_PERIOD || config->pmiThreshold < -HPC_MAX_PMI_PERIOD)
+			return HPC_CONFIG_BAD_THRESHOLD;
+	}else if(config->mode == HPC_MODE_POLLING){
+		if(config->pmiThreshold != 0)
+			return HPC_CONFIG_BAD_THRESHOLD;
+	}else
+		return HPC_CONFIG_BAD_MODE;
+
+	//groups rotate at PMIs, so multiplexing needs the sampling mode
+	if(config->groupCount < 1 || config->groupCount > HPC_MAX_GROUPS || config->groupPeriod < 1)
+		return HPC_CONFIG_BAD_GROUP;
+	if(config->groupCount > 1 && config->mode != HPC_MODE_SAMPLING)
+		return HPC_CONFIG_BAD_GROUP;
+
+	//only fixed counter 0 may raise PMIs, and an enabled event must count in user or kernel mode
+	for(g = 0; g < config->groupCount; g++){
+		for(i = 0; i < HPC_MAX_PROGRAMMABLE; i++){
+			evt = config->eventSel[g][i];
+			if(evt == 0)
+				continue;
+			if((evt & HPC_EVTSEL_INT) || !(evt & HPC_EVTSEL_EN) || !(evt & (HPC_EVTSEL_USR | HPC_EVTSEL_OS)))
+				return HPC_CONFIG_BAD_EVENT;
+		}
+	}
+
+	if(config->output != HPC_OUTPUT_LOG && config->output != HPC_OUTPUT_STATS)
+		return HPC_CONFIG_BAD_OUTPUT;
+
+	//the counters only freeze on PMIs
+	if(config->freeze > 1 || (config->freeze && config->mode != HPC_MODE_SAMPLING))
+		return HPC_CONFIG_BAD_FREEZE;
+
+	//the sampling mode reloads the counters at every PMI, so only the polling mode keeps them running for user-mode reads
+	if(config->rdpmc > 1 || (config->rdpmc && config->mode != HPC_MODE_POLLING))
+		return HPC_CONFIG_BAD_RDPMC;
+
+	//jittered and adapted periods are reloaded at PMIs and stay within the limits of a period
+	if(config->jitter != 0 || config->target != 0 || config->budget != 0){
+		if(config->mode != HPC_MODE_SAMPLING || config->budget > 1000)
+			return HPC_CONFIG_BAD_PERIOD;
+		if(-(INT64)config->pmiThreshold - config->jitter < HPC_MIN_PMI_PERIOD ||
+			-(INT64)config->pmiThreshold + config->jitter > HPC_MAX_PMI_PERIOD)
+			return HPC_CONFIG_BAD_PERIOD;
+	}
+
+	if(config->testAppCount == 0)
+		return HPC_CONFIG_BAD_APP;
+	if(config->testAppCount > HPC_MAX_TEST_APPS)
+		return HPC_CONFIG_TOO_MANY_APPS;
+	for(i = 0; i < config->testAppCount; i++){
+		if(config->testApps[i][0] == 0 || config->testApps[i][HPC_APP_NAME_SIZE - 1] != 0)
+			return HPC_CONFIG_BAD_APP;
+	}
+
+	for(j = 0; j < HPC_MAX_PATH && config->logFile[j] != 0; j++)
+		;
+	if(j == 0 || j == HPC_MAX_PATH)
+		return HPC_CONFIG_BAD_LOG;
+	return HPC_CONFIG_OK;
+}
+
+/*
+* Copy a configuration received from user mode and validate it
+*/
+int HpcConfigFromBuffer(PHPC_CONFIG config, const void *buffer, UINT32 len){
+	if(buffer == NULL || len != sizeof(*config))
+		return HPC_CONFIG_BAD_SIZE;
+	memcpy(config, buffer, sizeof(*config));
+	return HpcConfigValidate(config);
+}
+
+/*
+* Check whether an image file name (15 characters, as kept in EPROCESS) is one of the test applications
+*/
+int HpcConfigIsTestApp(const HPC_CONFIG *config, const char *imageName){
+	UINT32 i;
+
+	if(imageName == NULL)
+		return 0;
+	for(i = 0; i < config->testAppCount; i++){
+		if(strncmp(imageName, config->testApps[i], HPC_APP_NAME_SIZE - 1) == 0)
+			return 1;
+	}
+	return 0;
+}
+
+const char *HpcConfigErrorText(int error){
+	switch(error){
+	case HPC_CONFIG_OK:				return "ok";
+	case HPC_CONFIG_BAD_SIZE:		return "request has the wrong size";
+	case HPC_CONFIG_BAD_MODE:		return "mode must be sampling or polling";
+	case HPC_CONFIG_BAD_THRESHOLD:	return "threshold must be 0 in polling mode and -2147483647..-1000 in sampling mode";
+	case HPC_CONFIG_BAD_EVENT:		return "event must be 0 or have EN and USR/OS set and INT clear";
+	case HPC_CONFIG_BAD_APP:		return "test application names must have 1 to 15 characters";
+	case HPC_CONFIG_TOO_MANY_APPS:	return "too many test applications";
+	case HPC_CONFIG_BAD_LOG:		return "log file path must have 1 to 259 characters";
+	case HPC_CONFIG_BAD_OPTION:		return "unknown option";
+	case HPC_CONFIG_BAD_VALUE:		return "bad number";
+	case HPC_CONFIG_BAD_GROUP:		return "groups need one to eight events each, rotate >= 1 and the sampling mode";
+	case HPC_CONFIG_BAD_OUTPUT:		return "output must be log or stats";
+	case HPC_CONFIG_BAD_FREEZE:		return "freeze must be on or off, and on only in the sampling mode";
+	case HPC_CONFIG_BAD_PERIOD:		return "jitter, target and budget need the sampling mode, periods of -threshold +- jitter within 1000..2^31-1 and a budget of 0..1000";
+	case HPC_CONFIG_NO_PMU:			return "the processor has no architectural PMU with fixed counter 0";
+	case HPC_CONFIG_NO_COUNTER:		return "an event is set on a programmable counter the processor does not have";
+	case HPC_CONFIG_BAD_RDPMC:		return "rdpmc must be on or off, and on only in the polling mode";
+	default:						return "unknown error";
+	}
+}
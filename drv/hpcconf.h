@@ -0,0 +1,119 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Run-time configuration of the driver and its control requests.
+* The control device (\\.\MyDriver) takes IOCTL_HPC_CONFIGURE with an HPC_CONFIG,
+* IOCTL_HPC_START, IOCTL_HPC_STOP, IOCTL_HPC_QUERY_STATUS, which returns an
+* HPC_STATUS, and IOCTL_HPC_QUERY_STATS, which returns the stats image of a run with
+* output=stats (hpcstats.h). IOCTL_HPC_MAP_LIVE maps the live region of the sample
+* rings (hpclive.h) into the caller until it closes the handle and returns its address
+* as a UINT64. Parsing and validation of the requests is shared by the driver and
+* the hpcctl tool, so a request is checked the same way on both sides.
+*/
+
+#ifndef HPCCONF_H
+#define HPCCONF_H
+
+#include "hpcring.h"
+#include "hpcself.h"
+
+#if !defined(CTL_CODE)
+	//winioctl.h definitions, for the builds without the Windows headers
+	#define CTL_CODE(type, function, method, access) (((type) << 16) | ((access) << 14) | ((function) << 2) | (method))
+	#define METHOD_BUFFERED		0
+	#define FILE_READ_DATA		0x0001
+	#define FILE_WRITE_DATA		0x0002
+#endif
+
+#define HPC_DEVICE_NAME		"\\\\.\\MyDriver"
+#define HPC_IOCTL_TYPE		40000
+
+#define IOCTL_HPC_CONFIGURE		CTL_CODE(HPC_IOCTL_TYPE, 0x801, METHOD_BUFFERED, FILE_READ_DATA|FILE_WRITE_DATA)
+#define IOCTL_HPC_START			CTL_CODE(HPC_IOCTL_TYPE, 0x802, METHOD_BUFFERED, FILE_READ_DATA|FILE_WRITE_DATA)
+#define IOCTL_HPC_STOP			CTL_CODE(HPC_IOCTL_TYPE, 0x803, METHOD_BUFFERED, FILE_READ_DATA|FILE_WRITE_DATA)
+#define IOCTL_HPC_QUERY_STATUS	CTL_CODE(HPC_IOCTL_TYPE, 0x804, METHOD_BUFFERED, FILE_READ_DATA)
+#define IOCTL_HPC_QUERY_STATS	CTL_CODE(HPC_IOCTL_TYPE, 0x805, METHOD_BUFFERED, FILE_READ_DATA)
+#define IOCTL_HPC_MAP_LIVE		CTL_CODE(HPC_IOCTL_TYPE, 0x806, METHOD_BUFFERED, FILE_READ_DATA)
+
+//same values as SAMPLE_LOG_MODE_*
+#define HPC_MODE_SAMPLING	1
+#define HPC_MODE_POLLING	2
+
+//what is written into the output file
+#define HPC_OUTPUT_LOG		0		//every sample, as a sample log (hpclog.h)
+#define HPC_OUTPUT_STATS	1		//the distributions of the samples only (hpcstats.h), in constant memory
+
+#define HPC_MAX_TEST_APPS	8
+#define HPC_APP_NAME_SIZE	16		//EPROCESS.ImageFileName keeps 15 characters
+#define HPC_MAX_PATH		260
+
+//smallest sampling period; shorter periods turn the PMI handler into an interrupt storm
+#define HPC_MIN_PMI_PERIOD	1000
+#define HPC_MAX_PMI_PERIOD	0x7FFFFFFF
+
+//IA32_PERFEVTSELx bits checked by HpcConfigValidate
+#define HPC_EVTSEL_USR		0x00010000
+#define HPC_EVTSEL_OS		0x00020000
+#define HPC_EVTSEL_INT		0x00100000
+#define HPC_EVTSEL_EN		0x00400000
+
+typedef struct _HPC_CONFIG {
+	UINT32 size;						//sizeof(HPC_CONFIG)
+	UINT32 mode;						//HPC_MODE_*
+	INT32 pmiThreshold;					//negative sampling period, 0 in polling mode
+	UINT32 groupCount;					//event groups to multiplex, 1 to count eventSel[0] only
+	UINT32 groupPeriod;					//PMIs of a thread per group, see hpcmux.h
+	UINT32 eventSel[HPC_MAX_GROUPS][HPC_MAX_PROGRAMMABLE];	//IA32_PERFEVTSELx values of each group, 0 leaves the counter off
+	UINT32 testAppCount;
+	char testApps[HPC_MAX_TEST_APPS][HPC_APP_NAME_SIZE];
+	UINT16 logFile[HPC_MAX_PATH];		//NT path of the output file, UTF-16
+	UINT32 output;						//HPC_OUTPUT_*
+	UINT32 freeze;						//freeze the counters on PMIs, so the skid is not counted
+	UINT32 jitter;						//periods are drawn uniformly from -pmiThreshold +- jitter, see hpcperiod.h
+	UINT32 target;						//adapt the period to windows of this many reference cycles, 0 for a fixed period
+	UINT32 budget;						//adapt the period so the PMI handler takes at most budget per mille of the cycles
+	UINT32 rdpmc;						//let user mode read the counters with rdpmc (CR4.PCE) while running, see tools/hpcpmc.h
+} HPC_CONFIG, *PHPC_CONFIG;
+
+#define HPC_STATE_STOPPED	0
+#define HPC_STATE_RUNNING	1
+
+typedef struct _HPC_STATUS {
+	UINT32 size;						//sizeof(HPC_STATUS)
+	UINT32 state;						//HPC_STATE_*
+	UINT32 cpuCount;
+	UINT32 testProcesses;				//running test processes
+	UINT64 samples;						//samples taken since the last start
+	UINT64 dropped;						//samples lost to full rings since the last start
+	HPC_CONFIG config;					//parameters of the current or next run
+	SELF_STATS self;					//cost of the handlers since the last start, see hpcself.h
+} HPC_STATUS, *PHPC_STATUS;
+
+//results of the functions below
+#define HPC_CONFIG_OK				0
+#define HPC_CONFIG_BAD_SIZE			1
+#define HPC_CONFIG_BAD_MODE			2
+#define HPC_CONFIG_BAD_THRESHOLD	3
+#define HPC_CONFIG_BAD_EVENT		4
+#define HPC_CONFIG_BAD_APP			5
+#define HPC_CONFIG_TOO_MANY_APPS	6
+#define HPC_CONFIG_BAD_LOG			7
+#define HPC_CONFIG_BAD_OPTION		8
+#define HPC_CONFIG_BAD_VALUE		9
+#define HPC_CONFIG_BAD_GROUP		10
+#define HPC_CONFIG_BAD_OUTPUT		11
+#define HPC_CONFIG_BAD_FREEZE		12
+#define HPC_CONFIG_BAD_PERIOD		13
+#define HPC_CONFIG_NO_PMU			14
+#define HPC_CONFIG_NO_COUNTER		15
+#define HPC_CONFIG_BAD_RDPMC		16
+
+void HpcConfigInit(PHPC_CONFIG config);
+int HpcConfigSet(PHPC_CONFIG config, const char *option);
+int HpcConfigAddTestApp(PHPC_CONFIG config, const char *name);
+int HpcConfigValidate(const HPC_CONFIG *config);
+int HpcConfigFromBuffer(PHPC_CONFIG config, const void *buffer, UINT32 len);
+int HpcConfigIsTestApp(const HPC_CONFIG *config, const char *imageName);
+const char *HpcConfigErrorText(int error);
+
+#endif
@@ -0,0 +1,120 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Live region: the sample rings of all CPUs in one block of memory that the driver maps
+* into a user-mode consumer (IOCTL_HPC_MAP_LIVE), so samples are read where the PMI
+* handler wrote them, without copies and without an IOCTL per sample.
+*
+* The region holds a header, one cache line per CPU with the head of its ring, which
+* SampleRingCommit publishes there (SampleRingPublish), and the slots of the rings.
+* Observers never write to the region: the drain thread stays the only consumer of
+* the rings and an observer only follows the published heads. An observer that falls
+* behind by more than a ring loses the overwritten samples, which LiveRead counts,
+* and it never slows the producer down. A slot is copied out and accepted only if the
+* head has not passed it meanwhile, so a torn record is never returned.
+*
+* The region is allocated once and kept until the driver unloads, so a mapping stays
+* valid across runs; header.run changes at every start and header.log describes the
+* experiment of the current run.
+*/
+
+#ifndef HPCLIVE_H
+#define HPCLIVE_H
+
+#include "hpcring.h"
+#include "hpclog.h"
+
+#define HPC_LIVE_MAGIC		0x564C4348	//"HCLV"
+#define HPC_LIVE_VERSION	1
+
+//the parts of the region start on page boundaries
+#define HPC_LIVE_PAGE		4096
+
+typedef struct _HPC_LIVE_HEADER {
+	UINT32 magic;
+	UINT32 version;
+	UINT32 size;					//bytes of the region
+	UINT32 cpuCount;
+	UINT32 capacity;				//records per ring, a power of two
+	UINT32 cpuOffset;				//HPC_LIVE_CPU array
+	UINT32 slotOffset;				//capacity records of CPU 0, then of CPU 1, ...
+	volatile UINT32 run;			//incremented at every start
+	volatile UINT32 running;		//1 while a run collects samples
+	UINT32 reserved;
+	SAMPLE_LOG_HEADER log;			//experiment of the current run
+} HPC_LIVE_HEADER, *PHPC_LIVE_HEADER;
+
+//published head of the ring of a CPU, on a line of its own
+typedef struct _HPC_LIVE_CPU {
+	volatile UINT32 head;
+	UINT8 pad[HPC_CACHE_LINE - sizeof(UINT32)];
+} HPC_LIVE_CPU, *PHPC_LIVE_CPU;
+
+/*
+* Size of a region for cpuCount rings of capacity records, and the offsets of its parts
+*/
+HPC_INLINE UINT32 LiveLayout(UINT32 cpuCount, UINT32 capacity, UINT32 *cpuOffset, UINT32 *slotOffset){
+	UINT32 size = (sizeof(HPC_LIVE_HEADER) + HPC_LIVE_PAGE - 1) & ~(HPC_LIVE_PAGE - 1);
+
+	*cpuOffset = size;
+	size += (cpuCount * sizeof(HPC_LIVE_CPU) + HPC_LIVE_PAGE - 1) & ~(HPC_LIVE_PAGE - 1);
+	*slotOffset = size;
+	return size + cpuCount * capacity * sizeof(HPC_RECORD);
+}
+
+/*
+* Fill in the header of a zeroed region of LiveLayout bytes
+*/
+HPC_INLINE void LiveInit(PHPC_LIVE_HEADER live, UINT32 cpuCount, UINT32 capacity){
+	live->magic = HPC_LIVE_MAGIC;
+	live->version = HPC_LIVE_VERSION;
+	live->cpuCount = cpuCount;
+	live->capacity = capacity;
+	live->size = LiveLayout(cpuCount, capacity, &live->cpuOffset, &live->slotOffset);
+}
+
+HPC_INLINE PHPC_LIVE_CPU LiveCpu(const HPC_LIVE_HEADER *live, UINT32 cpu){
+	return (PHPC_LIVE_CPU)((UINT8 *)live + live->cpuOffset) + cpu;
+}
+
+HPC_INLINE PHPC_RECORD LiveSlots(const HPC_LIVE_HEADER *live, UINT32 cpu){
+	return (PHPC_RECORD)((UINT8 *)live + live->slotOffset) + cpu * live->capacity;
+}
+
+/*
+* Read the next sample of a CPU at *next, the free-running index of the observer.
+* Returns 1 for a sample, 0 if the observer is at the head. Samples overwritten before
+* they were read are skipped and added to *lost.
+*/
+HPC_INLINE int LiveRead(const HPC_LIVE_HEADER *live, UINT32 cpu, UINT32 *next, UINT64 *lost, PHPC_SAMPLE sample){
+	volatile UINT32 *published = &LiveCpu(live, cpu)->head;
+	const HPC_RECORD *slots = LiveSlots(live, cpu);
+	HPC_RECORD record;
+	UINT32 head;
+
+	for(;;){
+		head = HpcLoadAcquire(published);
+		if(head == *next)
+			return 0;
+		//the slot of index head - capacity may be being rewritten by the producer right now
+		if(head - *next >= live->capacity){
+			*lost += head - *next - live->capacity + 1;
+			*next = head - live->capacity + 1;
+		}
+		record = slots[*next & (live->capacity - 1)];
+		HpcLoadFence();
+
+		//valid only if the producer did not reach the slot while it was copied; x86 makes the
+		//stores of the producer visible in order, so the slot is rewritten only after head passed it
+		head = HpcLoadAcquire(published);
+		if(head - *next < live->capacity)
+			break;
+		(*lost)++;
+		(*next)++;
+	}
+	SampleRecordUnpack(&record, (UINT16)cpu, sample);
+	(*next)++;
+	return 1;
+}
+
+#endif
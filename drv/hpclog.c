@@ -0,0 +1,245 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Binary sample log writer and reader, see hpclog.h for the format.
+*/
+
+#include "hpclog.h"
+
+/*
+* Zigzag map a signed delta so that small negative values also get short varints
+*/
+HPC_INLINE UINT64 ZigzagEncode(UINT64 delta){
+	return (delta << 1) ^ (UINT64)((INT64)delta >> 63);
+}
+
+HPC_INLINE UINT64 ZigzagDecode(UINT64 val){
+	return (val >> 1) ^ (UINT64)(-(INT64)(val & 1));
+}
+
+/*
+* Copy the columns of a sample into a flat array in encoding order
+*/
+HPC_INLINE void SampleColumns(const HPC_SAMPLE *sample, UINT64 *cols){
+	UINT32 i;
+
+	for(i = 0; i < HPC_NUM_COUNTERS; i++)
+		cols[i] = sample->ctr[i];
+	cols[HPC_NUM_COUNTERS] = sample->tid;
+	cols[HPC_NUM_COUNTERS + 1] = sample->tsc;
+	cols[HPC_NUM_COUNTERS + 2] = sample->group;
+	cols[HPC_NUM_COUNTERS + 3] = sample->region;
+	cols[HPC_NUM_COUNTERS + 4] = sample->depth;
+	cols[HPC_NUM_COUNTERS + 5] = sample->period;
+	cols[HPC_NUM_COUNTERS + 6] = sample->ip;
+	cols[HPC_NUM_COUNTERS + 7] = sample->cpl;
+}
+
+/*
+* Fill in the fields that do not depend on the experiment
+*/
+void SampleLogInitHeader(PSAMPLE_LOG_HEADER header){
+	memset(header, 0, sizeof(*header));
+	memcpy(header->magic, SAMPLE_LOG_MAGIC, sizeof(SAMPLE_LOG_MAGIC));
+	header->headerSize = sizeof(*header);
+	header->version = SAMPLE_LOG_VERSION;
+	header->blockSize = SAMPLE_LOG_BLOCK_SIZE;
+	header->numCounters = HPC_NUM_COUNTERS;
+	header->columns = HPC_BASE_COLUMNS;
+	header->groupCount = 1;
+	header->groupPeriod = 1;
+}
+
+/*
+* Write the header, padded to SAMPLE_LOG_ALIGN, at the start of the log
+*/
+static int WriteHeader(PSAMPLE_LOG log){
+	memset(log->scratch, 0, SAMPLE_LOG_ALIGN);
+	memcpy(log->scratch, &log->header, sizeof(log->header));
+	if(log->error == 0)
+		log->error = log->write(log->context, 0, log->scratch, SAMPLE_LOG_ALIGN);
+	return log->error;
+}
+
+/*
+* Start a log. scratch is a SAMPLE_LOG_ALIGN-byte buffer that must stay valid until SampleLogClose;
+* header->blockSize must be a multiple of SAMPLE_LOG_ALIGN.
+*/
+int SampleLogOpen(PSAMPLE_LOG log, const SAMPLE_LOG_HEADER *header, UINT8 *scratch, SAMPLE_LOG_WRITE write, void *context){
+	log->header = *header;
+	log->header.samples = 0;
+	log->header.dropped = 0;
+	log->offset = SAMPLE_LOG_ALIGN;
+	log->scratch = scratch;
+	log->write = write;
+	log->context = context;
+	log->error = 0;
+	return WriteHeader(log);
+}
+
+/*
+* Start a new empty block in the staging buffer of a stream
+*/
+static void ResetBlock(PSAMPLE_LOG_STREAM stream){
+	UINT32 i;
+
+	stream->used = sizeof(SAMPLE_LOG_BLOCK);
+	stream->samples = 0;
+	for(i = 0; i < SAMPLE_LOG_COLUMNS; i++)
+		stream->prev[i] = 0;
+}
+
+/*
+* Attach the stream of one CPU to a log; block is the staging buffer of header.blockSize bytes
+*/
+void SampleLogStreamInit(PSAMPLE_LOG_STREAM stream, PSAMPLE_LOG log, UINT32 cpu, UINT8 *block){
+	stream->log = log;
+	stream->block = block;
+	stream->cpu = cpu;
+	ResetBlock(stream);
+}
+
+/*
+* Write out the current block of a stream padded to SAMPLE_LOG_ALIGN (or to blockSize if full)
+*/
+int SampleLogFlush(PSAMPLE_LOG_STREAM stream){
+	PSAMPLE_LOG log = stream->log;
+	PSAMPLE_LOG_BLOCK block = (PSAMPLE_LOG_BLOCK)stream->block;
+	UINT32 len;
+
+	if(stream->samples == 0)
+		return log->error;
+
+	block->magic = SAMPLE_LOG_BLOCK_MAGIC;
+	block->bytes = stream->used;
+	block->samples = stream->samples;
+	block->cpu = stream->cpu;
+
+	len = (stream->used + SAMPLE_LOG_ALIGN - 1) & ~(UINT32)(SAMPLE_LOG_ALIGN - 1);
+	memset(stream->block + stream->used, 0, len - stream->used);
+	log->header.samples += stream->samples;
+
+	if(log->error == 0)
+		log->error = log->write(log->context, log->offset, stream->block, len);
+	log->offset += len;
+	ResetBlock(stream);
+	return log->error;
+}
+
+/*
+* Encode one sample into the current block of the stream, writing the block out when it is full
+*/
+int SampleLogAppend(PSAMPLE_LOG_STREAM stream, const HPC_SAMPLE *sample){
+	UINT64 cols[SAMPLE_LOG_COLUMNS];
+	UINT8 *out;
+	UINT64 val;
+	UINT32 i;
+
+	if(stream->used + SAMPLE_LOG_MAX_RECORD > stream->log->header.blockSize)
+		SampleLogFlush(stream);
+
+	SampleColumns(sample, cols);
+	out = stream->block + stream->used;
+	for(i = 0; i < SAMPLE_LOG_COLUMNS; i++){
+		val = ZigzagEncode(cols[i] - stream->prev[i]);
+		stream->prev[i] = cols[i];
+		while(val >= 0x80){
+			*out++ = (UINT8)(val | 0x80);
+			val >>= 7;
+		}
+		*out++ = (UINT8)val;
+	}
+	stream->used = (UINT32)(out - stream->block);
+	stream->samples++;
+	return stream->log->error;
+}
+
+/*
+* Rewrite the header with the final sample and drop counts; all streams must be flushed before
+*/
+int SampleLogClose(PSAMPLE_LOG log, UINT64 dropped){
+	log->header.dropped = dropped;
+	return WriteHeader(log);
+}
+
+/*
+* Validate and copy the log header found at the start of buffer. Every change of the header
+* bumps SAMPLE_LOG_VERSION, so logs of other versions are rejected. Returns 0 on success.
+*/
+int SampleLogReadHeader(const UINT8 *buffer, UINT32 len, PSAMPLE_LOG_HEADER header){
+	const SAMPLE_LOG_HEADER *src = (const SAMPLE_LOG_HEADER *)buffer;
+	UINT32 size;
+
+	if(len < 16 || memcmp(src->magic, SAMPLE_LOG_MAGIC, sizeof(SAMPLE_LOG_MAGIC)) != 0)
+		return -1;
+	size = src->headerSize;
+	if(size > sizeof(*header))
+		size = sizeof(*header);
+	if(size > len)
+		return -1;
+
+	memset(header, 0, sizeof(*header));
+	memcpy(header, buffer, size);
+	if(header->version != SAMPLE_LOG_VERSION || header->numCounters != HPC_NUM_COUNTERS ||
+		header->blockSize < SAMPLE_LOG_ALIGN || header->blockSize % SAMPLE_LOG_ALIGN != 0)
+		return -1;
+	return 0;
+}
+
+/*
+* Start decoding the block at block[0..len). Returns 0 on success, -1 if it is not a valid block.
+*/
+int SampleLogBlockBegin(PSAMPLE_LOG_CURSOR cursor, const UINT8 *block, UINT32 len){
+	const SAMPLE_LOG_BLOCK *hdr = (const SAMPLE_LOG_BLOCK *)block;
+	UINT32 i;
+
+	if(len < sizeof(SAMPLE_LOG_BLOCK) || hdr->magic != SAMPLE_LOG_BLOCK_MAGIC || hdr->bytes > len || hdr->bytes < sizeof(SAMPLE_LOG_BLOCK))
+		return -1;
+
+	cursor->next = block + sizeof(SAMPLE_LOG_BLOCK);
+	cursor->end = block + hdr->bytes;
+	cursor->remaining = hdr->samples;
+	cursor->cpu = hdr->cpu;
+	for(i = 0; i < SAMPLE_LOG_COLUMNS; i++)
+		cursor->prev[i] = 0;
+	return 0;
+}
+
+/*
+* Decode the next sample of the block. Returns 1 if a sample was decoded, 0 at the end
+* of the block and -1 if the block is corrupt.
+*/
+int SampleLogBlockNext(PSAMPLE_LOG_CURSOR cursor, PHPC_SAMPLE sample){
+	const UINT8 *in = cursor->next;
+	UINT64 val;
+	UINT32 i, shift;
+
+	if(cursor->remaining == 0)
+		return 0;
+
+	for(i = 0; i < SAMPLE_LOG_COLUMNS; i++){
+		val = 0;
+		shift = 0;
+		do{
+			if(in >= cursor->end || shift > 63)
+				return -1;
+			val |= (UINT64)(*in & 0x7F) << shift;
+			shift += 7;
+		}while(*in++ & 0x80);
+		cursor->prev[i] += ZigzagDecode(val);
+	}
+	for(i = 0; i < HPC_NUM_COUNTERS; i++)
+		sample->ctr[i] = cursor->prev[i];
+	sample->tid = (UINT32)cursor->prev[HPC_NUM_COUNTERS];
+	sample->tsc = cursor->prev[HPC_NUM_COUNTERS + 1];
+	sample->cpu = (UINT16)cursor->cpu;
+	sample->group = (UINT16)cursor->prev[HPC_NUM_COUNTERS + 2];
+	sample->region = (UINT32)cursor->prev[HPC_NUM_COUNTERS + 3];
+	sample->depth = (UINT16)cursor->prev[HPC_NUM_COUNTERS + 4];
+	sample->period = (UINT32)cursor->prev[HPC_NUM_COUNTERS + 5];
+	sample->ip = cursor->prev[HPC_NUM_COUNTERS + 6];
+	sample->cpl = (UINT16)cursor->prev[HPC_NUM_COUNTERS + 7];
+	cursor->next = in;
+	cursor->remaining--;
+	return 1;
+}
@@ -0,0 +1,132 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Binary sample log format.
+*
+* A log starts with a SAMPLE_LOG_HEADER padded to SAMPLE_LOG_ALIGN bytes, followed by
+* blocks of at most header.blockSize bytes. Each block starts with a SAMPLE_LOG_BLOCK and
+* holds samples of one CPU, in the order that CPU took them; blocks of different CPUs are
+* interleaved in the order they filled up. The columns of a sample (the counters, the
+* thread id, the time stamp, the event group, the region and its depth, the sampling period, the instruction pointer
+* and the privilege level) are delta encoded against the previous
+* sample of the same block, zigzag mapped and written as LEB128 varints. Deltas restart in every block,
+* so blocks decode independently. A block takes its used bytes rounded up to
+* SAMPLE_LOG_ALIGN, which is header.blockSize except for the last block of each CPU.
+* Readers merge the per-CPU streams by time stamp. All fields are little endian.
+*/
+
+#ifndef HPCLOG_H
+#define HPCLOG_H
+
+#include "hpcring.h"
+#include "hpcself.h"
+
+#define SAMPLE_LOG_MAGIC		"HPCLOG1"
+#define SAMPLE_LOG_VERSION		9
+#define SAMPLE_LOG_BLOCK_MAGIC	0x4B4C4248		//"HBLK"
+
+//every write to the log file is a multiple of this size at an offset aligned to it
+#define SAMPLE_LOG_ALIGN		4096
+#define SAMPLE_LOG_BLOCK_SIZE	(64 * 1024)
+
+//encoded columns per sample: the counters, the thread id, the time stamp, the event group, the region and its depth, the period,
+//the instruction pointer and the privilege level
+#define SAMPLE_LOG_COLUMNS		(HPC_NUM_COUNTERS + 8)
+
+//worst-case encoded size of one sample: 10 bytes per 64-bit varint
+#define SAMPLE_LOG_MAX_RECORD	(10 * SAMPLE_LOG_COLUMNS)
+
+#define SAMPLE_LOG_MODE_SAMPLING	1
+#define SAMPLE_LOG_MODE_POLLING		2
+
+//written by the Linux collector (tools/hpcrun.c): time stamps are CLOCK_MONOTONIC nanoseconds, thread ids are Linux tids
+#define SAMPLE_LOG_FLAG_PERF		0x1
+//no hardware counters were available, the columns hold the software events listed in tools/README.md
+#define SAMPLE_LOG_FLAG_SOFTWARE	0x2
+//the driver froze the counters on PMIs (freeze=on), windows hold no skid
+#define SAMPLE_LOG_FLAG_FREEZE		0x4
+
+typedef struct _SAMPLE_LOG_HEADER {
+	char magic[8];				//SAMPLE_LOG_MAGIC
+	UINT32 headerSize;			//sizeof(SAMPLE_LOG_HEADER) of the writer; readers take the header of their own version only
+	UINT32 version;
+	UINT32 blockSize;
+	UINT32 numCounters;			//counter columns per sample
+	UINT32 mode;				//SAMPLE_LOG_MODE_*
+	INT32 pmiThreshold;			//negative mean period, see also jitter and target
+	UINT32 eventSel[HPC_MAX_PROGRAMMABLE];	//IA32_PERFEVTSELx values (EVENT0-7)
+	char testApp[16];			//TEST_APP
+	UINT32 cpuSignature;		//CPUID.1:EAX, family/model/stepping
+	UINT32 cpuCount;			//number of CPUs sampled
+	char cpuModel[48];			//CPUID brand string
+	UINT64 samples;				//samples written, updated when the log is closed
+	UINT64 dropped;				//samples lost to full rings, updated when the log is closed
+	UINT32 groupCount;			//event groups multiplexed over the programmable counters, 1 without multiplexing
+	UINT32 groupPeriod;			//PMIs of a thread before it moves on to the next group
+	UINT32 groupEventSel[HPC_MAX_GROUPS][HPC_MAX_PROGRAMMABLE];	//IA32_PERFEVTSELx values of each group, group 0 equals eventSel
+	UINT32 flags;				//SAMPLE_LOG_FLAG_*
+	UINT32 jitter;				//sampling periods of -pmiThreshold +- jitter, see hpcperiod.h
+	UINT32 target;				//periods adapted to windows of target reference cycles, 0 if not
+	UINT32 budget;				//periods adapted to a PMI handler cost of budget per mille, 0 if not
+	UINT32 pmuVersion;			//CPUID.0AH:EAX[7:0], 0 if unknown
+	UINT32 columns;				//bit mask of the counter columns the PMU has; the others are 0
+	UINT32 programmableWidth;	//counter widths in bits, the counts wrap around at 2^width
+	UINT32 fixedWidth;
+	SELF_STATS self;			//cost of the collector's handlers in this run, updated when the log is closed; zero in logs of hpcrun
+} SAMPLE_LOG_HEADER, *PSAMPLE_LOG_HEADER;
+
+//fails to compile if the header does not fit the scratch buffer it is written from
+typedef char SAMPLE_LOG_HEADER_SIZE_CHECK[sizeof(SAMPLE_LOG_HEADER) <= SAMPLE_LOG_ALIGN ? 1 : -1];
+
+typedef struct _SAMPLE_LOG_BLOCK {
+	UINT32 magic;				//SAMPLE_LOG_BLOCK_MAGIC
+	UINT32 bytes;				//used bytes including this header
+	UINT32 samples;				//samples encoded in the block
+	UINT32 cpu;					//CPU that took the samples
+} SAMPLE_LOG_BLOCK, *PSAMPLE_LOG_BLOCK;
+
+//writes len bytes at offset of the log; returns 0 on success
+typedef int (*SAMPLE_LOG_WRITE)(void *context, UINT64 offset, const void *buffer, UINT32 len);
+
+//the log file; blocks are placed one after the other in the order streams flush them
+typedef struct _SAMPLE_LOG {
+	SAMPLE_LOG_HEADER header;
+	UINT64 offset;				//file offset of the next block
+	UINT8 *scratch;				//SAMPLE_LOG_ALIGN bytes used to write the header
+	SAMPLE_LOG_WRITE write;
+	void *context;
+	int error;					//first write error, later writes are skipped
+} SAMPLE_LOG, *PSAMPLE_LOG;
+
+//the samples of one CPU, staged in a block until it is full
+typedef struct _SAMPLE_LOG_STREAM {
+	PSAMPLE_LOG log;
+	UINT8 *block;				//header.blockSize bytes, aligned to SAMPLE_LOG_ALIGN for unbuffered writes
+	UINT32 used;
+	UINT32 samples;
+	UINT32 cpu;
+	UINT64 prev[SAMPLE_LOG_COLUMNS];
+} SAMPLE_LOG_STREAM, *PSAMPLE_LOG_STREAM;
+
+typedef struct _SAMPLE_LOG_CURSOR {
+	const UINT8 *next;
+	const UINT8 *end;
+	UINT32 remaining;
+	UINT32 cpu;
+	UINT64 prev[SAMPLE_LOG_COLUMNS];
+} SAMPLE_LOG_CURSOR, *PSAMPLE_LOG_CURSOR;
+
+//writer
+void SampleLogInitHeader(PSAMPLE_LOG_HEADER header);
+int SampleLogOpen(PSAMPLE_LOG log, const SAMPLE_LOG_HEADER *header, UINT8 *scratch, SAMPLE_LOG_WRITE write, void *context);
+void SampleLogStreamInit(PSAMPLE_LOG_STREAM stream, PSAMPLE_LOG log, UINT32 cpu, UINT8 *block);
+int SampleLogAppend(PSAMPLE_LOG_STREAM stream, const HPC_SAMPLE *sample);
+int SampleLogFlush(PSAMPLE_LOG_STREAM stream);
+int SampleLogClose(PSAMPLE_LOG log, UINT64 dropped);
+
+//reader
+int SampleLogReadHeader(const UINT8 *buffer, UINT32 len, PSAMPLE_LOG_HEADER header);
+int SampleLogBlockBegin(PSAMPLE_LOG_CURSOR cursor, const UINT8 *block, UINT32 len);
+int SampleLogBlockNext(PSAMPLE_LOG_CURSOR cursor, PHPC_SAMPLE sample);
+
+#endif
@@ -0,0 +1,64 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Fixed-size target process set, see hpcmatch.h.
+* Removed keys leave a tombstone so that concurrent readers probing past
+* the slot still find keys inserted after it.
+*/
+
+#include "hpcmatch.h"
+
+void TargetSetInit(PTARGET_SET set){
+	UINT32 i;
+
+	for(i = 0; i < TARGET_SET_SIZE; i++)
+		set->slots[i] = TARGET_SLOT_EMPTY;
+	set->count = 0;
+}
+
+/*
+* Add key, the process of id pid, to the set. Returns 0 on success (or if already present), -1 if the set is full.
+*/
+int TargetSetAdd(PTARGET_SET set, UINT_PTR key, UINT_PTR pid){
+	UINT32 i, probes;
+	int reuse = -1;
+
+	if(TargetSetContains(set, key))
+		return 0;
+	if(set->count >= TARGET_SET_MAX)
+		return -1;
+
+	i = TargetSetHash(key);
+	for(probes = 0; probes < TARGET_SET_SIZE; probes++){
+		if(set->slots[i] == TARGET_SLOT_REMOVED && reuse < 0)
+			reuse = (int)i;
+		if(set->slots[i] == TARGET_SLOT_EMPTY)
+			break;
+		i = (i + 1) & (TARGET_SET_SIZE - 1);
+	}
+	if(reuse >= 0)
+		i = (UINT32)reuse;
+
+	//a single aligned store publishes the key to readers
+	set->pids[i] = pid;
+	set->slots[i] = key;
+	set->count++;
+	return 0;
+}
+
+/*
+* Remove the key of process id pid from the set. Returns 0 on success, -1 if it was not present.
+* The key is not hashed, so every slot is looked at; only writers pay for it.
+*/
+int TargetSetRemove(PTARGET_SET set, UINT_PTR pid){
+	UINT32 i;
+
+	for(i = 0; i < TARGET_SET_SIZE; i++){
+		if(set->slots[i] != TARGET_SLOT_EMPTY && set->slots[i] != TARGET_SLOT_REMOVED && set->pids[i] == pid){
+			set->slots[i] = TARGET_SLOT_REMOVED;
+			set->count--;
+			return 0;
+		}
+	}
+	return -1;
+}
@@ -0,0 +1,64 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Fixed-size set of target processes for the context switch hook.
+* Targets are resolved once (by the process notify routine) to their EPROCESS
+* pointer, so the hook only hashes a pointer and compares it: no allocation,
+* no string copy and no lock. Writers are serialized by the caller; readers may
+* run concurrently on any CPU at any IRQL. The process id of each key is kept
+* as well, since an exiting process may no longer be found by its id.
+*/
+
+#ifndef HPCMATCH_H
+#define HPCMATCH_H
+
+#include "hpcport.h"
+
+//number of slots, a power of two at least twice the number of targets
+#define TARGET_SET_SIZE 64
+#define TARGET_SET_MAX (TARGET_SET_SIZE / 2)
+
+//slot values that are never valid keys
+#define TARGET_SLOT_EMPTY	((UINT_PTR)0)
+#define TARGET_SLOT_REMOVED	((UINT_PTR)1)
+
+typedef struct _TARGET_SET {
+	volatile UINT_PTR slots[TARGET_SET_SIZE];
+	volatile UINT32 count;		//live keys, lets the hook skip the probe when nothing is watched
+	UINT_PTR pids[TARGET_SET_SIZE];	//process id of the key in each slot, only used by writers
+} TARGET_SET, *PTARGET_SET;
+
+/*
+* Fibonacci hash of a pointer-sized key into a slot index
+*/
+HPC_INLINE UINT32 TargetSetHash(UINT_PTR key){
+	UINT32 folded = (UINT32)key ^ (UINT32)((UINT64)key >> 32);
+	return (UINT32)((folded >> 3) * 0x9E3779B1u) & (TARGET_SET_SIZE - 1);
+}
+
+/*
+* Check whether key is in the set; safe at any IRQL
+*/
+HPC_INLINE int TargetSetContains(const TARGET_SET *set, UINT_PTR key){
+	UINT32 i, probes;
+	UINT_PTR slot;
+
+	if(set->count == 0)
+		return 0;
+	i = TargetSetHash(key);
+	for(probes = 0; probes < TARGET_SET_SIZE; probes++){
+		slot = set->slots[i];
+		if(slot == key)
+			return 1;
+		if(slot == TARGET_SLOT_EMPTY)
+			return 0;
+		i = (i + 1) & (TARGET_SET_SIZE - 1);
+	}
+	return 0;
+}
+
+void TargetSetInit(PTARGET_SET set);
+int TargetSetAdd(PTARGET_SET set, UINT_PTR key, UINT_PTR pid);
+int TargetSetRemove(PTARGET_SET set, UINT_PTR pid);
+
+#endif
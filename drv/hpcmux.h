@@ -0,0 +1,31 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Event multiplexing. The programmable counters can be given up to HPC_MAX_GROUPS
+* groups of four events; every monitored thread counts one group at a time and moves
+* on to the next group after a fixed number of its own PMIs. The group travels with
+* the thread's counters (THREAD_CONTEXT), so the window of a sample never mixes two
+* groups. Every sample records the group it counted, and the analysis side scales
+* the counts of a group by the share of the windows it was active in.
+*/
+
+#ifndef HPCMUX_H
+#define HPCMUX_H
+
+#include "hpcring.h"
+
+/*
+* Count one PMI of a thread in its current group and rotate after period PMIs.
+* Returns 1 if the thread moved on to another group and the event selects must be reprogrammed.
+*/
+HPC_INLINE int MuxNextGroup(UINT32 *group, UINT32 *pmis, UINT32 groupCount, UINT32 period){
+	if(groupCount <= 1)
+		return 0;
+	if(++*pmis < period)
+		return 0;
+	*pmis = 0;
+	*group = *group + 1 < groupCount ? *group + 1 : 0;
+	return 1;
+}
+
+#endif
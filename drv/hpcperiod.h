@@ -0,0 +1,66 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Sampling periods that change from window to window. The PMI handler reloads fixed
+* counter 0 with the period of the next window, which can be
+*	jittered:	drawn uniformly from mean +- jitter, so the windows do not alias with
+*				the loops of the program;
+*	adapted:	moved towards the period that gives windows of target reference cycles,
+*				i.e. a fixed number of samples per second of running time, or, with a
+*				budget, windows long enough that the handler takes at most budget per
+*				mille of the cycles; the longer of the two wins;
+* or both, jittered around the adapted mean. The mean starts at -pmiThreshold. The
+* period travels with the window of a thread (THREAD_CONTEXT) and every sample records
+* the period of its window, so the analysis can weight windows of different lengths.
+*/
+
+#ifndef HPCPERIOD_H
+#define HPCPERIOD_H
+
+#include "hpcconf.h"
+
+/*
+* Next pseudo-random number of a CPU, xorshift32; the seed must not be 0
+*/
+HPC_INLINE UINT32 PeriodRandom(UINT32 *seed){
+	UINT32 x = *seed;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*seed = x;
+	return x;
+}
+
+/*
+* Period of the window that follows a window of period instructions and refCycles reference
+* cycles; handlerCycles is the cost of the last PMI handler of the CPU
+*/
+HPC_INLINE UINT32 PeriodNext(const HPC_CONFIG *config, UINT32 period, UINT64 refCycles, UINT32 handlerCycles, UINT32 *seed){
+	UINT64 mean = (UINT64)-(INT64)config->pmiThreshold, goal, ideal;
+
+	if((config->target != 0 || config->budget != 0) && refCycles != 0){
+		goal = config->target;
+		if(config->budget != 0 && (UINT64)handlerCycles * 1000 / config->budget > goal)
+			goal = (UINT64)handlerCycles * 1000 / config->budget;
+		if(goal > 0xFFFFFFFF)
+			goal = 0xFFFFFFFF;
+
+		//halfway to the period that would have met the goal, at most twice the last one
+		ideal = (UINT64)period * goal / refCycles;
+		mean = (period + ideal) / 2;
+		if(mean > 2 * (UINT64)period)
+			mean = 2 * (UINT64)period;
+		if(mean < HPC_MIN_PMI_PERIOD + (UINT64)config->jitter)
+			mean = HPC_MIN_PMI_PERIOD + (UINT64)config->jitter;
+		if(mean > HPC_MAX_PMI_PERIOD - (UINT64)config->jitter)
+			mean = HPC_MAX_PMI_PERIOD - (UINT64)config->jitter;
+	}
+
+	//multiply-shift instead of a modulo
+	if(config->jitter != 0)
+		mean = mean - config->jitter + (((UINT64)PeriodRandom(seed) * (2 * (UINT64)config->jitter + 1)) >> 32);
+	return (UINT32)mean;
+}
+
+#endif
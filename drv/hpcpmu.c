@@ -0,0 +1,299 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Counter logic of the PMI and trap handlers, see hpcpmu.h.
+*/
+
+#include "hpcpmu.h"
+#include "hpcmux.h"
+#include "hpcperiod.h"
+
+const UINT32 pmuCounterMsr[HPC_NUM_COUNTERS] = { 0x309, 0x30A, 0x30B, 0xC1, 0xC2, 0xC3, 0xC4, 0xC5, 0xC6, 0xC7, 0xC8, 0x30C };
+
+int PmuCheckConfig(const PMU_CAPS *caps, const HPC_CONFIG *config){
+	UINT32 g, i;
+
+	//fixed counter 0 counts the instructions of every window and raises the PMIs
+	if(!(caps->columns & 1))
+		return HPC_CONFIG_NO_PMU;
+	for(g = 0; g < config->groupCount; g++){
+		for(i = caps->usedProgrammable; i < HPC_MAX_PROGRAMMABLE; i++){
+			if(config->eventSel[g][i] != 0)
+				return HPC_CONFIG_NO_COUNTER;
+		}
+	}
+	return HPC_CONFIG_OK;
+}
+
+UINT64 PmuPreload(const PMU_CAPS *caps, const HPC_CONFIG *config, int counter){
+	if(counter == 0 && config->mode == HPC_MODE_SAMPLING)
+		return (UINT64)(INT64)config->pmiThreshold & caps->mask[0];
+	return 0;
+}
+
+/*
+* Start value of fixed counter 0 for a window of period instructions
+*/
+HPC_INLINE UINT64 WindowPreload(const PMU_CAPS *caps, UINT32 period){
+	return ((UINT64)0 - period) & caps->mask[0];
+}
+
+UINT64 PmuCounterValue(const PMU_CAPS *caps, const HPC_CONFIG *config, int counter, UINT64 value){
+	//wraps around at 2^width, so a counter read after its overflow yields the period plus the skid
+	return (value - PmuPreload(caps, config, counter)) & caps->mask[counter];
+}
+
+/*
+* Program the events of a group into the programmable counters of this CPU
+*/
+void PmuProgramGroup(const PMU_OPS *pmu, const HPC_CONFIG *config, PCPU_STATE cpu, UINT32 group){
+	UINT32 i;
+
+	for(i = 0; i < pmu->caps->usedProgrammable; i++)
+		pmu->write(pmu->context, MSR_PERFEVTSEL0 + i, config->eventSel[group][i]);
+	cpu->group = group;
+}
+
+/*
+* Load the counters with the values a run starts from
+*/
+static void ResetCounters(const PMU_OPS *pmu, const HPC_CONFIG *config, PCPU_STATE cpu){
+	const PMU_CAPS *caps = pmu->caps;
+	UINT32 i;
+
+	for(i = 0; i < HPC_NUM_COUNTERS; i++)
+		cpu->base[i] = PmuPreload(caps, config, i);
+	for(i = 0; i < caps->count; i++)
+		pmu->write(pmu->context, caps->counter[i].msr, cpu->base[caps->counter[i].column]);
+}
+
+void PmuStart(const PMU_OPS *pmu, const HPC_CONFIG *config, PCPU_STATE cpu){
+	if(config->freeze)
+		pmu->write(pmu->context, MSR_DEBUGCTL, pmu->read(pmu->context, MSR_DEBUGCTL) | PMU_DEBUGCTL_FREEZE);
+	pmu->write(pmu->context, MSR_FIXED_CTR_CTRL, PmuCapsFixedCtrl(pmu->caps, config->mode == HPC_MODE_SAMPLING));
+
+	//start with the first group and the mean period
+	cpu->period = config->mode == HPC_MODE_SAMPLING ? (UINT32)-config->pmiThreshold : 0;
+	cpu->seed = 0x9E3779B9u ^ cpu->number;
+	cpu->handlerCycles = 0;
+	PmuProgramGroup(pmu, config, cpu, 0);
+	ResetCounters(pmu, config, cpu);
+
+	pmu->write(pmu->context, MSR_PERF_GLOBAL_CTRL, pmu->caps->globalEnable);
+}
+
+void PmuStop(const PMU_OPS *pmu){
+	UINT64 debugCtl;
+
+	pmu->write(pmu->context, MSR_PERF_GLOBAL_CTRL, 0);		//no more PMIs
+	debugCtl = pmu->read(pmu->context, MSR_DEBUGCTL);
+	if(debugCtl & PMU_DEBUGCTL_FREEZE)
+		pmu->write(pmu->context, MSR_DEBUGCTL, debugCtl & ~PMU_DEBUGCTL_FREEZE);
+}
+
+void PmuReadCounters(const PMU_OPS *pmu, UINT64 *values){
+	const PMU_CAPS *caps = pmu->caps;
+	UINT32 i;
+
+	if(pmu->readCounters != NULL)
+		pmu->readCounters(pmu->context, values);
+	else{
+		for(i = 0; i < caps->count; i++)
+			values[caps->counter[i].column] = pmu->read(pmu->context, caps->counter[i].msr);
+	}
+	//the mask of a column without a counter is 0
+	for(i = 0; i < HPC_NUM_COUNTERS; i++)
+		values[i] &= caps->mask[i];
+}
+
+/*
+* A preloaded counter is saved as it is, so it overflows at the end of the window of its own period
+*/
+void PmuSaveWindow(const PMU_OPS *pmu, const HPC_CONFIG *config, PCPU_STATE cpu, UINT64 *values){
+	int i;
+
+	PmuReadCounters(pmu, values);
+	for(i = 0; i < HPC_NUM_COUNTERS; i++){
+		if(PmuPreload(pmu->caps, config, i) == 0)
+			values[i] = (values[i] - cpu->base[i]) & pmu->caps->mask[i];
+	}
+}
+
+/*
+* Only fixed counter 0 of the sampling mode is written, it decides when the next PMI comes;
+* for the others the window base is moved so that the counts since the base equal the saved ones.
+* With rdpmc=on the counters are written with the saved counts as well, since the thread reads
+* them itself: the counts of other threads are dropped and a thread that moved to another CPU
+* continues there. A write to IA32_PMCx only takes bits 0..31 and sign extends bit 31, so the
+* programmable counters continue modulo 2^31.
+*/
+void PmuRestoreWindow(const PMU_OPS *pmu, const HPC_CONFIG *config, PCPU_STATE cpu, const UINT64 *values){
+	const PMU_CAPS *caps = pmu->caps;
+	UINT64 raw[HPC_NUM_COUNTERS];
+	UINT32 column;
+	int i;
+
+	if(config->rdpmc){
+		for(i = 0; i < (int)caps->count; i++){
+			column = caps->counter[i].column;
+			pmu->write(pmu->context, caps->counter[i].msr, column >= HPC_COLUMN_PMC0 && column < HPC_COLUMN_FIXED3 ?
+				values[column] & PMU_PMC_WRITE_MASK : values[column]);
+		}
+	}
+	PmuReadCounters(pmu, raw);
+	for(i = 0; i < HPC_NUM_COUNTERS; i++){
+		if(PmuPreload(pmu->caps, config, i) != 0){
+			pmu->write(pmu->context, pmuCounterMsr[i], values[i]);
+			cpu->base[i] = PmuPreload(pmu->caps, config, i);
+		}else
+			cpu->base[i] = (raw[i] - values[i]) & pmu->caps->mask[i];
+	}
+}
+
+void PmuResumeWindow(const PMU_CAPS *caps, const HPC_CONFIG *config, PCPU_STATE cpu, UINT32 period){
+	if(config->mode != HPC_MODE_SAMPLING)
+		return;
+	cpu->period = period != 0 ? period : (UINT32)-config->pmiThreshold;
+	cpu->base[0] = WindowPreload(caps, cpu->period);
+}
+
+/*
+* Record counts as one sample into the ring of the CPU; ip and cs are those of the interrupted code
+*/
+static void RecordCounts(const PMU_OPS *pmu, PCPU_STATE cpu, const UINT64 *counts, UINT32 tid, UINT32 region, UINT32 depth, UINT32 ip, UINT32 cs){
+	PHPC_RECORD record;
+	int i;
+
+	record = SampleRingReserve(&cpu->ring);
+	if(record == NULL)
+		return;		//ring is full, the drop is counted by the ring
+
+	for(i = 0; i < HPC_NUM_COUNTERS; i++)
+		SampleRecordSetCounter(record, i, counts[i] & pmu->caps->mask[i]);
+	record->tsc = pmu->tsc(pmu->context);
+	record->tid = tid;
+	record->ip = ip;
+	SampleRecordSetGroup(record, cpu->group, cs);
+	record->region = depth != 0 ? region : cpu->period;
+	record->depth = (UINT8)depth;
+	SampleRingCommit(&cpu->ring);
+}
+
+/*
+* Record the counts of the current window
+*/
+static void RecordSample(const PMU_OPS *pmu, PCPU_STATE cpu, const UINT64 *raw, UINT32 tid, UINT32 ip, UINT32 cs){
+	UINT64 counts[HPC_NUM_COUNTERS];
+	int i;
+
+	//wraps around at 2^width, so fixed counter 0 read after its overflow yields the period plus the skid
+	for(i = 0; i < HPC_NUM_COUNTERS; i++)
+		counts[i] = raw[i] - cpu->base[i];
+	RecordCounts(pmu, cpu, counts, tid, 0, 0, ip, cs);
+}
+
+/*
+* Start the next window at the counter values just read; only a preloaded counter is written,
+* with the period of the next window
+*/
+static void NextWindow(const PMU_OPS *pmu, const HPC_CONFIG *config, PCPU_STATE cpu, const UINT64 *raw){
+	int i;
+
+	if(config->mode == HPC_MODE_SAMPLING && (config->jitter != 0 || config->target != 0 || config->budget != 0))
+		cpu->period = PeriodNext(config, cpu->period, (raw[2] - cpu->base[2]) & pmu->caps->mask[2], cpu->handlerCycles, &cpu->seed);
+	for(i = 0; i < HPC_NUM_COUNTERS; i++){
+		if(PmuPreload(pmu->caps, config, i) != 0){
+			cpu->base[i] = WindowPreload(pmu->caps, cpu->period);
+			pmu->write(pmu->context, pmuCounterMsr[i], cpu->base[i]);
+		}else
+			cpu->base[i] = raw[i];
+	}
+	if(cpu->thread != NULL)
+		cpu->thread->period = cpu->period;
+}
+
+/*
+* Overflow of fixed counter 0: record the window of the running test thread, rotate its
+* event group when it is due and start the next window
+*/
+void PmuHandlePmi(const PMU_OPS *pmu, const HPC_CONFIG *config, PCPU_STATE cpu, UINT32 ip, UINT32 cs){
+	UINT64 raw[HPC_NUM_COUNTERS], start, cycles;
+
+	start = pmu->tsc(pmu->context);
+
+	//the counters only count in user mode, so they stand still while the handler runs
+	PmuReadCounters(pmu, raw);
+	if(cpu->isTestThread){
+		RecordSample(pmu, cpu, raw, cpu->tid, ip, cs);
+
+		//the next window starts at the values just read, so it counts only the new group
+		if(cpu->thread != NULL && MuxNextGroup(&cpu->thread->group, &cpu->thread->pmis, config->groupCount, config->groupPeriod))
+			PmuProgramGroup(pmu, config, cpu, cpu->thread->group);
+	}
+
+	NextWindow(pmu, config, cpu, raw);
+
+	//clear the overflow flag of fixed counter 0 in IA32_PERF_GLOBAL_STATUS
+	pmu->write(pmu->context, MSR_PERF_GLOBAL_OVF_CTRL, PMU_STATUS_FIXED0);
+
+	//the PMI froze the counters by clearing IA32_PERF_GLOBAL_CTRL
+	if(config->freeze)
+		pmu->write(pmu->context, MSR_PERF_GLOBAL_CTRL, pmu->caps->globalEnable);
+
+	cycles = pmu->tsc(pmu->context) - start;
+	cpu->handlerCycles = (UINT32)cycles;
+	SelfRecord(&cpu->self.handler[SELF_PMI], cycles);
+}
+
+/*
+* Software interrupt of the polling mode: record the interval since the previous trap if asked to
+*/
+void PmuHandleTrap(const PMU_OPS *pmu, const HPC_CONFIG *config, PCPU_STATE cpu, int record, UINT32 tid, UINT32 ip, UINT32 cs){
+	UINT64 raw[HPC_NUM_COUNTERS], start;
+
+	start = pmu->tsc(pmu->context);
+	PmuReadCounters(pmu, raw);
+	if(record)
+		RecordSample(pmu, cpu, raw, tid, ip, cs);
+	NextWindow(pmu, config, cpu, raw);
+	SelfRecord(&cpu->self.handler[SELF_TRAP], pmu->tsc(pmu->context) - start);
+}
+
+/*
+* The window of a test thread is never reset by region traps, so its counts since the
+* window base grow over the whole life of the thread and a region is the difference
+* between its end and its begin; no MSR is written.
+*/
+void PmuHandleRegion(const PMU_OPS *pmu, PCPU_STATE cpu, PREGION_STACK stack, UINT32 marker){
+	UINT64 counts[HPC_NUM_COUNTERS], inclusive[HPC_NUM_COUNTERS], start;
+	UINT32 region = marker & HPC_REGION_ID_MASK, depth;
+	int i;
+
+	start = pmu->tsc(pmu->context);
+	PmuReadCounters(pmu, counts);
+	for(i = 0; i < HPC_NUM_COUNTERS; i++)
+		counts[i] = (counts[i] - cpu->base[i]) & pmu->caps->mask[i];
+
+	if(!(marker & HPC_REGION_END))
+		RegionBegin(stack, region, counts);
+	else{
+		depth = RegionEnd(stack, region, counts, inclusive);
+		if(depth != 0)
+			RecordCounts(pmu, cpu, inclusive, stack->tid, region, depth, 0, 0);
+	}
+	SelfRecord(&cpu->self.handler[SELF_TRAP], pmu->tsc(pmu->context) - start);
+}
+
+/*
+* The slot of the thread may be handed to a new thread by another CPU as soon as it is a
+* tombstone, while the PMIs of this CPU until the final switch-out of the thread would still
+* write its group, PMI count and period. So the CPU lets go of the context first; the driver
+* drops the last window of an exiting thread anyway.
+*/
+void PmuThreadExit(PCOUNTER_VIRT virt, PCPU_STATE cpu, UINT_PTR thread){
+	if(cpu->thread != NULL && cpu->thread->thread == thread){
+		cpu->isTestThread = 0;
+		cpu->thread = NULL;
+	}
+	CounterVirtThreadExit(virt, thread);
+}
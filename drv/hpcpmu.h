@@ -0,0 +1,113 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Counter logic of the PMI and trap handlers, written against a PMU interface.
+* The driver implements PMU_OPS with rdmsr/wrmsr/rdtsc; the tools implement it
+* with a simulated PMU (tools/simpmu.h), so the handlers can be benchmarked and
+* checked in user mode without a Windows kernel or an Intel PMU.
+*
+* The counters used and their widths come from CPUID (hpccaps.h), and the values read
+* are masked to the width of their counter: 48 bits on most cores, 40 on Core 2. In
+* the sampling mode fixed counter 0 (instructions retired) is preloaded with
+* 2^width - period, so it overflows and raises a PMI after period instructions; its
+* sample column holds the instructions counted since the preload, modulo 2^width.
+* The columns of counters the PMU does not have stay 0. The period is -pmiThreshold, or changes at every PMI when it
+* is jittered or adapted (hpcperiod.h); the CPU keeps the period of its current window.
+*
+* The other counters are never reset while counting: every CPU remembers the raw
+* counter values its current window started from, and a sample holds the difference.
+* A PMI thus reads all counters in one batch and writes only fixed counter 0 and
+* IA32_PERF_GLOBAL_OVF_CTRL; a trap of the polling mode writes no MSR at all. Only
+* with rdpmc=on a context switch writes the counters, so the thread that reads them in
+* user mode sees its own counts (PmuRestoreWindow).
+*
+* With freeze set, IA32_DEBUGCTL.FREEZE_PERFMON_ON_PMI makes the processor clear
+* IA32_PERF_GLOBAL_CTRL when the PMI is raised, so the instructions of the skid are not
+* counted and a window holds exactly one period of instructions; the PMI handler
+* enables the counters again when it is done.
+*/
+
+#ifndef HPCPMU_H
+#define HPCPMU_H
+
+#include "hpcring.h"
+#include "hpccaps.h"
+#include "hpcvirt.h"
+#include "hpcconf.h"
+#include "hpcregion.h"
+#include "hpcself.h"
+
+//IA32_PERF_GLOBAL_STATUS/OVF_CTRL bit of fixed counter 0
+#define PMU_STATUS_FIXED0			((UINT64)1 << 32)
+
+//IA32_DEBUGCTL.FREEZE_PERFMON_ON_PMI
+#define PMU_DEBUGCTL_FREEZE			((UINT64)1 << 12)
+
+//bits of a write to IA32_PMCx that reach the counter unchanged, bit 31 is sign extended
+#define PMU_PMC_WRITE_MASK			0x7FFFFFFF
+
+//MSR of every sample column, whether the PMU has the counter or not
+extern const UINT32 pmuCounterMsr[HPC_NUM_COUNTERS];
+
+typedef struct _PMU_OPS {
+	UINT64 (*read)(void *context, UINT32 msr);
+	void (*write)(void *context, UINT32 msr, UINT64 value);
+	void (*readCounters)(void *context, UINT64 *values);	//the columns of caps in one batch (rdpmc), NULL to read their MSRs
+	UINT64 (*tsc)(void *context);			//time stamp of samples
+	void *context;
+	const PMU_CAPS *caps;					//counters of the PMU
+} PMU_OPS, *PPMU_OPS;
+
+//state of the handlers of one CPU; only that CPU writes it, except for the ring tail written by the drain thread
+typedef struct _CPU_STATE {
+	SAMPLE_RING ring;					//filled by the PMI/trap handlers, emptied by the drain thread
+	HPC_ALIGN(HPC_CACHE_LINE) int isTestThread;	//the running thread belongs to a test process
+	PTHREAD_CONTEXT thread;				//context of the running test thread, NULL if it is not virtualized
+	UINT32 tid;							//thread id of the running test thread
+	UINT32 group;						//event group programmed into the IA32_PERFEVTSELx
+	UINT16 number;						//CPU number, seeds the jittered periods
+	UINT32 period;						//sampling period of the current window, 0 when polling
+	UINT32 seed;						//of the jittered periods
+	UINT32 handlerCycles;				//time stamp cycles of the last PMI handler
+	UINT64 base[HPC_NUM_COUNTERS];		//raw counter values the current window started from
+	SELF_STATS self;					//cost of the handlers on this CPU, zeroed by the driver at the start of a run
+} CPU_STATE, *PCPU_STATE;
+
+//HPC_CONFIG_OK if the PMU has the counters the configuration uses, else HPC_CONFIG_NO_PMU or HPC_CONFIG_NO_COUNTER
+int PmuCheckConfig(const PMU_CAPS *caps, const HPC_CONFIG *config);
+
+//counter value a run starts from: the threshold when sampling, 0 when polling
+UINT64 PmuPreload(const PMU_CAPS *caps, const HPC_CONFIG *config, int counter);
+
+//continue the saved window of a thread of the given period (THREAD_CONTEXT.period) after PmuRestoreWindow
+void PmuResumeWindow(const PMU_CAPS *caps, const HPC_CONFIG *config, PCPU_STATE cpu, UINT32 period);
+
+//sample column of a counter value saved at a context switch
+UINT64 PmuCounterValue(const PMU_CAPS *caps, const HPC_CONFIG *config, int counter, UINT64 value);
+
+//start and stop counting on the current CPU
+void PmuStart(const PMU_OPS *pmu, const HPC_CONFIG *config, PCPU_STATE cpu);
+void PmuStop(const PMU_OPS *pmu);
+
+void PmuProgramGroup(const PMU_OPS *pmu, const HPC_CONFIG *config, PCPU_STATE cpu, UINT32 group);
+
+//raw counter values of all columns, 0 for the columns without a counter
+void PmuReadCounters(const PMU_OPS *pmu, UINT64 *values);
+
+//counter values of the current window as if the counters had been reset at its start, i.e. the
+//preload plus the counts since; the COUNTER_OPS of the counter virtualization save and restore these
+void PmuSaveWindow(const PMU_OPS *pmu, const HPC_CONFIG *config, PCPU_STATE cpu, UINT64 *values);
+void PmuRestoreWindow(const PMU_OPS *pmu, const HPC_CONFIG *config, PCPU_STATE cpu, const UINT64 *values);
+
+//handlers; ip and cs are the EIP and CS of the interrupted code from the interrupt frame.
+//PmuHandleTrap records a sample if record is set, on behalf of thread tid
+void PmuHandlePmi(const PMU_OPS *pmu, const HPC_CONFIG *config, PCPU_STATE cpu, UINT32 ip, UINT32 cs);
+void PmuHandleTrap(const PMU_OPS *pmu, const HPC_CONFIG *config, PCPU_STATE cpu, int record, UINT32 tid, UINT32 ip, UINT32 cs);
+
+//region trap of the running test thread with the ecx of the trap; records a sample at the end of a region
+void PmuHandleRegion(const PMU_OPS *pmu, PCPU_STATE cpu, PREGION_STACK stack, UINT32 marker);
+
+//thread notify routine of an exiting thread, in its context and kept on its CPU: forgets its context
+void PmuThreadExit(PCOUNTER_VIRT virt, PCPU_STATE cpu, UINT_PTR thread);
+
+#endif
@@ -0,0 +1,94 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Portability layer shared by the kernel driver and the user-mode tools.
+* The driver build defines HPC_KERNEL (see drv/sources); the tools are built
+* either with the Windows SDK or with gcc on Linux (see tools/build.sh).
+*/
+
+#ifndef HPCPORT_H
+#define HPCPORT_H
+
+#if defined(HPC_KERNEL)
+	#include <ntifs.h>
+#elif defined(_WIN32)
+	#include <windows.h>
+	#include <string.h>
+#else
+	#include <stdint.h>
+	#include <stddef.h>
+	#include <string.h>
+	typedef int8_t		INT8;
+	typedef uint8_t		UINT8;
+	typedef int16_t		INT16;
+	typedef uint16_t	UINT16;
+	typedef int32_t		INT32;
+	typedef uint32_t	UINT32;
+	typedef int64_t		INT64;
+	typedef uint64_t	UINT64;
+	typedef uintptr_t	UINT_PTR;
+#endif
+
+#if defined(_MSC_VER)
+	#define HPC_INLINE		static __inline
+	#define HPC_ALIGN(n)	__declspec(align(n))
+#else
+	#define HPC_INLINE		static inline
+	#define HPC_ALIGN(n)	__attribute__((aligned(n)))
+#endif
+
+//size of a cache line, used to keep producer and consumer data apart
+#define HPC_CACHE_LINE 64
+
+/*
+* Load a 32-bit index published by another CPU (acquire semantics).
+* x86 does not reorder loads with other loads, so a compiler barrier is enough for MSVC.
+*/
+HPC_INLINE UINT32 HpcLoadAcquire(volatile UINT32 *addr){
+#if defined(_MSC_VER)
+	UINT32 val = *addr;
+	_ReadWriteBarrier();
+	return val;
+#else
+	return __atomic_load_n(addr, __ATOMIC_ACQUIRE);
+#endif
+}
+
+/*
+* Publish a 32-bit index to another CPU (release semantics).
+* x86 does not reorder stores with older stores, so a compiler barrier is enough for MSVC.
+*/
+HPC_INLINE void HpcStoreRelease(volatile UINT32 *addr, UINT32 val){
+#if defined(_MSC_VER)
+	_ReadWriteBarrier();
+	*addr = val;
+#else
+	__atomic_store_n(addr, val, __ATOMIC_RELEASE);
+#endif
+}
+
+/*
+* Keep the loads before the fence ahead of the loads after it, for readers that
+* re-check an index after copying the data it guards (hpclive.h).
+* x86 does not reorder loads with other loads, so a compiler barrier is enough for MSVC.
+*/
+HPC_INLINE void HpcLoadFence(void){
+#if defined(_MSC_VER)
+	_ReadWriteBarrier();
+#else
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+#endif
+}
+
+/*
+* Atomically replace *addr by desired if it equals expected; returns the previous value
+*/
+HPC_INLINE UINT_PTR HpcCompareExchangePtr(volatile UINT_PTR *addr, UINT_PTR expected, UINT_PTR desired){
+#if defined(_MSC_VER)
+	return (UINT_PTR)InterlockedCompareExchangePointer((PVOID volatile *)addr, (PVOID)desired, (PVOID)expected);
+#else
+	return __sync_val_compare_and_swap(addr, expected, desired);
+#endif
+}
+
+#endif
@@ -0,0 +1,56 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Per-thread region stacks, see hpcregion.h.
+*/
+
+#include "hpcregion.h"
+
+void RegionStackInit(PREGION_STACK stack, UINT32 tid){
+	stack->tid = tid;
+	stack->depth = 0;
+	stack->overflows = 0;
+	stack->mismatches = 0;
+}
+
+void RegionBegin(PREGION_STACK stack, UINT32 region, const UINT64 *counts){
+	PREGION_FRAME frame;
+	int i;
+
+	if(stack->depth >= HPC_REGION_DEPTH){
+		stack->depth++;
+		stack->overflows++;
+		return;
+	}
+	frame = &stack->frames[stack->depth++];
+	frame->region = region;
+	for(i = 0; i < HPC_NUM_COUNTERS; i++)
+		frame->start[i] = counts[i];
+}
+
+UINT32 RegionEnd(PREGION_STACK stack, UINT32 region, const UINT64 *counts, UINT64 *inclusive){
+	PREGION_FRAME frame;
+	UINT32 depth;
+	int i;
+
+	//the end of a region that did not fit on the stack
+	if(stack->depth > HPC_REGION_DEPTH){
+		stack->depth--;
+		return 0;
+	}
+
+	//innermost open region with this id; the ones above it lost their end, e.g. to an early return
+	for(depth = stack->depth; depth > 0 && stack->frames[depth - 1].region != region; depth--)
+		;
+	if(depth == 0){
+		stack->mismatches++;
+		return 0;
+	}
+	stack->mismatches += stack->depth - depth;
+	stack->depth = depth - 1;
+
+	frame = &stack->frames[depth - 1];
+	for(i = 0; i < HPC_NUM_COUNTERS; i++)
+		inclusive[i] = counts[i] - frame->start[i];
+	return depth;
+}
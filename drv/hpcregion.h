@@ -0,0 +1,57 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Named, nested measurement regions of the polling mode.
+* A test program marks the begin and the end of a region with an "int 2e" that
+* carries HPC_REGION_MAGIC in ebx and the region id, with HPC_REGION_END set for
+* the end, in ecx (eax still holds the system service number, so the system call
+* goes through as before). Every thread has a stack of open regions; a begin pushes
+* the counts of the thread, the matching end pops them and records the counts in
+* between as one sample, with the region id and the nesting depth (1 for an outermost
+* region). These counts include the regions nested in it; the exclusive counts are
+* the inclusive counts minus those of the children, which end before their parent on
+* the same thread, so the analysis (tools/regionsum.c) derives them from the order of
+* the samples of a thread.
+*/
+
+#ifndef HPCREGION_H
+#define HPCREGION_H
+
+#include "hpcring.h"
+
+//ebx of a region trap; traps without it are the begin/end traps of the original driver
+#define HPC_REGION_MAGIC	0x52435048		//"HPCR"
+
+//ecx of a region trap: the region id in bits 0-30, bit 31 set for the end of the region
+#define HPC_REGION_END		0x80000000u
+#define HPC_REGION_ID_MASK	0x7FFFFFFFu
+
+//open regions per thread; deeper regions are not measured but their begin/end pairs are kept
+#define HPC_REGION_DEPTH	16
+
+typedef struct _REGION_FRAME {
+	UINT32 region;
+	UINT64 start[HPC_NUM_COUNTERS];		//counts of the thread at the begin of the region
+} REGION_FRAME, *PREGION_FRAME;
+
+typedef struct _REGION_STACK {
+	UINT32 tid;							//owner; a stack found with another tid belongs to an exited thread
+	UINT32 depth;						//open regions, including those beyond HPC_REGION_DEPTH
+	UINT32 overflows;					//regions not measured because the stack was full
+	UINT32 mismatches;					//ends without their begin, and regions closed by the end of an outer one
+	REGION_FRAME frames[HPC_REGION_DEPTH];
+} REGION_STACK, *PREGION_STACK;
+
+void RegionStackInit(PREGION_STACK stack, UINT32 tid);
+
+//begin of region with the current counts of the thread
+void RegionBegin(PREGION_STACK stack, UINT32 region, const UINT64 *counts);
+
+/*
+* End of region with the current counts of the thread. Returns its depth and fills the counts
+* since its begin if it is to be recorded, 0 otherwise. Regions still open inside it are closed
+* without a sample.
+*/
+UINT32 RegionEnd(PREGION_STACK stack, UINT32 region, const UINT64 *counts, UINT64 *inclusive);
+
+#endif
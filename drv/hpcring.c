@@ -0,0 +1,76 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Single-producer/single-consumer sample ring, see hpcring.h.
+*/
+
+#include "hpcring.h"
+
+/*
+* Initialize a ring over caller-provided storage; capacity must be a power of two.
+*/
+void SampleRingInit(PSAMPLE_RING ring, PHPC_RECORD slots, UINT32 capacity){
+	ring->head = 0;
+	ring->dropped = 0;
+	ring->tail = 0;
+	ring->mask = capacity - 1;
+	ring->slots = slots;
+	ring->published = NULL;
+}
+
+/*
+* Let SampleRingCommit also store the head where observers read it, see hpclive.h.
+* Call before the producer starts.
+*/
+void SampleRingPublish(PSAMPLE_RING ring, volatile UINT32 *published){
+	ring->published = published;
+	HpcStoreRelease(published, ring->head);
+}
+
+/*
+* Get the next free slot, or NULL (and count a drop) if the ring is full.
+* The slot becomes visible to the consumer only after SampleRingCommit.
+*/
+PHPC_RECORD SampleRingReserve(PSAMPLE_RING ring){
+	UINT32 head = ring->head;
+
+	if(head - HpcLoadAcquire(&ring->tail) > ring->mask){
+		ring->dropped++;
+		return NULL;
+	}
+	return &ring->slots[head & ring->mask];
+}
+
+/*
+* Publish the slot returned by the last SampleRingReserve.
+*/
+void SampleRingCommit(PSAMPLE_RING ring){
+	UINT32 head = ring->head + 1;
+
+	HpcStoreRelease(&ring->head, head);
+	if(ring->published != NULL)
+		HpcStoreRelease(ring->published, head);
+}
+
+/*
+* Get the oldest unread samples without copying them.
+* Returns how many samples are readable contiguously from *first (0 if the ring is empty);
+* call again after SampleRingRelease to get the part that wrapped around.
+*/
+UINT32 SampleRingPeek(PSAMPLE_RING ring, PHPC_RECORD *first){
+	UINT32 tail = ring->tail;
+	UINT32 avail = HpcLoadAcquire(&ring->head) - tail;
+	UINT32 index = tail & ring->mask;
+
+	if(avail > ring->mask + 1 - index)
+		avail = ring->mask + 1 - index;
+	*first = &ring->slots[index];
+	return avail;
+}
+
+/*
+* Hand back samples obtained from SampleRingPeek to the producer.
+*/
+void SampleRingRelease(PSAMPLE_RING ring, UINT32 count){
+	HpcStoreRelease(&ring->tail, ring->tail + count);
+}
@@ -0,0 +1,150 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Single-producer/single-consumer ring of HPC samples.
+* The driver keeps one ring per CPU: the PMI/trap handler of that CPU is the
+* only producer and the passive-level drain thread is the only consumer, so
+* no lock is needed and the producer never blocks. When a ring is full the
+* sample is dropped and counted instead of overwriting unread data.
+*
+* A slot is one HPC_RECORD of two cache lines. The counters are stored with 48 bits,
+* split into a low and a high part; they hold the counts of a window, which fit in
+* 48 bits whatever the width of the counters is. Consumers unpack records into HPC_SAMPLE. A window has no
+* region and a region no period, so both share one field of the record. The CPU is
+* that of the ring and not stored, and the event group shares a byte with the
+* privilege level of the interrupted code.
+*/
+
+#ifndef HPCRING_H
+#define HPCRING_H
+
+#include "hpcport.h"
+
+//counters a sample can hold; a PMU may have fewer, see hpccaps.h
+#define HPC_MAX_FIXED			4
+#define HPC_MAX_PROGRAMMABLE	8
+
+//columns of a sample: fixed counters 0-2, PMC0-7, fixed counter 3, so the first seven
+//columns are those of the original driver (3 fixed + 4 programmable counters)
+#define HPC_NUM_COUNTERS		(HPC_MAX_FIXED + HPC_MAX_PROGRAMMABLE)
+#define HPC_COLUMN_PMC0			3
+#define HPC_COLUMN_FIXED3		(HPC_COLUMN_PMC0 + HPC_MAX_PROGRAMMABLE)
+
+//column names of the CSV files, as written by hpcdump
+#define HPC_COLUMN_NAMES { "ins", "l_cycle", "ref_cycle", "event1", "event2", "event3", "event4", \
+	"event5", "event6", "event7", "event8", "slots" }
+
+//columns of the original driver, which the CSV files always have
+#define HPC_BASE_COLUMNS		0x7F
+
+//number of event groups the programmable counters can be multiplexed over, see hpcmux.h
+#define HPC_MAX_GROUPS 8
+
+//privilege level of the interrupted code in HPC_RECORD.group
+#define HPC_RECORD_CPL_SHIFT 6
+#define HPC_RECORD_GROUP_MASK 0x3F
+
+//default number of samples per ring, must be a power of two
+#define SAMPLE_RING_CAPACITY 16384
+
+typedef struct _HPC_SAMPLE {
+	UINT64 ctr[HPC_NUM_COUNTERS];	//ins, l_cycle, ref_cycle, PMC0-7, slots; 0 for counters the PMU lacks
+	UINT64 tsc;						//time stamp counter when the sample was taken
+	UINT32 tid;						//thread the counts belong to
+	UINT16 cpu;						//CPU that took the sample
+	UINT16 group;					//event group the programmable counters counted
+	UINT32 region;					//region of the polling mode the counts belong to, 0 for none, see hpcregion.h
+	UINT16 depth;					//nesting depth of the region, 1 for an outermost region
+	UINT32 period;					//sampling period of the window, 0 in the polling mode and for regions, see hpcperiod.h
+	UINT64 ip;						//instruction pointer of the interrupted code (the PMI or trap), 0 for regions and totals
+	UINT16 cpl;						//privilege level of the interrupted code, the low bits of its CS: 0 kernel, 3 user
+} HPC_SAMPLE, *PHPC_SAMPLE;
+
+//a sample as stored in a ring slot: two cache lines
+typedef struct _HPC_RECORD {
+	HPC_ALIGN(HPC_CACHE_LINE) UINT64 tsc;
+	UINT32 tid;
+	UINT32 region;						//the region if depth is not 0, else the sampling period
+	UINT32 ip;							//EIP of the interrupted code
+	UINT32 ctrLow[HPC_NUM_COUNTERS];	//bits 0-31 of the counters
+	UINT16 ctrHigh[HPC_NUM_COUNTERS];	//bits 32-47 of the counters
+	UINT8 group;						//event group, CS & 3 of the interrupted code in the top bits
+	UINT8 depth;
+} HPC_RECORD, *PHPC_RECORD;
+
+//fails to compile if a record does not fill exactly two cache lines
+typedef char HPC_RECORD_SIZE_CHECK[sizeof(HPC_RECORD) == 2 * HPC_CACHE_LINE ? 1 : -1];
+
+/*
+* Sample column of fixed counter i
+*/
+HPC_INLINE int HpcFixedColumn(int i){
+	return i < 3 ? i : HPC_COLUMN_FIXED3 + i - 3;
+}
+
+typedef struct _SAMPLE_RING {
+	//written by the producer only
+	volatile UINT32 head;			//free-running count of committed samples
+	volatile UINT32 dropped;		//samples lost because the ring was full
+	UINT8 pad0[HPC_CACHE_LINE - 2 * sizeof(UINT32)];
+
+	//written by the consumer only
+	volatile UINT32 tail;			//free-running count of released samples
+	UINT8 pad1[HPC_CACHE_LINE - sizeof(UINT32)];
+
+	//read-only after SampleRingInit
+	UINT32 mask;
+	PHPC_RECORD slots;
+	volatile UINT32 *published;		//copy of head for observers, NULL for none, see hpclive.h
+} SAMPLE_RING, *PSAMPLE_RING;
+
+/*
+* Store a 48-bit counter value into a record
+*/
+HPC_INLINE void SampleRecordSetCounter(PHPC_RECORD record, int i, UINT64 value){
+	record->ctrLow[i] = (UINT32)value;
+	record->ctrHigh[i] = (UINT16)(value >> 32);
+}
+
+HPC_INLINE UINT64 SampleRecordCounter(const HPC_RECORD *record, int i){
+	return ((UINT64)record->ctrHigh[i] << 32) | record->ctrLow[i];
+}
+
+/*
+* Event group and privilege level (cs & 3) of a record
+*/
+HPC_INLINE void SampleRecordSetGroup(PHPC_RECORD record, UINT32 group, UINT32 cs){
+	record->group = (UINT8)((group & HPC_RECORD_GROUP_MASK) | ((cs & 3) << HPC_RECORD_CPL_SHIFT));
+}
+
+/*
+* Copy a record out of the ring of a CPU into a sample
+*/
+HPC_INLINE void SampleRecordUnpack(const HPC_RECORD *record, UINT16 cpu, PHPC_SAMPLE sample){
+	int i;
+
+	for(i = 0; i < HPC_NUM_COUNTERS; i++)
+		sample->ctr[i] = SampleRecordCounter(record, i);
+	sample->tsc = record->tsc;
+	sample->tid = record->tid;
+	sample->cpu = cpu;
+	sample->group = record->group & HPC_RECORD_GROUP_MASK;
+	sample->region = record->depth != 0 ? record->region : 0;
+	sample->period = record->depth != 0 ? 0 : record->region;
+	sample->depth = record->depth;
+	sample->ip = record->ip;
+	sample->cpl = record->group >> HPC_RECORD_CPL_SHIFT;
+}
+
+void SampleRingInit(PSAMPLE_RING ring, PHPC_RECORD slots, UINT32 capacity);
+void SampleRingPublish(PSAMPLE_RING ring, volatile UINT32 *published);
+
+//producer side
+PHPC_RECORD SampleRingReserve(PSAMPLE_RING ring);
+void SampleRingCommit(PSAMPLE_RING ring);
+
+//consumer side
+UINT32 SampleRingPeek(PSAMPLE_RING ring, PHPC_RECORD *first);
+void SampleRingRelease(PSAMPLE_RING ring, UINT32 count);
+
+#endif
@@ -0,0 +1,120 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Self-instrumentation of the collector: what its handlers take from the system. Every
+* CPU times its PMI handler, its trap handler and the SwapContext hook with the time
+* stamp counter and keeps per handler the calls, their total and largest cost and a
+* histogram of the costs; the SwapContext hook also counts the switches that involved a
+* test process. The histogram is exact below SELF_SUB_BUCKETS cycles, then every power
+* of two is split into SELF_SUB_BUCKETS buckets up to 2^SELF_VALUE_BITS cycles, like the
+* sketch of hpcstats.h but coarser, so a quantile is within 1/8 of its value. Only
+* integers are used and only the CPU itself writes its counts, so the handlers update
+* them at any IRQL without locks. The driver sums the CPUs into IOCTL_HPC_QUERY_STATUS
+* and into the header of the output file (SAMPLE_LOG_HEADER.self), so every dataset
+* carries the perturbation of its own collection.
+*/
+
+#ifndef HPCSELF_H
+#define HPCSELF_H
+
+#include "hpcring.h"
+
+//handlers
+#define SELF_PMI			0		//HookPMI
+#define SELF_TRAP			1		//HookTrap: start/stop and region traps of test threads
+#define SELF_SWITCH			2		//SwapContext hook, every context switch
+#define SELF_HANDLERS		3
+
+#define SELF_SUB_BITS		2
+#define SELF_SUB_BUCKETS	(1 << SELF_SUB_BITS)
+#define SELF_VALUE_BITS		24		//costs from 2^24 cycles on share the last bucket
+#define SELF_BUCKETS		((SELF_VALUE_BITS - SELF_SUB_BITS + 1) * SELF_SUB_BUCKETS)
+
+typedef struct _SELF_HANDLER {
+	UINT64 calls;
+	UINT64 cycles;						//time stamp cycles of all calls
+	UINT64 max;
+	UINT64 buckets[SELF_BUCKETS];
+} SELF_HANDLER, *PSELF_HANDLER;
+
+typedef struct _SELF_STATS {
+	UINT64 runCycles;					//time stamp cycles from the start of the run to its end, or to the query
+	UINT64 matched;						//context switches from or to a thread of a test process
+	UINT64 dropped;						//samples lost to full rings
+	SELF_HANDLER handler[SELF_HANDLERS];
+} SELF_STATS, *PSELF_STATS;
+
+HPC_INLINE UINT32 SelfBucket(UINT64 cycles){
+	UINT32 msb = SELF_SUB_BITS, shift;
+
+	if(cycles < SELF_SUB_BUCKETS)
+		return (UINT32)cycles;
+	if(cycles >> SELF_VALUE_BITS)
+		return SELF_BUCKETS - 1;
+	while(cycles >> (msb + 1))
+		msb++;
+	shift = msb - SELF_SUB_BITS;
+	return (shift + 1) * SELF_SUB_BUCKETS + (UINT32)((cycles >> shift) & (SELF_SUB_BUCKETS - 1));
+}
+
+//the costs of a bucket are low .. low + width - 1
+HPC_INLINE void SelfBucketRange(UINT32 bucket, UINT64 *low, UINT64 *width){
+	UINT32 shift;
+
+	if(bucket < SELF_SUB_BUCKETS){
+		*low = bucket;
+		*width = 1;
+		return;
+	}
+	shift = bucket / SELF_SUB_BUCKETS - 1;
+	*low = (UINT64)(SELF_SUB_BUCKETS + bucket % SELF_SUB_BUCKETS) << shift;
+	*width = (UINT64)1 << shift;
+}
+
+//one call of a handler that took cycles
+HPC_INLINE void SelfRecord(PSELF_HANDLER handler, UINT64 cycles){
+	handler->calls++;
+	handler->cycles += cycles;
+	if(cycles > handler->max)
+		handler->max = cycles;
+	handler->buckets[SelfBucket(cycles)]++;
+}
+
+//add the counts of a CPU; the run cycles are the same for all CPUs
+HPC_INLINE void SelfMerge(PSELF_STATS into, const SELF_STATS *from){
+	UINT32 h, i;
+
+	into->matched += from->matched;
+	into->dropped += from->dropped;
+	if(from->runCycles > into->runCycles)
+		into->runCycles = from->runCycles;
+	for(h = 0; h < SELF_HANDLERS; h++){
+		into->handler[h].calls += from->handler[h].calls;
+		into->handler[h].cycles += from->handler[h].cycles;
+		if(from->handler[h].max > into->handler[h].max)
+			into->handler[h].max = from->handler[h].max;
+		for(i = 0; i < SELF_BUCKETS; i++)
+			into->handler[h].buckets[i] += from->handler[h].buckets[i];
+	}
+}
+
+/*
+* Cost of the call of rank perMille / 1000 * (calls - 1): the middle of its bucket, at most the largest cost
+*/
+HPC_INLINE UINT64 SelfQuantile(const SELF_HANDLER *handler, UINT32 perMille){
+	UINT64 rank, seen = 0, low, width;
+	UINT32 i;
+
+	if(handler->calls == 0)
+		return 0;
+	rank = (handler->calls - 1) * perMille / 1000;
+	for(i = 0; i < SELF_BUCKETS - 1; i++){
+		seen += handler->buckets[i];
+		if(seen > rank)
+			break;
+	}
+	SelfBucketRange(i, &low, &width);
+	return low + width / 2 < handler->max ? low + width / 2 : handler->max;
+}
+
+#endif
@@ -0,0 +1,200 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Online aggregation of samples, see hpcstats.h.
+* Uses no C library beyond string.h, so it links into the driver as is.
+*/
+
+#include "hpcstats.h"
+
+UINT32 StatBucket(UINT64 value){
+	UINT32 msb = STAT_SUB_BITS, shift;
+
+	if(value < STAT_SUB_BUCKETS)
+		return (UINT32)value;
+	if(value >> STAT_VALUE_BITS)
+		return STAT_BUCKETS - 1;
+	while(value >> (msb + 1))
+		msb++;
+	shift = msb - STAT_SUB_BITS;
+	return (shift + 1) * STAT_SUB_BUCKETS + (UINT32)((value >> shift) & (STAT_SUB_BUCKETS - 1));
+}
+
+void StatBucketRange(UINT32 bucket, UINT64 *low, UINT64 *width){
+	UINT32 shift;
+
+	if(bucket < STAT_SUB_BUCKETS){
+		*low = bucket;
+		*width = 1;
+		return;
+	}
+	shift = bucket / STAT_SUB_BUCKETS - 1;
+	*low = (UINT64)(STAT_SUB_BUCKETS + bucket % STAT_SUB_BUCKETS) << shift;
+	*width = (UINT64)1 << shift;
+}
+
+void StatInit(PSTAT_METRIC metric){
+	memset(metric, 0, sizeof(*metric));
+	metric->min = ~(UINT64)0;
+}
+
+void StatAdd(PSTAT_METRIC metric, UINT64 value){
+	double delta = (double)value - metric->mean;
+
+	metric->count++;
+	metric->mean += delta / (double)metric->count;
+	metric->m2 += delta * ((double)value - metric->mean);
+	if(value < metric->min)
+		metric->min = value;
+	if(value > metric->max)
+		metric->max = value;
+	metric->buckets[StatBucket(value)]++;
+}
+
+/*
+* Combine the mean and variance of two sets of values (Chan et al.)
+*/
+void StatMerge(PSTAT_METRIC into, const STAT_METRIC *from){
+	double delta, count;
+	UINT32 i;
+
+	if(from->count == 0)
+		return;
+	count = (double)into->count + (double)from->count;
+	delta = from->mean - into->mean;
+	into->m2 += from->m2 + delta * delta * (double)into->count * (double)from->count / count;
+	into->mean += delta * (double)from->count / count;
+	into->count += from->count;
+	if(from->min < into->min)
+		into->min = from->min;
+	if(from->max > into->max)
+		into->max = from->max;
+	for(i = 0; i < STAT_BUCKETS; i++)
+		into->buckets[i] += from->buckets[i];
+}
+
+double StatVariance(const STAT_METRIC *metric){
+	return metric->count > 1 ? metric->m2 / (double)(metric->count - 1) : 0;
+}
+
+/*
+* The value of rank q * (count - 1) is in the first bucket whose cumulative count exceeds
+* the rank; the middle of that bucket is within half a bucket of it, and the bounds are exact
+*/
+UINT64 StatQuantile(const STAT_METRIC *metric, double q){
+	UINT64 rank, seen = 0, low, width, value;
+	UINT32 i;
+
+	if(metric->count == 0)
+		return 0;
+	if(q <= 0)
+		return metric->min;
+	if(q >= 1)
+		return metric->max;
+	rank = (UINT64)(q * (double)(metric->count - 1));
+	for(i = 0; i < STAT_BUCKETS - 1; i++){
+		seen += metric->buckets[i];
+		if(seen > rank)
+			break;
+	}
+	StatBucketRange(i, &low, &width);
+	value = low + width / 2;
+	if(value < metric->min)
+		return metric->min;
+	if(value > metric->max)
+		return metric->max;
+	return value;
+}
+
+UINT32 StatsSize(UINT32 groupCount){
+	return sizeof(SAMPLE_STATS) + groupCount * STAT_METRICS * sizeof(STAT_METRIC);
+}
+
+PSTAT_METRIC StatsMetric(PSAMPLE_STATS stats, UINT32 group, UINT32 metric){
+	return (PSTAT_METRIC)((UINT8 *)stats + stats->headerSize) + group * STAT_METRICS + metric;
+}
+
+void StatsInit(PSAMPLE_STATS stats, const SAMPLE_LOG_HEADER *log){
+	UINT32 g, i, evt;
+
+	memset(stats, 0, sizeof(*stats));
+	memcpy(stats->magic, SAMPLE_STATS_MAGIC, sizeof(SAMPLE_STATS_MAGIC));
+	stats->headerSize = sizeof(*stats);
+	stats->version = SAMPLE_STATS_VERSION;
+	stats->metricSize = sizeof(STAT_METRIC);
+	stats->metricCount = STAT_METRICS;
+	stats->log = *log;
+	stats->log.samples = 0;
+	stats->log.dropped = 0;
+	stats->groupCount = log->groupCount >= 1 && log->groupCount <= HPC_MAX_GROUPS ? log->groupCount : 1;
+	stats->log.groupCount = stats->groupCount;
+	stats->ipc = !(log->flags & SAMPLE_LOG_FLAG_SOFTWARE);
+
+	//the LLC miss rate needs both events in the same group
+	for(g = 0; g < stats->groupCount; g++){
+		for(i = 0; i < HPC_MAX_PROGRAMMABLE; i++){
+			evt = log->groupEventSel[g][i] & STAT_EVENT_MASK;
+			if(evt == STAT_EVENT_LLC_REF)
+				stats->llcRef[g] = HPC_COLUMN_PMC0 + i;
+			else if(evt == STAT_EVENT_LLC_MISS)
+				stats->llcMiss[g] = HPC_COLUMN_PMC0 + i;
+		}
+		for(i = 0; i < STAT_METRICS; i++)
+			StatInit(StatsMetric(stats, g, i));
+	}
+}
+
+/*
+* Fixed point ratio; numerators of more than 47 bits lose the low bits of the quotient instead of overflowing
+*/
+HPC_INLINE UINT64 StatRatio(UINT64 num, UINT64 den){
+	if(num < ((UINT64)1 << 47))
+		return num * STAT_RATIO_SCALE / den;
+	return num / den * STAT_RATIO_SCALE;
+}
+
+void StatsAddSample(PSAMPLE_STATS stats, const HPC_SAMPLE *sample){
+	UINT32 group = sample->group < stats->groupCount ? sample->group : 0, ref, miss, i;
+
+	for(i = 0; i < HPC_NUM_COUNTERS; i++)
+		StatAdd(StatsMetric(stats, group, i), sample->ctr[i]);
+	if(stats->ipc && sample->ctr[1] != 0)
+		StatAdd(StatsMetric(stats, group, STAT_IPC), StatRatio(sample->ctr[0], sample->ctr[1]));
+	ref = stats->llcRef[group];
+	miss = stats->llcMiss[group];
+	if(ref != 0 && miss != 0 && sample->ctr[ref] != 0)
+		StatAdd(StatsMetric(stats, group, STAT_LLC_MISS_RATE), StatRatio(sample->ctr[miss], sample->ctr[ref]));
+	stats->log.samples++;
+}
+
+int StatsMerge(PSAMPLE_STATS into, const SAMPLE_STATS *from){
+	UINT64 runCycles;
+	UINT32 g, i;
+
+	if(into->groupCount != from->groupCount
+		|| memcmp(into->log.groupEventSel, from->log.groupEventSel, sizeof(into->log.groupEventSel)) != 0)
+		return -1;
+	for(g = 0; g < into->groupCount; g++){
+		for(i = 0; i < STAT_METRICS; i++)
+			StatMerge(StatsMetric(into, g, i), StatsMetric((PSAMPLE_STATS)from, g, i));
+	}
+	into->log.samples += from->log.samples;
+	into->log.dropped += from->log.dropped;
+
+	//the runs follow each other, their handlers ran in the sum of their run cycles
+	runCycles = into->log.self.runCycles + from->log.self.runCycles;
+	SelfMerge(&into->log.self, &from->log.self);
+	into->log.self.runCycles = runCycles;
+	return 0;
+}
+
+int StatsCheck(const SAMPLE_STATS *stats, UINT32 len){
+	if(len < sizeof(*stats) || memcmp(stats->magic, SAMPLE_STATS_MAGIC, sizeof(SAMPLE_STATS_MAGIC)) != 0)
+		return -1;
+	if(stats->version != SAMPLE_STATS_VERSION || stats->headerSize != sizeof(*stats)
+		|| stats->metricSize != sizeof(STAT_METRIC) || stats->metricCount != STAT_METRICS)
+		return -1;
+	if(stats->groupCount < 1 || stats->groupCount > HPC_MAX_GROUPS || len < StatsSize(stats->groupCount))
+		return -1;
+	return 0;
+}
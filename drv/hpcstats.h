@@ -0,0 +1,101 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Online aggregation of samples into distributions, for runs too long to keep every sample.
+* Every counter column and two derived ratios, the IPC and the LLC miss rate, of every event
+* group get a STAT_METRIC: the count, min and max, the running mean and variance (Welford)
+* and a quantile sketch. The sketch is a DDSketch with the linearly interpolated mapping:
+* values below STAT_SUB_BUCKETS have a bucket each, every larger power of two is split into
+* STAT_SUB_BUCKETS equal buckets, so a quantile is off by at most 1/(2*STAT_SUB_BUCKETS) of
+* its value. The buckets cover the 48 bits of the counters, the memory does not grow with the
+* run and sketches of the same metric merge by adding their buckets. Ratios are fixed point
+* numbers with STAT_RATIO_SCALE as one.
+*
+* A stats image is a SAMPLE_STATS followed by the groupCount * STAT_METRICS metrics, group by
+* group. The driver dumps it into the output file instead of a sample log (output=stats), and
+* returns a snapshot for IOCTL_HPC_QUERY_STATS; tools/hpcstats prints and merges images.
+* Only the adding of samples runs in the driver, there at passive level with the floating
+* point state saved. All fields are little endian.
+*/
+
+#ifndef HPCSTATS_H
+#define HPCSTATS_H
+
+#include "hpclog.h"
+
+#define SAMPLE_STATS_MAGIC		"HPCSTAT"
+#define SAMPLE_STATS_VERSION	3
+
+//sketch buckets: exact below STAT_SUB_BUCKETS, then STAT_SUB_BUCKETS per power of two up to 2^STAT_VALUE_BITS
+#define STAT_SUB_BITS		5
+#define STAT_SUB_BUCKETS	(1 << STAT_SUB_BITS)
+#define STAT_VALUE_BITS		48
+#define STAT_BUCKETS		((STAT_VALUE_BITS - STAT_SUB_BITS + 1) * STAT_SUB_BUCKETS)
+
+//metrics of a group: the counter columns, then the ratios
+#define STAT_IPC			HPC_NUM_COUNTERS			//ins / l_cycle
+#define STAT_LLC_MISS_RATE	(HPC_NUM_COUNTERS + 1)		//LLC misses / LLC references, if the group counts both
+#define STAT_METRICS		(HPC_NUM_COUNTERS + 2)
+
+#define STAT_RATIO_SCALE	65536
+
+//architectural LLC events (event 0x2E), matched on the event and umask bits of IA32_PERFEVTSELx
+#define STAT_EVENT_MASK		0xFFFF
+#define STAT_EVENT_LLC_REF	0x4F2E
+#define STAT_EVENT_LLC_MISS	0x412E
+
+typedef struct _STAT_METRIC {
+	UINT64 count;
+	UINT64 min;
+	UINT64 max;
+	double mean;
+	double m2;							//sum of the squared differences from the mean
+	UINT64 buckets[STAT_BUCKETS];
+} STAT_METRIC, *PSTAT_METRIC;
+
+typedef struct _SAMPLE_STATS {
+	char magic[8];						//SAMPLE_STATS_MAGIC
+	UINT32 headerSize;					//sizeof(SAMPLE_STATS) of the writer, the metrics start there
+	UINT32 version;
+	UINT32 metricSize;					//sizeof(STAT_METRIC)
+	UINT32 metricCount;					//STAT_METRICS
+	UINT32 groupCount;					//groups of metrics following the header, log.groupCount
+	UINT32 llcRef[HPC_MAX_GROUPS];		//counter column of the LLC references of each group, 0 if not counted
+	UINT32 llcMiss[HPC_MAX_GROUPS];		//counter column of the LLC misses of each group, 0 if not counted
+	UINT32 ipc;							//1 if columns 0 and 1 count instructions and cycles, 0 for the software events of hpcrun
+	SAMPLE_LOG_HEADER log;				//the experiment as in a sample log; samples counts the aggregated samples
+} SAMPLE_STATS, *PSAMPLE_STATS;
+
+//bytes of a stats image of groupCount groups
+UINT32 StatsSize(UINT32 groupCount);
+
+//start an empty image for the experiment of a log header; stats is StatsSize(log->groupCount) bytes
+void StatsInit(PSAMPLE_STATS stats, const SAMPLE_LOG_HEADER *log);
+
+//metric of a group of an image
+PSTAT_METRIC StatsMetric(PSAMPLE_STATS stats, UINT32 group, UINT32 metric);
+
+//add one sample to the metrics of its group
+void StatsAddSample(PSAMPLE_STATS stats, const HPC_SAMPLE *sample);
+
+//add the metrics of an image of the same events into another; returns -1 if their groups differ
+int StatsMerge(PSAMPLE_STATS into, const SAMPLE_STATS *from);
+
+//check an image read from a file or a device of len bytes; returns 0 if it can be used
+int StatsCheck(const SAMPLE_STATS *stats, UINT32 len);
+
+void StatInit(PSTAT_METRIC metric);
+void StatAdd(PSTAT_METRIC metric, UINT64 value);
+void StatMerge(PSTAT_METRIC into, const STAT_METRIC *from);
+
+//variance of the values added, 0 below two values
+double StatVariance(const STAT_METRIC *metric);
+
+//value at quantile q (0..1) within the accuracy of the sketch, 0 for an empty metric
+UINT64 StatQuantile(const STAT_METRIC *metric, double q);
+
+//sketch bucket of a value and the values of a bucket, [low, low + width)
+UINT32 StatBucket(UINT64 value);
+void StatBucketRange(UINT32 bucket, UINT64 *low, UINT64 *width);
+
+#endif
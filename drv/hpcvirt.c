@@ -0,0 +1,140 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Per-thread counter virtualization, see hpcvirt.h.
+*/
+
+#include "hpcvirt.h"
+
+/*
+* Hash of a KTHREAD pointer into a table index
+*/
+HPC_INLINE UINT32 ThreadHash(PCOUNTER_VIRT virt, UINT_PTR thread){
+	UINT32 folded = (UINT32)thread ^ (UINT32)((UINT64)thread >> 32);
+	return ((folded >> 4) * 0x9E3779B1u) & virt->mask;
+}
+
+/*
+* Reset a context to the state of a thread that has not run yet
+*/
+static void ResetContext(PCOUNTER_VIRT virt, PTHREAD_CONTEXT ctx, UINT32 tid){
+	UINT32 i;
+
+	ctx->tid = tid;
+	ctx->state = THREAD_STATE_FRESH;
+	ctx->group = 0;
+	ctx->pmis = 0;
+	ctx->period = 0;
+	for(i = 0; i < HPC_NUM_COUNTERS; i++)
+		ctx->ctr[i] = virt->initial[i];
+}
+
+/*
+* Initialize the table over caller-provided storage; size must be a power of two
+*/
+void CounterVirtInit(PCOUNTER_VIRT virt, PTHREAD_CONTEXT contexts, UINT32 size, const COUNTER_OPS *ops, const UINT64 *initial){
+	UINT32 i;
+
+	virt->contexts = contexts;
+	virt->mask = size - 1;
+	virt->ops = *ops;
+	virt->overflows = 0;
+	for(i = 0; i < HPC_NUM_COUNTERS; i++)
+		virt->initial[i] = initial != NULL ? initial[i] : 0;
+	for(i = 0; i < size; i++){
+		contexts[i].thread = THREAD_SLOT_EMPTY;
+		contexts[i].tid = 0;
+		contexts[i].state = THREAD_STATE_FRESH;
+	}
+}
+
+/*
+* Find the context of a thread, or NULL
+*/
+PTHREAD_CONTEXT CounterVirtFind(PCOUNTER_VIRT virt, UINT_PTR thread){
+	UINT32 i, probes;
+	UINT_PTR key;
+
+	i = ThreadHash(virt, thread);
+	for(probes = 0; probes <= virt->mask; probes++){
+		key = virt->contexts[i].thread;
+		if(key == thread)
+			return &virt->contexts[i];
+		if(key == THREAD_SLOT_EMPTY)
+			return NULL;
+		i = (i + 1) & virt->mask;
+	}
+	return NULL;
+}
+
+/*
+* Claim a free slot for a thread that has no context yet
+*/
+static PTHREAD_CONTEXT InsertContext(PCOUNTER_VIRT virt, UINT_PTR thread, UINT32 tid){
+	PTHREAD_CONTEXT ctx;
+	UINT32 i, probes;
+	UINT_PTR key;
+
+	i = ThreadHash(virt, thread);
+	for(probes = 0; probes <= virt->mask; probes++){
+		ctx = &virt->contexts[i];
+		key = ctx->thread;
+		if((key == THREAD_SLOT_EMPTY || key == THREAD_SLOT_REMOVED) &&
+			HpcCompareExchangePtr(&ctx->thread, key, thread) == key){
+			ResetContext(virt, ctx, tid);
+			return ctx;
+		}
+		i = (i + 1) & virt->mask;
+	}
+	return NULL;
+}
+
+/*
+* A monitored thread is switched in: load its counters into the PMU.
+* Returns its context, or NULL if the table is full and the thread shares the live counters.
+*/
+PTHREAD_CONTEXT CounterVirtSwitchIn(PCOUNTER_VIRT virt, UINT_PTR thread, UINT32 tid){
+	PTHREAD_CONTEXT ctx;
+
+	ctx = CounterVirtFind(virt, thread);
+	if(ctx != NULL && ctx->tid != tid)
+		ResetContext(virt, ctx, tid);		//stale context of an exited thread at the same address
+	if(ctx == NULL)
+		ctx = InsertContext(virt, thread, tid);
+	if(ctx == NULL){
+		virt->overflows++;
+		return NULL;
+	}
+
+	if(ctx->state != THREAD_STATE_RUNNING){
+		virt->ops.write(virt->ops.context, ctx->ctr);
+		ctx->state = THREAD_STATE_RUNNING;
+	}
+	return ctx;
+}
+
+/*
+* A monitored thread is switched out: save its counters.
+* Threads are only inserted at switch-in, so an exited thread is not re-added by its last switch-out.
+*/
+PTHREAD_CONTEXT CounterVirtSwitchOut(PCOUNTER_VIRT virt, UINT_PTR thread){
+	PTHREAD_CONTEXT ctx;
+
+	ctx = CounterVirtFind(virt, thread);
+	if(ctx == NULL || ctx->state != THREAD_STATE_RUNNING)
+		return NULL;
+	virt->ops.read(virt->ops.context, ctx->ctr);
+	ctx->state = THREAD_STATE_SAVED;
+	return ctx;
+}
+
+/*
+* Forget an exiting thread. The tombstone keeps probe chains of other threads intact.
+*/
+void CounterVirtThreadExit(PCOUNTER_VIRT virt, UINT_PTR thread){
+	PTHREAD_CONTEXT ctx;
+
+	ctx = CounterVirtFind(virt, thread);
+	if(ctx != NULL)
+		HpcCompareExchangePtr(&ctx->thread, thread, THREAD_SLOT_REMOVED);
+}
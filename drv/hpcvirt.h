@@ -0,0 +1,67 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Per-thread counter virtualization.
+* Every monitored thread owns a THREAD_CONTEXT, keyed by its KTHREAD, that holds its
+* counter values while it is switched out. The context switch hook calls
+* CounterVirtSwitchOut for the exiting thread and CounterVirtSwitchIn for the incoming
+* one, so threads of one test process, or of several, never see each other's counts.
+*
+* The table is preallocated and lock-free: contexts are inserted with a compare-exchange
+* on switch-in, updated only by the CPU that runs the thread, and removed when the
+* thread exits. The counters are accessed through COUNTER_OPS, so the state machine
+* can be driven by a simulated scheduler and PMU in user mode.
+*/
+
+#ifndef HPCVIRT_H
+#define HPCVIRT_H
+
+#include "hpcring.h"
+
+//default number of thread contexts, a power of two
+#define THREAD_TABLE_SIZE 1024
+
+//key values that are never valid KTHREAD pointers
+#define THREAD_SLOT_EMPTY	((UINT_PTR)0)
+#define THREAD_SLOT_REMOVED	((UINT_PTR)1)
+
+//state of a thread context
+#define THREAD_STATE_FRESH		0	//never ran, holds the initial counter values
+#define THREAD_STATE_RUNNING	1	//counters are live in the PMU
+#define THREAD_STATE_SAVED		2	//counters were saved at switch-out
+
+typedef struct _COUNTER_OPS {
+	void (*read)(void *context, UINT64 *values);		//read HPC_NUM_COUNTERS counters
+	void (*write)(void *context, const UINT64 *values);	//load HPC_NUM_COUNTERS counters
+	void *context;
+} COUNTER_OPS, *PCOUNTER_OPS;
+
+typedef struct _THREAD_CONTEXT {
+	volatile UINT_PTR thread;		//KTHREAD, or THREAD_SLOT_*
+	UINT32 tid;						//thread id, detects a KTHREAD address reused by a new thread
+	UINT32 state;					//THREAD_STATE_*
+	UINT32 group;					//event group of the thread when multiplexing, see hpcmux.h
+	UINT32 pmis;					//PMIs of the thread in its current group
+	UINT32 period;					//sampling period of the current window, 0 for -pmiThreshold, see hpcperiod.h
+	UINT64 ctr[HPC_NUM_COUNTERS];
+} THREAD_CONTEXT, *PTHREAD_CONTEXT;
+
+typedef struct _COUNTER_VIRT {
+	PTHREAD_CONTEXT contexts;
+	UINT32 mask;
+	COUNTER_OPS ops;
+	UINT64 initial[HPC_NUM_COUNTERS];	//counter values a new thread starts with
+	volatile UINT32 overflows;			//switch-ins not virtualized because the table was full
+} COUNTER_VIRT, *PCOUNTER_VIRT;
+
+void CounterVirtInit(PCOUNTER_VIRT virt, PTHREAD_CONTEXT contexts, UINT32 size, const COUNTER_OPS *ops, const UINT64 *initial);
+PTHREAD_CONTEXT CounterVirtFind(PCOUNTER_VIRT virt, UINT_PTR thread);
+
+//context switch hook
+PTHREAD_CONTEXT CounterVirtSwitchIn(PCOUNTER_VIRT virt, UINT_PTR thread, UINT32 tid);
+PTHREAD_CONTEXT CounterVirtSwitchOut(PCOUNTER_VIRT virt, UINT_PTR thread);
+
+//thread exit notification, called in the context of the exiting thread
+void CounterVirtThreadExit(PCOUNTER_VIRT virt, UINT_PTR thread);
+
+#endif
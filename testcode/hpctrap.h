@@ -0,0 +1,38 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Region markers of the polling mode for 32-bit Windows test programs, see drv/hpcregion.h.
+* A marker is an "int 2e" with HPC_REGION_MAGIC in ebx and the region id, with bit 31 set
+* for the end of the region, in ecx. Regions may nest; the driver records one sample per
+* region instance, and tools/regionsum sums them per region. Without a trap, tools/hpcpmc.h
+* counts regions per thread with rdpmc when the driver runs with rdpmc=on, which then writes
+* the counts of a test thread into the counters whenever it is switched in.
+*/
+
+#ifndef HPCTRAP_H
+#define HPCTRAP_H
+
+#define HPC_REGION_MAGIC	0x52435048		//"HPCR"
+#define HPC_REGION_END		0x80000000
+
+//region ids are 1..0x7FFFFFFF, 0 is the id of samples outside regions
+static __inline void HpcRegionBegin(unsigned int region){
+	__asm {
+		mov eax, 19h
+		mov ebx, HPC_REGION_MAGIC
+		mov ecx, region
+		int 0x2e
+	}
+}
+
+static __inline void HpcRegionEnd(unsigned int region){
+	__asm {
+		mov eax, 19h
+		mov ebx, HPC_REGION_MAGIC
+		mov ecx, region
+		or ecx, HPC_REGION_END
+		int 0x2e
+	}
+}
+
+#endif
@@ -1,9 +1,12 @@
 #include <stdio.h>
 #include <windows.h>
+#include "hpctrap.h"
 
 
 void main()
 {
+	int i;
+
 	//Instrument to generate trap
 	__asm __volatile {
 		mov eax, 19h 
@@ -18,5 +21,13 @@ void main()
 		mov eax, 19h; 
 		int 0x2e 
 	}
-}	
 
+	//named regions: 1 holds three instances of 2
+	HpcRegionBegin(1);
+	for(i = 0; i < 3; i++){
+		HpcRegionBegin(2);
+		printf("Hello region %d!\n", i);
+		HpcRegionEnd(2);
+	}
+	HpcRegionEnd(1);
+}	
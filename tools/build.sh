@@ -0,0 +1,62 @@
+#!/bin/bash
+#
+# Builds the portable user-mode tools on Linux.
+# The modules shared with the driver are compiled from ../drv,
+# the other modules from this directory.
+
+CC=${CC:-gcc}
+#-O3 for the loop vectorizer, which the kernels of csvscan.c are written for
+CFLAGS=${CFLAGS:-"-O3 -Wall"}
+DRV=../drv
+
+cd "$(dirname "$0")"
+
+#tool name and the modules it links
+declare -a arr=(
+	"ringbench:hpcring.c"
+	"hpcdump:hpcring.c hpclog.c logread.c calib.c overhead.c"
+	"matchbench:hpcmatch.c"
+	"hpcctl:hpcconf.c hpcstats.c overhead.c"
+	"confcheck:hpcconf.c"
+	"hpcmux:hpcring.c hpclog.c logread.c muxest.c"
+	"muxsim:muxest.c"
+	"pmubench:hpcring.c hpcconf.c hpcpmu.c hpccaps.c hpcregion.c hpcvirt.c simpmu.c calib.c"
+	"regionsum:hpcring.c hpclog.c logread.c"
+	"hpcstats:hpcring.c hpclog.c logread.c hpcstats.c"
+	"statbench:hpcstats.c"
+	"hpcanalyze:csvscan.c hpcstats.c"
+	"csvbench:csvscan.c hpcstats.c"
+	"hpccmp:csvscan.c hpcstats.c"
+	"phasesim:phase.c"
+	"hpccorpus:hpcring.c hpclog.c csvscan.c hpcstats.c corpus.c"
+	"featbench:feature.c"
+	"hpccal:hpcring.c hpclog.c logread.c calib.c"
+	"hpcsym:hpcring.c hpclog.c logread.c elfsym.c"
+	"pmucaps:hpccaps.c"
+	"virtsim:hpcring.c hpcconf.c hpcpmu.c hpccaps.c hpcregion.c hpcvirt.c simpmu.c"
+)
+
+#the perf_event_open collector only builds on Linux
+if [ "$(uname -s)" = "Linux" ]; then
+	arr+=("hpcrun:hpcconf.c hpcring.c hpclog.c hpcregion.c hpcstats.c perfev.c")
+	arr+=("detbench:hpcring.c hpclog.c logread.c")
+	arr+=("hpclive:hpcring.c hpclog.c live.c perfev.c csvscan.c hpcstats.c")
+	arr+=("hpcphase:hpcring.c hpclog.c live.c perfev.c csvscan.c hpcstats.c phase.c")
+	arr+=("hpcfeat:hpcring.c hpclog.c logread.c live.c perfev.c csvscan.c hpcstats.c feature.c")
+	arr+=("markbench:")
+fi
+
+for i in "${arr[@]}"
+do
+	name=${i%%:*}
+	mods=""
+	for m in ${i#*:}; do
+		if [ -f "$DRV/$m" ]; then
+			mods="$mods $DRV/$m"
+		else
+			mods="$mods $m"
+		fi
+	done
+	#compilation-commands
+	$CC $CFLAGS -I$DRV -o $name $name.c $mods -lpthread -lm || exit 1
+done
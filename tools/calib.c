@@ -0,0 +1,163 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Calibration of the sampling windows, see calib.h.
+*
+* A calibration file is CSV text:
+*	period,N
+*	freeze,0|1
+*	events,0xSEL0,...,0xSEL7
+*	windows,N
+*	skid,mean,sd,min,max
+*	counter,rate,overhead,sd
+* followed by one line per counter in sample column order. Files written before the
+* record had twelve columns list four events and end after event4; they still load.
+*/
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "calib.h"
+
+static const char *counterNames[HPC_NUM_COUNTERS] = HPC_COLUMN_NAMES;
+
+//counter lines of the files of four programmable counters
+#define CALIB_BASE_COUNTERS	(HPC_COLUMN_PMC0 + 4)
+
+void CalibInit(PCALIBRATION cal, UINT64 period, const UINT32 *eventSel, UINT32 freeze){
+	memset(cal, 0, sizeof(*cal));
+	cal->period = period;
+	memcpy(cal->eventSel, eventSel, sizeof(cal->eventSel));
+	cal->freeze = freeze;
+}
+
+int CalibReference(PCALIBRATION cal, const UINT64 *totals){
+	int c;
+
+	if(totals[0] == 0)
+		return -1;
+	for(c = 0; c < HPC_NUM_COUNTERS; c++)
+		cal->rate[c] = (double)totals[c] / (double)totals[0];
+	return 0;
+}
+
+//Welford, one value at a time
+static void AddValue(PCALIB_MOMENTS m, double value){
+	double delta;
+
+	m->count++;
+	delta = value - m->mean;
+	m->mean += delta / m->count;
+	m->m2 += delta * (value - m->mean);
+}
+
+int CalibAddWindow(PCALIBRATION cal, const UINT64 *ctr, UINT64 period){
+	UINT64 skid;
+	int c;
+
+	if(period == 0 || ctr[0] < period || ctr[0] >= 2 * period)
+		return 0;
+	skid = ctr[0] - period;
+	if(cal->skid.count == 0 || skid < cal->skidMin)
+		cal->skidMin = skid;
+	if(skid > cal->skidMax)
+		cal->skidMax = skid;
+	AddValue(&cal->skid, (double)skid);
+	AddValue(&cal->overhead[0], (double)skid);
+	for(c = 1; c < HPC_NUM_COUNTERS; c++)
+		AddValue(&cal->overhead[c], (double)ctr[c] - cal->rate[c] * (double)ctr[0]);
+	return 1;
+}
+
+double CalibSd(const CALIB_MOMENTS *moments){
+	return moments->count > 1 ? sqrt(moments->m2 / (moments->count - 1)) : 0;
+}
+
+void CalibNormalize(const CALIBRATION *cal, const UINT32 *eventSel, const UINT64 *ctr, UINT64 *out){
+	double value;
+	int c;
+
+	if(ctr[0] == 0){
+		memcpy(out, ctr, HPC_NUM_COUNTERS * sizeof(UINT64));
+		return;
+	}
+	out[0] = cal->period;
+	for(c = 1; c < HPC_NUM_COUNTERS; c++){
+		value = (double)ctr[c];
+		//the fixed counters always count the same events
+		if(c < HPC_COLUMN_PMC0 || c == HPC_COLUMN_FIXED3 || eventSel[c - HPC_COLUMN_PMC0] == cal->eventSel[c - HPC_COLUMN_PMC0])
+			value -= cal->overhead[c].mean;
+		out[c] = value > 0 ? (UINT64)(value * (double)cal->period / (double)ctr[0] + 0.5) : 0;
+	}
+}
+
+int CalibSave(const CALIBRATION *cal, FILE *file){
+	int c;
+
+	fprintf(file, "period,%llu\r\nfreeze,%u\r\n", (unsigned long long)cal->period, cal->freeze);
+	fprintf(file, "events");
+	for(c = 0; c < HPC_MAX_PROGRAMMABLE; c++)
+		fprintf(file, ",0x%08X", cal->eventSel[c]);
+	fprintf(file, "\r\n");
+	fprintf(file, "windows,%llu\r\n", (unsigned long long)cal->skid.count);
+	fprintf(file, "skid,%.6f,%.6f,%llu,%llu\r\n", cal->skid.mean, CalibSd(&cal->skid),
+		(unsigned long long)cal->skidMin, (unsigned long long)cal->skidMax);
+	fprintf(file, "counter,rate,overhead,sd\r\n");
+	for(c = 0; c < HPC_NUM_COUNTERS; c++)
+		fprintf(file, "%s,%.12g,%.6f,%.6f\r\n", counterNames[c], cal->rate[c], cal->overhead[c].mean, CalibSd(&cal->overhead[c]));
+	return ferror(file) ? -1 : 0;
+}
+
+/*
+* Moments from a mean and standard deviation over count values
+*/
+static void SetMoments(PCALIB_MOMENTS m, UINT64 count, double mean, double sd){
+	m->count = count;
+	m->mean = mean;
+	m->m2 = count > 1 ? sd * sd * (count - 1) : 0;
+}
+
+int CalibLoad(PCALIBRATION cal, FILE *file){
+	char line[256], name[16], *next;
+	unsigned long long period, windows, skidMin, skidMax;
+	double mean, sd, rate;
+	unsigned int freeze;
+	int c;
+
+	memset(cal, 0, sizeof(*cal));
+	if(fgets(line, sizeof(line), file) == NULL || sscanf(line, "period,%llu", &period) != 1 || period == 0)
+		return -1;
+	if(fgets(line, sizeof(line), file) == NULL || sscanf(line, "freeze,%u", &freeze) != 1)
+		return -1;
+	if(fgets(line, sizeof(line), file) == NULL || strncmp(line, "events,", 7) != 0)
+		return -1;
+	next = line + 6;
+	for(c = 0; c < HPC_MAX_PROGRAMMABLE && *next == ','; c++)
+		cal->eventSel[c] = (UINT32)strtoul(next + 1, &next, 16);
+	if(c < 4)
+		return -1;
+	if(fgets(line, sizeof(line), file) == NULL || sscanf(line, "windows,%llu", &windows) != 1)
+		return -1;
+	if(fgets(line, sizeof(line), file) == NULL || sscanf(line, "skid,%lf,%lf,%llu,%llu", &mean, &sd, &skidMin, &skidMax) != 4)
+		return -1;
+	if(fgets(line, sizeof(line), file) == NULL || strncmp(line, "counter,", 8) != 0)
+		return -1;
+	cal->period = period;
+	cal->freeze = freeze;
+	cal->skidMin = skidMin;
+	cal->skidMax = skidMax;
+	SetMoments(&cal->skid, windows, mean, sd);
+	for(c = 0; c < HPC_NUM_COUNTERS; c++){
+		if(fgets(line, sizeof(line), file) == NULL){
+			if(c == CALIB_BASE_COUNTERS)
+				break;
+			return -1;
+		}
+		if(sscanf(line, "%15[^,],%lf,%lf,%lf", name, &rate, &mean, &sd) != 4
+			|| strcmp(name, counterNames[c]) != 0)
+			return -1;
+		cal->rate[c] = rate;
+		SetMoments(&cal->overhead[c], windows, mean, sd);
+	}
+	return 0;
+}
@@ -0,0 +1,63 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Calibration of the sampling windows: the skid of fixed counter 0 and the overhead
+* of a PMI in every other counter, measured on a workload with known event rates.
+*
+* A sampling window should hold exactly one period of instructions, but fixed counter 0
+* keeps counting for the skid between its overflow and the PMI, and the other counters
+* also count the events of the interrupt path. A window of ins instructions thus holds
+*	ctr[c] = rate[c] * ins + overhead[c]
+* events, where rate[c] is the number of events per instruction of the workload. The
+* rates come from a reference run that takes no PMIs, e.g. a polling log of the same
+* program; the skid and the overhead from a sampling log of it. The overhead of fixed
+* counter 0 is the mean skid.
+*
+* CalibNormalize maps a window onto exactly the calibrated period: the overhead is
+* subtracted and the rest scaled by period / ins, so rates are comparable between runs,
+* periods (jittered or adapted ones too) and machines with different skid. The overhead
+* of a programmable counter is only subtracted if the window counted the event it was
+* calibrated with.
+*/
+
+#ifndef CALIB_H
+#define CALIB_H
+
+#include <stdio.h>
+#include "hpcring.h"
+
+typedef struct _CALIB_MOMENTS {
+	UINT64 count;
+	double mean;
+	double m2;
+} CALIB_MOMENTS, *PCALIB_MOMENTS;
+
+typedef struct _CALIBRATION {
+	UINT64 period;						//instructions per window, the mean of jittered periods
+	UINT32 eventSel[HPC_MAX_PROGRAMMABLE];	//events of the programmable counters
+	UINT32 freeze;						//the sampling run froze the counters on PMIs
+	double rate[HPC_NUM_COUNTERS];		//events per instruction of the reference run
+	UINT64 skidMin, skidMax;
+	CALIB_MOMENTS skid;					//instructions counted after the overflow
+	CALIB_MOMENTS overhead[HPC_NUM_COUNTERS];	//events per window beyond rate * ins, the skid for counter 0
+} CALIBRATION, *PCALIBRATION;
+
+void CalibInit(PCALIBRATION cal, UINT64 period, const UINT32 *eventSel, UINT32 freeze);
+
+//set the rates from the counter totals of the reference run; returns -1 if it retired no instructions
+int CalibReference(PCALIBRATION cal, const UINT64 *totals);
+
+//add a window of the given sampling period (HPC_SAMPLE.period); windows shorter than their period
+//(the end of a thread) and longer than two are skipped. Returns 1 if the window was used.
+int CalibAddWindow(PCALIBRATION cal, const UINT64 *ctr, UINT64 period);
+
+double CalibSd(const CALIB_MOMENTS *moments);
+
+//window ctr counting the events eventSel, normalized to one period
+void CalibNormalize(const CALIBRATION *cal, const UINT32 *eventSel, const UINT64 *ctr, UINT64 *out);
+
+//text format of a calibration file; CalibLoad returns -1 if the file is not one
+int CalibSave(const CALIBRATION *cal, FILE *file);
+int CalibLoad(PCALIBRATION cal, FILE *file);
+
+#endif
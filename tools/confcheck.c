@@ -0,0 +1,149 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Checks the parsing and validation of the driver's configuration (drv/hpcconf.c),
+* which the driver runs on every IOCTL_HPC_CONFIGURE and hpcctl before it sends one.
+* Every case applies options to a valid sampling configuration, overwrites a field
+* with a value the options cannot produce if it needs one, passes the result through
+* HpcConfigFromBuffer like the driver does and compares the result with the expected
+* one: sizes of the request, thresholds up to INT32_MIN, jitter at the limits of a
+* period, group counts and the options that only fit one of the modes.
+*/
+
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include "hpcconf.h"
+
+//field overwritten after the options
+#define FIELD_NONE		0
+#define FIELD_LENGTH	1		//length of the buffer, relative to sizeof(HPC_CONFIG)
+#define FIELD_NULL		2		//no buffer
+#define FIELD_SIZE		3
+#define FIELD_MODE		4
+#define FIELD_THRESHOLD	5
+#define FIELD_GROUPS	6
+#define FIELD_ROTATE	7
+#define FIELD_JITTER	8
+#define FIELD_BUDGET	9
+#define FIELD_APPS		10
+
+//valid sampling configuration the options of a case start from
+#define BASE_OPTIONS	"mode=sampling threshold=-50000 apps=test.exe log=\\??\\C:\\hpc.bin"
+
+typedef struct _CASE {
+	const char *name;
+	const char *options;		//applied in order with HpcConfigSet, separated by spaces
+	int field;					//FIELD_*
+	INT64 value;
+	int result;					//of the first option that fails, else of HpcConfigFromBuffer
+} CASE;
+
+static const CASE cases[] = {
+	{"valid sampling", "", FIELD_NONE, 0, HPC_CONFIG_OK},
+	{"valid polling", "mode=polling threshold=0 rdpmc=on", FIELD_NONE, 0, HPC_CONFIG_OK},
+	//sizes
+	{"buffer one byte short", "", FIELD_LENGTH, -1, HPC_CONFIG_BAD_SIZE},
+	{"buffer one byte long", "", FIELD_LENGTH, 1, HPC_CONFIG_BAD_SIZE},
+	{"empty buffer", "", FIELD_LENGTH, -(INT64)sizeof(HPC_CONFIG), HPC_CONFIG_BAD_SIZE},
+	{"no buffer", "", FIELD_NULL, 0, HPC_CONFIG_BAD_SIZE},
+	{"size field of an older request", "", FIELD_SIZE, sizeof(HPC_CONFIG) - 4, HPC_CONFIG_BAD_SIZE},
+	{"mode 0", "", FIELD_MODE, 0, HPC_CONFIG_BAD_MODE},
+	{"mode 3", "", FIELD_MODE, 3, HPC_CONFIG_BAD_MODE},
+	//thresholds
+	{"shortest period", "threshold=-1000", FIELD_NONE, 0, HPC_CONFIG_OK},
+	{"period below the shortest", "threshold=-999", FIELD_NONE, 0, HPC_CONFIG_BAD_THRESHOLD},
+	{"sampling without period", "threshold=0", FIELD_NONE, 0, HPC_CONFIG_BAD_THRESHOLD},
+	{"positive threshold", "threshold=1", FIELD_NONE, 0, HPC_CONFIG_BAD_THRESHOLD},
+	{"longest period", "threshold=-0x7FFFFFFF", FIELD_NONE, 0, HPC_CONFIG_OK},
+	{"period of 2^31", "threshold=-0x80000000", FIELD_NONE, 0, HPC_CONFIG_BAD_THRESHOLD},
+	{"INT32_MIN threshold", "", FIELD_THRESHOLD, INT_MIN, HPC_CONFIG_BAD_THRESHOLD},
+	{"INT32_MIN threshold with jitter", "jitter=1", FIELD_THRESHOLD, INT_MIN, HPC_CONFIG_BAD_THRESHOLD},
+	{"polling with a period", "mode=polling", FIELD_NONE, 0, HPC_CONFIG_BAD_THRESHOLD},
+	//jitter, target and budget
+	{"jitter down to the shortest period", "jitter=49000", FIELD_NONE, 0, HPC_CONFIG_OK},
+	{"jitter below the shortest period", "jitter=49001", FIELD_NONE, 0, HPC_CONFIG_BAD_PERIOD},
+	{"jitter up to the longest period", "threshold=-0x7FFFFFF0 jitter=15", FIELD_NONE, 0, HPC_CONFIG_OK},
+	{"jitter beyond the longest period", "threshold=-0x7FFFFFF0 jitter=16", FIELD_NONE, 0, HPC_CONFIG_BAD_PERIOD},
+	{"jitter of 2^31", "jitter=0x80000000", FIELD_NONE, 0, HPC_CONFIG_BAD_PERIOD},
+	{"jitter of 2^32-1", "", FIELD_JITTER, 0xFFFFFFFF, HPC_CONFIG_BAD_PERIOD},
+	{"jitter in polling mode", "mode=polling threshold=0 jitter=100", FIELD_NONE, 0, HPC_CONFIG_BAD_PERIOD},
+	{"target and budget", "target=100000 budget=10", FIELD_NONE, 0, HPC_CONFIG_OK},
+	{"budget option above 1000", "budget=1001", FIELD_NONE, 0, HPC_CONFIG_BAD_PERIOD},
+	{"budget above 1000", "", FIELD_BUDGET, 1001, HPC_CONFIG_BAD_PERIOD},
+	//groups
+	{"eight groups", "group7=0x4300C0", FIELD_NONE, 0, HPC_CONFIG_OK},
+	{"no group", "", FIELD_GROUPS, 0, HPC_CONFIG_BAD_GROUP},
+	{"nine groups", "", FIELD_GROUPS, HPC_MAX_GROUPS + 1, HPC_CONFIG_BAD_GROUP},
+	{"groups in polling mode", "mode=polling threshold=0 group1=0x4300C0", FIELD_NONE, 0, HPC_CONFIG_BAD_GROUP},
+	{"nine events in a group", "group1=1,2,3,4,5,6,7,8,9", FIELD_NONE, 0, HPC_CONFIG_BAD_GROUP},
+	{"rotate option 0", "rotate=0", FIELD_NONE, 0, HPC_CONFIG_BAD_GROUP},
+	{"rotate 0", "", FIELD_ROTATE, 0, HPC_CONFIG_BAD_GROUP},
+	//events and mode-specific options
+	{"event", "event0=0x4300C0", FIELD_NONE, 0, HPC_CONFIG_OK},
+	{"event raising PMIs", "event0=0x5300C0", FIELD_NONE, 0, HPC_CONFIG_BAD_EVENT},
+	{"event counting in no mode", "event0=0x4000C0", FIELD_NONE, 0, HPC_CONFIG_BAD_EVENT},
+	{"freeze in polling mode", "mode=polling threshold=0 freeze=on", FIELD_NONE, 0, HPC_CONFIG_BAD_FREEZE},
+	{"rdpmc in sampling mode", "rdpmc=on", FIELD_NONE, 0, HPC_CONFIG_BAD_RDPMC},
+	{"no test application", "", FIELD_APPS, 0, HPC_CONFIG_BAD_APP},
+	{"too many test applications", "", FIELD_APPS, HPC_MAX_TEST_APPS + 1, HPC_CONFIG_TOO_MANY_APPS},
+};
+
+static int ApplyOptions(PHPC_CONFIG config, const char *options){
+	char text[256], *option;
+	int rc;
+
+	snprintf(text, sizeof(text), "%s", options);
+	for(option = strtok(text, " "); option != NULL; option = strtok(NULL, " ")){
+		if((rc = HpcConfigSet(config, option)) != HPC_CONFIG_OK)
+			return rc;
+	}
+	return HPC_CONFIG_OK;
+}
+
+/*
+* Result of a case: the options, the field, then the configuration as the driver receives it
+*/
+static int Run(const CASE *c){
+	HPC_CONFIG config, received;
+	UINT32 len = sizeof(config);
+	const void *buffer = &config;
+	int rc;
+
+	HpcConfigInit(&config);
+	if((rc = ApplyOptions(&config, BASE_OPTIONS)) != HPC_CONFIG_OK || (rc = ApplyOptions(&config, c->options)) != HPC_CONFIG_OK)
+		return rc;
+	switch(c->field){
+	case FIELD_LENGTH:		len = (UINT32)(sizeof(config) + c->value); break;
+	case FIELD_NULL:		buffer = NULL; break;
+	case FIELD_SIZE:		config.size = (UINT32)c->value; break;
+	case FIELD_MODE:		config.mode = (UINT32)c->value; break;
+	case FIELD_THRESHOLD:	config.pmiThreshold = (INT32)c->value; break;
+	case FIELD_GROUPS:		config.groupCount = (UINT32)c->value; break;
+	case FIELD_ROTATE:		config.groupPeriod = (UINT32)c->value; break;
+	case FIELD_JITTER:		config.jitter = (UINT32)c->value; break;
+	case FIELD_BUDGET:		config.budget = (UINT32)c->value; break;
+	case FIELD_APPS:		config.testAppCount = (UINT32)c->value; break;
+	}
+	return HpcConfigFromBuffer(&received, buffer, len);
+}
+
+int main(int argc, char *argv[]){
+	size_t n;
+	int rc, errors = 0;
+
+	if(argc != 1){
+		fprintf(stderr, "usage: %s\n", argv[0]);
+		fprintf(stderr, "  checks the parsing and validation of configurations against a table of cases\n");
+		return 2;
+	}
+	for(n = 0; n < sizeof(cases) / sizeof(cases[0]); n++){
+		rc = Run(&cases[n]);
+		if(rc != cases[n].result){
+			printf("%s: expected \"%s\", got \"%s\"\n", cases[n].name, HpcConfigErrorText(cases[n].result), HpcConfigErrorText(rc));
+			errors++;
+		}
+	}
+	printf("%u configurations, check: %s\n", (unsigned)n, errors == 0 ? "ok" : "FAILED");
+	return errors == 0 ? 0 : 1;
+}
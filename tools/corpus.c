@@ -0,0 +1,558 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Summaries of a corpus of runs and their cache, see corpus.h.
+*/
+
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "hpclog.h"
+#include "corpus.h"
+
+#define HASH_PRIME1		0x9E3779B185EBCA87ULL
+#define HASH_PRIME2		0xC2B2AE3D27D4EB4FULL
+
+typedef struct _CACHE_HEADER {
+	char magic[8];					//CORPUS_CACHE_MAGIC
+	UINT32 version;
+	UINT32 summarySize;				//sizeof(CORPUS_SUMMARY) of the writer
+	UINT32 legacy;
+	UINT32 count;
+} CACHE_HEADER;
+
+//a summary in the cache file, followed by pathLength bytes of its path
+typedef struct _CACHE_RECORD {
+	CORPUS_SUMMARY summary;
+	UINT32 pathLength;
+	UINT32 reserved;
+} CACHE_RECORD;
+
+typedef struct _CORPUS_CACHE {
+	PCORPUS_RUN byPath;
+	PCORPUS_RUN *byHash;
+	UINT32 count;
+} CORPUS_CACHE;
+
+typedef struct _FILE_LIST {
+	PCORPUS_RUN runs;
+	UINT32 count;
+	UINT32 capacity;
+} FILE_LIST;
+
+typedef struct _SUMMARIZE_JOB {
+	const char *root;
+	const CORPUS_OPTIONS *options;
+	const CORPUS_CACHE *cache;
+	PCORPUS_RUN *todo;				//runs the cache did not match by size and time
+	UINT32 count;
+	UINT32 next;
+	pthread_mutex_t lock;
+	//counted under the lock
+	UINT32 moved;
+	UINT32 parsed;
+	UINT32 failed;
+	UINT64 bytesParsed;
+} SUMMARIZE_JOB;
+
+HPC_INLINE UINT64 RotateLeft(UINT64 x, int r){
+	return (x << r) | (x >> (64 - r));
+}
+
+HPC_INLINE UINT64 HashRound(UINT64 lane, UINT64 word){
+	return RotateLeft(lane + word * HASH_PRIME2, 31) * HASH_PRIME1;
+}
+
+/*
+* Four independent lanes over 8-byte words, so the multiplies of a round overlap,
+* merged with the length and the tail at the end
+*/
+UINT64 CorpusHash(const void *data, size_t len){
+	const UINT8 *p = (const UINT8*)data, *end = p + len;
+	UINT64 lane[4] = { HASH_PRIME1 + HASH_PRIME2, HASH_PRIME2, 0, 0 - HASH_PRIME1 };
+	UINT64 word, h;
+	int i;
+
+	for(; end - p >= 32; p += 32){
+		for(i = 0; i < 4; i++){
+			memcpy(&word, p + 8 * i, 8);
+			lane[i] = HashRound(lane[i], word);
+		}
+	}
+	h = RotateLeft(lane[0], 1) + RotateLeft(lane[1], 7) + RotateLeft(lane[2], 12) + RotateLeft(lane[3], 18);
+	h ^= (UINT64)len * HASH_PRIME1;
+	for(; end - p >= 8; p += 8){
+		memcpy(&word, p, 8);
+		h = RotateLeft(h ^ HashRound(0, word), 27) * HASH_PRIME1 + HASH_PRIME2;
+	}
+	for(; p < end; p++)
+		h = RotateLeft(h ^ (*p * HASH_PRIME1), 11) * HASH_PRIME2;
+	h ^= h >> 33;
+	h *= HASH_PRIME2;
+	h ^= h >> 29;
+	return h;
+}
+
+static int CompareRunPath(const void *x, const void *y){
+	return strcmp(((const CORPUS_RUN*)x)->path, ((const CORPUS_RUN*)y)->path);
+}
+
+static int CompareRunHash(const void *x, const void *y){
+	const CORPUS_SUMMARY *a = &(*(const CORPUS_RUN* const*)x)->summary, *b = &(*(const CORPUS_RUN* const*)y)->summary;
+
+	if(a->hash != b->hash)
+		return a->hash < b->hash ? -1 : 1;
+	return a->size < b->size ? -1 : a->size > b->size;
+}
+
+static void FreeRuns(PCORPUS_RUN runs, UINT32 count){
+	UINT32 i;
+
+	for(i = 0; i < count; i++)
+		free(runs[i].path);
+	free(runs);
+}
+
+/*
+* The cache of the root; an unreadable cache or one of other settings is empty
+*/
+static void LoadCache(const char *path, const CORPUS_OPTIONS *options, CORPUS_CACHE *cache){
+	CACHE_HEADER header;
+	CACHE_RECORD record;
+	FILE *file;
+	UINT32 i;
+
+	memset(cache, 0, sizeof(*cache));
+	if(options->rebuild || (file = fopen(path, "rb")) == NULL)
+		return;
+	if(fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, CORPUS_CACHE_MAGIC, sizeof(CORPUS_CACHE_MAGIC)) != 0 ||
+		header.version != CORPUS_CACHE_VERSION || header.summarySize != sizeof(CORPUS_SUMMARY) ||
+		header.legacy != (UINT32)(options->legacy != 0) ||
+		(cache->byPath = (PCORPUS_RUN)calloc(header.count + 1, sizeof(CORPUS_RUN))) == NULL){
+		fclose(file);
+		return;
+	}
+	for(i = 0; i < header.count; i++){
+		if(fread(&record, sizeof(record), 1, file) != 1 || record.pathLength == 0 || record.pathLength > 4096 ||
+			(cache->byPath[i].path = (char*)malloc(record.pathLength + 1)) == NULL)
+			break;
+		if(fread(cache->byPath[i].path, 1, record.pathLength, file) != record.pathLength){
+			free(cache->byPath[i].path);
+			break;
+		}
+		cache->byPath[i].path[record.pathLength] = 0;
+		cache->byPath[i].summary = record.summary;
+		cache->byPath[i].valid = 1;
+	}
+	fclose(file);
+	//a cut cache keeps the records before the cut
+	cache->count = i;
+	cache->byHash = (PCORPUS_RUN*)malloc(sizeof(PCORPUS_RUN) * (cache->count + 1));
+	if(cache->byHash == NULL){
+		FreeRuns(cache->byPath, cache->count);
+		memset(cache, 0, sizeof(*cache));
+		return;
+	}
+	qsort(cache->byPath, cache->count, sizeof(CORPUS_RUN), CompareRunPath);
+	for(i = 0; i < cache->count; i++)
+		cache->byHash[i] = &cache->byPath[i];
+	qsort(cache->byHash, cache->count, sizeof(PCORPUS_RUN), CompareRunHash);
+}
+
+static void FreeCache(CORPUS_CACHE *cache){
+	FreeRuns(cache->byPath, cache->count);
+	free(cache->byHash);
+	memset(cache, 0, sizeof(*cache));
+}
+
+/*
+* Write the cache next to its place and move it there, so a reader never sees half of it
+*/
+static int SaveCache(const char *path, const CORPUS_OPTIONS *options, const CORPUS *corpus){
+	CACHE_HEADER header;
+	CACHE_RECORD record;
+	char *temp;
+	FILE *file;
+	UINT32 i, count = 0;
+	int ok;
+
+	for(i = 0; i < corpus->count; i++)
+		count += corpus->runs[i].valid;
+	temp = (char*)malloc(strlen(path) + 8);
+	if(temp == NULL)
+		return -1;
+	sprintf(temp, "%s.tmp", path);
+	file = fopen(temp, "wb");
+	if(file == NULL){
+		free(temp);
+		return -1;
+	}
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CORPUS_CACHE_MAGIC, sizeof(CORPUS_CACHE_MAGIC));
+	header.version = CORPUS_CACHE_VERSION;
+	header.summarySize = sizeof(CORPUS_SUMMARY);
+	header.legacy = options->legacy != 0;
+	header.count = count;
+	ok = fwrite(&header, sizeof(header), 1, file) == 1;
+	for(i = 0; ok && i < corpus->count; i++){
+		if(!corpus->runs[i].valid)
+			continue;
+		memset(&record, 0, sizeof(record));
+		record.summary = corpus->runs[i].summary;
+		record.pathLength = (UINT32)strlen(corpus->runs[i].path);
+		ok = fwrite(&record, sizeof(record), 1, file) == 1 &&
+			fwrite(corpus->runs[i].path, 1, record.pathLength, file) == record.pathLength;
+	}
+	ok = fclose(file) == 0 && ok;
+	ok = ok && rename(temp, path) == 0;
+	if(!ok)
+		remove(temp);
+	free(temp);
+	return ok ? 0 : -1;
+}
+
+static char *JoinPath(const char *a, const char *b){
+	size_t la = strlen(a), lb = strlen(b);
+	char *path = (char*)malloc(la + lb + 2);
+
+	if(path == NULL)
+		return NULL;
+	memcpy(path, a, la);
+	path[la] = '/';
+	memcpy(path + la + 1, b, lb + 1);
+	return la == 0 ? memmove(path, path + 1, lb + 1) : path;
+}
+
+static int IsCsv(const char *name){
+	size_t n = strlen(name);
+
+	return n > 4 && strcasecmp(name + n - 4, ".csv") == 0;
+}
+
+/*
+* The CSV files below root/dir, with their size and time; dot files and directories are skipped
+*/
+static int Walk(const char *root, const char *dir, FILE_LIST *list){
+	struct dirent *entry;
+	struct stat st;
+	char *full, *rel;
+	PCORPUS_RUN grown;
+	DIR *d;
+
+	full = JoinPath(root, dir);
+	d = full != NULL ? opendir(full) : NULL;
+	free(full);
+	if(d == NULL)
+		return -1;
+	while((entry = readdir(d)) != NULL){
+		if(entry->d_name[0] == '.')
+			continue;
+		rel = JoinPath(dir, entry->d_name);
+		full = rel != NULL ? JoinPath(root, rel) : NULL;
+		if(full == NULL || stat(full, &st) != 0){
+			free(rel);
+			free(full);
+			continue;
+		}
+		free(full);
+		if(S_ISDIR(st.st_mode)){
+			Walk(root, rel, list);
+			free(rel);
+			continue;
+		}
+		if(!S_ISREG(st.st_mode) || !IsCsv(entry->d_name)){
+			free(rel);
+			continue;
+		}
+		if(list->count == list->capacity){
+			list->capacity = list->capacity != 0 ? list->capacity * 2 : 1024;
+			grown = (PCORPUS_RUN)realloc(list->runs, sizeof(CORPUS_RUN) * list->capacity);
+			if(grown == NULL){
+				free(rel);
+				break;
+			}
+			list->runs = grown;
+		}
+		memset(&list->runs[list->count], 0, sizeof(CORPUS_RUN));
+		list->runs[list->count].path = rel;
+		list->runs[list->count].summary.size = (UINT64)st.st_size;
+		list->runs[list->count].summary.mtime = (INT64)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+		list->count++;
+	}
+	closedir(d);
+	return 0;
+}
+
+/*
+* Workload and events from the sample log next to the file, else from its directories
+*/
+static void RunKeys(const char *root, const char *path, PCORPUS_SUMMARY summary){
+	static const UINT8 counterOfEvent[HPC_MAX_PROGRAMMABLE] = { 3, 4, 5, 6, 7, 8, 9, 10 };
+	SAMPLE_LOG_HEADER header;
+	UINT8 *first;
+	char *log, *slash;
+	size_t n, len;
+	FILE *file;
+	int i;
+
+	summary->logged = 0;
+	log = JoinPath(root, path);
+	first = (UINT8*)malloc(SAMPLE_LOG_ALIGN);
+	if(log != NULL && first != NULL){
+		memcpy(log + strlen(log) - 4, ".bin", 4);
+		file = fopen(log, "rb");
+		if(file != NULL){
+			if(fread(first, 1, SAMPLE_LOG_ALIGN, file) == SAMPLE_LOG_ALIGN && SampleLogReadHeader(first, SAMPLE_LOG_ALIGN, &header) == 0){
+				snprintf(summary->workload, CORPUS_KEY_LENGTH, "%.16s", header.testApp[0] != 0 ? header.testApp : "-");
+				len = 0;
+				for(i = 0; i < HPC_MAX_PROGRAMMABLE && len < CORPUS_KEY_LENGTH; i++){
+					if(header.columns & (1u << counterOfEvent[i]))
+						len += snprintf(summary->events + len, CORPUS_KEY_LENGTH - len, "%s%08X", len != 0 ? "+" : "", header.eventSel[i]);
+				}
+				if(header.groupCount > 1 && len < CORPUS_KEY_LENGTH)
+					snprintf(summary->events + len, CORPUS_KEY_LENGTH - len, "/%u", header.groupCount);
+				summary->logged = 1;
+			}
+			fclose(file);
+		}
+	}
+	free(first);
+	free(log);
+	if(summary->logged)
+		return;
+
+	strcpy(summary->workload, "-");
+	strcpy(summary->events, "-");
+	slash = strchr(path, '/');
+	if(slash == NULL)
+		return;
+	n = (size_t)(slash - path);
+	snprintf(summary->workload, CORPUS_KEY_LENGTH, "%.*s", (int)n, path);
+	path = slash + 1;
+	slash = strchr(path, '/');
+	if(slash != NULL)
+		snprintf(summary->events, CORPUS_KEY_LENGTH, "%.*s", (int)(slash - path), path);
+}
+
+static const CORPUS_RUN *FindByPath(const CORPUS_CACHE *cache, const char *path){
+	CORPUS_RUN key;
+
+	key.path = (char*)path;
+	return (const CORPUS_RUN*)bsearch(&key, cache->byPath, cache->count, sizeof(CORPUS_RUN), CompareRunPath);
+}
+
+static const CORPUS_RUN *FindByContent(const CORPUS_CACHE *cache, UINT64 hash, UINT64 size){
+	const CORPUS_RUN * const *found;
+	CORPUS_RUN key;
+	const CORPUS_RUN *pkey = &key;
+
+	key.summary.hash = hash;
+	key.summary.size = size;
+	found = (const CORPUS_RUN* const*)bsearch(&pkey, cache->byHash, cache->count, sizeof(PCORPUS_RUN), CompareRunHash);
+	return found != NULL ? *found : NULL;
+}
+
+/*
+* Hash a file and take over the summary of the same content, else parse it with threads
+* threads; returns 1 if it was parsed, 0 if taken over and -1 on errors
+*/
+static int Summarize(const char *root, PCORPUS_RUN run, const CORPUS_CACHE *cache, const CORPUS_OPTIONS *options, int threads){
+	PCORPUS_SUMMARY summary = &run->summary;
+	const CORPUS_RUN *same;
+	CSV_OPTIONS csv;
+	CSV_RESULT result;
+	struct stat st;
+	void *map = NULL;
+	char *full;
+	int fd, rc;
+
+	full = JoinPath(root, run->path);
+	fd = full != NULL ? open(full, O_RDONLY) : -1;
+	free(full);
+	if(fd < 0)
+		return -1;
+	if(fstat(fd, &st) != 0){
+		close(fd);
+		return -1;
+	}
+	summary->size = (UINT64)st.st_size;
+	summary->mtime = (INT64)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+	if(st.st_size != 0){
+		map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(map == MAP_FAILED){
+			close(fd);
+			return -1;
+		}
+		madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+	}
+	close(fd);
+	summary->hash = CorpusHash(map != NULL ? map : "", (size_t)st.st_size);
+
+	same = FindByContent(cache, summary->hash, summary->size);
+	if(same != NULL){
+		run->summary = same->summary;
+		summary->mtime = (INT64)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+		rc = 0;
+	}else{
+		memset(&csv, 0, sizeof(csv));
+		csv.threads = threads;
+		csv.legacy = options->legacy;
+		rc = CsvAnalyze(map != NULL ? (const char*)map : "", (size_t)st.st_size, &csv, &result) == 0 ? 1 : -1;
+		if(rc == 1){
+			summary->rows = result.rows;
+			summary->bad = result.bad;
+			summary->repaired = result.repaired;
+			summary->columns = result.columns;
+			memcpy(summary->totals, result.totals, sizeof(summary->totals));
+			memcpy(summary->counters, result.counters, sizeof(summary->counters));
+			memcpy(summary->derived, result.derived, sizeof(summary->derived));
+			CsvFreeResult(&result);
+		}
+	}
+	if(map != NULL)
+		munmap(map, (size_t)st.st_size);
+	//the keys follow the file even if its content was seen before under another path
+	if(rc >= 0)
+		RunKeys(root, run->path, summary);
+	run->valid = rc >= 0;
+	return rc;
+}
+
+static void Counted(SUMMARIZE_JOB *job, PCORPUS_RUN run, int rc){
+	pthread_mutex_lock(&job->lock);
+	if(rc == 1){
+		job->parsed++;
+		job->bytesParsed += run->summary.size;
+	}else if(rc == 0)
+		job->moved++;
+	else
+		job->failed++;
+	pthread_mutex_unlock(&job->lock);
+}
+
+static void *SummarizeThread(void *context){
+	SUMMARIZE_JOB *job = (SUMMARIZE_JOB*)context;
+	PCORPUS_RUN run;
+
+	for(;;){
+		pthread_mutex_lock(&job->lock);
+		run = job->next < job->count ? job->todo[job->next++] : NULL;
+		pthread_mutex_unlock(&job->lock);
+		if(run == NULL)
+			return NULL;
+		Counted(job, run, Summarize(job->root, run, job->cache, job->options, 1));
+	}
+}
+
+static int CompareRunSize(const void *x, const void *y){
+	UINT64 a = (*(const CORPUS_RUN* const*)x)->summary.size, b = (*(const CORPUS_RUN* const*)y)->summary.size;
+
+	return a > b ? -1 : a < b;
+}
+
+/*
+* Summarize the runs that need it: the large files first, each by all threads, then the
+* others largest first, one per thread, so the threads run out of work together
+*/
+static void SummarizeAll(SUMMARIZE_JOB *job){
+	pthread_t threads[CSV_MAX_THREADS];
+	int started[CSV_MAX_THREADS];
+	int t, count = job->options->threads;
+
+	qsort(job->todo, job->count, sizeof(PCORPUS_RUN), CompareRunSize);
+	while(job->next < job->count && job->todo[job->next]->summary.size >= CORPUS_BIG_FILE){
+		Counted(job, job->todo[job->next], Summarize(job->root, job->todo[job->next], job->cache, job->options, count));
+		job->next++;
+	}
+	if(count > (int)(job->count - job->next))
+		count = (int)(job->count - job->next);
+	for(t = 1; t < count; t++)
+		started[t] = pthread_create(&threads[t], NULL, SummarizeThread, job) == 0;
+	SummarizeThread(job);
+	for(t = 1; t < count; t++){
+		if(started[t])
+			pthread_join(threads[t], NULL);
+	}
+}
+
+int CorpusUpdate(const char *root, const CORPUS_OPTIONS *options, PCORPUS corpus){
+	CORPUS_OPTIONS settings = *options;
+	CORPUS_CACHE cache;
+	SUMMARIZE_JOB job;
+	FILE_LIST list;
+	const CORPUS_RUN *known;
+	char *cachePath;
+	UINT32 i, kept = 0;
+	int rc = 0, changed;
+
+	memset(corpus, 0, sizeof(*corpus));
+	memset(&list, 0, sizeof(list));
+	if(settings.threads < 1)
+		settings.threads = 1;
+	if(settings.threads > CSV_MAX_THREADS)
+		settings.threads = CSV_MAX_THREADS;
+	cachePath = options->cache != NULL ? strdup(options->cache) : JoinPath(root, CORPUS_CACHE_NAME);
+	if(cachePath == NULL || Walk(root, "", &list) != 0){
+		free(cachePath);
+		FreeRuns(list.runs, list.count);
+		return -1;
+	}
+	corpus->runs = list.runs;
+	corpus->count = list.count;
+	qsort(corpus->runs, corpus->count, sizeof(CORPUS_RUN), CompareRunPath);
+	LoadCache(cachePath, &settings, &cache);
+
+	memset(&job, 0, sizeof(job));
+	job.root = root;
+	job.options = &settings;
+	job.cache = &cache;
+	job.todo = (PCORPUS_RUN*)malloc(sizeof(PCORPUS_RUN) * (corpus->count + 1));
+	if(job.todo == NULL){
+		FreeCache(&cache);
+		free(cachePath);
+		CorpusFree(corpus);
+		return -1;
+	}
+	for(i = 0; i < corpus->count; i++){
+		known = FindByPath(&cache, corpus->runs[i].path);
+		if(known != NULL && known->summary.size == corpus->runs[i].summary.size && known->summary.mtime == corpus->runs[i].summary.mtime){
+			corpus->runs[i].summary = known->summary;
+			corpus->runs[i].valid = 1;
+			kept++;
+		}else
+			job.todo[job.count++] = &corpus->runs[i];
+	}
+	pthread_mutex_init(&job.lock, NULL);
+	SummarizeAll(&job);
+	pthread_mutex_destroy(&job.lock);
+	free(job.todo);
+
+	corpus->cached = kept;
+	corpus->moved = job.moved;
+	corpus->parsed = job.parsed;
+	corpus->failed = job.failed;
+	corpus->bytesParsed = job.bytesParsed;
+	//summaries of files that are gone
+	for(i = 0; i < cache.count; i++){
+		if(bsearch(&cache.byPath[i], corpus->runs, corpus->count, sizeof(CORPUS_RUN), CompareRunPath) == NULL)
+			corpus->removed++;
+	}
+	changed = job.count != 0 || corpus->removed != 0 || cache.count == 0;
+	if(changed && SaveCache(cachePath, &settings, corpus) != 0)
+		rc = -1;
+	FreeCache(&cache);
+	free(cachePath);
+	return rc;
+}
+
+void CorpusFree(PCORPUS corpus){
+	FreeRuns(corpus->runs, corpus->count);
+	memset(corpus, 0, sizeof(*corpus));
+}
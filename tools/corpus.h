@@ -0,0 +1,83 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* A corpus of runs: a directory tree of CSV sample files, one per run, laid out as
+*	root/<workload>/<events>/.../run.csv
+* Every file is summarized once by csvscan (rows, totals and moments of the counters and
+* derived metrics), and the summaries are kept in a cache file in the root. A file whose
+* size and modification time match its summary is not read again; a file that changed is
+* hashed, and if its content is that of a summary (touched, copied or moved) the summary is
+* taken over, else it is parsed. The files to read are spread over threads: one file per
+* thread, large files one after the other with every thread parsing one of them.
+*
+* The workload and the event configuration of a run come from its sample log, when the
+* file has one next to it (run.bin, see drv/hpclog.h): the test application and the event
+* selectors of the counters. Otherwise they are the first and second directory of its path
+* below the root, and "-" where there is none.
+*/
+
+#ifndef CORPUS_H
+#define CORPUS_H
+
+#include "csvscan.h"
+
+#define CORPUS_CACHE_NAME		".hpccorpus"
+#define CORPUS_CACHE_MAGIC		"HPCCORP"
+#define CORPUS_CACHE_VERSION	1
+#define CORPUS_KEY_LENGTH		128
+#define CORPUS_BIG_FILE			(256ULL << 20)	//files parsed by all threads, one after the other
+
+//what one run comes to
+typedef struct _CORPUS_SUMMARY {
+	UINT64 hash;					//of the content
+	UINT64 size;
+	INT64 mtime;					//modification time in ns
+	UINT64 rows;
+	UINT64 bad;
+	UINT64 repaired;
+	UINT32 columns;
+	UINT32 logged;					//workload and events come from the sample log
+	UINT64 totals[HPC_NUM_COUNTERS];
+	CSV_MOMENTS counters[HPC_NUM_COUNTERS];
+	CSV_MOMENTS derived[CSV_DERIVED];
+	char workload[CORPUS_KEY_LENGTH];
+	char events[CORPUS_KEY_LENGTH];
+} CORPUS_SUMMARY, *PCORPUS_SUMMARY;
+
+typedef struct _CORPUS_RUN {
+	char *path;						//relative to the root
+	CORPUS_SUMMARY summary;
+	int valid;						//the file could be summarized
+} CORPUS_RUN, *PCORPUS_RUN;
+
+typedef struct _CORPUS_OPTIONS {
+	int threads;
+	int legacy;						//see CSV_OPTIONS; the cache of other settings is not used
+	int rebuild;					//ignore the cache
+	const char *cache;				//cache file, NULL for root/CORPUS_CACHE_NAME
+} CORPUS_OPTIONS, *PCORPUS_OPTIONS;
+
+typedef struct _CORPUS {
+	PCORPUS_RUN runs;				//sorted by path
+	UINT32 count;
+	//what the last update did
+	UINT32 cached;					//summaries taken from the cache by size and time
+	UINT32 moved;					//taken from the cache by content
+	UINT32 parsed;
+	UINT32 failed;
+	UINT32 removed;					//summaries of files that are gone
+	UINT64 bytesParsed;
+} CORPUS, *PCORPUS;
+
+/*
+* Walk the root, bring the summaries of all files up to date and write the cache back if
+* it changed. Returns 0 on success, -1 if the root cannot be read or the cache not written;
+* the corpus is freed with CorpusFree.
+*/
+int CorpusUpdate(const char *root, const CORPUS_OPTIONS *options, PCORPUS corpus);
+void CorpusFree(PCORPUS corpus);
+
+//hash of the content of a file, also its key in the cache
+UINT64 CorpusHash(const void *data, size_t len);
+
+#endif
@@ -0,0 +1,206 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Benchmark and check of the CSV analysis of csvscan.h on a synthetic file shaped like
+* output/hpcoutput-sampl.csv: a header and rows of about 50000 instructions with the
+* default events of the driver, plus a few values printed with the sign extension of the
+* original driver's Extract48BitVal. The generator keeps the exact totals and the moments
+* of the derived metrics, which the analysis must reproduce with every thread count. It
+* reports the throughput of the mapped file (in the page cache after the first run) and,
+* for comparison, that of parsing the rows one at a time with fgets and strtoull.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "csvscan.h"
+
+#define TIME_RUNS 3
+
+static UINT64 rngState = 0x2545F4914F6CDD1Dull;
+
+static UINT64 NowNs(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (UINT64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static UINT64 Random(UINT64 range){
+	rngState ^= rngState >> 12;
+	rngState ^= rngState << 25;
+	rngState ^= rngState >> 27;
+	return ((rngState * 0x2545F4914F6CDD1Dull) >> 11) % range;
+}
+
+/*
+* Write rows until the file has size bytes; returns the number of rows and fills the exact result
+*/
+static UINT64 Generate(FILE *file, UINT64 size, PCSV_RESULT exact, UINT64 *legacyValues){
+	UINT64 ctr[HPC_NUM_COUNTERS], written, rows = 0;
+	CSV_MOMENTS *m;
+	double value, delta;
+	int c, k;
+
+	memset(exact, 0, sizeof(*exact));
+	memset(ctr, 0, sizeof(ctr));		//the file has the seven columns of the original driver only
+	written = fprintf(file, "ins,l_cycle,ref_cycle,event1,event2,event3,event4\r\n");
+	while(written < size){
+		ctr[0] = 50000 + Random(200);					//period plus skid
+		ctr[1] = Random(8) != 0 ? 40000 + Random(160000) : 0;
+		ctr[2] = 80000 + Random(120000);
+		ctr[3] = 8000 + Random(5000);
+		ctr[4] = 300 + Random(200);
+		ctr[5] = 2000 + Random(2500);
+		ctr[6] = 500 + Random(1000);
+		if(Random(10000) == 0){
+			//a long polling interval with bit 31 set, which the original driver printed as 2^64 - 2^32 + value
+			ctr[2] = 0x80000000u + Random(0x7FFFFFFF);
+			written += fprintf(file, "%llu,%llu,%llu,%llu,%llu,%llu,%llu\r\n", (unsigned long long)ctr[0],
+				(unsigned long long)ctr[1], (unsigned long long)(ctr[2] - ((UINT64)1 << 32)), (unsigned long long)ctr[3],
+				(unsigned long long)ctr[4], (unsigned long long)ctr[5], (unsigned long long)ctr[6]);
+			(*legacyValues)++;
+		}else
+			written += fprintf(file, "%llu,%llu,%llu,%llu,%llu,%llu,%llu\r\n", (unsigned long long)ctr[0],
+				(unsigned long long)ctr[1], (unsigned long long)ctr[2], (unsigned long long)ctr[3],
+				(unsigned long long)ctr[4], (unsigned long long)ctr[5], (unsigned long long)ctr[6]);
+		for(c = 0; c < HPC_NUM_COUNTERS; c++){
+			exact->counters[c].min = rows == 0 || ctr[c] < exact->counters[c].min ? ctr[c] : exact->counters[c].min;
+			exact->counters[c].max = ctr[c] > exact->counters[c].max ? ctr[c] : exact->counters[c].max;
+			exact->totals[c] += ctr[c];
+		}
+		for(k = 0; k < CSV_DERIVED; k++){
+			if(!CsvDerive(ctr, k, &value))
+				continue;
+			//Welford, one value at a time
+			m = &exact->derived[k];
+			m->min = m->count == 0 || value < m->min ? value : m->min;
+			m->max = m->count == 0 || value > m->max ? value : m->max;
+			m->count++;
+			delta = value - m->mean;
+			m->mean += delta / m->count;
+			m->m2 += delta * (value - m->mean);
+		}
+		rows++;
+	}
+	exact->rows = rows;
+	return rows;
+}
+
+/*
+* The analysis before: one row at a time through stdio
+*/
+static UINT64 ParseNaive(const char *path, UINT64 *totals){
+	char line[256], *p;
+	FILE *file;
+	UINT64 rows = 0;
+	int c;
+
+	file = fopen(path, "rb");
+	if(file == NULL)
+		return 0;
+	if(fgets(line, sizeof(line), file) == NULL){
+		fclose(file);
+		return 0;
+	}
+	while(fgets(line, sizeof(line), file) != NULL){
+		p = line;
+		for(c = 0; c < HPC_COLUMN_PMC0 + 4; c++){
+			totals[c] += strtoull(p, &p, 10);
+			p++;
+		}
+		rows++;
+	}
+	fclose(file);
+	return rows;
+}
+
+static int Close(double a, double b, double tolerance){
+	return fabs(a - b) <= tolerance * (fabs(b) > 1 ? fabs(b) : 1);
+}
+
+int main(int argc, char *argv[]){
+	CSV_OPTIONS options;
+	CSV_RESULT exact, result;
+	UINT64 size = 256, rows, start, best, legacyValues = 0, naiveTotals[HPC_NUM_COUNTERS];
+	const char *path = "csvbench.csv";
+	FILE *file;
+	int maxThreads = (int)sysconf(_SC_NPROCESSORS_ONLN), keep = 0, opt, threads, run, c, k, errors = 0, ok;
+
+	while((opt = getopt(argc, argv, "m:j:o:k")) != -1){
+		switch(opt){
+		case 'm': size = strtoull(optarg, NULL, 0); break;
+		case 'j': maxThreads = atoi(optarg); break;
+		case 'o': path = optarg; break;
+		case 'k': keep = 1; break;
+		default:
+			fprintf(stderr, "usage: %s [-m MB] [-j max threads] [-o file] [-k]\n", argv[0]);
+			fprintf(stderr, "  -k  keep the generated file\n");
+			return 2;
+		}
+	}
+	if(maxThreads < 1)
+		maxThreads = 1;
+
+	file = fopen(path, "wb");
+	if(file == NULL){
+		perror(path);
+		return 1;
+	}
+	rows = Generate(file, size << 20, &exact, &legacyValues);
+	if(fclose(file) != 0){
+		perror(path);
+		return 1;
+	}
+	printf("%s: %llu MB, %llu rows, %llu sign-extended values\n", path, (unsigned long long)size,
+		(unsigned long long)rows, (unsigned long long)legacyValues);
+
+	memset(naiveTotals, 0, sizeof(naiveTotals));
+	start = NowNs();
+	ParseNaive(path, naiveTotals);
+	best = NowNs() - start;
+	printf("fgets+strtoull:     %7.3f GB/s\n", (double)(size << 20) / (double)best);
+
+	memset(&options, 0, sizeof(options));
+	options.windowRows = 1000;
+	for(threads = 1; threads <= maxThreads; threads *= 2){
+		options.threads = threads;
+		best = ~(UINT64)0;
+		ok = 1;
+		for(run = 0; run < TIME_RUNS; run++){
+			start = NowNs();
+			if(CsvAnalyzeFile(path, &options, &result) != 0){
+				fprintf(stderr, "analysis failed\n");
+				return 1;
+			}
+			if(NowNs() - start < best)
+				best = NowNs() - start;
+			if(result.rows != rows || result.bad != 0 || result.repaired != legacyValues)
+				ok = 0;
+			for(c = 0; c < HPC_NUM_COUNTERS; c++){
+				if(result.totals[c] != exact.totals[c] || result.counters[c].min != exact.counters[c].min
+					|| result.counters[c].max != exact.counters[c].max)
+					ok = 0;
+			}
+			for(k = 0; k < CSV_DERIVED; k++){
+				if(result.derived[k].count != exact.derived[k].count || result.derived[k].min != exact.derived[k].min
+					|| result.derived[k].max != exact.derived[k].max || !Close(result.derived[k].mean, exact.derived[k].mean, 1e-9)
+					|| !Close(CsvVariance(&result.derived[k]), CsvVariance(&exact.derived[k]), 1e-6))
+					ok = 0;
+			}
+			if(result.windowCount != (rows + 999) / 1000 || result.windows[0].rows != (rows < 1000 ? rows : 1000)
+				|| result.windows[0].ctr[0] == 0)
+				ok = 0;
+			CsvFreeResult(&result);
+		}
+		printf("csvscan %2d threads: %7.3f GB/s  check %s\n", threads, (double)(size << 20) / (double)best, ok ? "ok" : "FAILED");
+		errors += !ok;
+		if(threads < maxThreads && threads * 2 > maxThreads)
+			threads = maxThreads / 2;
+	}
+	if(!keep)
+		unlink(path);
+	return errors != 0;
+}
@@ -0,0 +1,702 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Parallel analysis of CSV sample files, see csvscan.h.
+*/
+
+#include <fcntl.h>
+#include <float.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "csvscan.h"
+
+#define COUNTER_MASK	(((UINT64)1 << 48) - 1)
+
+//bits of the double 2^52, whose mantissa takes a 48-bit counter as is
+#define DOUBLE_2_52			0x4330000000000000ULL
+#define DOUBLE_2_52_VALUE	4503599627370496.0
+
+//independent partial sums of the kernels, a multiple of the doubles in a vector
+#define CSV_LANES			4
+
+//longest unsigned 64-bit number
+#define MAX_DIGITS		20
+
+const char *csvCounterNames[HPC_NUM_COUNTERS] = HPC_COLUMN_NAMES;
+const char *csvDerivedNames[CSV_DERIVED] = { "ipc", "branch_mpki", "llc_mpki", "llc_miss_ratio" };
+
+//counters of the derived metrics: scale * num / den
+static const int derivedNum[CSV_DERIVED] = { 0, 4, 6, 6 };
+static const int derivedDen[CSV_DERIVED] = { 1, 0, 0, 5 };
+static const double derivedScale[CSV_DERIVED] = { 1, 1000, 1000, 1 };
+
+//column of every counter in a row; a counter the file does not have reads the value after the last column, 0
+typedef struct _CSV_LAYOUT {
+	int columns;
+	int counter[HPC_NUM_COUNTERS];
+	UINT32 present;					//bit mask of the counters the file has
+} CSV_LAYOUT, *PCSV_LAYOUT;
+
+//rows of a chunk in columns, the unit the kernels work on
+typedef struct _CSV_BLOCK {
+	UINT64 ctr[HPC_NUM_COUNTERS][CSV_BLOCK_ROWS];
+	double value[HPC_NUM_COUNTERS][CSV_BLOCK_ROWS];
+	double derived[CSV_DERIVED][CSV_BLOCK_ROWS];
+	double valid[CSV_DERIVED][CSV_BLOCK_ROWS];		//1 for a row with a value, else 0
+	double weight[CSV_BLOCK_ROWS];					//1 for a row, 0 for padding
+	UINT64 line[CSV_BLOCK_ROWS];
+	UINT32 rows;
+} CSV_BLOCK, *PCSV_BLOCK;
+
+//one chunk of the file and what its thread found in it
+typedef struct _CSV_JOB {
+	const char *begin;
+	const char *end;				//after the last line end of the chunk, or the end of the file
+	const CSV_LAYOUT *layout;
+	const CSV_OPTIONS *options;
+	UINT64 lines;					//line ends in the chunk, counted by the first pass
+	UINT64 firstLine;				//line number of begin
+	UINT64 firstWindow;
+	PCSV_BLOCK block;
+	CSV_RESULT part;
+	pthread_t thread;
+} CSV_JOB, *PCSV_JOB;
+
+double CsvVariance(const CSV_MOMENTS *moments){
+	return moments->count > 1 ? moments->m2 / (double)(moments->count - 1) : 0;
+}
+
+int CsvDerive(const UINT64 *ctr, int metric, double *value){
+	if(ctr[derivedDen[metric]] == 0)
+		return 0;
+	*value = derivedScale[metric] * (double)ctr[derivedNum[metric]] / (double)ctr[derivedDen[metric]];
+	return 1;
+}
+
+/*
+* Combine the moments of a block with those of the rows before it (Chan et al.)
+*/
+static void MergeMoments(PCSV_MOMENTS into, UINT64 count, double mean, double m2, double min, double max){
+	double delta, total;
+
+	if(count == 0)
+		return;
+	if(into->count == 0){
+		into->min = min;
+		into->max = max;
+	}else{
+		into->min = min < into->min ? min : into->min;
+		into->max = max > into->max ? max : into->max;
+	}
+	total = (double)into->count + (double)count;
+	delta = mean - into->mean;
+	into->m2 += m2 + delta * delta * (double)into->count * (double)count / total;
+	into->mean += delta * (double)count / total;
+	into->count += count;
+}
+
+/*
+* Find the counter columns in the header line, or take the first seven columns if there is none.
+* The counters after event4 are optional. Returns the start of the first row, NULL if a counter
+* column of the original driver is missing.
+*/
+static const char *ReadLayout(const char *data, const char *end, PCSV_LAYOUT layout){
+	const char *p = data, *name;
+	size_t len;
+	int i, header = p < end && (*p < '0' || *p > '9');
+
+	memset(layout, 0, sizeof(*layout));
+	for(i = 0; i < HPC_NUM_COUNTERS; i++)
+		layout->counter[i] = header || !(HPC_BASE_COLUMNS & (1u << i)) ? -1 : i;
+	while(p < end && *p != '\n' && *p != '\r'){
+		for(name = p; p < end && *p != ',' && *p != '\n' && *p != '\r'; p++)
+			;
+		len = p - name;
+		for(i = 0; header && i < HPC_NUM_COUNTERS; i++){
+			if(strlen(csvCounterNames[i]) == len && memcmp(name, csvCounterNames[i], len) == 0)
+				layout->counter[i] = layout->columns;
+		}
+		layout->columns++;
+		if(p < end && *p == ',')
+			p++;
+	}
+	for(i = 0; i < HPC_NUM_COUNTERS; i++){
+		if(layout->counter[i] < 0 || layout->counter[i] >= layout->columns || layout->counter[i] >= CSV_MAX_COLUMNS){
+			if(HPC_BASE_COLUMNS & (1u << i))
+				return NULL;
+			layout->counter[i] = CSV_MAX_COLUMNS;
+		}else
+			layout->present |= 1u << i;
+	}
+	if(!header)
+		return data;
+	while(p < end && *p != '\n')
+		p++;
+	return p < end ? p + 1 : end;
+}
+
+/*
+* Parse the digits at p, 8 bytes at a time where at least 8 are left before end (SWAR):
+* the bytes are XORed with '0', which leaves a digit as 0..9, and the first byte that is
+* not a digit found with a carry-free test of the high nibbles. The digits are shifted
+* to the top of the word and combined in pairs, quads and octets with three multiplies.
+* Returns the end of the number; *digits is its length, and 0 if p is no digit.
+*/
+HPC_INLINE const char *ParseNumber(const char *p, const char *end, UINT64 *value, int *digits){
+	static const UINT64 scale[9] = { 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000 };
+	UINT64 word, other, v = 0;
+	UINT32 d;
+	int len, n = 0;
+
+	while(end - p >= 8){
+		memcpy(&word, p, sizeof(word));
+		word ^= 0x3030303030303030ULL;
+		other = (word | (word + 0x0606060606060606ULL)) & 0xF0F0F0F0F0F0F0F0ULL;
+		len = other != 0 ? __builtin_ctzll(other) >> 3 : 8;
+		if(len == 0)
+			break;
+		word <<= 8 * (8 - len);
+		word = (word * 10 + (word >> 8)) & 0x00FF00FF00FF00FFULL;
+		word = (word * 100 + (word >> 16)) & 0x0000FFFF0000FFFFULL;
+		word = (word * 10000 + (word >> 32)) & 0xFFFFFFFFULL;
+		v = v * scale[len] + word;
+		n += len;
+		p += len;
+		if(len < 8){
+			*value = v;
+			*digits = n;
+			return p;
+		}
+	}
+	//near the end of the data, one byte at a time
+	while(p < end && (d = (UINT32)((UINT8)*p - '0')) < 10){
+		v = v * 10 + d;
+		p++;
+		n++;
+	}
+	*value = v;
+	*digits = n;
+	return p;
+}
+
+/*
+* Parse one line that is known to end in '\n' before end. Returns the start of the next line;
+* *ok is 1 for a row of the schema, 0 for a blank line and -1 for anything else.
+*/
+HPC_INLINE const char *ParseLine(const char *p, const char *end, const CSV_LAYOUT *layout, UINT64 *values, int *ok){
+	UINT64 v;
+	int col = 0, digits;
+
+	if(*p == '\n' || (*p == '\r' && p[1] == '\n')){
+		*ok = 0;
+		return p + (*p == '\r') + 1;
+	}
+	for(;;){
+		p = ParseNumber(p, end, &v, &digits);
+		if(digits == 0 || digits > MAX_DIGITS)
+			break;
+		if(col < CSV_MAX_COLUMNS)
+			values[col] = v;
+		col++;
+		if(*p != ',')
+			break;
+		p++;
+	}
+	if(*p == '\r')
+		p++;
+	*ok = *p == '\n' && col == layout->columns ? 1 : -1;
+	if(*p != '\n')
+		p = memchr(p, '\n', end - p);
+	return p + 1;
+}
+
+/*
+* Repair a counter the original driver sign extended: bits 48-63 not 0, or with legacy bit 31 set
+*/
+HPC_INLINE UINT64 RepairCounter(UINT64 x, UINT64 legacy, UINT64 *repaired){
+	UINT64 repair = (((x >> 48) + 0xFFFF) >> 16) | (legacy & (x >> 31));
+
+	*repaired += repair;
+	return (x + (repair << 32)) & COUNTER_MASK;
+}
+
+/*
+* Count, mean, m2, min and max of the values whose weight is 1, over rows padded to a multiple
+* of CSV_LANES. The sums are kept in CSV_LANES independent lanes, which fixes the order of the
+* additions, so the compiler can vectorize them without being allowed to reassociate.
+*/
+static void BlockMoments(const double *v, const double *weight, UINT32 n, PCSV_MOMENTS into){
+	double count[CSV_LANES], sum[CSV_LANES], m2[CSV_LANES], lo[CSV_LANES], hi[CSV_LANES], mean, d, skip, total = 0, rows = 0;
+	UINT32 r, l;
+
+	for(l = 0; l < CSV_LANES; l++){
+		count[l] = sum[l] = m2[l] = 0;
+		lo[l] = HUGE_VAL;
+		hi[l] = -HUGE_VAL;
+	}
+	for(r = 0; r < n; r += CSV_LANES){
+		for(l = 0; l < CSV_LANES; l++){
+			count[l] += weight[r + l];
+			sum[l] += weight[r + l] * v[r + l];
+		}
+	}
+	//a row of weight 0 is moved out of the range instead of branched around
+	for(r = 0; r < n; r += CSV_LANES){
+		for(l = 0; l < CSV_LANES; l++){
+			skip = (1 - weight[r + l]) * DBL_MAX;
+			lo[l] = v[r + l] + skip < lo[l] ? v[r + l] + skip : lo[l];
+			hi[l] = v[r + l] - skip > hi[l] ? v[r + l] - skip : hi[l];
+		}
+	}
+	for(l = 0; l < CSV_LANES; l++){
+		rows += count[l];
+		total += sum[l];
+	}
+	if(rows == 0)
+		return;
+	mean = total / rows;
+	for(r = 0; r < n; r += CSV_LANES){
+		for(l = 0; l < CSV_LANES; l++){
+			d = v[r + l] - mean;
+			m2[l] += weight[r + l] * d * d;
+		}
+	}
+	for(l = 1; l < CSV_LANES; l++){
+		m2[0] += m2[l];
+		lo[0] = lo[l] < lo[0] ? lo[l] : lo[0];
+		hi[0] = hi[l] > hi[0] ? hi[l] : hi[0];
+	}
+	MergeMoments(into, (UINT64)rows, mean, m2[0], lo[0], hi[0]);
+}
+
+/*
+* Kernels over the columns of a full block: repair, totals, moments, derived metrics, sketches, windows
+*/
+static void RunKernels(PCSV_JOB job){
+	PCSV_BLOCK b = job->block;
+	PCSV_RESULT part = &job->part;
+	PSTAT_METRIC sketch;
+	UINT64 *x, sum, repaired = 0, legacy = job->options->legacy ? 1 : 0, w;
+	union { UINT64 bits; double value; } convert;
+	double *f, *ok;
+	UINT32 n = b->rows, padded = (n + CSV_LANES - 1) & ~(CSV_LANES - 1), r;
+	int c, k;
+
+	//rows of zeros pad the block; they weigh nothing and have no derived values
+	for(r = 0; r < padded; r++)
+		b->weight[r] = r < n;
+	for(c = 0; c < HPC_NUM_COUNTERS; c++){
+		for(r = n; r < padded; r++)
+			b->ctr[c][r] = 0;
+	}
+
+	for(c = 0; c < HPC_NUM_COUNTERS; c++){
+		if(!(job->layout->present & (1u << c)))
+			continue;		//all 0 from ParseLines
+		x = b->ctr[c];
+		f = b->value[c];
+		sum = 0;
+		//repair, then convert through the mantissa of 2^52: the conversion of a UINT64 does not vectorize
+		for(r = 0; r < padded; r++){
+			x[r] = RepairCounter(x[r], legacy, &repaired);
+			sum += x[r];
+			convert.bits = x[r] | DOUBLE_2_52;
+			f[r] = convert.value - DOUBLE_2_52_VALUE;
+		}
+		part->totals[c] += sum;
+		BlockMoments(f, b->weight, padded, &part->counters[c]);
+	}
+	part->repaired += repaired;
+
+	//the denominator of a row without a value is made 1 so the division stays branch free
+	for(k = 0; k < CSV_DERIVED; k++){
+		f = b->value[derivedDen[k]];
+		ok = b->valid[k];
+		for(r = 0; r < padded; r++){
+			ok[r] = f[r] != 0 ? 1.0 : 0.0;
+			b->derived[k][r] = derivedScale[k] * b->value[derivedNum[k]][r] / (f[r] + 1 - ok[r]);
+		}
+	}
+	for(k = 0; k < CSV_DERIVED; k++)
+		BlockMoments(b->derived[k], b->valid[k], padded, &part->derived[k]);
+
+	if(part->sketches != NULL){
+		for(c = 0; c < HPC_NUM_COUNTERS; c++){
+			if(!(job->layout->present & (1u << c)))
+				continue;
+			sketch = &part->sketches[c];
+			for(r = 0; r < n; r++)
+				sketch->buckets[StatBucket(b->ctr[c][r])]++;
+		}
+		for(k = 0; k < CSV_DERIVED; k++){
+			sketch = &part->sketches[HPC_NUM_COUNTERS + k];
+			for(r = 0; r < n; r++){
+				if(b->valid[k][r] != 0)
+					sketch->buckets[StatBucket((UINT64)(b->derived[k][r] * STAT_RATIO_SCALE + 0.5))]++;
+			}
+		}
+	}
+
+	if(part->windows != NULL){
+		for(r = 0; r < n; r++){
+			w = b->line[r] / part->windowRows - job->firstWindow;
+			part->windows[w].rows++;
+			for(c = 0; c < HPC_NUM_COUNTERS; c++)
+				part->windows[w].ctr[c] += b->ctr[c][r];
+		}
+	}
+	part->rows += n;
+	b->rows = 0;
+}
+
+/*
+* Parse the lines of [p, end), which end in '\n', into blocks
+*/
+static void ParseLines(PCSV_JOB job, const char *p, const char *end, UINT64 *line){
+	const CSV_LAYOUT *layout = job->layout;
+	PCSV_BLOCK b = job->block;
+	UINT64 values[CSV_MAX_COLUMNS + 1];
+	int ok, c;
+
+	values[CSV_MAX_COLUMNS] = 0;
+	while(p < end){
+		p = ParseLine(p, end, layout, values, &ok);
+		if(ok > 0){
+			for(c = 0; c < HPC_NUM_COUNTERS; c++)
+				b->ctr[c][b->rows] = values[layout->counter[c]];
+			b->line[b->rows] = *line;
+			if(++b->rows == CSV_BLOCK_ROWS)
+				RunKernels(job);
+		}else if(ok < 0)
+			job->part.bad++;
+		(*line)++;
+	}
+}
+
+static void *CountThread(void *context){
+	PCSV_JOB job = (PCSV_JOB)context;
+	const char *p = job->begin;
+
+	while(p < job->end && (p = memchr(p, '\n', job->end - p)) != NULL){
+		job->lines++;
+		p++;
+	}
+	return NULL;
+}
+
+static void *ParseThread(void *context){
+	PCSV_JOB job = (PCSV_JOB)context;
+	const char *last = job->end;
+	char tail[CSV_MAX_COLUMNS * (MAX_DIGITS + 1) + 4];
+	UINT64 line = job->firstLine;
+	size_t len;
+
+	//only the last chunk can end without a line end; its last line is parsed from a copy that has one
+	while(last > job->begin && last[-1] != '\n')
+		last--;
+	ParseLines(job, job->begin, last, &line);
+	len = job->end - last;
+	if(len != 0){
+		if(len > sizeof(tail) - 1)
+			job->part.bad++;
+		else{
+			memcpy(tail, last, len);
+			tail[len] = '\n';
+			ParseLines(job, tail, tail + len + 1, &line);
+		}
+	}
+	if(job->block->rows != 0)
+		RunKernels(job);
+	return NULL;
+}
+
+/*
+* Thread-local part of the result: sketches and the windows the chunk's lines fall into
+*/
+static int InitPart(PCSV_JOB job, UINT64 windowRows){
+	PCSV_RESULT part = &job->part;
+	UINT64 lastLine;
+
+	memset(part, 0, sizeof(*part));
+	job->block = malloc(sizeof(CSV_BLOCK));
+	if(job->block == NULL)
+		return -1;
+	job->block->rows = 0;
+	if(job->options->quantiles){
+		part->sketches = calloc(HPC_NUM_COUNTERS + CSV_DERIVED, sizeof(STAT_METRIC));
+		if(part->sketches == NULL)
+			return -1;
+	}
+	if(windowRows != 0){
+		lastLine = job->firstLine + job->lines + (job->end > job->begin && job->end[-1] != '\n');
+		job->firstWindow = job->firstLine / windowRows;
+		part->windowRows = windowRows;
+		part->windowCount = lastLine > job->firstLine ? (lastLine - 1) / windowRows - job->firstWindow + 1 : 0;
+		part->windows = calloc(part->windowCount + 1, sizeof(CSV_WINDOW));
+		if(part->windows == NULL)
+			return -1;
+	}
+	return 0;
+}
+
+static void FreePart(PCSV_JOB job){
+	free(job->block);
+	free(job->part.sketches);
+	free(job->part.windows);
+}
+
+/*
+* Sketches only count buckets while parsing; the bounds they clamp to come from the moments
+*/
+static void FinishSketch(PSTAT_METRIC sketch, const CSV_MOMENTS *moments, double scale){
+	UINT32 i;
+
+	sketch->count = 0;
+	for(i = 0; i < STAT_BUCKETS; i++)
+		sketch->count += sketch->buckets[i];
+	sketch->min = moments->count != 0 ? (UINT64)(moments->min * scale + 0.5) : 0;
+	sketch->max = moments->count != 0 ? (UINT64)(moments->max * scale + 0.5) : 0;
+	sketch->mean = moments->mean * scale;
+	sketch->m2 = moments->m2 * scale * scale;
+}
+
+int CsvAnalyze(const char *data, size_t len, const CSV_OPTIONS *options, PCSV_RESULT result){
+	CSV_JOB jobs[CSV_MAX_THREADS];
+	CSV_LAYOUT layout;
+	PCSV_RESULT part;
+	const char *body, *end = data + len, *cut;
+	UINT64 lines = 0, i;
+	int threads = options->threads, t, c, rc = 0;
+
+	memset(result, 0, sizeof(*result));
+	body = ReadLayout(data, end, &layout);
+	if(body == NULL)
+		return -1;
+	result->columns = layout.present;
+	if(threads < 1)
+		threads = 1;
+	if(threads > CSV_MAX_THREADS)
+		threads = CSV_MAX_THREADS;
+
+	//chunks of about equal size, cut after a line end
+	memset(jobs, 0, sizeof(jobs));
+	for(t = 0; t < threads; t++){
+		jobs[t].begin = t == 0 ? body : jobs[t - 1].end;
+		cut = body + (size_t)(end - body) * (t + 1) / threads;
+		if(cut < jobs[t].begin)
+			cut = jobs[t].begin;
+		if(t == threads - 1 || cut >= end)
+			cut = end;
+		else{
+			cut = memchr(cut, '\n', end - cut);
+			cut = cut != NULL ? cut + 1 : end;
+		}
+		jobs[t].end = cut;
+		jobs[t].layout = &layout;
+		jobs[t].options = options;
+	}
+
+	//the windows need the line number each chunk starts at
+	if(options->windowRows != 0){
+		for(t = 0; t < threads; t++)
+			pthread_create(&jobs[t].thread, NULL, CountThread, &jobs[t]);
+		for(t = 0; t < threads; t++){
+			pthread_join(jobs[t].thread, NULL);
+			jobs[t].firstLine = lines;
+			lines += jobs[t].lines;
+		}
+		if(end > body && end[-1] != '\n')
+			lines++;
+		result->windowRows = options->windowRows;
+		result->windowCount = (lines + options->windowRows - 1) / options->windowRows;
+		result->windows = calloc(result->windowCount + 1, sizeof(CSV_WINDOW));
+		if(result->windows == NULL)
+			rc = -1;
+	}
+	if(options->quantiles){
+		result->sketches = calloc(HPC_NUM_COUNTERS + CSV_DERIVED, sizeof(STAT_METRIC));
+		if(result->sketches == NULL)
+			rc = -1;
+	}
+	for(t = 0; t < threads && rc == 0; t++)
+		rc = InitPart(&jobs[t], options->windowRows);
+	if(rc != 0){
+		for(t = 0; t < threads; t++)
+			FreePart(&jobs[t]);
+		CsvFreeResult(result);
+		return -1;
+	}
+
+	for(t = 0; t < threads; t++)
+		pthread_create(&jobs[t].thread, NULL, ParseThread, &jobs[t]);
+	for(t = 0; t < threads; t++){
+		pthread_join(jobs[t].thread, NULL);
+		part = &jobs[t].part;
+		result->rows += part->rows;
+		result->bad += part->bad;
+		result->repaired += part->repaired;
+		for(c = 0; c < HPC_NUM_COUNTERS; c++){
+			result->totals[c] += part->totals[c];
+			MergeMoments(&result->counters[c], part->counters[c].count, part->counters[c].mean,
+				part->counters[c].m2, part->counters[c].min, part->counters[c].max);
+		}
+		for(c = 0; c < CSV_DERIVED; c++)
+			MergeMoments(&result->derived[c], part->derived[c].count, part->derived[c].mean,
+				part->derived[c].m2, part->derived[c].min, part->derived[c].max);
+		if(result->sketches != NULL){
+			for(c = 0; c < HPC_NUM_COUNTERS + CSV_DERIVED; c++){
+				for(i = 0; i < STAT_BUCKETS; i++)
+					result->sketches[c].buckets[i] += part->sketches[c].buckets[i];
+			}
+		}
+		for(i = 0; i < part->windowCount && jobs[t].firstWindow + i < result->windowCount; i++){
+			result->windows[jobs[t].firstWindow + i].rows += part->windows[i].rows;
+			for(c = 0; c < HPC_NUM_COUNTERS; c++)
+				result->windows[jobs[t].firstWindow + i].ctr[c] += part->windows[i].ctr[c];
+		}
+		FreePart(&jobs[t]);
+	}
+	if(result->sketches != NULL){
+		for(c = 0; c < HPC_NUM_COUNTERS; c++)
+			FinishSketch(&result->sketches[c], &result->counters[c], 1);
+		for(c = 0; c < CSV_DERIVED; c++)
+			FinishSketch(&result->sketches[HPC_NUM_COUNTERS + c], &result->derived[c], STAT_RATIO_SCALE);
+	}
+	return 0;
+}
+
+void CsvFreeResult(PCSV_RESULT result){
+	free(result->sketches);
+	free(result->windows);
+	result->sketches = NULL;
+	result->windows = NULL;
+}
+
+/*
+* Parse the lines of [p, end), which end in '\n', into the block of the reader, which is
+* passed on whenever it is full; returns what stopped the handler, else 0
+*/
+static int ReadLines(PCSV_ROWS b, const CSV_LAYOUT *layout, UINT64 legacy, const char *p, const char *end,
+	CSV_ROWS_HANDLER handler, void *context){
+	UINT64 values[CSV_MAX_COLUMNS + 1];
+	UINT32 r;
+	int ok, c, rc;
+
+	values[CSV_MAX_COLUMNS] = 0;
+	while(p < end){
+		p = ParseLine(p, end, layout, values, &ok);
+		if(ok > 0){
+			for(c = 0; c < HPC_NUM_COUNTERS; c++)
+				b->ctr[c][b->rows] = values[layout->counter[c]];
+			if(++b->rows < CSV_BLOCK_ROWS)
+				continue;
+			for(c = 0; c < HPC_NUM_COUNTERS; c++){
+				for(r = 0; r < CSV_BLOCK_ROWS; r++)
+					b->ctr[c][r] = RepairCounter(b->ctr[c][r], legacy, &b->repaired);
+			}
+			rc = handler(context, b);
+			b->rows = 0;
+			if(rc != 0)
+				return rc;
+		}else if(ok < 0)
+			b->bad++;
+	}
+	return 0;
+}
+
+int CsvReadRows(const char *data, size_t len, int legacy, CSV_ROWS_HANDLER handler, void *context){
+	CSV_LAYOUT layout;
+	PCSV_ROWS b;
+	const char *body, *end = data + len, *last = end;
+	char tail[CSV_MAX_COLUMNS * (MAX_DIGITS + 1) + 4];
+	UINT32 r;
+	int c, rc;
+
+	body = ReadLayout(data, end, &layout);
+	if(body == NULL)
+		return -1;
+	b = (PCSV_ROWS)malloc(sizeof(CSV_ROWS));
+	if(b == NULL)
+		return -1;
+	memset(b, 0, sizeof(*b));
+	b->columns = layout.present;
+	//the last line may lack its line end, it is parsed from a copy that has one
+	while(last > body && last[-1] != '\n')
+		last--;
+	rc = ReadLines(b, &layout, legacy ? 1 : 0, body, last, handler, context);
+	if(rc == 0 && end > last){
+		if((size_t)(end - last) > sizeof(tail) - 1)
+			b->bad++;
+		else{
+			memcpy(tail, last, end - last);
+			tail[end - last] = '\n';
+			rc = ReadLines(b, &layout, legacy ? 1 : 0, tail, tail + (end - last) + 1, handler, context);
+		}
+	}
+	if(rc == 0 && b->rows != 0){
+		for(c = 0; c < HPC_NUM_COUNTERS; c++){
+			for(r = 0; r < b->rows; r++)
+				b->ctr[c][r] = RepairCounter(b->ctr[c][r], legacy ? 1 : 0, &b->repaired);
+		}
+		rc = handler(context, b);
+	}
+	free(b);
+	return rc;
+}
+
+int CsvReadRowsFile(const char *path, int legacy, CSV_ROWS_HANDLER handler, void *context){
+	struct stat st;
+	void *map;
+	int fd, rc;
+
+	fd = open(path, O_RDONLY);
+	if(fd < 0)
+		return -1;
+	if(fstat(fd, &st) != 0){
+		close(fd);
+		return -1;
+	}
+	if(st.st_size == 0){
+		close(fd);
+		return CsvReadRows("", 0, legacy, handler, context);
+	}
+	map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED)
+		return -1;
+	madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+	rc = CsvReadRows((const char *)map, (size_t)st.st_size, legacy, handler, context);
+	munmap(map, (size_t)st.st_size);
+	return rc;
+}
+
+int CsvAnalyzeFile(const char *path, const CSV_OPTIONS *options, PCSV_RESULT result){
+	struct stat st;
+	void *map;
+	int fd, rc;
+
+	fd = open(path, O_RDONLY);
+	if(fd < 0)
+		return -1;
+	if(fstat(fd, &st) != 0){
+		close(fd);
+		return -1;
+	}
+	if(st.st_size == 0){
+		close(fd);
+		return CsvAnalyze("", 0, options, result);
+	}
+	map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED)
+		return -1;
+	madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+	rc = CsvAnalyze((const char *)map, (size_t)st.st_size, options, result);
+	munmap(map, (size_t)st.st_size);
+	return rc;
+}
@@ -0,0 +1,123 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Parallel analysis of the CSV sample files of the original driver and of hpcdump/hpcrun
+* (ins,l_cycle,ref_cycle,event1,event2,event3,event4, optionally followed by more columns,
+* among them the counters of PMUs with more counters: event5..event8 and slots).
+* The file is memory mapped and cut at line ends into one chunk per thread. Every thread
+* parses its chunk into columnar blocks of CSV_BLOCK_ROWS rows and runs the kernels over
+* the columns of a block: the moments, minima and maxima of every counter and of the
+* derived metrics, and optionally their quantile sketches (drv/hpcstats.h). The kernels
+* are plain loops over arrays without branches on the data, which the compiler vectorizes.
+* The results of the blocks and threads are merged like the moments of hpcstats.
+*
+* The derived metrics assume the default events of the driver, event1..event4 = branches
+* retired, mispredicted branches, LLC references and LLC misses:
+*	ipc = ins / l_cycle, branch_mpki and llc_mpki = misses per 1000 ins, llc_miss_ratio = event4 / event3
+* A row whose denominator is 0 has no value for that metric; l_cycle stays 0 in logs of the
+* original driver, which did not enable fixed counter 1.
+*
+* Counters are 48 bits wide. The original driver sign extended the low half of a counter
+* in Extract48BitVal, so a value whose bit 31 was set came out 2^32 too small, and printed
+* with %llu as a 20-digit number if it was below 2^32. Values of 2^48 and more can only come
+* from this and are always repaired; with legacy set every value with bit 31 set is.
+*
+* Per-window series split the file into windows of windowRows lines, counted from the first
+* line after the header. They need the line numbers of the chunks, which a first pass over
+* the file counts.
+*/
+
+#ifndef CSVSCAN_H
+#define CSVSCAN_H
+
+#include <stddef.h>
+#include "hpcstats.h"
+
+#define CSV_MAX_COLUMNS		24
+#define CSV_MAX_THREADS		64
+#define CSV_BLOCK_ROWS		1024
+
+//derived metrics
+#define CSV_IPC				0
+#define CSV_BRANCH_MPKI		1
+#define CSV_LLC_MPKI		2
+#define CSV_LLC_MISS_RATIO	3
+#define CSV_DERIVED			4
+
+extern const char *csvCounterNames[HPC_NUM_COUNTERS];
+extern const char *csvDerivedNames[CSV_DERIVED];
+
+typedef struct _CSV_OPTIONS {
+	int threads;
+	UINT64 windowRows;				//lines per window of the series, 0 for no series
+	int legacy;						//repair the sign extension of every value with bit 31 set
+	int quantiles;					//keep a quantile sketch of every counter and derived metric
+} CSV_OPTIONS, *PCSV_OPTIONS;
+
+//count, mean, variance, min and max of a column
+typedef struct _CSV_MOMENTS {
+	UINT64 count;
+	double mean;
+	double m2;
+	double min;
+	double max;
+} CSV_MOMENTS, *PCSV_MOMENTS;
+
+//sums over the rows of one window
+typedef struct _CSV_WINDOW {
+	UINT64 rows;
+	UINT64 ctr[HPC_NUM_COUNTERS];
+} CSV_WINDOW, *PCSV_WINDOW;
+
+typedef struct _CSV_RESULT {
+	UINT64 rows;					//parsed rows
+	UINT64 bad;						//lines that are not rows of the schema
+	UINT64 repaired;				//values repaired from the sign extension
+	UINT32 columns;					//bit mask of the counters the file has, the others are 0
+	UINT64 totals[HPC_NUM_COUNTERS];
+	CSV_MOMENTS counters[HPC_NUM_COUNTERS];
+	CSV_MOMENTS derived[CSV_DERIVED];
+	PSTAT_METRIC sketches;			//counters, then derived metrics in fixed point of STAT_RATIO_SCALE; NULL without quantiles
+	PCSV_WINDOW windows;
+	UINT64 windowCount;
+	UINT64 windowRows;
+} CSV_RESULT, *PCSV_RESULT;
+
+/*
+* Analyze len bytes of CSV. Returns 0 on success, -1 if the header lacks a counter column
+* or memory runs out; the result is freed with CsvFreeResult.
+*/
+int CsvAnalyze(const char *data, size_t len, const CSV_OPTIONS *options, PCSV_RESULT result);
+void CsvFreeResult(PCSV_RESULT result);
+
+//analyze a file through a read-only mapping
+int CsvAnalyzeFile(const char *path, const CSV_OPTIONS *options, PCSV_RESULT result);
+
+//a block of rows in columns, for readers that need the rows in order
+typedef struct _CSV_ROWS {
+	UINT64 ctr[HPC_NUM_COUNTERS][CSV_BLOCK_ROWS];
+	UINT32 rows;
+	UINT32 columns;					//bit mask of the counters the file has, the others are 0
+	UINT64 bad;						//lines so far that are not rows of the schema
+	UINT64 repaired;
+} CSV_ROWS, *PCSV_ROWS;
+
+//takes a block of rows; a value other than 0 stops the reader, which returns it
+typedef int (*CSV_ROWS_HANDLER)(void *context, const CSV_ROWS *rows);
+
+/*
+* Pass the rows of len bytes of CSV to handler in the order of the file, in blocks of up to
+* CSV_BLOCK_ROWS rows repaired like by CsvAnalyze, on the calling thread. Returns 0, -1 if the
+* header lacks a counter column or memory runs out, or the value that stopped the handler.
+*/
+int CsvReadRows(const char *data, size_t len, int legacy, CSV_ROWS_HANDLER handler, void *context);
+
+//read the rows of a file through a read-only mapping
+int CsvReadRowsFile(const char *path, int legacy, CSV_ROWS_HANDLER handler, void *context);
+
+double CsvVariance(const CSV_MOMENTS *moments);
+
+//value of a derived metric for sums or a row of counters, returns 0 if it has none
+int CsvDerive(const UINT64 *ctr, int metric, double *value);
+
+#endif
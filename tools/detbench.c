@@ -0,0 +1,484 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Determinism check of the collector on the string-operation programs of ../benchmarks
+* (after Weaver & McKee). Every program executes one string instruction a known number of
+* times, so its retired instructions and branches at user level are known exactly:
+*	rep_X:  the instructions of the program, the rep instruction counting once; no branches
+*	loop_X: the instructions of the program plus (iterations - 1) times the loop body;
+*	        one branch per iteration, the loop instruction
+* They are computed from the source: its instruction lines, the iteration count moved into
+* rcx and the instructions from the loop label to the loop instruction. A syscall that the
+* processor counts as a far branch shows up as a constant branch overcount of 1.
+*
+* detbench assembles the programs that are out of date, runs each one N times under hpcrun
+* with the given options (mode=polling by default, so a run is one sample) and sums the
+* samples of every run. For the instructions and branches of every program it prints the
+* overcount (measured - expected) of the runs as CSV: median, mean, standard deviation,
+* range, and the outliers, runs more than OUTLIER_MADS scaled median absolute deviations
+* from the median. -o writes the same CSV into a results file; given the results file of an
+* earlier run with -b, every counter whose median overcount moved by more than the tolerance
+* and the noise of both runs is a measurement regression of the collector or its configuration.
+*
+* Branches are only checked when event0 counts branches: the default, or raw event 0xC4 umask 0.
+* Exit code 0 when every run succeeded and nothing regressed, 1 otherwise, 2 on usage or setup errors.
+*/
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "logread.h"
+
+#define MAX_PROGRAMS	64
+#define MAX_OPTIONS		32
+#define NAME_SIZE		64
+#define PATH_SIZE		512
+
+#define COUNT_INS		0
+#define COUNT_BRANCHES	1
+#define COUNTS			2
+
+//outliers are further from the median than this many MADs scaled to a standard deviation, and at least OUTLIER_MIN
+#define OUTLIER_MADS	3.0
+#define OUTLIER_MIN		2.0
+#define MAD_TO_SD		1.4826
+
+//raw IA32_PERFEVTSEL event and umask of BR_INST_RETIRED.ALL_BRANCHES
+#define EVENT_BRANCHES	0x00C4
+
+static const char *countNames[COUNTS] = { "ins", "branches" };
+
+typedef struct _PROGRAM {
+	char name[NAME_SIZE];
+	UINT64 expected[COUNTS];
+	INT64 *overcount[COUNTS];		//one per run
+	UINT32 runs;
+} PROGRAM, *PPROGRAM;
+
+//overcounts of one counter over the runs
+typedef struct _SUMMARY {
+	double median;
+	double mean;
+	double sd;
+	INT64 min;
+	INT64 max;
+	UINT32 outliers;
+} SUMMARY, *PSUMMARY;
+
+static int verbose;
+
+/*
+* Run a command and wait for it; returns its exit status, or -1 if it did not exit normally
+*/
+static int Spawn(char *const argv[], int quiet){
+	pid_t pid;
+	int status, fd;
+
+	pid = fork();
+	if(pid < 0)
+		return -1;
+	if(pid == 0){
+		if(quiet){
+			fd = open("/dev/null", O_WRONLY);
+			dup2(fd, 1);
+			dup2(fd, 2);
+		}
+		execvp(argv[0], argv);
+		_exit(127);
+	}
+	if(waitpid(pid, &status, 0) != pid || !WIFEXITED(status))
+		return -1;
+	return WEXITSTATUS(status);
+}
+
+/*
+* Expected user-level counts of a program from its source; returns 0 on success
+*/
+static int ReadExpected(const char *path, PPROGRAM program){
+	char line[256], *p, *mnemonic, *operands;
+	UINT64 iterations = 0, instructions = 0, label = 0, body = 0;
+	FILE *file;
+	int loop = 0;
+
+	file = fopen(path, "r");
+	if(file == NULL)
+		return -1;
+	while(fgets(line, sizeof(line), file) != NULL){
+		if((p = strchr(line, '#')) != NULL)
+			*p = 0;
+		p = line + strspn(line, " \t\r\n");
+		if(*p == 0 || *p == '.')
+			continue;
+		mnemonic = p;
+		p += strcspn(p, " \t\r\n");
+		if(p > mnemonic && p[-1] == ':'){
+			//a label, maybe followed by an instruction
+			label = instructions;
+			mnemonic = p + strspn(p, " \t\r\n");
+			if(*mnemonic == 0)
+				continue;
+			p = mnemonic + strcspn(mnemonic, " \t\r\n");
+		}
+		if(*p != 0)
+			*p++ = 0;
+		operands = p + strspn(p, " \t");
+		instructions++;
+		if(strcmp(mnemonic, "mov") == 0 && operands[0] == '$' && strstr(operands, ",%rcx") != NULL)
+			iterations = strtoull(operands + 1, NULL, 0);
+		else if(strcmp(mnemonic, "loop") == 0){
+			loop = 1;
+			body = instructions - label;
+		}
+	}
+	fclose(file);
+	if(instructions == 0 || (loop && iterations == 0))
+		return -1;
+	program->expected[COUNT_INS] = instructions + (loop ? (iterations - 1) * body : 0);
+	program->expected[COUNT_BRANCHES] = loop ? iterations : 0;
+	return 0;
+}
+
+/*
+* Assemble and link a program if its binary is older than its source
+*/
+static int Build(const char *dir, const char *name){
+	char source[PATH_SIZE], object[PATH_SIZE], binary[PATH_SIZE];
+	char *as[] = { "as", "-o", object, source, NULL }, *ld[] = { "ld", "-o", binary, object, NULL };
+	struct stat src, bin;
+
+	if(snprintf(source, sizeof(source), "%s/%s.s", dir, name) >= (int)sizeof(source)
+		|| snprintf(object, sizeof(object), "%s/%s.o", dir, name) >= (int)sizeof(object)
+		|| snprintf(binary, sizeof(binary), "%s/%s", dir, name) >= (int)sizeof(binary))
+		return -1;
+	if(stat(source, &src) != 0)
+		return -1;
+	if(stat(binary, &bin) == 0 && bin.st_mtime >= src.st_mtime)
+		return 0;
+	if(Spawn(as, 0) != 0 || Spawn(ld, 0) != 0)
+		return -1;
+	return 0;
+}
+
+/*
+* One run under hpcrun: the counts summed over its samples. Returns 0 on success, 1 if the
+* run failed, 2 if the counters are not hardware counters.
+*/
+static int Run(const char *hpcrun, char **options, int optionCount, const char *binary, const char *log,
+	UINT64 *counts, int *branches){
+	char *argv[MAX_OPTIONS + 8], logOption[PATH_SIZE];
+	LOG_READER reader;
+	HPC_SAMPLE sample;
+	const char *error = NULL;
+	int argc = 0, i, rc;
+
+	argv[argc++] = (char *)hpcrun;
+	argv[argc++] = "mode=polling";
+	for(i = 0; i < optionCount; i++)
+		argv[argc++] = options[i];
+	snprintf(logOption, sizeof(logOption), "log=%s", log);
+	argv[argc++] = logOption;
+	argv[argc++] = "--";
+	argv[argc++] = (char *)binary;
+	argv[argc] = NULL;
+	if((rc = Spawn(argv, !verbose)) != 0){
+		fprintf(stderr, "%s: hpcrun exited with %d, -v shows its messages\n", binary, rc);
+		return 1;
+	}
+
+	if(LogReaderOpen(&reader, log, &error) != 0){
+		fprintf(stderr, "%s: %s\n", log, error != NULL ? error : "cannot be read");
+		return 1;
+	}
+	if(reader.header.flags & SAMPLE_LOG_FLAG_SOFTWARE){
+		LogReaderClose(&reader);
+		return 2;
+	}
+	*branches = reader.header.eventSel[0] == 0 || (reader.header.eventSel[0] & 0xFFFF) == EVENT_BRANCHES;
+	counts[COUNT_INS] = counts[COUNT_BRANCHES] = 0;
+	while((rc = LogReaderNext(&reader, &sample)) > 0){
+		counts[COUNT_INS] += sample.ctr[0];
+		counts[COUNT_BRANCHES] += sample.ctr[3];
+	}
+	if(rc < 0 || reader.header.dropped != 0){
+		fprintf(stderr, "%s: %s\n", binary, rc < 0 ? "corrupt log" : "samples were dropped");
+		LogReaderClose(&reader);
+		return 1;
+	}
+	LogReaderClose(&reader);
+	return 0;
+}
+
+static int CompareInt64(const void *a, const void *b){
+	INT64 x = *(const INT64 *)a, y = *(const INT64 *)b;
+	return x < y ? -1 : x > y;
+}
+
+static double Median(const INT64 *sorted, UINT32 n){
+	return n % 2 ? (double)sorted[n / 2] : ((double)sorted[n / 2 - 1] + (double)sorted[n / 2]) / 2;
+}
+
+static void Summarize(const INT64 *overcount, UINT32 n, PSUMMARY s){
+	INT64 *sorted, *deviation;
+	double mad, limit, d;
+	UINT32 i;
+
+	memset(s, 0, sizeof(*s));
+	sorted = malloc(n * sizeof(INT64));
+	deviation = malloc(n * sizeof(INT64));
+	if(sorted == NULL || deviation == NULL || n == 0){
+		free(sorted);
+		free(deviation);
+		return;
+	}
+	memcpy(sorted, overcount, n * sizeof(INT64));
+	qsort(sorted, n, sizeof(INT64), CompareInt64);
+	s->median = Median(sorted, n);
+	s->min = sorted[0];
+	s->max = sorted[n - 1];
+	for(i = 0; i < n; i++)
+		s->mean += (double)overcount[i] / n;
+	for(i = 0; i < n; i++){
+		d = (double)overcount[i] - s->mean;
+		s->sd += d * d;
+	}
+	s->sd = n > 1 ? sqrt(s->sd / (n - 1)) : 0;
+
+	//deviations doubled, so the median of an even count stays an integer
+	for(i = 0; i < n; i++)
+		deviation[i] = llabs(2 * sorted[i] - (INT64)(2 * s->median));
+	qsort(deviation, n, sizeof(INT64), CompareInt64);
+	mad = Median(deviation, n) / 2;
+	limit = OUTLIER_MADS * MAD_TO_SD * mad;
+	if(limit < OUTLIER_MIN)
+		limit = OUTLIER_MIN;
+	for(i = 0; i < n; i++){
+		if(fabs((double)overcount[i] - s->median) > limit)
+			s->outliers++;
+	}
+	free(sorted);
+	free(deviation);
+}
+
+/*
+* Compare with the results of an earlier run; returns the number of regressions
+*/
+static int CompareBaseline(const char *path, const PROGRAM *programs, int count, const SUMMARY (*summary)[COUNTS],
+	int branches, double tolerance){
+	char line[512], name[NAME_SIZE], counter[16];
+	double median, sd, limit;
+	FILE *file;
+	int regressions = 0, p, c, matched = 0;
+
+	file = fopen(path, "r");
+	if(file == NULL){
+		perror(path);
+		return 1;
+	}
+	while(fgets(line, sizeof(line), file) != NULL){
+		//program,counter,runs,expected,median,mean,sd,...
+		if(sscanf(line, "%63[^,],%15[^,],%*u,%*u,%lf,%*f,%lf", name, counter, &median, &sd) != 4)
+			continue;
+		for(p = 0; p < count && strcmp(programs[p].name, name) != 0; p++)
+			;
+		for(c = 0; c < COUNTS && strcmp(countNames[c], counter) != 0; c++)
+			;
+		if(p == count || c == COUNTS || programs[p].runs == 0 || (c == COUNT_BRANCHES && !branches))
+			continue;
+		matched++;
+		limit = tolerance + 3 * (sd + summary[p][c].sd);
+		if(fabs(summary[p][c].median - median) > limit){
+			fprintf(stderr, "regression: %s %s median overcount %.1f, was %.1f (limit %.1f)\n", name, counter,
+				summary[p][c].median, median, limit);
+			regressions++;
+		}
+	}
+	fclose(file);
+	if(matched == 0){
+		fprintf(stderr, "%s: no results of these programs\n", path);
+		regressions++;
+	}
+	return regressions;
+}
+
+static int CompareNames(const void *a, const void *b){
+	return strcmp(((const PROGRAM *)a)->name, ((const PROGRAM *)b)->name);
+}
+
+/*
+* All programs with a source in dir
+*/
+static int ListPrograms(const char *dir, PPROGRAM programs){
+	struct dirent *entry;
+	DIR *d;
+	size_t len;
+	int count = 0;
+
+	d = opendir(dir);
+	if(d == NULL)
+		return -1;
+	while((entry = readdir(d)) != NULL && count < MAX_PROGRAMS){
+		len = strlen(entry->d_name);
+		if(len < 3 || len - 2 >= NAME_SIZE || strcmp(entry->d_name + len - 2, ".s") != 0)
+			continue;
+		memcpy(programs[count].name, entry->d_name, len - 2);
+		programs[count].name[len - 2] = 0;
+		count++;
+	}
+	closedir(d);
+	qsort(programs, count, sizeof(PROGRAM), CompareNames);
+	return count;
+}
+
+static void Usage(const char *name){
+	fprintf(stderr, "usage: %s [-n runs] [-d dir] [-r hpcrun] [-o results.csv] [-b baseline.csv] [-t counts] [-v]\n", name);
+	fprintf(stderr, "       [program...] [-- hpcrun options...]\n");
+	fprintf(stderr, "  -n  runs of every program (default 10)\n");
+	fprintf(stderr, "  -d  directory of the programs' sources (default ../benchmarks)\n");
+	fprintf(stderr, "  -r  collector (default hpcrun next to %s)\n", name);
+	fprintf(stderr, "  -o  write the results into a CSV file\n");
+	fprintf(stderr, "  -b  flag changes of the median overcounts against an earlier results file\n");
+	fprintf(stderr, "  -t  change of a median overcount tolerated beyond 3 standard deviations (default 2)\n");
+	fprintf(stderr, "  -v  show the messages of the collector\n");
+}
+
+static void PrintResults(FILE *out, const PROGRAM *programs, int count, const SUMMARY (*summary)[COUNTS], int branches){
+	const SUMMARY *s;
+	int p, c;
+
+	fprintf(out, "program,counter,runs,expected,median,mean,sd,min,max,outliers\r\n");
+	for(p = 0; p < count; p++){
+		for(c = 0; c < COUNTS; c++){
+			if(c == COUNT_BRANCHES && !branches)
+				continue;
+			s = &summary[p][c];
+			fprintf(out, "%s,%s,%u,%llu,%.1f,%.2f,%.2f,%lld,%lld,%u\r\n", programs[p].name, countNames[c], programs[p].runs,
+				(unsigned long long)programs[p].expected[c], s->median, s->mean, s->sd, (long long)s->min, (long long)s->max,
+				s->outliers);
+		}
+	}
+}
+
+int main(int argc, char *argv[]){
+	static PROGRAM programs[MAX_PROGRAMS];
+	static SUMMARY summary[MAX_PROGRAMS][COUNTS];
+	char hpcrun[PATH_SIZE], source[PATH_SIZE], binary[PATH_SIZE], log[] = "/tmp/detbench-XXXXXX";
+	const char *dir = "../benchmarks", *resultsPath = NULL, *baselinePath = NULL, *slash;
+	char **options = NULL;
+	UINT64 counts[COUNTS];
+	UINT32 runs = 10, run;
+	double tolerance = 2;
+	FILE *out;
+	int opt, count = 0, optionCount = 0, p, c, rc, fd, branches = 1, runBranches, failed = 0;
+
+	slash = strrchr(argv[0], '/');
+	if(slash != NULL)
+		snprintf(hpcrun, sizeof(hpcrun), "%.*shpcrun", (int)(slash - argv[0] + 1), argv[0]);
+	else
+		snprintf(hpcrun, sizeof(hpcrun), "./hpcrun");
+	//options end at the first program name or at "--"
+	while((opt = getopt(argc, argv, "+n:d:r:o:b:t:v")) != -1){
+		switch(opt){
+		case 'n': runs = (UINT32)atoi(optarg); break;
+		case 'd': dir = optarg; break;
+		case 'r': snprintf(hpcrun, sizeof(hpcrun), "%s", optarg); break;
+		case 'o': resultsPath = optarg; break;
+		case 'b': baselinePath = optarg; break;
+		case 't': tolerance = atof(optarg); break;
+		case 'v': verbose = 1; break;
+		default:
+			Usage(argv[0]);
+			return 2;
+		}
+	}
+	//program names up to "--", hpcrun options after it
+	if(optind > 1 && strcmp(argv[optind - 1], "--") == 0){
+		options = argv + optind;
+		optionCount = argc - optind;
+		optind = argc;
+	}
+	for(; optind < argc; optind++){
+		if(strcmp(argv[optind], "--") == 0){
+			options = argv + optind + 1;
+			optionCount = argc - optind - 1;
+			break;
+		}
+		if(count == MAX_PROGRAMS || strlen(argv[optind]) >= NAME_SIZE){
+			Usage(argv[0]);
+			return 2;
+		}
+		strcpy(programs[count++].name, argv[optind]);
+	}
+	if(runs < 1 || optionCount > MAX_OPTIONS){
+		Usage(argv[0]);
+		return 2;
+	}
+	if(count == 0 && (count = ListPrograms(dir, programs)) <= 0){
+		fprintf(stderr, "%s: no programs\n", dir);
+		return 2;
+	}
+
+	fd = mkstemp(log);
+	if(fd < 0){
+		perror(log);
+		return 2;
+	}
+	close(fd);
+	for(p = 0; p < count; p++){
+		if(snprintf(source, sizeof(source), "%s/%s.s", dir, programs[p].name) >= (int)sizeof(source)
+			|| snprintf(binary, sizeof(binary), "%s/%s", dir, programs[p].name) >= (int)sizeof(binary)
+			|| ReadExpected(source, &programs[p]) != 0 || Build(dir, programs[p].name) != 0){
+			fprintf(stderr, "%s: cannot be read or built, or has no iteration count\n", source);
+			unlink(log);
+			return 2;
+		}
+		for(c = 0; c < COUNTS; c++){
+			programs[p].overcount[c] = calloc(runs, sizeof(INT64));
+			if(programs[p].overcount[c] == NULL){
+				unlink(log);
+				return 2;
+			}
+		}
+		for(run = 0; run < runs; run++){
+			rc = Run(hpcrun, options, optionCount, binary, log, counts, &runBranches);
+			if(rc == 2){
+				fprintf(stderr, "no hardware counters: hpcrun counted software events, which have no expected counts\n");
+				unlink(log);
+				return 2;
+			}
+			if(rc != 0){
+				failed++;
+				continue;
+			}
+			branches &= runBranches;
+			for(c = 0; c < COUNTS; c++)
+				programs[p].overcount[c][programs[p].runs] = (INT64)(counts[c] - programs[p].expected[c]);
+			programs[p].runs++;
+		}
+		for(c = 0; c < COUNTS; c++)
+			Summarize(programs[p].overcount[c], programs[p].runs, &summary[p][c]);
+	}
+	unlink(log);
+
+	PrintResults(stdout, programs, count, summary, branches);
+	if(resultsPath != NULL){
+		out = fopen(resultsPath, "wb");
+		if(out == NULL){
+			perror(resultsPath);
+			return 2;
+		}
+		PrintResults(out, programs, count, summary, branches);
+		if(fclose(out) != 0){
+			perror(resultsPath);
+			return 2;
+		}
+	}
+	if(baselinePath != NULL)
+		failed += CompareBaseline(baselinePath, programs, count, summary, branches, tolerance);
+	return failed != 0;
+}
@@ -0,0 +1,655 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* ELF symbols and DWARF line tables, see elfsym.h.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "elfsym.h"
+
+#define SHT_SYMTAB		2
+#define SHT_DYNSYM		11
+#define SHF_EXECINSTR	0x4
+#define SHF_COMPRESSED	0x800
+#define PT_LOAD			1
+#define STT_NOTYPE		0
+#define STT_FUNC		2
+#define STT_GNU_IFUNC	10
+
+//DWARF line program opcodes and the forms of the DWARF 5 entry formats
+#define DW_LNS_copy					1
+#define DW_LNS_advance_pc			2
+#define DW_LNS_advance_line			3
+#define DW_LNS_set_file				4
+#define DW_LNS_const_add_pc			8
+#define DW_LNS_fixed_advance_pc		9
+#define DW_LNE_end_sequence			1
+#define DW_LNE_set_address			2
+#define DW_LNE_define_file			3
+#define DW_LNCT_path				1
+#define DW_LNCT_directory_index		2
+#define DW_FORM_block				0x09
+#define DW_FORM_data1				0x0b
+#define DW_FORM_data2				0x05
+#define DW_FORM_data4				0x06
+#define DW_FORM_data8				0x07
+#define DW_FORM_data16				0x1e
+#define DW_FORM_string				0x08
+#define DW_FORM_strp				0x0e
+#define DW_FORM_udata				0x0f
+#define DW_FORM_line_strp			0x1f
+
+//a section header of either class
+typedef struct _ELF_SECTION {
+	UINT32 name;
+	UINT32 type;
+	UINT64 flags;
+	UINT64 offset;
+	UINT64 size;
+	UINT32 link;
+	UINT64 entsize;
+} ELF_SECTION;
+
+//bounds-checked reading of a section; error is set once a read runs past its end
+typedef struct _ELF_READER {
+	const UINT8 *p;
+	const UINT8 *end;
+	int error;
+} ELF_READER;
+
+static UINT64 Little(const UINT8 *p, int bytes){
+	UINT64 value = 0;
+	int i;
+
+	for(i = bytes - 1; i >= 0; i--)
+		value = (value << 8) | p[i];
+	return value;
+}
+
+static UINT64 ReadFixed(ELF_READER *r, int bytes){
+	UINT64 value;
+
+	if(r->error || r->end - r->p < bytes){
+		r->error = 1;
+		return 0;
+	}
+	value = Little(r->p, bytes);
+	r->p += bytes;
+	return value;
+}
+
+static UINT64 ReadUleb(ELF_READER *r){
+	UINT64 value = 0;
+	UINT32 shift = 0;
+	UINT8 byte;
+
+	do{
+		if(r->error || r->p >= r->end){
+			r->error = 1;
+			return 0;
+		}
+		byte = *r->p++;
+		if(shift < 64)
+			value |= (UINT64)(byte & 0x7F) << shift;
+		shift += 7;
+	}while(byte & 0x80);
+	return value;
+}
+
+static INT64 ReadSleb(ELF_READER *r){
+	INT64 value = 0;
+	UINT32 shift = 0;
+	UINT8 byte;
+
+	do{
+		if(r->error || r->p >= r->end){
+			r->error = 1;
+			return 0;
+		}
+		byte = *r->p++;
+		if(shift < 64)
+			value |= (INT64)(byte & 0x7F) << shift;
+		shift += 7;
+	}while(byte & 0x80);
+	if(shift < 64 && (byte & 0x40))
+		value |= -((INT64)1 << shift);
+	return value;
+}
+
+static const char *ReadString(ELF_READER *r){
+	const char *s = (const char *)r->p;
+	const UINT8 *nul = r->error ? NULL : memchr(r->p, 0, r->end - r->p);
+
+	if(nul == NULL){
+		r->error = 1;
+		return "";
+	}
+	r->p = nul + 1;
+	return s;
+}
+
+static void Skip(ELF_READER *r, UINT64 bytes){
+	if(r->error || (UINT64)(r->end - r->p) < bytes){
+		r->error = 1;
+		return;
+	}
+	r->p += bytes;
+}
+
+/*
+* Section header index of a 32-bit or 64-bit file
+*/
+static int ReadSection(const ELF_IMAGE *image, int is64, UINT64 shoff, UINT32 shentsize, UINT32 index, ELF_SECTION *s){
+	const UINT8 *h;
+
+	if(shoff + (UINT64)(index + 1) * shentsize > image->size || shentsize < (is64 ? 64u : 40u))
+		return -1;
+	h = image->data + shoff + (UINT64)index * shentsize;
+	s->name = (UINT32)Little(h, 4);
+	s->type = (UINT32)Little(h + 4, 4);
+	s->flags = is64 ? Little(h + 8, 8) : Little(h + 8, 4);
+	s->offset = is64 ? Little(h + 24, 8) : Little(h + 16, 4);
+	s->size = is64 ? Little(h + 32, 8) : Little(h + 20, 4);
+	s->link = (UINT32)(is64 ? Little(h + 40, 4) : Little(h + 24, 4));
+	s->entsize = is64 ? Little(h + 56, 8) : Little(h + 36, 4);
+	if(s->type != 8 && (s->offset > image->size || s->size > image->size - s->offset))		//SHT_NOBITS has no data
+		return -1;
+	return 0;
+}
+
+static int CompareSymbols(const void *a, const void *b){
+	const ELF_SYMBOL *x = (const ELF_SYMBOL *)a, *y = (const ELF_SYMBOL *)b;
+
+	if(x->addr != y->addr)
+		return x->addr < y->addr ? -1 : 1;
+	//of the symbols at one address the one with a size wins, it is kept first
+	if(x->size != y->size)
+		return x->size > y->size ? -1 : 1;
+	return 0;
+}
+
+/*
+* Code symbols of a symbol table: functions, and labels in executable sections
+*/
+static int LoadSymbols(PELF_IMAGE image, int is64, const ELF_SECTION *sections, UINT32 count, const ELF_SECTION *table){
+	const ELF_SECTION *strtab;
+	const UINT8 *sym;
+	UINT64 n, i, value, size, entsize = is64 ? 24 : 16;
+	UINT32 name, shndx, kept = 0;
+	UINT8 type;
+
+	if(table->link >= count || table->entsize < entsize)
+		return 0;
+	strtab = &sections[table->link];
+	n = table->size / table->entsize;
+	image->symbols = malloc((size_t)(n + 1) * sizeof(ELF_SYMBOL));
+	if(image->symbols == NULL)
+		return -1;
+	for(i = 1; i < n; i++){
+		sym = image->data + table->offset + i * table->entsize;
+		name = (UINT32)Little(sym, 4);
+		type = (is64 ? sym[4] : sym[12]) & 0xF;
+		shndx = (UINT32)(is64 ? Little(sym + 6, 2) : Little(sym + 14, 2));
+		value = is64 ? Little(sym + 8, 8) : Little(sym + 4, 4);
+		size = is64 ? Little(sym + 16, 8) : Little(sym + 8, 4);
+		//symbols without a name say nothing
+		if(shndx == 0 || shndx >= count || name >= strtab->size || image->data[strtab->offset + name] == 0 ||
+			memchr(image->data + strtab->offset + name, 0, (size_t)(strtab->size - name)) == NULL)
+			continue;
+		if(type != STT_FUNC && type != STT_GNU_IFUNC && !(type == STT_NOTYPE && (sections[shndx].flags & SHF_EXECINSTR)))
+			continue;
+		if(type == STT_NOTYPE)
+			size = 0;
+		image->symbols[kept].addr = value;
+		image->symbols[kept].size = size;
+		image->symbols[kept].name = (const char *)image->data + strtab->offset + name;
+		kept++;
+	}
+	qsort(image->symbols, kept, sizeof(ELF_SYMBOL), CompareSymbols);
+
+	//one symbol per address
+	for(i = 0, n = 0; i < kept; i++){
+		if(n == 0 || image->symbols[n - 1].addr != image->symbols[i].addr)
+			image->symbols[n++] = image->symbols[i];
+	}
+	image->symbolCount = (UINT32)n;
+	return 0;
+}
+
+static int AddLine(PELF_IMAGE image, UINT32 *capacity, UINT64 addr, UINT32 file, UINT32 line){
+	PELF_LINE grown;
+
+	if(image->lineCount == *capacity){
+		*capacity = *capacity ? 2 * *capacity : 4096;
+		grown = realloc(image->lines, *capacity * sizeof(ELF_LINE));
+		if(grown == NULL)
+			return -1;
+		image->lines = grown;
+	}
+	image->lines[image->lineCount].addr = addr;
+	image->lines[image->lineCount].file = file;
+	image->lines[image->lineCount].line = line;
+	image->lineCount++;
+	return 0;
+}
+
+static int AddFile(PELF_IMAGE image, UINT32 *capacity, const char *dir, const char *name){
+	char **grown;
+	size_t len;
+	char *path;
+
+	if(image->fileCount == *capacity){
+		*capacity = *capacity ? 2 * *capacity : 256;
+		grown = realloc(image->files, *capacity * sizeof(char *));
+		if(grown == NULL)
+			return -1;
+		image->files = grown;
+	}
+	if(dir == NULL || dir[0] == 0 || name[0] == '/')
+		dir = NULL;
+	len = (dir != NULL ? strlen(dir) + 1 : 0) + strlen(name) + 1;
+	path = malloc(len);
+	if(path == NULL)
+		return -1;
+	if(dir != NULL)
+		snprintf(path, len, "%s/%s", dir, name);
+	else
+		memcpy(path, name, len);
+	image->files[image->fileCount++] = path;
+	return 0;
+}
+
+/*
+* Value of an attribute of a DWARF 5 entry; strings are returned in str, numbers in value
+*/
+static void ReadForm(ELF_READER *r, UINT64 form, int offset64, const ELF_READER *debugStr, const ELF_READER *lineStr,
+	const char **str, UINT64 *value){
+	const ELF_READER *table;
+	UINT64 off;
+
+	*str = NULL;
+	*value = 0;
+	switch(form){
+	case DW_FORM_string:	*str = ReadString(r); break;
+	case DW_FORM_strp:
+	case DW_FORM_line_strp:
+		off = ReadFixed(r, offset64 ? 8 : 4);
+		table = form == DW_FORM_strp ? debugStr : lineStr;
+		if(table->p != NULL && off < (UINT64)(table->end - table->p) && memchr(table->p + off, 0, table->end - table->p - off) != NULL)
+			*str = (const char *)table->p + off;
+		else
+			*str = "";
+		break;
+	case DW_FORM_udata:		*value = ReadUleb(r); break;
+	case DW_FORM_data1:		*value = ReadFixed(r, 1); break;
+	case DW_FORM_data2:		*value = ReadFixed(r, 2); break;
+	case DW_FORM_data4:		*value = ReadFixed(r, 4); break;
+	case DW_FORM_data8:		*value = ReadFixed(r, 8); break;
+	case DW_FORM_data16:	Skip(r, 16); break;
+	case DW_FORM_block:		Skip(r, ReadUleb(r)); break;
+	default:				r->error = 1; break;
+	}
+}
+
+/*
+* Directories or files of a DWARF 5 line table header; files are added to the image
+* with their directory, directories are returned in dirs
+*/
+static int ReadEntries(PELF_IMAGE image, UINT32 *fileCapacity, ELF_READER *r, int offset64, const ELF_READER *debugStr,
+	const ELF_READER *lineStr, const char **dirs, UINT32 *dirCount, UINT32 maxDirs, int isFile){
+	UINT64 formats[16][2], count, i, value, dirIndex;
+	const char *str, *path;
+	UINT32 formatCount, f;
+
+	formatCount = (UINT32)ReadFixed(r, 1);
+	if(formatCount > 16)
+		return -1;
+	for(f = 0; f < formatCount; f++){
+		formats[f][0] = ReadUleb(r);
+		formats[f][1] = ReadUleb(r);
+	}
+	count = ReadUleb(r);
+	for(i = 0; i < count && !r->error; i++){
+		path = "";
+		dirIndex = 0;
+		for(f = 0; f < formatCount; f++){
+			ReadForm(r, formats[f][1], offset64, debugStr, lineStr, &str, &value);
+			if(formats[f][0] == DW_LNCT_path && str != NULL)
+				path = str;
+			else if(formats[f][0] == DW_LNCT_directory_index)
+				dirIndex = value;
+		}
+		if(!isFile){
+			if(*dirCount < maxDirs)
+				dirs[(*dirCount)++] = path;
+		}else if(AddFile(image, fileCapacity, dirIndex < *dirCount ? dirs[dirIndex] : NULL, path) != 0)
+			return -1;
+	}
+	return r->error ? -1 : 0;
+}
+
+/*
+* Run the line program of one unit of .debug_line; r is positioned after its unit length
+*/
+static int ReadLineUnit(PELF_IMAGE image, UINT32 *lineCapacity, UINT32 *fileCapacity, ELF_READER *r, int offset64,
+	const ELF_READER *debugStr, const ELF_READER *lineStr){
+	const char *dirs[256], *name;
+	UINT8 lengths[256];
+	ELF_READER program, ext;
+	UINT64 headerLength, address = 0, len, dir;
+	INT64 line = 1;
+	UINT32 version, minLength, lineRange, opcodeBase, firstFile, file = 1, dirCount = 0, i, op, adjusted;
+	INT32 lineBase;
+
+	version = (UINT32)ReadFixed(r, 2);
+	if(version < 2 || version > 5)
+		return -1;
+	if(version >= 5)
+		Skip(r, 2);						//address_size, segment_selector_size
+	headerLength = ReadFixed(r, offset64 ? 8 : 4);
+	if(r->error || headerLength > (UINT64)(r->end - r->p))
+		return -1;
+	program.p = r->p + headerLength;
+	program.end = r->end;
+	program.error = 0;
+
+	minLength = (UINT32)ReadFixed(r, 1);
+	if(version >= 4)
+		Skip(r, 1);						//maximum_operations_per_instruction, 1 on x86
+	Skip(r, 1);							//default_is_stmt
+	lineBase = (INT8)ReadFixed(r, 1);
+	lineRange = (UINT32)ReadFixed(r, 1);
+	opcodeBase = (UINT32)ReadFixed(r, 1);
+	if(r->error || lineRange == 0 || opcodeBase == 0)
+		return -1;
+	memset(lengths, 0, sizeof(lengths));
+	for(i = 1; i < opcodeBase; i++)
+		lengths[i] = (UINT8)ReadFixed(r, 1);
+
+	//files are numbered from 1 before DWARF 5 and from 0 since
+	firstFile = image->fileCount;
+	if(version >= 5){
+		if(ReadEntries(image, fileCapacity, r, offset64, debugStr, lineStr, dirs, &dirCount, 256, 0) != 0 ||
+			ReadEntries(image, fileCapacity, r, offset64, debugStr, lineStr, dirs, &dirCount, 256, 1) != 0)
+			return -1;
+	}else{
+		dirs[dirCount++] = NULL;		//directory 0 is that of the compilation
+		while(!r->error && *(name = ReadString(r)) != 0 && dirCount < 256)
+			dirs[dirCount++] = name;
+		if(AddFile(image, fileCapacity, NULL, "") != 0)	//file 0 does not exist
+			return -1;
+		while(!r->error && *(name = ReadString(r)) != 0){
+			dir = ReadUleb(r);
+			ReadUleb(r);
+			ReadUleb(r);
+			if(AddFile(image, fileCapacity, dir < dirCount ? dirs[dir] : NULL, name) != 0)
+				return -1;
+		}
+	}
+	if(r->error)
+		return -1;
+
+	while(!program.error && program.p < program.end){
+		op = (UINT32)ReadFixed(&program, 1);
+		if(op >= opcodeBase){
+			adjusted = op - opcodeBase;
+			address += (UINT64)(adjusted / lineRange) * minLength;
+			line += lineBase + (INT32)(adjusted % lineRange);
+			if(AddLine(image, lineCapacity, address, firstFile + file, line > 0 ? (UINT32)line : 1) != 0)
+				return -1;
+			continue;
+		}
+		switch(op){
+		case 0:
+			len = ReadUleb(&program);
+			if(program.error || len == 0 || len > (UINT64)(program.end - program.p))
+				return -1;
+			ext.p = program.p;
+			ext.end = program.p + len;
+			ext.error = 0;
+			program.p += len;
+			switch(ReadFixed(&ext, 1)){
+			case DW_LNE_end_sequence:
+				if(AddLine(image, lineCapacity, address, 0, 0) != 0)
+					return -1;
+				address = 0;
+				line = 1;
+				file = 1;
+				break;
+			case DW_LNE_set_address:
+				address = ReadFixed(&ext, (int)(len - 1 <= 8 ? len - 1 : 8));
+				break;
+			case DW_LNE_define_file:
+				if(AddFile(image, fileCapacity, NULL, ReadString(&ext)) != 0)
+					return -1;
+				break;
+			}
+			break;
+		case DW_LNS_copy:
+			if(AddLine(image, lineCapacity, address, firstFile + file, line > 0 ? (UINT32)line : 1) != 0)
+				return -1;
+			break;
+		case DW_LNS_advance_pc:		address += ReadUleb(&program) * minLength; break;
+		case DW_LNS_advance_line:	line += ReadSleb(&program); break;
+		case DW_LNS_set_file:		file = (UINT32)ReadUleb(&program); break;
+		case DW_LNS_const_add_pc:	address += (UINT64)((255 - opcodeBase) / lineRange) * minLength; break;
+		case DW_LNS_fixed_advance_pc:	address += ReadFixed(&program, 2); break;
+		default:
+			//column, is_stmt, basic block, prologue/epilogue and isa: skip their operands
+			for(i = 0; i < lengths[op]; i++)
+				ReadUleb(&program);
+			break;
+		}
+	}
+	return program.error ? -1 : 0;
+}
+
+static int CompareLines(const void *a, const void *b){
+	const ELF_LINE *x = (const ELF_LINE *)a, *y = (const ELF_LINE *)b;
+
+	if(x->addr != y->addr)
+		return x->addr < y->addr ? -1 : 1;
+	//the end of one sequence sorts before a row that starts the next at the same address
+	if((x->line == 0) != (y->line == 0))
+		return x->line == 0 ? -1 : 1;
+	return 0;
+}
+
+/*
+* Line table of all units of .debug_line; a unit that cannot be read ends the table,
+* the rows before it are kept
+*/
+static int LoadLines(PELF_IMAGE image, const ELF_SECTION *debugLine, const ELF_READER *debugStr, const ELF_READER *lineStr){
+	ELF_READER r, unit;
+	UINT32 lineCapacity = 0, fileCapacity = 0;
+	UINT64 length;
+	int offset64;
+
+	r.p = image->data + debugLine->offset;
+	r.end = r.p + debugLine->size;
+	r.error = 0;
+	while(!r.error && r.p < r.end){
+		length = ReadFixed(&r, 4);
+		offset64 = length == 0xFFFFFFFF;
+		if(offset64)
+			length = ReadFixed(&r, 8);
+		if(r.error || length > (UINT64)(r.end - r.p))
+			break;
+		unit.p = r.p;
+		unit.end = r.p + length;
+		unit.error = 0;
+		r.p += length;
+		if(ReadLineUnit(image, &lineCapacity, &fileCapacity, &unit, offset64, debugStr, lineStr) != 0)
+			break;
+	}
+	if(image->lineCount != 0)
+		qsort(image->lines, image->lineCount, sizeof(ELF_LINE), CompareLines);
+	return 0;
+}
+
+static int ReadFile(PELF_IMAGE image, const char *path){
+	FILE *file;
+	long size;
+
+	file = fopen(path, "rb");
+	if(file == NULL)
+		return -1;
+	if(fseek(file, 0, SEEK_END) != 0 || (size = ftell(file)) < 64 || fseek(file, 0, SEEK_SET) != 0){
+		fclose(file);
+		return -1;
+	}
+	image->size = (size_t)size;
+	image->data = malloc(image->size);
+	if(image->data == NULL || fread(image->data, 1, image->size, file) != image->size){
+		fclose(file);
+		return -1;
+	}
+	fclose(file);
+	return 0;
+}
+
+int ElfOpen(PELF_IMAGE image, const char *path){
+	ELF_SECTION *sections = NULL, names, *symtab = NULL, *dynsym = NULL, *debugLine = NULL;
+	ELF_READER debugStr, lineStr, *str;
+	UINT64 phoff, shoff;
+	UINT32 phentsize, phnum, shentsize, shnum, shstrndx, i;
+	const UINT8 *h, *ph;
+	const char *name;
+	int is64;
+
+	memset(image, 0, sizeof(*image));
+	memset(&debugStr, 0, sizeof(debugStr));
+	memset(&lineStr, 0, sizeof(lineStr));
+	if(ReadFile(image, path) != 0)
+		goto fail;
+	h = image->data;
+	if(memcmp(h, "\177ELF", 4) != 0 || (h[4] != 1 && h[4] != 2) || h[5] != 1)
+		goto fail;
+	is64 = h[4] == 2;
+	phoff = is64 ? Little(h + 0x20, 8) : Little(h + 0x1C, 4);
+	shoff = is64 ? Little(h + 0x28, 8) : Little(h + 0x20, 4);
+	phentsize = (UINT32)Little(h + (is64 ? 0x36 : 0x2A), 2);
+	phnum = (UINT32)Little(h + (is64 ? 0x38 : 0x2C), 2);
+	shentsize = (UINT32)Little(h + (is64 ? 0x3A : 0x2E), 2);
+	shnum = (UINT32)Little(h + (is64 ? 0x3C : 0x30), 2);
+	shstrndx = (UINT32)Little(h + (is64 ? 0x3E : 0x32), 2);
+
+	//the loadable segments map file offsets to addresses
+	if(phentsize < (is64 ? 56u : 32u) || phoff + (UINT64)phnum * phentsize > image->size)
+		goto fail;
+	for(i = 0; i < phnum && image->segmentCount < ELF_MAX_SEGMENTS; i++){
+		ph = image->data + phoff + (UINT64)i * phentsize;
+		if(Little(ph, 4) != PT_LOAD)
+			continue;
+		image->segments[image->segmentCount].offset = is64 ? Little(ph + 8, 8) : Little(ph + 4, 4);
+		image->segments[image->segmentCount].vaddr = is64 ? Little(ph + 16, 8) : Little(ph + 8, 4);
+		image->segments[image->segmentCount].size = is64 ? Little(ph + 32, 8) : Little(ph + 16, 4);
+		image->segmentCount++;
+	}
+
+	//without section headers there is nothing to resolve, but offsets still map
+	if(shnum == 0 || shstrndx >= shnum || ReadSection(image, is64, shoff, shentsize, shstrndx, &names) != 0)
+		return 0;
+	sections = malloc(shnum * sizeof(ELF_SECTION));
+	if(sections == NULL)
+		goto fail;
+	for(i = 0; i < shnum; i++){
+		if(ReadSection(image, is64, shoff, shentsize, i, &sections[i]) != 0){
+			sections[i].type = 0;
+			sections[i].size = 0;
+			continue;
+		}
+		if(sections[i].name >= names.size)
+			continue;
+		name = (const char *)image->data + names.offset + sections[i].name;
+		if(sections[i].type == SHT_SYMTAB)
+			symtab = &sections[i];
+		else if(sections[i].type == SHT_DYNSYM)
+			dynsym = &sections[i];
+		else if(sections[i].flags & SHF_COMPRESSED)
+			continue;
+		else if(strcmp(name, ".debug_line") == 0)
+			debugLine = &sections[i];
+		else if(strcmp(name, ".debug_str") == 0 || strcmp(name, ".debug_line_str") == 0){
+			str = name[7] == 's' ? &debugStr : &lineStr;
+			str->p = image->data + sections[i].offset;
+			str->end = str->p + sections[i].size;
+		}
+	}
+	if(symtab == NULL)
+		symtab = dynsym;
+	if(symtab != NULL && LoadSymbols(image, is64, sections, shnum, symtab) != 0)
+		goto fail;
+	if(debugLine != NULL && LoadLines(image, debugLine, &debugStr, &lineStr) != 0)
+		goto fail;
+	free(sections);
+	return 0;
+
+fail:
+	free(sections);
+	ElfClose(image);
+	return -1;
+}
+
+void ElfClose(PELF_IMAGE image){
+	UINT32 i;
+
+	for(i = 0; i < image->fileCount; i++)
+		free(image->files[i]);
+	free(image->files);
+	free(image->lines);
+	free(image->symbols);
+	free(image->data);
+	memset(image, 0, sizeof(*image));
+}
+
+int ElfOffsetToAddr(const ELF_IMAGE *image, UINT64 offset, UINT64 *addr){
+	UINT32 i;
+
+	for(i = 0; i < image->segmentCount; i++){
+		if(offset >= image->segments[i].offset && offset - image->segments[i].offset < image->segments[i].size){
+			*addr = offset - image->segments[i].offset + image->segments[i].vaddr;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+const ELF_SYMBOL *ElfFindSymbol(const ELF_IMAGE *image, UINT64 addr){
+	const ELF_SYMBOL *sym;
+	UINT32 lo = 0, hi = image->symbolCount, mid;
+
+	//last symbol at or below addr
+	while(lo < hi){
+		mid = lo + (hi - lo) / 2;
+		if(image->symbols[mid].addr <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if(lo == 0)
+		return NULL;
+	sym = &image->symbols[lo - 1];
+	if(sym->size != 0 && addr - sym->addr >= sym->size)
+		return NULL;
+	return sym;
+}
+
+const ELF_LINE *ElfFindLine(const ELF_IMAGE *image, UINT64 addr){
+	const ELF_LINE *row;
+	UINT32 lo = 0, hi = image->lineCount, mid;
+
+	while(lo < hi){
+		mid = lo + (hi - lo) / 2;
+		if(image->lines[mid].addr <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if(lo == 0)
+		return NULL;
+	row = &image->lines[lo - 1];
+	return row->line != 0 ? row : NULL;
+}
@@ -0,0 +1,65 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Symbols and line numbers of an ELF file, for the instruction pointers of the samples
+* of the Linux collector. An image holds the loadable segments, which map the file
+* offsets of a mapping (PERF_MAPPING) onto the addresses of the file, the code symbols
+* of .symtab, or of .dynsym if the file is stripped, and the line table of .debug_line
+* (DWARF 2 to 5) if the file was built with -g. Labels without a type in executable
+* sections count as functions, so hand-written assembly (../benchmarks) resolves too.
+* Compressed debug sections are not read; such files resolve to functions only.
+* An image is read-only once opened, so threads may look up addresses in it at once.
+* Only uses stdio, so it builds with the Windows SDK as well as on Linux.
+*/
+
+#ifndef ELFSYM_H
+#define ELFSYM_H
+
+#include "hpcport.h"
+
+#define ELF_MAX_SEGMENTS 16
+
+typedef struct _ELF_SEGMENT {
+	UINT64 offset;				//p_offset
+	UINT64 vaddr;				//p_vaddr
+	UINT64 size;				//p_filesz
+} ELF_SEGMENT, *PELF_SEGMENT;
+
+typedef struct _ELF_SYMBOL {
+	UINT64 addr;
+	UINT64 size;				//0 for labels, which reach up to the next symbol
+	const char *name;			//in the string table of the image
+} ELF_SYMBOL, *PELF_SYMBOL;
+
+//a row of the line table; a row with line 0 ends a sequence of rows
+typedef struct _ELF_LINE {
+	UINT64 addr;
+	UINT32 file;				//index into files
+	UINT32 line;
+} ELF_LINE, *PELF_LINE;
+
+typedef struct _ELF_IMAGE {
+	UINT8 *data;				//the whole file
+	size_t size;
+	ELF_SEGMENT segments[ELF_MAX_SEGMENTS];
+	UINT32 segmentCount;
+	PELF_SYMBOL symbols;		//sorted by address
+	UINT32 symbolCount;
+	PELF_LINE lines;			//sorted by address
+	UINT32 lineCount;
+	char **files;				//source file names of the line table
+	UINT32 fileCount;
+} ELF_IMAGE, *PELF_IMAGE;
+
+//returns 0 on success, -1 if the file cannot be read or is no little-endian ELF file
+int ElfOpen(PELF_IMAGE image, const char *path);
+void ElfClose(PELF_IMAGE image);
+
+//address in the file of an offset into it; returns -1 if no loadable segment holds the offset
+int ElfOffsetToAddr(const ELF_IMAGE *image, UINT64 offset, UINT64 *addr);
+
+//symbol and line row that hold an address, NULL if there is none
+const ELF_SYMBOL *ElfFindSymbol(const ELF_IMAGE *image, UINT64 addr);
+const ELF_LINE *ElfFindLine(const ELF_IMAGE *image, UINT64 addr);
+
+#endif
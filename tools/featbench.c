@@ -0,0 +1,181 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Throughput and check of the feature kernels (feature.c). Every window of a random
+* sample stream, with samples without instructions and counters up to 2^40, is computed
+* again directly from its samples and must match the features within the precision of
+* float32; this for tumbling and sliding windows. Then it reports the samples per second
+* the extractor takes for each shape of window, the rate to compare with the samples a
+* collector takes on all CPUs.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "feature.h"
+
+#define CHECK_SAMPLES	20000
+
+static UINT64 rngState = 1;
+
+static UINT64 Random(){
+	rngState = rngState * 6364136223846793005ULL + 1442695040888963407ULL;
+	return rngState >> 16;
+}
+
+static void RandomSample(UINT64 *ctr, UINT32 columns){
+	int c;
+
+	memset(ctr, 0, sizeof(UINT64) * HPC_NUM_COUNTERS);
+	ctr[0] = Random() % 16 == 0 ? 0 : 40000 + Random() % 20000;
+	for(c = 1; c < HPC_NUM_COUNTERS; c++){
+		if(columns & (1u << c))
+			ctr[c] = Random() % 64 == 0 ? Random() % ((UINT64)1 << 40) : Random() % (1u << (Random() % 20));
+	}
+}
+
+/*
+* The features of samples [first, first + window) computed directly
+*/
+static void Direct(const FEATURE_EXTRACTOR *fx, const UINT64 *samples, UINT64 first, double *vector){
+	UINT64 sum[HPC_NUM_COUNTERS], rated = 0, hist[FEATURE_BINS];
+	const UINT64 *s;
+	double mean, m2, lo, hi, rate;
+	UINT32 r, j = 0;
+	int c, k, e;
+
+	memset(sum, 0, sizeof(sum));
+	for(r = 0; r < fx->window; r++){
+		s = samples + (first + r) * HPC_NUM_COUNTERS;
+		for(c = 0; c < HPC_NUM_COUNTERS; c++)
+			sum[c] += s[c];
+		rated += s[0] != 0;
+	}
+	for(c = 0; c < HPC_NUM_COUNTERS; c++){
+		if(fx->columns & (1u << c))
+			vector[j++] = (double)sum[c];
+	}
+	for(c = 0; c < HPC_NUM_COUNTERS; c++){
+		if(!(fx->columns & (1u << c)))
+			continue;
+		mean = (double)sum[c] / fx->window;
+		m2 = 0;
+		lo = HUGE_VAL;
+		hi = -HUGE_VAL;
+		for(r = 0; r < fx->window; r++){
+			s = samples + (first + r) * HPC_NUM_COUNTERS;
+			m2 += ((double)s[c] - mean) * ((double)s[c] - mean);
+			lo = (double)s[c] < lo ? (double)s[c] : lo;
+			hi = (double)s[c] > hi ? (double)s[c] : hi;
+		}
+		vector[j++] = mean;
+		vector[j++] = fx->window > 1 ? sqrt(m2 / (fx->window - 1)) : 0;
+		vector[j++] = lo;
+		vector[j++] = hi;
+	}
+	vector[j++] = sum[1] != 0 ? (double)sum[0] / (double)sum[1] : 0;
+	for(c = 1; c < HPC_NUM_COUNTERS; c++){
+		if(fx->columns & (1u << c))
+			vector[j++] = sum[0] != 0 ? 1000.0 * (double)sum[c] / (double)sum[0] : 0;
+	}
+	for(c = 1; c < HPC_NUM_COUNTERS; c++){
+		if(!(fx->columns & (1u << c)))
+			continue;
+		memset(hist, 0, sizeof(hist));
+		for(r = 0; r < fx->window; r++){
+			s = samples + (first + r) * HPC_NUM_COUNTERS;
+			if(s[0] == 0)
+				continue;
+			rate = 1000.0 * (double)s[c] / (double)s[0];
+			e = rate > 0 ? ilogb(rate) : -1023;
+			k = e - FEATURE_BIN_LOW;
+			hist[k < 0 ? 0 : k > FEATURE_BINS - 1 ? FEATURE_BINS - 1 : k]++;
+		}
+		for(k = 0; k < FEATURE_BINS; k++)
+			vector[j++] = rated != 0 ? (double)hist[k] / rated : 0;
+	}
+}
+
+static int Check(UINT32 columns, UINT32 window, UINT32 stride){
+	static UINT64 samples[CHECK_SAMPLES * HPC_NUM_COUNTERS];
+	FEATURE_EXTRACTOR fx;
+	float vector[FEATURE_MAX];
+	double direct[FEATURE_MAX], error, worst = 0;
+	char name[64];
+	UINT64 i, windows = 0;
+	UINT32 f;
+	int bad = 0;
+
+	if(FeatureInit(&fx, columns, FEATURE_ALL, window, stride) != 0)
+		return 1;
+	for(i = 0; i < CHECK_SAMPLES; i++){
+		RandomSample(samples + i * HPC_NUM_COUNTERS, columns);
+		if(!FeatureAdd(&fx, samples + i * HPC_NUM_COUNTERS, vector))
+			continue;
+		Direct(&fx, samples, i + 1 - window, direct);
+		windows++;
+		for(f = 0; f < fx.count; f++){
+			error = fabs(vector[f] - direct[f]) / (fabs(direct[f]) + 1e-6);
+			if(error > worst)
+				worst = error;
+			if(error > 1e-5 && bad++ < 5){
+				FeatureName(&fx, f, name, sizeof(name));
+				printf("  window %llu: %s is %.9g, directly %.9g\n", (unsigned long long)windows, name, vector[f], direct[f]);
+			}
+		}
+	}
+	printf("check window %u stride %u, %u features: %llu windows, largest relative error %.2g: %s\n", window, stride,
+		fx.count, (unsigned long long)windows, worst, bad == 0 && windows == (CHECK_SAMPLES - window) / stride + 1 ? "ok" : "FAILED");
+	FeatureFree(&fx);
+	return bad != 0 || windows != (CHECK_SAMPLES - window) / stride + 1;
+}
+
+static void Throughput(UINT32 columns, UINT32 groups, UINT32 window, UINT32 stride, UINT64 count){
+	FEATURE_EXTRACTOR fx;
+	float vector[FEATURE_MAX];
+	UINT64 *samples, i, windows = 0;
+	struct timespec t0, t1;
+	double seconds;
+
+	samples = (UINT64*)malloc(sizeof(UINT64) * HPC_NUM_COUNTERS * 65536);
+	if(samples == NULL || FeatureInit(&fx, columns, groups, window, stride) != 0){
+		free(samples);
+		return;
+	}
+	for(i = 0; i < 65536; i++)
+		RandomSample(samples + i * HPC_NUM_COUNTERS, columns);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for(i = 0; i < count; i++)
+		windows += FeatureAdd(&fx, samples + (i & 65535) * HPC_NUM_COUNTERS, vector);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	seconds = (double)(t1.tv_sec - t0.tv_sec) + (double)(t1.tv_nsec - t0.tv_nsec) / 1e9;
+	printf("window %5u stride %5u, %3u features: %6.1f M samples/s, %8.0f windows/s\n", window, stride, fx.count,
+		(double)count / seconds / 1e6, (double)windows / seconds);
+	FeatureFree(&fx);
+	free(samples);
+}
+
+int main(int argc, char *argv[]){
+	UINT64 count = 20000000;
+	int failed = 0;
+
+	if(argc > 2 || (argc == 2 && (count = strtoull(argv[1], NULL, 0)) == 0)){
+		fprintf(stderr, "usage: %s [samples]\n", argv[0]);
+		fprintf(stderr, "  samples per throughput run (default 20000000)\n");
+		return 2;
+	}
+	failed |= Check(0x7F, 100, 100);
+	failed |= Check(0x7F, 1000, 10);
+	failed |= Check(0xFFF, 64, 16);
+	failed |= Check(0x7F, 1, 1);
+
+	Throughput(0x7F, FEATURE_ALL, 100, 100, count);
+	Throughput(0x7F, FEATURE_ALL, 1000, 100, count);
+	Throughput(0x7F, FEATURE_ALL, 1000, 10, count);
+	Throughput(0x7F, FEATURE_DELTAS | FEATURE_MOMENTS | FEATURE_RATES, 100, 100, count);
+	Throughput(0xFFF, FEATURE_ALL, 100, 100, count);
+	printf("check: %s\n", failed ? "FAILED" : "ok");
+	return failed;
+}
@@ -0,0 +1,284 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Feature vectors of windows of a sample stream, see feature.h.
+*/
+
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "feature.h"
+
+//independent partial sums of the kernels, a multiple of the doubles in a vector
+#define FEATURE_LANES		4
+
+static const char *counterNames[HPC_NUM_COUNTERS] = HPC_COLUMN_NAMES;
+
+int FeatureInit(PFEATURE_EXTRACTOR fx, UINT32 columns, UINT32 groups, UINT32 window, UINT32 stride){
+	UINT32 padded = (stride + FEATURE_LANES - 1) & ~(FEATURE_LANES - 1), present = 0;
+	int c;
+
+	memset(fx, 0, sizeof(*fx));
+	if(stride == 0 || stride > FEATURE_MAX_STRIDE || window % stride != 0 || window / stride > FEATURE_MAX_BLOCKS ||
+		window == 0 || !(columns & 1) || (groups & FEATURE_ALL) == 0)
+		return -1;
+	fx->columns = columns;
+	fx->groups = groups & FEATURE_ALL;
+	fx->window = window;
+	fx->stride = stride;
+	for(c = 0; c < HPC_NUM_COUNTERS; c++)
+		present += (columns >> c) & 1;
+	if(fx->groups & FEATURE_DELTAS)
+		fx->count += present;
+	if(fx->groups & FEATURE_MOMENTS)
+		fx->count += 4 * present;
+	if(fx->groups & FEATURE_RATES)
+		fx->count += ((columns >> 1) & 1) + present - 1;
+	if(fx->groups & FEATURE_HIST)
+		fx->count += FEATURE_BINS * (present - 1);
+
+	for(c = 0; c < HPC_NUM_COUNTERS; c++){
+		fx->staged[c] = (double*)calloc(padded, sizeof(double));
+		if(fx->staged[c] == NULL){
+			FeatureFree(fx);
+			return -1;
+		}
+	}
+	fx->rate = (double*)calloc(2 * padded, sizeof(double));
+	fx->blocks = (PFEATURE_BLOCK)calloc(window / stride, sizeof(FEATURE_BLOCK));
+	if(fx->rate == NULL || fx->blocks == NULL){
+		FeatureFree(fx);
+		return -1;
+	}
+	return 0;
+}
+
+void FeatureFree(PFEATURE_EXTRACTOR fx){
+	int c;
+
+	for(c = 0; c < HPC_NUM_COUNTERS; c++)
+		free(fx->staged[c]);
+	free(fx->rate);
+	free(fx->blocks);
+	memset(fx, 0, sizeof(*fx));
+}
+
+void FeatureName(const FEATURE_EXTRACTOR *fx, UINT32 index, char *name, size_t size){
+	static const char *moments[4] = { "mean", "sd", "min", "max" };
+	UINT32 i = 0;
+	int c, k;
+
+	snprintf(name, size, "?");
+	for(c = 0; (fx->groups & FEATURE_DELTAS) && c < HPC_NUM_COUNTERS; c++){
+		if((fx->columns & (1u << c)) && i++ == index)
+			snprintf(name, size, "%s", counterNames[c]);
+	}
+	for(c = 0; (fx->groups & FEATURE_MOMENTS) && c < HPC_NUM_COUNTERS; c++){
+		for(k = 0; (fx->columns & (1u << c)) && k < 4; k++){
+			if(i++ == index)
+				snprintf(name, size, "%s_%s", counterNames[c], moments[k]);
+		}
+	}
+	if((fx->groups & FEATURE_RATES) && (fx->columns & 2) && i++ == index)
+		snprintf(name, size, "ipc");
+	for(c = 1; (fx->groups & FEATURE_RATES) && c < HPC_NUM_COUNTERS; c++){
+		if((fx->columns & (1u << c)) && i++ == index)
+			snprintf(name, size, "%s_pki", counterNames[c]);
+	}
+	for(c = 1; (fx->groups & FEATURE_HIST) && c < HPC_NUM_COUNTERS; c++){
+		for(k = 0; (fx->columns & (1u << c)) && k < FEATURE_BINS; k++){
+			if(i++ == index)
+				snprintf(name, size, "%s_pki_h%d", counterNames[c], k);
+		}
+	}
+}
+
+/*
+* Mean, m2, min and max of the n staged values of a counter, padded to a multiple of
+* FEATURE_LANES with copies of the first value, which leave the minimum and maximum as
+* they are and are weighed out of the sums. The lanes fix the order of the additions,
+* so the compiler vectorizes them without being allowed to reassociate.
+*/
+static void Moments(const double *v, UINT32 n, UINT32 padded, double *mean, double *m2, double *min, double *max){
+	double sum[FEATURE_LANES], sq[FEATURE_LANES], lo[FEATURE_LANES], hi[FEATURE_LANES], total = 0, m, d;
+	UINT32 r, l;
+
+	for(l = 0; l < FEATURE_LANES; l++){
+		sum[l] = sq[l] = 0;
+		lo[l] = hi[l] = v[0];
+	}
+	for(r = 0; r < padded; r += FEATURE_LANES){
+		for(l = 0; l < FEATURE_LANES; l++){
+			sum[l] += r + l < n ? v[r + l] : 0;
+			lo[l] = v[r + l] < lo[l] ? v[r + l] : lo[l];
+			hi[l] = v[r + l] > hi[l] ? v[r + l] : hi[l];
+		}
+	}
+	for(l = 0; l < FEATURE_LANES; l++)
+		total += sum[l];
+	m = total / n;
+	for(r = 0; r < padded; r += FEATURE_LANES){
+		for(l = 0; l < FEATURE_LANES; l++){
+			d = r + l < n ? v[r + l] - m : 0;
+			sq[l] += d * d;
+		}
+	}
+	*mean = m;
+	*m2 = sq[0] + sq[1] + sq[2] + sq[3];
+	*min = lo[0];
+	*max = hi[0];
+	for(l = 1; l < FEATURE_LANES; l++){
+		*min = lo[l] < *min ? lo[l] : *min;
+		*max = hi[l] > *max ? hi[l] : *max;
+	}
+}
+
+/*
+* Kernels over the staged block: moments of every counter, then the rate of every sample
+* per 1000 instructions and its bin, the exponent of the rate taken from its bits
+*/
+static void RunKernels(PFEATURE_EXTRACTOR fx, PFEATURE_BLOCK b){
+	UINT32 n = fx->rows, padded = (n + FEATURE_LANES - 1) & ~(FEATURE_LANES - 1), r, k;
+	const double *ins = fx->staged[0], *v;
+	double *rate = fx->rate, *valid = fx->rate + padded;
+	union { double value; UINT64 bits; } convert;
+	INT64 e;
+	int c;
+
+	for(c = 0; c < HPC_NUM_COUNTERS; c++){
+		for(r = n; r < padded; r++)
+			fx->staged[c][r] = fx->staged[c][0];
+	}
+	b->rows = n;
+	for(c = 0; (fx->groups & FEATURE_MOMENTS) && c < HPC_NUM_COUNTERS; c++){
+		if(fx->columns & (1u << c))
+			Moments(fx->staged[c], n, padded, &b->mean[c], &b->m2[c], &b->min[c], &b->max[c]);
+	}
+	b->rated = 0;
+	if(!(fx->groups & FEATURE_HIST))
+		return;
+
+	//a sample without instructions has no rate, its denominator is made 1 to stay branch free
+	for(r = 0; r < n; r++){
+		valid[r] = ins[r] != 0 ? 1.0 : 0.0;
+		b->rated += ins[r] != 0;
+	}
+	memset(b->hist, 0, sizeof(b->hist));
+	for(c = 1; c < HPC_NUM_COUNTERS; c++){
+		if(!(fx->columns & (1u << c)))
+			continue;
+		v = fx->staged[c];
+		for(r = 0; r < n; r++)
+			rate[r] = 1000 * v[r] / (ins[r] + 1 - valid[r]);
+		for(r = 0; r < n; r++){
+			convert.value = rate[r];
+			e = (INT64)((convert.bits >> 52) & 0x7FF) - 1023 - FEATURE_BIN_LOW;
+			e = e < 0 ? 0 : e > FEATURE_BINS - 1 ? FEATURE_BINS - 1 : e;
+			k = (UINT32)e;
+			b->hist[c][k] += valid[r] != 0;
+		}
+	}
+}
+
+/*
+* The features of the window of the last window / stride blocks
+*/
+static void Window(const FEATURE_EXTRACTOR *fx, float *vector){
+	UINT32 blocks = fx->window / fx->stride, i, j = 0;
+	UINT64 rows = 0, rated = fx->total.rated;
+	const UINT64 *sum = fx->total.sum;
+	double mean[HPC_NUM_COUNTERS], m2[HPC_NUM_COUNTERS], min[HPC_NUM_COUNTERS], max[HPC_NUM_COUNTERS], delta, total;
+	const FEATURE_BLOCK *b;
+	int c, k;
+
+	//the moments of the blocks merged (Chan et al.)
+	for(i = 0; (fx->groups & FEATURE_MOMENTS) && i < blocks; i++){
+		b = &fx->blocks[i];
+		for(c = 0; c < HPC_NUM_COUNTERS; c++){
+			if(!(fx->columns & (1u << c)))
+				continue;
+			if(rows == 0){
+				mean[c] = b->mean[c];
+				m2[c] = b->m2[c];
+				min[c] = b->min[c];
+				max[c] = b->max[c];
+			}else{
+				total = (double)(rows + b->rows);
+				delta = b->mean[c] - mean[c];
+				m2[c] += b->m2[c] + delta * delta * (double)rows * (double)b->rows / total;
+				mean[c] += delta * (double)b->rows / total;
+				min[c] = b->min[c] < min[c] ? b->min[c] : min[c];
+				max[c] = b->max[c] > max[c] ? b->max[c] : max[c];
+			}
+		}
+		rows += b->rows;
+	}
+
+	for(c = 0; (fx->groups & FEATURE_DELTAS) && c < HPC_NUM_COUNTERS; c++){
+		if(fx->columns & (1u << c))
+			vector[j++] = (float)sum[c];
+	}
+	for(c = 0; (fx->groups & FEATURE_MOMENTS) && c < HPC_NUM_COUNTERS; c++){
+		if(!(fx->columns & (1u << c)))
+			continue;
+		vector[j++] = (float)mean[c];
+		vector[j++] = rows > 1 ? (float)sqrt(m2[c] / (double)(rows - 1)) : 0;
+		vector[j++] = (float)min[c];
+		vector[j++] = (float)max[c];
+	}
+	if((fx->groups & FEATURE_RATES) && (fx->columns & 2))
+		vector[j++] = sum[1] != 0 ? (float)((double)sum[0] / (double)sum[1]) : 0;
+	for(c = 1; (fx->groups & FEATURE_RATES) && c < HPC_NUM_COUNTERS; c++){
+		if(fx->columns & (1u << c))
+			vector[j++] = sum[0] != 0 ? (float)(1000.0 * (double)sum[c] / (double)sum[0]) : 0;
+	}
+	for(c = 1; (fx->groups & FEATURE_HIST) && c < HPC_NUM_COUNTERS; c++){
+		for(k = 0; (fx->columns & (1u << c)) && k < FEATURE_BINS; k++)
+			vector[j++] = rated != 0 ? (float)((double)fx->total.hist[c][k] / (double)rated) : 0;
+	}
+}
+
+/*
+* Take a block into the totals of the ring (sign 1) or out of them (sign -1)
+*/
+static void Total(PFEATURE_EXTRACTOR fx, const FEATURE_BLOCK *b, UINT64 sign){
+	int c, k;
+
+	for(c = 0; c < HPC_NUM_COUNTERS; c++){
+		fx->total.sum[c] += sign * b->sum[c];
+		for(k = 0; (fx->groups & FEATURE_HIST) && k < FEATURE_BINS; k++)
+			fx->total.hist[c][k] += (UINT32)sign * b->hist[c][k];
+	}
+	fx->total.rated += sign * b->rated;
+}
+
+int FeatureAdd(PFEATURE_EXTRACTOR fx, const UINT64 *ctr, float *vector){
+	UINT32 blocks = fx->window / fx->stride;
+	PFEATURE_BLOCK b = &fx->blocks[fx->done % blocks];
+	int c;
+
+	//the block of the ring that is reused leaves the window
+	if(fx->rows == 0){
+		if(fx->done >= blocks)
+			Total(fx, b, (UINT64)-1);
+		memset(b->sum, 0, sizeof(b->sum));
+	}
+	//the counts are summed exactly here, the kernels work on doubles
+	for(c = 0; c < HPC_NUM_COUNTERS; c++){
+		fx->staged[c][fx->rows] = (double)ctr[c];
+		b->sum[c] += ctr[c];
+	}
+	fx->samples++;
+	if(++fx->rows < fx->stride)
+		return 0;
+	RunKernels(fx, b);
+	Total(fx, b, 1);
+	fx->rows = 0;
+	fx->done++;
+	if(fx->done < blocks)
+		return 0;
+	Window(fx, vector);
+	return 1;
+}
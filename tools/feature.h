@@ -0,0 +1,77 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Fixed-length feature vectors of windows of a sample stream, for training models on
+* the counters. A window is window consecutive samples and a new one starts every stride
+* samples: tumbling windows if stride equals window, sliding windows if it divides it.
+* The samples are staged in columns, and every stride samples the kernels run over the
+* columns of the block: plain loops over arrays that the compiler vectorizes, which sum
+* the counters, take their moments and the rates of the samples and bin them. A window
+* merges the partial results of its window / stride blocks, so a sample is only read by
+* the kernels once however far the windows overlap. The features of every counter the
+* samples have, in this order and by groups:
+*	FEATURE_DELTAS	the counts of the window (the sum of the per-sample deltas)
+*	FEATURE_MOMENTS	mean, standard deviation, min and max of the counts per sample
+*	FEATURE_RATES	the IPC, then every counter but instructions per 1000 instructions
+*	FEATURE_HIST	every counter but instructions per 1000 instructions of each sample, as
+*					the share of the samples in FEATURE_BINS bins of powers of two
+*/
+
+#ifndef FEATURE_H
+#define FEATURE_H
+
+#include "hpcring.h"
+
+#define FEATURE_DELTAS		0x1
+#define FEATURE_MOMENTS		0x2
+#define FEATURE_RATES		0x4
+#define FEATURE_HIST		0x8
+#define FEATURE_ALL			0xF
+
+#define FEATURE_BINS		16
+#define FEATURE_BIN_LOW		(-3)			//bin 0 holds rates below 2^-2 per 1000 instructions, bin 15 from 2^12 on
+#define FEATURE_MAX_BLOCKS	1024			//window / stride
+#define FEATURE_MAX_STRIDE	65536
+#define FEATURE_MAX			(HPC_NUM_COUNTERS * (1 + 4 + 1 + FEATURE_BINS) + 1)
+
+//what the kernels found in the samples of one block
+typedef struct _FEATURE_BLOCK {
+	UINT64 rows;
+	UINT64 sum[HPC_NUM_COUNTERS];
+	double mean[HPC_NUM_COUNTERS];
+	double m2[HPC_NUM_COUNTERS];
+	double min[HPC_NUM_COUNTERS];
+	double max[HPC_NUM_COUNTERS];
+	UINT32 hist[HPC_NUM_COUNTERS][FEATURE_BINS];
+	UINT64 rated;					//samples with instructions, in the histograms
+} FEATURE_BLOCK, *PFEATURE_BLOCK;
+
+typedef struct _FEATURE_EXTRACTOR {
+	UINT32 columns;					//counters the samples have
+	UINT32 groups;					//FEATURE_*
+	UINT32 window;
+	UINT32 stride;
+	UINT32 count;					//features per vector
+	double *staged[HPC_NUM_COUNTERS];	//the samples of the current block, stride rows padded
+	double *rate;					//scratch of the kernels
+	UINT32 rows;					//samples staged
+	PFEATURE_BLOCK blocks;			//ring of the last window / stride blocks
+	FEATURE_BLOCK total;			//counts and bins of the blocks in the ring, kept up as they come and go
+	UINT64 done;					//blocks completed
+	UINT64 samples;
+} FEATURE_EXTRACTOR, *PFEATURE_EXTRACTOR;
+
+//returns 0, or -1 if the window is no multiple of the stride or memory runs out
+int FeatureInit(PFEATURE_EXTRACTOR fx, UINT32 columns, UINT32 groups, UINT32 window, UINT32 stride);
+void FeatureFree(PFEATURE_EXTRACTOR fx);
+
+//name of a feature, e.g. "event4_pki_h7"
+void FeatureName(const FEATURE_EXTRACTOR *fx, UINT32 index, char *name, size_t size);
+
+/*
+* Add the next sample; returns 1 and the features of the window it completed in vector
+* (fx->count values), else 0
+*/
+int FeatureAdd(PFEATURE_EXTRACTOR fx, const UINT64 *ctr, float *vector);
+
+#endif
@@ -0,0 +1,139 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Summary of CSV sample files (output/hpcoutput-*.csv, hpcdump and hpcrun output) with the
+* parallel parser of csvscan.h. For every file it prints one CSV line per counter and
+* derived metric:
+*	file,metric,rows,total,mean,sd,min[,p50,p90,p99],max
+* where the total of a derived metric is the one of the summed counters, e.g. the IPC of
+* the whole file, and its mean is the mean of the per-row values. -w writes the series of
+* windows of N rows into a CSV file: the counter sums and derived metrics of every window.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include "csvscan.h"
+
+static const double quantiles[] = { 0.5, 0.9, 0.99 };
+#define QUANTILES 3
+
+static void PrintMetric(const char *file, const char *name, const CSV_MOMENTS *m, double total,
+	const STAT_METRIC *sketch, double scale, int integer){
+	int q;
+
+	printf("%s,%s,%llu", file, name, (unsigned long long)m->count);
+	printf(integer ? ",%.0f" : ",%.6g", total);
+	printf(",%.6g,%.6g,%.6g", m->mean, sqrt(CsvVariance(m)), m->count != 0 ? m->min : 0);
+	for(q = 0; sketch != NULL && q < QUANTILES; q++)
+		printf(",%.6g", (double)StatQuantile(sketch, quantiles[q]) / scale);
+	printf(",%.6g\r\n", m->count != 0 ? m->max : 0);
+}
+
+static int WriteSeries(const char *path, const CSV_RESULT *result){
+	const CSV_WINDOW *w;
+	FILE *out;
+	UINT64 i;
+	double value;
+	int c, k;
+
+	out = fopen(path, "wb");
+	if(out == NULL)
+		return -1;
+	fprintf(out, "window,first_line,rows");
+	for(c = 0; c < HPC_NUM_COUNTERS; c++){
+		if(result->columns & (1u << c))
+			fprintf(out, ",%s", csvCounterNames[c]);
+	}
+	for(k = 0; k < CSV_DERIVED; k++)
+		fprintf(out, ",%s", csvDerivedNames[k]);
+	fprintf(out, "\r\n");
+	for(i = 0; i < result->windowCount; i++){
+		w = &result->windows[i];
+		fprintf(out, "%llu,%llu,%llu", (unsigned long long)i, (unsigned long long)(i * result->windowRows),
+			(unsigned long long)w->rows);
+		for(c = 0; c < HPC_NUM_COUNTERS; c++){
+			if(result->columns & (1u << c))
+				fprintf(out, ",%llu", (unsigned long long)w->ctr[c]);
+		}
+		for(k = 0; k < CSV_DERIVED; k++){
+			if(CsvDerive(w->ctr, k, &value))
+				fprintf(out, ",%.6g", value);
+			else
+				fprintf(out, ",");
+		}
+		fprintf(out, "\r\n");
+	}
+	return fclose(out);
+}
+
+int main(int argc, char *argv[]){
+	CSV_OPTIONS options;
+	CSV_RESULT result;
+	const char *seriesPath = NULL;
+	double total;
+	int opt, arg, c, k, q, rc = 0;
+
+	memset(&options, 0, sizeof(options));
+	options.threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	while((opt = getopt(argc, argv, "j:w:s:ql")) != -1){
+		switch(opt){
+		case 'j': options.threads = atoi(optarg); break;
+		case 'w': options.windowRows = strtoull(optarg, NULL, 0); break;
+		case 's': seriesPath = optarg; break;
+		case 'q': options.quantiles = 1; break;
+		case 'l': options.legacy = 1; break;
+		default:
+			optind = argc + 1;
+			break;
+		}
+	}
+	if(optind >= argc || (seriesPath != NULL) != (options.windowRows != 0)){
+		fprintf(stderr, "usage: %s [-j threads] [-q] [-l] [-w rows -s series.csv] file.csv...\n", argv[0]);
+		fprintf(stderr, "  -j  parser threads, default one per CPU\n");
+		fprintf(stderr, "  -q  add the quantiles p50, p90 and p99\n");
+		fprintf(stderr, "  -l  repair every value with bit 31 set, for the CSV of the original driver\n");
+		fprintf(stderr, "  -w  rows per window of the series written to -s (with one file only)\n");
+		return 2;
+	}
+	if(seriesPath != NULL && optind + 1 != argc){
+		fprintf(stderr, "a series is written for one file only\n");
+		return 2;
+	}
+
+	printf("file,metric,rows,total,mean,sd,min");
+	for(q = 0; options.quantiles && q < QUANTILES; q++)
+		printf(",p%g", quantiles[q] * 100);
+	printf(",max\r\n");
+	for(arg = optind; arg < argc; arg++){
+		if(CsvAnalyzeFile(argv[arg], &options, &result) != 0){
+			fprintf(stderr, "%s: cannot be read or lacks a counter column\n", argv[arg]);
+			rc = 1;
+			continue;
+		}
+		for(c = 0; c < HPC_NUM_COUNTERS; c++){
+			if(result.columns & (1u << c))
+				PrintMetric(argv[arg], csvCounterNames[c], &result.counters[c], (double)result.totals[c],
+					result.sketches != NULL ? &result.sketches[c] : NULL, 1, 1);
+		}
+		for(k = 0; k < CSV_DERIVED; k++){
+			if(!CsvDerive(result.totals, k, &total))
+				total = 0;
+			PrintMetric(argv[arg], csvDerivedNames[k], &result.derived[k], total,
+				result.sketches != NULL ? &result.sketches[HPC_NUM_COUNTERS + k] : NULL, STAT_RATIO_SCALE, 0);
+		}
+		if(result.bad != 0)
+			fprintf(stderr, "%s: %llu lines skipped\n", argv[arg], (unsigned long long)result.bad);
+		if(result.repaired != 0)
+			fprintf(stderr, "%s: %llu values repaired from the sign extension of the original driver\n", argv[arg],
+				(unsigned long long)result.repaired);
+		if(seriesPath != NULL && WriteSeries(seriesPath, &result) != 0){
+			perror(seriesPath);
+			rc = 1;
+		}
+		CsvFreeResult(&result);
+	}
+	return rc;
+}
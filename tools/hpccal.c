@@ -0,0 +1,129 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Calibration of the skid and the PMI overhead of a machine (calib.h) from two logs
+* of the same workload: a reference run in the polling mode, which gives the events
+* per instruction of the workload, and a run in the sampling mode, whose windows hold
+* these events plus the skid and the overhead. The workload should be the same every
+* run and run long enough for a few thousand windows, e.g. benchmarks/loop_stosb.
+* It prints the skid and, per counter, the rate and the overhead per window with its
+* standard deviation; -o saves the calibration for hpcdump -k, which normalizes the
+* windows of other sampling logs of this machine to the calibrated period.
+* Only uses stdio, so it builds with the Windows SDK as well as on Linux.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "calib.h"
+#include "logread.h"
+
+static const char *names[HPC_NUM_COUNTERS] = HPC_COLUMN_NAMES;
+
+static int Open(PLOG_READER reader, const char *path, UINT32 mode){
+	const char *error;
+
+	if(LogReaderOpen(reader, path, &error) != 0){
+		if(error != NULL)
+			fprintf(stderr, "%s: %s (version %d)\n", path, error, SAMPLE_LOG_VERSION);
+		else
+			perror(path);
+		return -1;
+	}
+	if(reader->header.mode != mode){
+		fprintf(stderr, "%s: not a log of the %s mode\n", path, mode == SAMPLE_LOG_MODE_POLLING ? "polling" : "sampling");
+		LogReaderClose(reader);
+		return -1;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[]){
+	LOG_READER reader;
+	HPC_SAMPLE sample;
+	CALIBRATION cal;
+	UINT64 totals[HPC_NUM_COUNTERS], skipped = 0;
+	UINT32 eventSel[HPC_MAX_PROGRAMMABLE], columns;
+	const char *outPath = NULL;
+	FILE *out;
+	int arg = 1, c, rc;
+
+	if(arg + 1 < argc && strcmp(argv[arg], "-o") == 0){
+		outPath = argv[arg + 1];
+		arg += 2;
+	}
+	if(arg + 2 != argc){
+		fprintf(stderr, "usage: %s [-o cal.csv] polling.bin sampling.bin\n", argv[0]);
+		fprintf(stderr, "  both logs of the same workload and events; -o saves the calibration for hpcdump -k\n");
+		return 2;
+	}
+
+	//rates of the workload, from the samples of group 0 like the windows
+	if(Open(&reader, argv[arg], SAMPLE_LOG_MODE_POLLING) != 0)
+		return 1;
+	memcpy(eventSel, reader.header.eventSel, sizeof(eventSel));
+	memset(totals, 0, sizeof(totals));
+	while((rc = LogReaderNext(&reader, &sample)) == 1){
+		for(c = 0; c < HPC_NUM_COUNTERS && sample.group == 0; c++)
+			totals[c] += sample.ctr[c];
+	}
+	LogReaderClose(&reader);
+	if(rc < 0){
+		fprintf(stderr, "%s: corrupt block\n", argv[arg]);
+		return 1;
+	}
+
+	if(Open(&reader, argv[arg + 1], SAMPLE_LOG_MODE_SAMPLING) != 0)
+		return 1;
+	if(memcmp(eventSel, reader.header.eventSel, sizeof(eventSel)) != 0){
+		fprintf(stderr, "the logs count different events\n");
+		LogReaderClose(&reader);
+		return 1;
+	}
+	if(reader.header.flags & SAMPLE_LOG_FLAG_SOFTWARE)
+		fprintf(stderr, "warning: %s holds software events, their skid says nothing about the PMU\n", argv[arg + 1]);
+	CalibInit(&cal, (UINT64)-(INT64)reader.header.pmiThreshold, eventSel, (reader.header.flags & SAMPLE_LOG_FLAG_FREEZE) != 0);
+	columns = reader.header.columns;
+	if(CalibReference(&cal, totals) != 0){
+		fprintf(stderr, "%s: no instructions counted\n", argv[arg]);
+		LogReaderClose(&reader);
+		return 1;
+	}
+	while((rc = LogReaderNext(&reader, &sample)) == 1){
+		if(sample.group != 0 || sample.region != 0 || !CalibAddWindow(&cal, sample.ctr, sample.period))
+			skipped++;
+	}
+	LogReaderClose(&reader);
+	if(rc < 0){
+		fprintf(stderr, "%s: corrupt block\n", argv[arg + 1]);
+		return 1;
+	}
+	if(cal.skid.count == 0){
+		fprintf(stderr, "%s: no complete window of %llu instructions\n", argv[arg + 1], (unsigned long long)cal.period);
+		return 1;
+	}
+
+	printf("period %llu, %llu windows (%llu skipped)%s\n", (unsigned long long)cal.period,
+		(unsigned long long)cal.skid.count, (unsigned long long)skipped, cal.freeze ? ", frozen on PMIs" : "");
+	printf("skid: mean %.2f, sd %.2f, min %llu, max %llu instructions\n", cal.skid.mean, CalibSd(&cal.skid),
+		(unsigned long long)cal.skidMin, (unsigned long long)cal.skidMax);
+	printf("counter      rate/ins  overhead/window        sd\n");
+	for(c = 0; c < HPC_NUM_COUNTERS; c++){
+		if(columns & (1u << c))
+			printf("%-9s  %10.6f  %15.2f  %8.2f\n", names[c], cal.rate[c], cal.overhead[c].mean, CalibSd(&cal.overhead[c]));
+	}
+
+	if(outPath != NULL){
+		out = fopen(outPath, "wb");
+		if(out == NULL){
+			perror(outPath);
+			return 1;
+		}
+		rc = CalibSave(&cal, out);
+		if(fclose(out) != 0 || rc != 0){
+			perror(outPath);
+			return 1;
+		}
+	}
+	return 0;
+}
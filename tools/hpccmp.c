@@ -0,0 +1,380 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* A/B comparison of two sets of runs, each run a CSV sample file of the original driver,
+* hpcdump or hpcrun. For every counter (its mean per sample) and derived metric of
+* csvscan.h it prints the value of both sets, the change of B against A in percent with
+* a bootstrap confidence interval, and a verdict:
+*	metric,a,b,change,low,high,verdict
+*
+* The value of a set is the mean of the values of its runs, so every run counts the same
+* however many samples it has. The bootstrap resamples at two levels, which gives the
+* interval the noise between runs as well as the noise within a run: it draws the runs of
+* each set with replacement, and for each run drawn its samples with replacement in blocks
+* of consecutive rows (csvscan windows), which keeps the correlation of neighboring samples
+* within a block. Every replicate draws from its own seed, so the replicates are split over
+* threads and the result does not depend on the number of threads.
+*
+* A change is significant if the interval excludes 0 and the change is at least the
+* threshold. A significant change of a gated metric in its bad direction (up, except for
+* the IPC) is a regression, and the exit code is 1; errors exit with 2.
+*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include "csvscan.h"
+
+#define METRICS			(HPC_NUM_COUNTERS + CSV_DERIVED)
+#define MAX_THREADS		CSV_MAX_THREADS
+
+//a set of runs: the windows of every run
+typedef struct _RUN_SET {
+	CSV_RESULT *runs;
+	int count;
+	UINT32 columns;					//counters all runs have
+} RUN_SET, *PRUN_SET;
+
+typedef struct _BOOTSTRAP {
+	const RUN_SET *set[2];
+	UINT64 seed;
+	UINT32 replicates;
+	double *change;					//[metric][replicate], NAN where a set has no value
+	int threads;
+} BOOTSTRAP, *PBOOTSTRAP;
+
+typedef struct _WORKER {
+	PBOOTSTRAP boot;
+	UINT32 first, last;				//replicates of the worker
+	pthread_t thread;
+} WORKER, *PWORKER;
+
+/*
+* splitmix64, which also turns the replicate number into a seed of its own
+*/
+HPC_INLINE UINT64 NextRandom(UINT64 *state){
+	UINT64 z = (*state += 0x9E3779B97F4A7C15ULL);
+
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+//uniform in 0..n-1 for n < 2^32
+HPC_INLINE UINT32 Draw(UINT64 *state, UINT32 n){
+	return (UINT32)(((NextRandom(state) >> 32) * n) >> 32);
+}
+
+/*
+* Values of all metrics for summed counters: counters per sample, then the derived metrics
+*/
+static void Metrics(const UINT64 *ctr, UINT64 rows, double *value, int *valid){
+	int c, k;
+
+	for(c = 0; c < HPC_NUM_COUNTERS; c++){
+		value[c] = rows != 0 ? (double)ctr[c] / (double)rows : 0;
+		valid[c] = rows != 0;
+	}
+	for(k = 0; k < CSV_DERIVED; k++)
+		valid[HPC_NUM_COUNTERS + k] = CsvDerive(ctr, k, &value[HPC_NUM_COUNTERS + k]);
+}
+
+/*
+* Mean of the metrics over the runs of a set. With state, the runs and their windows are
+* drawn with replacement; without, every run and window is taken once.
+*/
+static void SetMean(const RUN_SET *set, UINT64 *state, double *mean){
+	UINT64 ctr[HPC_NUM_COUNTERS], rows;
+	double value[METRICS];
+	int valid[METRICS], runs[METRICS];
+	const CSV_RESULT *run;
+	UINT64 w, windows;
+	int r, c, m;
+
+	memset(runs, 0, sizeof(runs));
+	for(m = 0; m < METRICS; m++)
+		mean[m] = 0;
+	for(r = 0; r < set->count; r++){
+		run = &set->runs[state != NULL ? Draw(state, (UINT32)set->count) : (UINT32)r];
+		windows = run->windowCount;
+		memset(ctr, 0, sizeof(ctr));
+		rows = 0;
+		for(w = 0; w < windows; w++){
+			const CSV_WINDOW *window = &run->windows[state != NULL ? Draw(state, (UINT32)windows) : w];
+
+			for(c = 0; c < HPC_NUM_COUNTERS; c++)
+				ctr[c] += window->ctr[c];
+			rows += window->rows;
+		}
+		Metrics(ctr, rows, value, valid);
+		for(m = 0; m < METRICS; m++){
+			if(valid[m]){
+				mean[m] += value[m];
+				runs[m]++;
+			}
+		}
+	}
+	for(m = 0; m < METRICS; m++)
+		mean[m] = runs[m] != 0 ? mean[m] / runs[m] : NAN;
+}
+
+//change of b against a in percent
+static double Change(double a, double b){
+	if(isnan(a) || isnan(b) || a == 0)
+		return NAN;
+	return (b / a - 1) * 100;
+}
+
+static void *BootstrapThread(void *context){
+	PWORKER worker = (PWORKER)context;
+	PBOOTSTRAP boot = worker->boot;
+	double a[METRICS], b[METRICS];
+	UINT64 state;
+	UINT32 i;
+	int m;
+
+	for(i = worker->first; i < worker->last; i++){
+		state = boot->seed ^ ((UINT64)i * 0xD1B54A32D192ED03ULL);
+		SetMean(boot->set[0], &state, a);
+		SetMean(boot->set[1], &state, b);
+		for(m = 0; m < METRICS; m++)
+			boot->change[(size_t)m * boot->replicates + i] = Change(a[m], b[m]);
+	}
+	return NULL;
+}
+
+static int Bootstrap(PBOOTSTRAP boot){
+	WORKER workers[MAX_THREADS];
+	int started[MAX_THREADS];
+	int t, threads = boot->threads;
+
+	boot->change = (double*)malloc(sizeof(double) * METRICS * boot->replicates);
+	if(boot->change == NULL)
+		return -1;
+	if(threads > (int)boot->replicates)
+		threads = (int)boot->replicates;
+	for(t = 0; t < threads; t++){
+		workers[t].boot = boot;
+		workers[t].first = (UINT32)((UINT64)boot->replicates * t / threads);
+		workers[t].last = (UINT32)((UINT64)boot->replicates * (t + 1) / threads);
+		started[t] = t != 0 && pthread_create(&workers[t].thread, NULL, BootstrapThread, &workers[t]) == 0;
+	}
+	//the replicates of threads that could not be started are drawn here
+	for(t = 0; t < threads; t++){
+		if(!started[t])
+			BootstrapThread(&workers[t]);
+	}
+	for(t = 1; t < threads; t++){
+		if(started[t])
+			pthread_join(workers[t].thread, NULL);
+	}
+	return 0;
+}
+
+static int CompareDouble(const void *x, const void *y){
+	double a = *(const double*)x, b = *(const double*)y;
+
+	return a < b ? -1 : a > b;
+}
+
+/*
+* Percentile interval of the replicates of a metric that have a value, which are sorted;
+* returns 0 if fewer than half of them have one
+*/
+static int Interval(double *change, UINT32 replicates, double confidence, double *low, double *high){
+	UINT32 i, n = 0;
+	double tail = (1 - confidence) / 2;
+
+	for(i = 0; i < replicates; i++){
+		if(!isnan(change[i]))
+			change[n++] = change[i];
+	}
+	if(n == 0 || n < replicates / 2)
+		return 0;
+	qsort(change, n, sizeof(double), CompareDouble);
+	*low = change[(UINT32)floor(tail * (n - 1))];
+	*high = change[(UINT32)ceil((1 - tail) * (n - 1))];
+	return 1;
+}
+
+static const char *MetricName(int m){
+	return m < HPC_NUM_COUNTERS ? csvCounterNames[m] : csvDerivedNames[m - HPC_NUM_COUNTERS];
+}
+
+/*
+* Mark the metrics of a comma separated list, or all of them
+*/
+static int ParseGate(const char *list, int *gated){
+	char name[32];
+	size_t len;
+	int m;
+
+	memset(gated, 0, sizeof(int) * METRICS);
+	while(*list != 0){
+		len = strcspn(list, ",");
+		if(len == 0 || len >= sizeof(name))
+			return -1;
+		memcpy(name, list, len);
+		name[len] = 0;
+		list += len + (list[len] == ',');
+		if(strcmp(name, "all") == 0){
+			for(m = 0; m < METRICS; m++)
+				gated[m] = 1;
+			continue;
+		}
+		for(m = 0; m < METRICS && strcmp(MetricName(m), name) != 0; m++)
+			;
+		if(m == METRICS)
+			return -1;
+		gated[m] = 1;
+	}
+	return 0;
+}
+
+/*
+* Analyze the files of a set into windows of blockRows rows
+*/
+static int LoadSet(PRUN_SET set, char **files, int count, const CSV_OPTIONS *options){
+	int i;
+
+	set->runs = (CSV_RESULT*)calloc((size_t)count, sizeof(CSV_RESULT));
+	if(set->runs == NULL)
+		return -1;
+	set->columns = ~0u;
+	for(i = 0; i < count; i++){
+		if(CsvAnalyzeFile(files[i], options, &set->runs[i]) != 0){
+			fprintf(stderr, "%s: cannot be read or lacks a counter column\n", files[i]);
+			return -1;
+		}
+		set->count++;
+		if(set->runs[i].rows == 0){
+			fprintf(stderr, "%s: no samples\n", files[i]);
+			return -1;
+		}
+		if(set->runs[i].windowCount > 0xFFFFFFFF){
+			fprintf(stderr, "%s: too many blocks, use longer ones\n", files[i]);
+			return -1;
+		}
+		if(set->runs[i].bad != 0)
+			fprintf(stderr, "%s: %llu lines skipped\n", files[i], (unsigned long long)set->runs[i].bad);
+		set->columns &= set->runs[i].columns;
+	}
+	return 0;
+}
+
+static void FreeSet(PRUN_SET set){
+	int i;
+
+	for(i = 0; i < set->count; i++)
+		CsvFreeResult(&set->runs[i]);
+	free(set->runs);
+}
+
+static void Usage(const char *name){
+	fprintf(stderr, "usage: %s [-j threads] [-r replicates] [-b rows] [-c confidence] [-t percent] [-g metrics] [-s seed] [-l]\n", name);
+	fprintf(stderr, "       a.csv... -- b.csv...\n");
+	fprintf(stderr, "  compares the runs of set B with those of set A, one CSV sample file per run\n");
+	fprintf(stderr, "  -j  threads, default one per CPU\n");
+	fprintf(stderr, "  -r  bootstrap replicates (default 2000)\n");
+	fprintf(stderr, "  -b  rows per block of samples drawn together (default 100)\n");
+	fprintf(stderr, "  -c  confidence of the intervals (default 0.95)\n");
+	fprintf(stderr, "  -t  smallest significant change in percent (default 0)\n");
+	fprintf(stderr, "  -g  metrics whose regressions fail the comparison, or all (default l_cycle,ipc)\n");
+	fprintf(stderr, "  -s  seed of the resampling (default 1)\n");
+	fprintf(stderr, "  -l  repair every value with bit 31 set, for the CSV of the original driver\n");
+}
+
+int main(int argc, char *argv[]){
+	CSV_OPTIONS options;
+	RUN_SET sets[2];
+	BOOTSTRAP boot;
+	double a[METRICS], b[METRICS], change, low, high, confidence = 0.95, threshold = 0;
+	const char *gate = "l_cycle,ipc", *verdict;
+	int gated[METRICS], opt, split, m, regressions = 0, rc = 2;
+	UINT32 columns;
+
+	memset(&options, 0, sizeof(options));
+	memset(&boot, 0, sizeof(boot));
+	memset(sets, 0, sizeof(sets));
+	options.threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	options.windowRows = 100;
+	boot.replicates = 2000;
+	boot.seed = 1;
+	//+ stops at the first file, so the -- between the sets stays in argv
+	while((opt = getopt(argc, argv, "+j:r:b:c:t:g:s:l")) != -1){
+		switch(opt){
+		case 'j': options.threads = atoi(optarg); break;
+		case 'r': boot.replicates = (UINT32)strtoul(optarg, NULL, 0); break;
+		case 'b': options.windowRows = strtoull(optarg, NULL, 0); break;
+		case 'c': confidence = atof(optarg); break;
+		case 't': threshold = atof(optarg); break;
+		case 'g': gate = optarg; break;
+		case 's': boot.seed = strtoull(optarg, NULL, 0); break;
+		case 'l': options.legacy = 1; break;
+		default:
+			Usage(argv[0]);
+			return 2;
+		}
+	}
+	for(split = optind; split < argc && strcmp(argv[split], "--") != 0; split++)
+		;
+	if(split == optind || split >= argc - 1 || options.threads < 1 || options.windowRows == 0 ||
+		boot.replicates < 100 || confidence <= 0 || confidence >= 1 || threshold < 0){
+		Usage(argv[0]);
+		return 2;
+	}
+	if(ParseGate(gate, gated) != 0){
+		fprintf(stderr, "%s: unknown metric\n", gate);
+		return 2;
+	}
+	if(options.threads > MAX_THREADS)
+		options.threads = MAX_THREADS;
+	boot.threads = options.threads;
+
+	if(LoadSet(&sets[0], argv + optind, split - optind, &options) != 0 ||
+		LoadSet(&sets[1], argv + split + 1, argc - split - 1, &options) != 0)
+		goto done;
+	if(sets[0].count < 2 || sets[1].count < 2)
+		fprintf(stderr, "warning: a set has a single run, the intervals leave out the noise between runs\n");
+	columns = sets[0].columns & sets[1].columns;
+
+	boot.set[0] = &sets[0];
+	boot.set[1] = &sets[1];
+	if(Bootstrap(&boot) != 0){
+		fprintf(stderr, "out of memory\n");
+		goto done;
+	}
+	SetMean(&sets[0], NULL, a);
+	SetMean(&sets[1], NULL, b);
+
+	printf("metric,a,b,change,low,high,verdict\r\n");
+	for(m = 0; m < METRICS; m++){
+		if(m < HPC_NUM_COUNTERS && !(columns & (1u << m)))
+			continue;
+		change = Change(a[m], b[m]);
+		if(isnan(change) || !Interval(&boot.change[(size_t)m * boot.replicates], boot.replicates, confidence, &low, &high)){
+			printf("%s,%.6g,%.6g,,,,-\r\n", MetricName(m), a[m], b[m]);
+			continue;
+		}
+		verdict = "same";
+		if((low > 0 || high < 0) && fabs(change) >= threshold){
+			//only a higher IPC is better
+			verdict = (change > 0) == (m == HPC_NUM_COUNTERS + CSV_IPC) ? "better" : "worse";
+			if(gated[m] && verdict[0] == 'w'){
+				fprintf(stderr, "regression: %s %+.2f%% [%+.2f%%, %+.2f%%]\n", MetricName(m), change, low, high);
+				regressions++;
+			}
+		}
+		printf("%s,%.6g,%.6g,%.3f,%.3f,%.3f,%s\r\n", MetricName(m), a[m], b[m], change, low, high, verdict);
+	}
+	rc = regressions != 0;
+
+done:
+	free(boot.change);
+	FreeSet(&sets[0]);
+	FreeSet(&sets[1]);
+	return rc;
+}
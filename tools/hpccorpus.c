@@ -0,0 +1,259 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Queries over a corpus of runs (corpus.h): a directory tree of CSV sample files, one
+* per run, under <workload>/<events>/ or with their sample logs next to them. The
+* summaries of the files come from the cache in the root, and only new or changed files
+* are read, on all CPUs, so a query over thousands of runs takes as long as the files
+* that changed. For every group of runs (-g: per workload, per event configuration or
+* both) and every counter (its mean per sample) and derived metric it prints
+*	workload,events,metric,runs,rows,mean,sd,min,max,pooled
+* mean, sd, min and max are over the values of the runs, so every run counts the same;
+* pooled is the value of all samples of the group together. -g run prints one line per
+* run with all metrics instead.
+*/
+
+#define _GNU_SOURCE
+#include <fnmatch.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "corpus.h"
+
+#define METRICS			(HPC_NUM_COUNTERS + CSV_DERIVED)
+
+#define GROUP_WORKLOAD	1
+#define GROUP_EVENTS	2
+#define GROUP_BOTH		3
+#define GROUP_RUN		4
+
+static int groupBy;
+
+static const char *MetricName(int m){
+	return m < HPC_NUM_COUNTERS ? csvCounterNames[m] : csvDerivedNames[m - HPC_NUM_COUNTERS];
+}
+
+//value of a metric for summed counters, 0 if it has none
+static int MetricValue(const UINT64 *totals, UINT64 rows, UINT32 columns, int m, double *value){
+	if(m >= HPC_NUM_COUNTERS)
+		return CsvDerive(totals, m - HPC_NUM_COUNTERS, value);
+	if(rows == 0 || !(columns & (1u << m)))
+		return 0;
+	*value = (double)totals[m] / (double)rows;
+	return 1;
+}
+
+static int CompareGroup(const void *x, const void *y){
+	const CORPUS_RUN *a = *(const CORPUS_RUN* const*)x, *b = *(const CORPUS_RUN* const*)y;
+	int c = 0;
+
+	if(groupBy & GROUP_WORKLOAD)
+		c = strcmp(a->summary.workload, b->summary.workload);
+	if(c == 0 && (groupBy & GROUP_EVENTS))
+		c = strcmp(a->summary.events, b->summary.events);
+	return c != 0 ? c : strcmp(a->path, b->path);
+}
+
+static int SameGroup(const CORPUS_RUN *a, const CORPUS_RUN *b){
+	return (!(groupBy & GROUP_WORKLOAD) || strcmp(a->summary.workload, b->summary.workload) == 0) &&
+		(!(groupBy & GROUP_EVENTS) || strcmp(a->summary.events, b->summary.events) == 0);
+}
+
+static void PrintGroup(CORPUS_RUN **runs, UINT32 count, const int *metrics){
+	UINT64 totals[HPC_NUM_COUNTERS], rows = 0;
+	UINT32 columns = ~0u, i, n;
+	double value, mean, m2, min, max, delta;
+	int m, c;
+
+	memset(totals, 0, sizeof(totals));
+	for(i = 0; i < count; i++){
+		rows += runs[i]->summary.rows;
+		columns &= runs[i]->summary.columns;
+		for(c = 0; c < HPC_NUM_COUNTERS; c++)
+			totals[c] += runs[i]->summary.totals[c];
+	}
+	for(m = 0; m < METRICS; m++){
+		if(!metrics[m])
+			continue;
+		n = 0;
+		mean = m2 = 0;
+		min = INFINITY;
+		max = -INFINITY;
+		for(i = 0; i < count; i++){
+			if(!MetricValue(runs[i]->summary.totals, runs[i]->summary.rows, runs[i]->summary.columns, m, &value))
+				continue;
+			n++;
+			delta = value - mean;
+			mean += delta / n;
+			m2 += delta * (value - mean);
+			if(value < min)
+				min = value;
+			if(value > max)
+				max = value;
+		}
+		if(n == 0)
+			continue;
+		printf("%s,%s,%s,%u,%llu,%.6g,", groupBy & GROUP_WORKLOAD ? runs[0]->summary.workload : "*",
+			groupBy & GROUP_EVENTS ? runs[0]->summary.events : "*", MetricName(m), n, (unsigned long long)rows, mean);
+		if(n > 1)
+			printf("%.6g", sqrt(m2 / (n - 1)));
+		printf(",%.6g,%.6g,", min, max);
+		//the pooled value only uses the counters all runs of the group have
+		if(MetricValue(totals, rows, columns, m, &value))
+			printf("%.6g", value);
+		printf("\r\n");
+	}
+}
+
+static void PrintRuns(CORPUS_RUN **runs, UINT32 count, const int *metrics){
+	double value;
+	UINT32 i;
+	int m;
+
+	printf("path,workload,events,rows");
+	for(m = 0; m < METRICS; m++){
+		if(metrics[m])
+			printf(",%s", MetricName(m));
+	}
+	printf("\r\n");
+	for(i = 0; i < count; i++){
+		printf("%s,%s,%s,%llu", runs[i]->path, runs[i]->summary.workload, runs[i]->summary.events,
+			(unsigned long long)runs[i]->summary.rows);
+		for(m = 0; m < METRICS; m++){
+			if(!metrics[m])
+				continue;
+			if(MetricValue(runs[i]->summary.totals, runs[i]->summary.rows, runs[i]->summary.columns, m, &value))
+				printf(",%.6g", value);
+			else
+				printf(",");
+		}
+		printf("\r\n");
+	}
+}
+
+//comma separated metric names, or all
+static int ParseMetrics(const char *list, int *metrics){
+	const char *p = list, *end;
+	size_t n;
+	int m;
+
+	if(strcmp(list, "all") == 0){
+		for(m = 0; m < METRICS; m++)
+			metrics[m] = 1;
+		return 0;
+	}
+	memset(metrics, 0, sizeof(int) * METRICS);
+	while(*p != 0){
+		end = strchr(p, ',');
+		n = end != NULL ? (size_t)(end - p) : strlen(p);
+		for(m = 0; m < METRICS; m++){
+			if(strlen(MetricName(m)) == n && strncmp(MetricName(m), p, n) == 0)
+				break;
+		}
+		if(m == METRICS){
+			fprintf(stderr, "unknown metric %.*s\n", (int)n, p);
+			return -1;
+		}
+		metrics[m] = 1;
+		p += n;
+		if(*p == ',')
+			p++;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[]){
+	CORPUS_OPTIONS options;
+	CORPUS corpus;
+	CORPUS_RUN **runs;
+	const char *workloads = NULL, *events = NULL;
+	int metrics[METRICS];
+	struct timespec t0, t1;
+	UINT32 i, first, count = 0;
+	int opt, update = 0;
+
+	memset(&options, 0, sizeof(options));
+	options.threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	groupBy = GROUP_BOTH;
+	ParseMetrics("all", metrics);
+	while((opt = getopt(argc, argv, "j:c:lfg:W:E:m:u")) != -1){
+		switch(opt){
+		case 'j': options.threads = atoi(optarg); break;
+		case 'c': options.cache = optarg; break;
+		case 'l': options.legacy = 1; break;
+		case 'f': options.rebuild = 1; break;
+		case 'g':
+			groupBy = strcmp(optarg, "workload") == 0 ? GROUP_WORKLOAD : strcmp(optarg, "events") == 0 ? GROUP_EVENTS :
+				strcmp(optarg, "both") == 0 ? GROUP_BOTH : strcmp(optarg, "run") == 0 ? GROUP_RUN : 0;
+			break;
+		case 'W': workloads = optarg; break;
+		case 'E': events = optarg; break;
+		case 'm':
+			if(ParseMetrics(optarg, metrics) != 0)
+				return 2;
+			break;
+		case 'u': update = 1; break;
+		default:
+			optind = argc + 1;
+			break;
+		}
+	}
+	if(optind != argc - 1 || groupBy == 0 || options.threads < 1){
+		fprintf(stderr, "usage: %s [-j threads] [-c cache] [-l] [-f] [-u] [-g workload|events|both|run] [-W pattern] [-E pattern] [-m metrics] corpus\n", argv[0]);
+		fprintf(stderr, "  -j  threads that read files, default one per CPU\n");
+		fprintf(stderr, "  -c  cache file, default corpus/%s\n", CORPUS_CACHE_NAME);
+		fprintf(stderr, "  -l  repair every value with bit 31 set (logs of the original driver, see hpcanalyze)\n");
+		fprintf(stderr, "  -f  read all files again\n");
+		fprintf(stderr, "  -u  only bring the cache up to date\n");
+		fprintf(stderr, "  -g  groups of runs (default both)\n");
+		fprintf(stderr, "  -W  only workloads matching the pattern, -E only event configurations matching it\n");
+		fprintf(stderr, "  -m  comma separated counters and derived metrics (default all)\n");
+		return 2;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	if(CorpusUpdate(argv[optind], &options, &corpus) != 0 && corpus.runs == NULL){
+		fprintf(stderr, "%s: cannot be read\n", argv[optind]);
+		return 2;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	fprintf(stderr, "%u runs: %u cached, %u moved, %u read (%.1f MB), %u failed, %u removed; %.2f s\n", corpus.count,
+		corpus.cached, corpus.moved, corpus.parsed, (double)corpus.bytesParsed / 1e6, corpus.failed, corpus.removed,
+		(double)(t1.tv_sec - t0.tv_sec) + (double)(t1.tv_nsec - t0.tv_nsec) / 1e9);
+	if(update){
+		CorpusFree(&corpus);
+		return 0;
+	}
+
+	runs = (CORPUS_RUN**)malloc(sizeof(CORPUS_RUN*) * (corpus.count + 1));
+	if(runs == NULL){
+		CorpusFree(&corpus);
+		return 2;
+	}
+	for(i = 0; i < corpus.count; i++){
+		if(!corpus.runs[i].valid)
+			continue;
+		if(workloads != NULL && fnmatch(workloads, corpus.runs[i].summary.workload, 0) != 0)
+			continue;
+		if(events != NULL && fnmatch(events, corpus.runs[i].summary.events, 0) != 0)
+			continue;
+		runs[count++] = &corpus.runs[i];
+	}
+	if(groupBy == GROUP_RUN)
+		PrintRuns(runs, count, metrics);
+	else{
+		qsort(runs, count, sizeof(CORPUS_RUN*), CompareGroup);
+		printf("workload,events,metric,runs,rows,mean,sd,min,max,pooled\r\n");
+		for(first = 0; first < count; first = i){
+			for(i = first + 1; i < count && SameGroup(runs[first], runs[i]); i++)
+				;
+			PrintGroup(runs + first, i - first, metrics);
+		}
+	}
+	free(runs);
+	CorpusFree(&corpus);
+	return 0;
+}
@@ -0,0 +1,232 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Control tool of the HPCTestDrv driver: configures, starts, stops and queries
+* the driver through the IOCTLs of drv/hpcconf.h, so that a parameter sweep does
+* not need a rebuild of the driver, and saves the stats of a running output=stats
+* run (drv/hpcstats.h) for tools/hpcstats. The status includes what the driver's handlers
+* cost the current or last run (drv/hpcself.h), overhead prints their histograms. Options are checked with the same code as in
+* the driver. Without the Windows SDK (e.g. on Linux) only the dry run (-n) is
+* available, which validates and prints a configuration.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hpcconf.h"
+#include "hpcstats.h"
+#include "overhead.h"
+
+/*
+* Print a configuration in the key=value syntax of the options
+*/
+static void PrintConfig(FILE *out, const HPC_CONFIG *config){
+	UINT32 i, j, last;
+
+	fprintf(out, "mode=%s\n", config->mode == HPC_MODE_SAMPLING ? "sampling" :
+		config->mode == HPC_MODE_POLLING ? "polling" : "unset");
+	fprintf(out, "threshold=%d\n", config->pmiThreshold);
+	//the four events of the original driver, the others if they are set
+	for(i = 0; i < HPC_MAX_PROGRAMMABLE; i++){
+		if(i < 4 || config->eventSel[0][i] != 0)
+			fprintf(out, "event%u=0x%08X\n", i, config->eventSel[0][i]);
+	}
+	for(i = 1; i < config->groupCount && i < HPC_MAX_GROUPS; i++){
+		for(last = 0, j = 1; j < HPC_MAX_PROGRAMMABLE; j++){
+			if(config->eventSel[i][j] != 0)
+				last = j;
+		}
+		fprintf(out, "group%u=", i);
+		for(j = 0; j <= last; j++)
+			fprintf(out, "%s0x%08X", j ? "," : "", config->eventSel[i][j]);
+		fprintf(out, "\n");
+	}
+	if(config->groupCount > 1)
+		fprintf(out, "rotate=%u\n", config->groupPeriod);
+	fprintf(out, "apps=");
+	for(i = 0; i < config->testAppCount && i < HPC_MAX_TEST_APPS; i++)
+		fprintf(out, "%s%.15s", i ? "," : "", config->testApps[i]);
+	fprintf(out, "\nlog=");
+	for(i = 0; i < HPC_MAX_PATH && config->logFile[i] != 0; i++)
+		fputc(config->logFile[i] < 0x80 ? (char)config->logFile[i] : '?', out);
+	fprintf(out, "\noutput=%s\n", config->output == HPC_OUTPUT_STATS ? "stats" : "log");
+	fprintf(out, "freeze=%s\n", config->freeze ? "on" : "off");
+	if(config->jitter != 0)
+		fprintf(out, "jitter=%u\n", config->jitter);
+	if(config->target != 0)
+		fprintf(out, "target=%u\n", config->target);
+	if(config->budget != 0)
+		fprintf(out, "budget=%u\n", config->budget);
+	fprintf(out, "rdpmc=%s\n", config->rdpmc ? "on" : "off");
+}
+
+#if defined(_WIN32)
+static void PrintStatus(FILE *out, const HPC_STATUS *status){
+	fprintf(out, "state:     %s\n", status->state == HPC_STATE_RUNNING ? "running" : "stopped");
+	fprintf(out, "cpus:      %u\n", status->cpuCount);
+	fprintf(out, "processes: %u\n", status->testProcesses);
+	fprintf(out, "samples:   %llu\n", (unsigned long long)status->samples);
+	fprintf(out, "dropped:   %llu\n", (unsigned long long)status->dropped);
+	OverheadPrint(out, &status->self, status->cpuCount, 10);
+	PrintConfig(out, &status->config);
+}
+#endif
+
+/*
+* Apply the key=value options to config and validate the result
+*/
+static int ApplyOptions(PHPC_CONFIG config, int argc, char *argv[]){
+	int i, rc;
+
+	for(i = 0; i < argc; i++){
+		rc = HpcConfigSet(config, argv[i]);
+		if(rc != HPC_CONFIG_OK){
+			fprintf(stderr, "%s: %s\n", argv[i], HpcConfigErrorText(rc));
+			return -1;
+		}
+	}
+	rc = HpcConfigValidate(config);
+	if(rc != HPC_CONFIG_OK){
+		fprintf(stderr, "invalid configuration: %s\n", HpcConfigErrorText(rc));
+		return -1;
+	}
+	return 0;
+}
+
+#if defined(_WIN32)
+/*
+* Send one IOCTL to the driver; returns 0 on success
+*/
+static int Control(HANDLE device, DWORD code, void *in, DWORD inLen, void *out, DWORD outLen){
+	DWORD bytes;
+
+	if(!DeviceIoControl(device, code, in, inLen, out, outLen, &bytes, NULL)){
+		fprintf(stderr, "request failed: error %lu\n", GetLastError());
+		return -1;
+	}
+	return 0;
+}
+
+/*
+* Save a snapshot of the stats of the current run into a file
+*/
+static int SaveStats(HANDLE device, const char *path){
+	UINT32 size = StatsSize(HPC_MAX_GROUPS);
+	PSAMPLE_STATS stats = malloc(size);
+	DWORD bytes;
+	FILE *file;
+	int rc = -1;
+
+	if(stats == NULL)
+		return -1;
+	if(!DeviceIoControl(device, IOCTL_HPC_QUERY_STATS, NULL, 0, stats, size, &bytes, NULL))
+		fprintf(stderr, "request failed: error %lu (is a run with output=stats active?)\n", GetLastError());
+	else if(StatsCheck(stats, bytes) != 0)
+		fprintf(stderr, "the driver returned stats of another version\n");
+	else if((file = fopen(path, "wb")) == NULL)
+		perror(path);
+	else{
+		if(fwrite(stats, 1, bytes, file) == bytes)
+			rc = 0;
+		if(fclose(file) != 0 || rc != 0){
+			perror(path);
+			rc = -1;
+		}
+	}
+	free(stats);
+	return rc;
+}
+#endif
+
+static void Usage(const char *name){
+	fprintf(stderr, "usage: %s [-n] command [key=value...]\n", name);
+	fprintf(stderr, "commands:\n");
+	fprintf(stderr, "  status                 print the state, counts, cost of the handlers and configuration of the driver\n");
+	fprintf(stderr, "  configure key=value... change the configuration of the next run\n");
+	fprintf(stderr, "  start [key=value...]   configure, then start monitoring\n");
+	fprintf(stderr, "  stop                   stop monitoring and flush the output file\n");
+	fprintf(stderr, "  overhead               print the histograms of the cost of the handlers in the current or last run as CSV\n");
+	fprintf(stderr, "  stats FILE             save the stats of the current output=stats run, see hpcstats\n");
+	fprintf(stderr, "keys: mode=sampling|polling threshold=N event0..event7=N apps=a.exe[,b.exe] log=\\\\DosDevices\\\\C:\\\\out.bin\n");
+	fprintf(stderr, "      group1..group7=N[,N...] (up to 8 events, multiplexed with group 0 = event0..event7) rotate=N (PMIs per group)\n");
+	fprintf(stderr, "      output=log|stats (every sample, or only their distributions)\n");
+	fprintf(stderr, "      freeze=on|off (freeze the counters on PMIs, so that the skid is not counted)\n");
+	fprintf(stderr, "      jitter=N (periods drawn from -threshold +- N) target=N (adapt the period to windows of N reference cycles)\n");
+	fprintf(stderr, "      budget=N (adapt the period so the PMI handler takes at most N per mille of the cycles)\n");
+	fprintf(stderr, "      rdpmc=on|off (let the test programs read the counters with rdpmc, polling mode, see hpcpmc.h)\n");
+	fprintf(stderr, "  -n  dry run: validate and print the configuration built from the options alone\n");
+}
+
+int main(int argc, char *argv[]){
+	HPC_STATUS status;
+	const char *command;
+	int dryRun = 0, arg = 1;
+#if defined(_WIN32)
+	HANDLE device;
+	int rc = 0;
+#endif
+
+	if(arg < argc && strcmp(argv[arg], "-n") == 0){
+		dryRun = 1;
+		arg++;
+	}
+	if(arg >= argc){
+		Usage(argv[0]);
+		return 2;
+	}
+	command = argv[arg++];
+	if(strcmp(command, "status") != 0 && strcmp(command, "configure") != 0 &&
+		strcmp(command, "start") != 0 && strcmp(command, "stop") != 0 && strcmp(command, "overhead") != 0 &&
+		(strcmp(command, "stats") != 0 || arg + 1 != argc)){
+		Usage(argv[0]);
+		return 2;
+	}
+
+#if !defined(_WIN32)
+	dryRun = 1;
+#endif
+	if(dryRun){
+		if(strcmp(command, "configure") != 0 && strcmp(command, "start") != 0){
+			fprintf(stderr, "%s: needs the driver, only configure and start have a dry run\n", command);
+			return 2;
+		}
+		HpcConfigInit(&status.config);
+		if(ApplyOptions(&status.config, argc - arg, argv + arg) != 0)
+			return 1;
+		PrintConfig(stdout, &status.config);
+		return 0;
+	}
+
+#if defined(_WIN32)
+	device = CreateFileA(HPC_DEVICE_NAME, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+	if(device == INVALID_HANDLE_VALUE){
+		fprintf(stderr, "cannot open %s: error %lu (is the driver started?)\n", HPC_DEVICE_NAME, GetLastError());
+		return 1;
+	}
+
+	//options change the current configuration of the driver, the other parameters are kept
+	if(Control(device, IOCTL_HPC_QUERY_STATUS, NULL, 0, &status, sizeof(status)) != 0)
+		rc = 1;
+	else if(strcmp(command, "status") == 0)
+		PrintStatus(stdout, &status);
+	else if(strcmp(command, "overhead") == 0)
+		OverheadWriteCsv(stdout, &status.self);
+	else if(strcmp(command, "stop") == 0)
+		rc = Control(device, IOCTL_HPC_STOP, NULL, 0, NULL, 0) != 0;
+	else if(strcmp(command, "stats") == 0)
+		rc = SaveStats(device, argv[arg]) != 0;
+	else{
+		if(arg < argc || strcmp(command, "configure") == 0){
+			if(ApplyOptions(&status.config, argc - arg, argv + arg) != 0 ||
+				Control(device, IOCTL_HPC_CONFIGURE, &status.config, sizeof(status.config), NULL, 0) != 0)
+				rc = 1;
+		}
+		if(rc == 0 && strcmp(command, "start") == 0)
+			rc = Control(device, IOCTL_HPC_START, NULL, 0, NULL, 0) != 0;
+	}
+	CloseHandle(device);
+	return rc;
+#else
+	return 1;
+#endif
+}
@@ -0,0 +1,215 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Converts a binary sample log written by the driver (drv/hpclog.h) into the
+* CSV format of the original driver:
+*	ins,l_cycle,ref_cycle,event1,event2,event3,event4
+* followed by the other counters the PMU of the log has (event5..event8, slots), and
+* optionally by the thread id, CPU and time stamp, the event group, the region, the sampling period and the
+* interrupted instruction pointer of each sample.
+* The per-CPU sample streams of the log are merged in time stamp order.
+* With a calibration of hpccal, the windows of a sampling log are normalized to exactly
+* one period (calib.h): the skid and the PMI overhead are taken out of the counts.
+* The header of a log of the driver also tells what its handlers cost the run (drv/hpcself.h).
+* Only uses stdio, so it builds with the Windows SDK as well as on Linux.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "calib.h"
+#include "logread.h"
+#include "overhead.h"
+
+static const char *columnNames[HPC_NUM_COUNTERS] = HPC_COLUMN_NAMES;
+
+/*
+* Print the experiment description of the log header
+*/
+static void PrintHeader(FILE *out, const SAMPLE_LOG_HEADER *header){
+	UINT32 g, i;
+
+	fprintf(out, "mode:          %s\n", header->mode == SAMPLE_LOG_MODE_SAMPLING ? "sampling" :
+		header->mode == SAMPLE_LOG_MODE_POLLING ? "polling" : "unknown");
+	fprintf(out, "pmiThreshold:  %d\n", header->pmiThreshold);
+	if(header->jitter != 0)
+		fprintf(out, "jitter:        +-%u instructions\n", header->jitter);
+	if(header->target != 0 || header->budget != 0)
+		fprintf(out, "adapted:       target %u reference cycles, budget %u per mille\n", header->target, header->budget);
+	fprintf(out, "events:       ");
+	for(i = 0; i < HPC_MAX_PROGRAMMABLE; i++)
+		fprintf(out, " 0x%08X", header->eventSel[i]);
+	fprintf(out, "\n");
+	for(g = 1; g < header->groupCount && g < HPC_MAX_GROUPS; g++){
+		fprintf(out, "group %u:      ", g);
+		for(i = 0; i < HPC_MAX_PROGRAMMABLE; i++)
+			fprintf(out, " 0x%08X", header->groupEventSel[g][i]);
+		fprintf(out, "\n");
+	}
+	if(header->groupCount > 1)
+		fprintf(out, "rotate:        every %u PMIs\n", header->groupPeriod);
+	fprintf(out, "test app:      %.16s\n", header->testApp);
+	fprintf(out, "cpu:           %.48s (signature 0x%08X, %u cpus)\n", header->cpuModel, header->cpuSignature, header->cpuCount);
+	if(header->pmuVersion != 0)
+		fprintf(out, "pmu:           version %u, counters of %u bits, fixed counters of %u bits\n", header->pmuVersion,
+			header->programmableWidth, header->fixedWidth);
+	fprintf(out, "columns:      ");
+	for(i = 0; i < HPC_NUM_COUNTERS; i++){
+		if(header->columns & (1u << i))
+			fprintf(out, " %s", columnNames[i]);
+	}
+	fprintf(out, "\n");
+	if(header->flags & SAMPLE_LOG_FLAG_PERF)
+		fprintf(out, "collector:     hpcrun, time stamps in ns%s\n",
+			header->flags & SAMPLE_LOG_FLAG_SOFTWARE ? ", software events" : "");
+	if(header->flags & SAMPLE_LOG_FLAG_FREEZE)
+		fprintf(out, "freeze:        counters frozen on PMIs\n");
+	fprintf(out, "samples:       %llu\n", (unsigned long long)header->samples);
+	fprintf(out, "dropped:       %llu\n", (unsigned long long)header->dropped);
+	if(!(header->flags & SAMPLE_LOG_FLAG_PERF))
+		OverheadPrint(out, &header->self, header->cpuCount, 14);
+}
+
+int main(int argc, char *argv[]){
+	LOG_READER reader;
+	HPC_SAMPLE sample;
+	CALIBRATION cal;
+	UINT64 normalized[HPC_NUM_COUNTERS];
+	UINT32 extra;
+	FILE *out = stdout, *calFile;
+	const char *error, *calPath = NULL;
+	int c, infoOnly = 0, overheadOnly = 0, withTid = 0, withCpu = 0, withGroup = 0, withRegion = 0, withPeriod = 0, withIp = 0, arg = 1, rc;
+
+	for(; arg < argc && argv[arg][0] == '-'; arg++){
+		if(strcmp(argv[arg], "-i") == 0)
+			infoOnly = 1;
+		else if(strcmp(argv[arg], "-o") == 0)
+			overheadOnly = 1;
+		else if(strcmp(argv[arg], "-t") == 0)
+			withTid = 1;
+		else if(strcmp(argv[arg], "-c") == 0)
+			withCpu = 1;
+		else if(strcmp(argv[arg], "-g") == 0)
+			withGroup = 1;
+		else if(strcmp(argv[arg], "-r") == 0)
+			withRegion = 1;
+		else if(strcmp(argv[arg], "-p") == 0)
+			withPeriod = 1;
+		else if(strcmp(argv[arg], "-a") == 0)
+			withIp = 1;
+		else if(strcmp(argv[arg], "-k") == 0 && arg + 1 < argc)
+			calPath = argv[++arg];
+		else
+			break;
+	}
+	if(arg >= argc || argv[arg][0] == '-'){
+		fprintf(stderr, "usage: %s [-i] [-o] [-t] [-c] [-g] [-r] [-p] [-a] [-k cal.csv] hpcoutput.bin [hpcoutput.csv]\n", argv[0]);
+		fprintf(stderr, "  -i  print the log header instead of the samples\n");
+		fprintf(stderr, "  -o  print the histograms of the cost of the driver's handlers as CSV instead\n");
+		fprintf(stderr, "  -t  add the thread id of each sample as a column\n");
+		fprintf(stderr, "  -c  add the CPU and time stamp of each sample as columns\n");
+		fprintf(stderr, "  -g  add the event group of each sample as a column (see hpcmux)\n");
+		fprintf(stderr, "  -r  add the region and its nesting depth as columns (see regionsum)\n");
+		fprintf(stderr, "  -p  add the sampling period of each window as a column\n");
+		fprintf(stderr, "  -a  add the interrupted instruction pointer and privilege level as columns (see hpcsym)\n");
+		fprintf(stderr, "  -k  normalize every window to one period with a calibration of hpccal\n");
+		return 2;
+	}
+
+	if(LogReaderOpen(&reader, argv[arg], &error) != 0){
+		if(error != NULL)
+			fprintf(stderr, "%s: %s (version %d)\n", argv[arg], error, SAMPLE_LOG_VERSION);
+		else
+			perror(argv[arg]);
+		return 1;
+	}
+	if(infoOnly){
+		PrintHeader(stdout, &reader.header);
+		LogReaderClose(&reader);
+		return 0;
+	}
+	if(overheadOnly){
+		OverheadWriteCsv(stdout, &reader.header.self);
+		LogReaderClose(&reader);
+		return 0;
+	}
+
+	if(calPath != NULL){
+		calFile = fopen(calPath, "rb");
+		if(calFile == NULL){
+			perror(calPath);
+			return 1;
+		}
+		rc = CalibLoad(&cal, calFile);
+		fclose(calFile);
+		if(rc != 0){
+			fprintf(stderr, "%s: not a calibration of hpccal\n", calPath);
+			return 1;
+		}
+		if(reader.header.mode != SAMPLE_LOG_MODE_SAMPLING){
+			fprintf(stderr, "%s: only the windows of the sampling mode are normalized\n", argv[arg]);
+			return 1;
+		}
+		if(cal.freeze != ((reader.header.flags & SAMPLE_LOG_FLAG_FREEZE) != 0))
+			fprintf(stderr, "warning: the calibration was taken %s freeze on PMI, the log %s\n",
+				cal.freeze ? "with" : "without", cal.freeze ? "without" : "with");
+	}
+
+	if(arg + 1 < argc){
+		out = fopen(argv[arg + 1], "wb");
+		if(out == NULL){
+			perror(argv[arg + 1]);
+			return 1;
+		}
+	}
+
+	//samples of all CPUs, merged in time stamp order
+	//the columns of the original driver, then those of the other counters of the PMU
+	extra = reader.header.columns & ~HPC_BASE_COLUMNS;
+	fprintf(out, "ins,l_cycle,ref_cycle,event1,event2,event3,event4");
+	for(c = 0; c < HPC_NUM_COUNTERS; c++){
+		if(extra & (1u << c))
+			fprintf(out, ",%s", columnNames[c]);
+	}
+	fprintf(out, "%s%s%s%s%s%s\r\n", withTid ? ",tid" : "", withCpu ? ",cpu,tsc" : "",
+		withGroup ? ",group" : "", withRegion ? ",region,depth" : "", withPeriod ? ",period" : "", withIp ? ",ip,cpl" : "");
+	while((rc = LogReaderNext(&reader, &sample)) == 1){
+		//region samples are no windows
+		if(calPath != NULL && sample.region == 0){
+			CalibNormalize(&cal, reader.header.groupEventSel[sample.group % HPC_MAX_GROUPS], sample.ctr, normalized);
+			memcpy(sample.ctr, normalized, sizeof(normalized));
+		}
+		fprintf(out, "%llu,%llu,%llu,%llu,%llu,%llu,%llu",
+			(unsigned long long)sample.ctr[0], (unsigned long long)sample.ctr[1], (unsigned long long)sample.ctr[2],
+			(unsigned long long)sample.ctr[3], (unsigned long long)sample.ctr[4], (unsigned long long)sample.ctr[5],
+			(unsigned long long)sample.ctr[6]);
+		for(c = 0; c < HPC_NUM_COUNTERS; c++){
+			if(extra & (1u << c))
+				fprintf(out, ",%llu", (unsigned long long)sample.ctr[c]);
+		}
+		if(withTid)
+			fprintf(out, ",%u", sample.tid);
+		if(withCpu)
+			fprintf(out, ",%u,%llu", sample.cpu, (unsigned long long)sample.tsc);
+		if(withGroup)
+			fprintf(out, ",%u", sample.group);
+		if(withRegion)
+			fprintf(out, ",%u,%u", sample.region, sample.depth);
+		if(withPeriod)
+			fprintf(out, ",%u", sample.period);
+		if(withIp)
+			fprintf(out, ",0x%llx,%u", (unsigned long long)sample.ip, sample.cpl);
+		fprintf(out, "\r\n");
+	}
+	if(rc < 0){
+		fprintf(stderr, "corrupt block after %llu samples\n", (unsigned long long)reader.samples);
+		return 1;
+	}
+
+	if(reader.header.dropped != 0)
+		fprintf(stderr, "warning: %llu samples were dropped by the driver\n", (unsigned long long)reader.header.dropped);
+	LogReaderClose(&reader);
+	if(out != stdout)
+		fclose(out);
+	return 0;
+}
@@ -0,0 +1,353 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Feature vectors of windows of samples (feature.h) for training models: from CSV
+* sample files, from sample logs, or from a running experiment as its samples are taken
+* (live.h). Every window becomes one row of a dense matrix of float32, or float64 with
+* -d, written as a NumPy .npy file whose shape is filled in at the end, or as raw rows to
+* stdout with -o -. The names of the columns go to a text file, one per line. Windows do
+* not span input files; with -i every row starts with the number of its input file and
+* of the first sample of its window in it.
+*/
+
+#if !defined(_WIN32)
+#define _GNU_SOURCE
+#include <unistd.h>
+#endif
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "live.h"
+#include "logread.h"
+#include "csvscan.h"
+#include "feature.h"
+
+//the .npy header is written with room for any shape and rewritten at the end
+#define NPY_HEADER_SIZE		128
+
+typedef struct _MATRIX {
+	FILE *file;
+	int npy;
+	int wide;						//float64
+	UINT64 rows;
+	UINT32 columns;					//0 until the first input fixes them
+	int error;
+} MATRIX, *PMATRIX;
+
+typedef struct _EXTRACTION {
+	FEATURE_EXTRACTOR fx;
+	PMATRIX out;
+	UINT32 groups, window, stride;
+	int index;						//prepend the file and first sample
+	UINT32 file;
+	float vector[FEATURE_MAX];
+	char names[256];				//where the column names go, empty for none
+} EXTRACTION, *PEXTRACTION;
+
+static volatile sig_atomic_t stopRequested;
+
+static void RequestStop(int signal){
+	(void)signal;
+	stopRequested = 1;
+}
+
+static double Seconds(){
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/*
+* The .npy header: magic, version 1.0, the length of the dictionary, which is padded
+* with spaces so the data starts at NPY_HEADER_SIZE
+*/
+static void WriteNpyHeader(PMATRIX out){
+	char header[NPY_HEADER_SIZE + 1];
+	int n;
+
+	memcpy(header, "\x93NUMPY\x01\x00", 8);
+	header[8] = (char)(NPY_HEADER_SIZE - 10);
+	header[9] = 0;
+	n = snprintf(header + 10, sizeof(header) - 10, "{'descr': '<%s', 'fortran_order': False, 'shape': (%llu, %u), }",
+		out->wide ? "f8" : "f4", (unsigned long long)out->rows, out->columns);
+	memset(header + 10 + n, ' ', NPY_HEADER_SIZE - 10 - n - 1);
+	header[NPY_HEADER_SIZE - 1] = '\n';
+	if(fwrite(header, 1, NPY_HEADER_SIZE, out->file) != NPY_HEADER_SIZE)
+		out->error = 1;
+}
+
+static void WriteRow(PMATRIX out, const double *prefix, int prefixes, const float *vector, UINT32 count){
+	double wide[FEATURE_MAX];
+	float narrow[2];
+	UINT32 i;
+	int ok;
+
+	if(out->wide){
+		for(i = 0; i < (UINT32)prefixes; i++)
+			wide[i] = prefix[i];
+		for(i = 0; i < count; i++)
+			wide[prefixes + i] = vector[i];
+		ok = fwrite(wide, sizeof(double), prefixes + count, out->file) == prefixes + count;
+	}else{
+		for(i = 0; i < (UINT32)prefixes; i++)
+			narrow[i] = (float)prefix[i];
+		ok = fwrite(narrow, sizeof(float), prefixes, out->file) == (size_t)prefixes &&
+			fwrite(vector, sizeof(float), count, out->file) == count;
+	}
+	if(!ok)
+		out->error = 1;
+	out->rows++;
+}
+
+/*
+* A new input: the extractor for its columns, which must be those of the inputs before
+*/
+static int StartInput(PEXTRACTION x, UINT32 columns, const char *name){
+	char feature[64];
+	FILE *names;
+	UINT32 i;
+
+	FeatureFree(&x->fx);
+	if(FeatureInit(&x->fx, columns, x->groups, x->window, x->stride) != 0){
+		fprintf(stderr, "%s: no instructions column, or out of memory\n", name);
+		return -1;
+	}
+	if(x->out->columns == 0){
+		x->out->columns = x->fx.count + (x->index ? 2 : 0);
+		if(x->out->npy)
+			WriteNpyHeader(x->out);
+		if(x->names[0] != 0 && (names = fopen(x->names, "w")) != NULL){
+			if(x->index)
+				fprintf(names, "file\nfirst\n");
+			for(i = 0; i < x->fx.count; i++){
+				FeatureName(&x->fx, i, feature, sizeof(feature));
+				fprintf(names, "%s\n", feature);
+			}
+			fclose(names);
+		}
+	}else if(x->out->columns != x->fx.count + (x->index ? 2 : 0)){
+		fprintf(stderr, "%s: has other counters than the inputs before\n", name);
+		return -1;
+	}
+	return 0;
+}
+
+static void AddSample(PEXTRACTION x, const UINT64 *ctr){
+	double prefix[2];
+
+	if(!FeatureAdd(&x->fx, ctr, x->vector))
+		return;
+	prefix[0] = x->file;
+	prefix[1] = (double)(x->fx.samples - x->window);
+	WriteRow(x->out, prefix, x->index ? 2 : 0, x->vector, x->fx.count);
+}
+
+static int CsvBlock(void *context, const CSV_ROWS *rows){
+	PEXTRACTION x = (PEXTRACTION)context;
+	UINT64 ctr[HPC_NUM_COUNTERS];
+	UINT32 r;
+	int c;
+
+	if(x->fx.window == 0 && StartInput(x, rows->columns, "input") != 0)
+		return 1;
+	for(r = 0; r < rows->rows; r++){
+		for(c = 0; c < HPC_NUM_COUNTERS; c++)
+			ctr[c] = rows->ctr[c][r];
+		AddSample(x, ctr);
+	}
+	return 0;
+}
+
+static int ExtractCsv(PEXTRACTION x, const char *path){
+	int rc;
+
+	FeatureFree(&x->fx);
+	rc = CsvReadRowsFile(path, 0, CsvBlock, x);
+	if(rc < 0)
+		fprintf(stderr, "%s: cannot be read or lacks a counter column\n", path);
+	return rc != 0 ? -1 : 0;
+}
+
+static int ExtractLog(PEXTRACTION x, const char *path){
+	LOG_READER reader;
+	HPC_SAMPLE sample;
+	const char *error;
+	int rc;
+
+	if(LogReaderOpen(&reader, path, &error) != 0){
+		if(error != NULL)
+			fprintf(stderr, "%s: %s (version %d)\n", path, error, SAMPLE_LOG_VERSION);
+		else
+			perror(path);
+		return -1;
+	}
+	if(StartInput(x, reader.header.columns, path) != 0){
+		LogReaderClose(&reader);
+		return -1;
+	}
+	while((rc = LogReaderNext(&reader, &sample)) == 1)
+		AddSample(x, sample.ctr);
+	if(rc < 0)
+		fprintf(stderr, "%s: corrupt after %llu samples\n", path, (unsigned long long)reader.samples);
+	LogReaderClose(&reader);
+	return rc < 0 ? -1 : 0;
+}
+
+static int ExtractLive(PEXTRACTION x, UINT32 pid, INT32 threshold){
+	LIVE_SOURCE source;
+	HPC_SAMPLE sample;
+	char name[32];
+
+	if(LiveOpen(&source, pid, threshold, 0) != 0)
+		return -1;
+	if(source.header.flags & SAMPLE_LOG_FLAG_SOFTWARE)
+		fprintf(stderr, "warning: no hardware counters, the features are those of the software events\n");
+	snprintf(name, sizeof(name), "live:%u", pid);
+	if(StartInput(x, source.header.columns, name) != 0){
+		LiveClose(&source);
+		return -1;
+	}
+	signal(SIGINT, RequestStop);
+	while(!stopRequested && !x->out->error){
+		LiveWait(&source, 100);
+		while(LiveNext(&source, &sample) == 1)
+			AddSample(x, sample.ctr);
+		//rows reach a reader at the other end of a pipe while the experiment runs
+		fflush(x->out->file);
+#if !defined(_WIN32)
+		if(kill((pid_t)pid, 0) != 0)
+			break;
+#endif
+	}
+	if(source.lost != 0)
+		fprintf(stderr, "%llu samples lost\n", (unsigned long long)source.lost);
+	LiveClose(&source);
+	return 0;
+}
+
+static UINT32 ParseGroups(const char *list){
+	static const char *names[4] = { "deltas", "moments", "rates", "hist" };
+	const char *p = list;
+	UINT32 groups = 0;
+	size_t n;
+	int g;
+
+	if(strcmp(list, "all") == 0)
+		return FEATURE_ALL;
+	while(*p != 0){
+		n = strcspn(p, ",");
+		for(g = 0; g < 4; g++){
+			if(strlen(names[g]) == n && strncmp(names[g], p, n) == 0)
+				break;
+		}
+		if(g == 4)
+			return 0;
+		groups |= 1u << g;
+		p += n + (p[n] == ',');
+	}
+	return groups;
+}
+
+int main(int argc, char *argv[]){
+	static EXTRACTION x;
+	MATRIX out;
+	const char *path = NULL;
+	INT32 threshold = -50000;
+	UINT32 pid = 0;
+	double t0;
+	size_t len;
+	int opt, arg, live = 0, rc = 0;
+
+	memset(&out, 0, sizeof(out));
+	x.out = &out;
+	x.groups = FEATURE_ALL;
+	x.window = 100;
+	while((opt = getopt(argc, argv, "w:s:f:o:n:dilp:t:")) != -1){
+		switch(opt){
+		case 'w': x.window = (UINT32)strtoul(optarg, NULL, 0); break;
+		case 's': x.stride = (UINT32)strtoul(optarg, NULL, 0); break;
+		case 'f': x.groups = ParseGroups(optarg); break;
+		case 'o': path = optarg; break;
+		case 'n': snprintf(x.names, sizeof(x.names), "%s", optarg); break;
+		case 'd': out.wide = 1; break;
+		case 'i': x.index = 1; break;
+		case 'l': live = 1; break;
+		case 'p': pid = (UINT32)strtoul(optarg, NULL, 0); live = 1; break;
+		case 't': threshold = (INT32)strtol(optarg, NULL, 0); break;
+		default:
+			optind = argc + 1;
+			break;
+		}
+	}
+	if(x.stride == 0)
+		x.stride = x.window;
+	if(optind > argc || (live ? optind != argc : optind == argc) || path == NULL || x.groups == 0 ||
+		x.window == 0 || x.window % x.stride != 0 || x.window / x.stride > FEATURE_MAX_BLOCKS || x.stride > FEATURE_MAX_STRIDE){
+		fprintf(stderr, "usage: %s [-w samples] [-s samples] [-f groups] [-d] [-i] [-n names] -o out.npy|- input...\n", argv[0]);
+#if defined(_WIN32)
+		fprintf(stderr, "       %s [options] -o out.npy|- -l\n", argv[0]);
+#else
+		fprintf(stderr, "       %s [options] [-t threshold] -o out.npy|- -p pid\n", argv[0]);
+#endif
+		fprintf(stderr, "  inputs are CSV sample files or sample logs (.bin)\n");
+		fprintf(stderr, "  -w  samples per window (default 100)\n");
+		fprintf(stderr, "  -s  samples between the starts of two windows, divides -w at most %d times (default -w, tumbling)\n", FEATURE_MAX_BLOCKS);
+		fprintf(stderr, "  -f  comma separated feature groups: deltas, moments, rates, hist (default all)\n");
+		fprintf(stderr, "  -d  float64 instead of float32\n");
+		fprintf(stderr, "  -i  start every row with the input number and the first sample of its window\n");
+		fprintf(stderr, "  -n  file of the column names (default out.npy.names)\n");
+#if defined(_WIN32)
+		fprintf(stderr, "  -l  follow the samples of the running driver\n");
+#else
+		fprintf(stderr, "  -p  follow a running process, sampled every -t instructions (default -50000)\n");
+#endif
+		return 2;
+	}
+#if !defined(_WIN32)
+	if(live && pid == 0){
+		fprintf(stderr, "-p pid is needed\n");
+		return 2;
+	}
+#endif
+
+	if(strcmp(path, "-") == 0)
+		out.file = stdout;
+	else{
+		out.file = fopen(path, "wb");
+		out.npy = 1;
+		if(x.names[0] == 0)
+			snprintf(x.names, sizeof(x.names), "%s.names", path);
+	}
+	if(out.file == NULL){
+		perror(path);
+		return 2;
+	}
+
+	t0 = Seconds();
+	if(live)
+		rc = ExtractLive(&x, pid, threshold) != 0;
+	for(arg = optind; !live && arg < argc && !out.error; arg++){
+		x.file = (UINT32)(arg - optind);
+		len = strlen(argv[arg]);
+		if(len > 4 && strcmp(argv[arg] + len - 4, ".bin") == 0)
+			rc |= ExtractLog(&x, argv[arg]) != 0;
+		else
+			rc |= ExtractCsv(&x, argv[arg]) != 0;
+	}
+	FeatureFree(&x.fx);
+	if(out.npy && out.columns != 0 && !out.error){
+		rewind(out.file);
+		WriteNpyHeader(&out);
+	}
+	if(out.file != stdout && fclose(out.file) != 0)
+		out.error = 1;
+	if(out.error){
+		fprintf(stderr, "%s: cannot be written\n", path);
+		return 2;
+	}
+	fprintf(stderr, "%llu windows of %u features, %.1f s\n", (unsigned long long)out.rows, out.columns, Seconds() - t0);
+	return rc;
+}
@@ -0,0 +1,238 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Live view of a running experiment: every interval it prints the samples taken, the
+* samples lost because the viewer fell behind, and the IPC, branch and LLC misses per
+* thousand instructions and the LLC miss ratio over the last intervals (csvscan.h has
+* the definitions, which assume the default events of the driver). The samples are
+* read from the live source of live.h: the mapped rings of the driver on Windows, the
+* perf ring of a process on Linux, which hpclive attaches to (-p) or starts. It runs
+* until the experiment ends or it gets SIGINT, then prints the metrics of the whole run.
+*/
+
+#if !defined(_WIN32)
+#define _GNU_SOURCE
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "live.h"
+#include "csvscan.h"
+
+//intervals the rolling metrics can span
+#define MAX_WINDOW 60
+
+static volatile sig_atomic_t stopRequested;
+
+static void RequestStop(int signal){
+	(void)signal;
+	stopRequested = 1;
+}
+
+static double Seconds(){
+#if defined(_WIN32)
+	return (double)GetTickCount64() / 1000.0;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+#endif
+}
+
+/*
+* Derived metrics of summed counters, "-" where they have no value
+*/
+static void PrintMetrics(const UINT64 *ctr){
+	double value;
+	int k;
+
+	for(k = 0; k < CSV_DERIVED; k++){
+		if(CsvDerive(ctr, k, &value))
+			printf("  %14.4f", value);
+		else
+			printf("  %14s", "-");
+	}
+	printf("\n");
+}
+
+static void PrintTitle(){
+	int k;
+
+	printf("%8s  %10s  %10s", "time", "samples", "lost");
+	for(k = 0; k < CSV_DERIVED; k++)
+		printf("  %14s", csvDerivedNames[k]);
+	printf("\n");
+}
+
+static void Usage(const char *name){
+#if defined(_WIN32)
+	fprintf(stderr, "usage: %s [-i interval ms] [-w intervals]\n", name);
+	fprintf(stderr, "  follows the samples of the driver, see hpcctl to configure and start it\n");
+#else
+	fprintf(stderr, "usage: %s [-i interval ms] [-w intervals] [-t threshold] (-p pid | [--] program [args...])\n", name);
+	fprintf(stderr, "  -t  sampling period as in the driver (default -50000)\n");
+#endif
+	fprintf(stderr, "  -i  interval between two lines (default 1000 ms)\n");
+	fprintf(stderr, "  -w  intervals the metrics are computed over (default 5, at most %d)\n", MAX_WINDOW);
+}
+
+int main(int argc, char *argv[]){
+	LIVE_SOURCE source;
+	HPC_SAMPLE sample;
+	UINT64 interval[MAX_WINDOW][HPC_NUM_COUNTERS], rolling[HPC_NUM_COUNTERS], total[HPC_NUM_COUNTERS];
+	UINT64 samples = 0, intervalSamples = 0, lastLost = 0;
+	double start, next;
+	int intervalMs = 1000, window = 5, slot = 0, arg = 1, c, i, running = 1;
+	INT32 threshold = -50000;
+	UINT32 pid = 0, flags = 0;
+#if !defined(_WIN32)
+	int go[2], status = 0, child = 0;
+	char ack = 1;
+	pid_t started = 0;
+#endif
+
+	for(; arg < argc && argv[arg][0] == '-' && argv[arg][1] != '-'; arg++){
+		if(arg + 1 >= argc || argv[arg][2] != 0){
+			Usage(argv[0]);
+			return 2;
+		}
+		if(argv[arg][1] == 'i')
+			intervalMs = atoi(argv[++arg]);
+		else if(argv[arg][1] == 'w')
+			window = atoi(argv[++arg]);
+#if !defined(_WIN32)
+		else if(argv[arg][1] == 't')
+			threshold = (INT32)strtol(argv[++arg], NULL, 0);
+		else if(argv[arg][1] == 'p')
+			pid = (UINT32)strtoul(argv[++arg], NULL, 0);
+#endif
+		else{
+			Usage(argv[0]);
+			return 2;
+		}
+	}
+	if(arg < argc && strcmp(argv[arg], "--") == 0)
+		arg++;
+	if(intervalMs <= 0 || window < 1 || window > MAX_WINDOW){
+		Usage(argv[0]);
+		return 2;
+	}
+#if defined(_WIN32)
+	if(arg != argc){
+		Usage(argv[0]);
+		return 2;
+	}
+#else
+	if((pid == 0) == (arg == argc)){
+		Usage(argv[0]);
+		return 2;
+	}
+
+	//a program is started like hpcrun does: it waits until its counters are open, then execs
+	if(pid == 0){
+		if(pipe(go) != 0){
+			perror("pipe");
+			return 1;
+		}
+		started = fork();
+		if(started < 0){
+			perror("fork");
+			return 1;
+		}
+		if(started == 0){
+			close(go[1]);
+			if(read(go[0], &ack, 1) != 1)
+				_exit(127);
+			close(go[0]);
+			execvp(argv[arg], argv + arg);
+			perror(argv[arg]);
+			_exit(127);
+		}
+		close(go[0]);
+		pid = (UINT32)started;
+		flags = LIVE_OPEN_ON_EXEC;
+		child = 1;
+	}
+#endif
+
+	if(LiveOpen(&source, pid, threshold, flags) != 0){
+#if !defined(_WIN32)
+		if(child){
+			kill(started, SIGKILL);
+			waitpid(started, NULL, 0);
+		}
+#endif
+		return 1;
+	}
+#if !defined(_WIN32)
+	if(child){
+		if(write(go[1], &ack, 1) != 1)
+			perror("start");
+		close(go[1]);
+	}
+#endif
+	if(source.header.flags & SAMPLE_LOG_FLAG_SOFTWARE)
+		fprintf(stderr, "warning: no hardware counters, the metrics are those of the software events\n");
+	signal(SIGINT, RequestStop);
+
+	memset(interval, 0, sizeof(interval));
+	memset(total, 0, sizeof(total));
+	PrintTitle();
+	start = Seconds();
+	next = start + intervalMs / 1000.0;
+	while(running && !stopRequested){
+		LiveWait(&source, intervalMs < 10 ? intervalMs : 10);
+		while(LiveNext(&source, &sample) == 1){
+			for(c = 0; c < HPC_NUM_COUNTERS; c++){
+				interval[slot][c] += sample.ctr[c];
+				total[c] += sample.ctr[c];
+			}
+			intervalSamples++;
+		}
+
+#if !defined(_WIN32)
+		if(child && waitpid(started, &status, WNOHANG) == (pid_t)started)
+			running = 0;
+		else if(!child && kill((pid_t)pid, 0) != 0)
+			running = 0;
+#endif
+		if(Seconds() < next && running)
+			continue;
+		next += intervalMs / 1000.0;
+		//the driver keeps the region between runs; stay quiet while it is stopped
+		if(!LiveRunning(&source) && intervalSamples == 0)
+			continue;
+
+		//the metrics of the last window intervals
+		memset(rolling, 0, sizeof(rolling));
+		for(i = 0; i < window; i++){
+			for(c = 0; c < HPC_NUM_COUNTERS; c++)
+				rolling[c] += interval[(slot + MAX_WINDOW - i) % MAX_WINDOW][c];
+		}
+		printf("%8.1f  %10llu  %10llu", Seconds() - start, (unsigned long long)intervalSamples,
+			(unsigned long long)(source.lost - lastLost));
+		PrintMetrics(rolling);
+		fflush(stdout);
+		samples += intervalSamples;
+		intervalSamples = 0;
+		lastLost = source.lost;
+		slot = (slot + 1) % MAX_WINDOW;
+		memset(interval[slot], 0, sizeof(interval[slot]));
+	}
+
+	printf("%8s  %10llu  %10llu", "total", (unsigned long long)samples, (unsigned long long)source.lost);
+	PrintMetrics(total);
+	LiveClose(&source);
+#if !defined(_WIN32)
+	if(child && running){
+		kill(started, SIGINT);
+		waitpid(started, &status, 0);
+	}
+#endif
+	return 0;
+}
@@ -0,0 +1,91 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Start/stop markers of the polling mode for programs measured by hpcrun on Linux,
+* the counterpart of the "int 2e" traps of the Windows test programs. hpcrun passes
+* a control and an acknowledgement pipe in the HPC_MARK_FD environment variable;
+* a marker writes a request and waits until hpcrun has reset or read the counters,
+* so the counts between HpcMarkStart and HpcMarkStop cover only the code between
+* them (plus the few user-mode instructions of the marker itself).
+* Markers are meant to be hit by one thread at a time, acknowledgements are not
+* addressed to a thread. Outside hpcrun the markers do nothing. Header only.
+*
+* HpcRegionBegin/HpcRegionEnd mark named, nested regions like the region traps of
+* drv/hpcregion.h: every region instance becomes one sample with its region id and
+* nesting depth, and the counters are never reset in between. hpcrun counts the whole
+* program, so the counts of a region include those of other threads running meanwhile.
+* hpcpmc.h counts regions per thread without the round trip to hpcrun.
+*/
+
+#ifndef HPCMARK_H
+#define HPCMARK_H
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#define HPC_MARK_ENV	"HPC_MARK_FD"		//"<control fd>,<ack fd>"
+#define HPC_MARK_START	'S'
+#define HPC_MARK_STOP	'E'
+#define HPC_MARK_REGION	'R'
+
+//region of an HPC_MARK_REGION request: the id in bits 0-30, bit 31 set for the end, as in the ecx of a region trap
+#define HPC_MARK_REGION_END	0x80000000u
+
+//request written to the control pipe, smaller than PIPE_BUF so writes of several threads do not mix
+typedef struct _HPC_MARK_REQUEST {
+	char op;					//HPC_MARK_START, HPC_MARK_STOP or HPC_MARK_REGION
+	char pad[3];
+	unsigned int tid;			//thread that hit the marker
+	unsigned int region;		//region and end flag of HPC_MARK_REGION
+} HPC_MARK_REQUEST;
+
+/*
+* Send a request to hpcrun and wait for its acknowledgement; returns 0 on success
+*/
+static inline int HpcMark(char op, unsigned int region){
+	static int fd[2] = {-2, -2};
+	HPC_MARK_REQUEST request;
+	const char *env;
+	char ack;
+
+	if(fd[0] == -2){
+		env = getenv(HPC_MARK_ENV);
+		fd[0] = fd[1] = -1;
+		if(env != NULL){
+			fd[0] = atoi(env);
+			while(*env != 0 && *env != ',')
+				env++;
+			fd[1] = *env == ',' ? atoi(env + 1) : -1;
+		}
+	}
+	if(fd[0] < 0 || fd[1] < 0)
+		return -1;
+
+	request.op = op;
+	request.pad[0] = request.pad[1] = request.pad[2] = 0;
+	request.tid = (unsigned int)syscall(SYS_gettid);
+	request.region = region;
+	if(write(fd[0], &request, sizeof(request)) != (ssize_t)sizeof(request))
+		return -1;
+	return read(fd[1], &ack, 1) == 1 ? 0 : -1;
+}
+
+static inline int HpcMarkStart(void){
+	return HpcMark(HPC_MARK_START, 0);
+}
+
+static inline int HpcMarkStop(void){
+	return HpcMark(HPC_MARK_STOP, 0);
+}
+
+//region ids are 1..0x7FFFFFFF, 0 is the id of samples outside regions
+static inline int HpcRegionBegin(unsigned int region){
+	return HpcMark(HPC_MARK_REGION, region & ~HPC_MARK_REGION_END);
+}
+
+static inline int HpcRegionEnd(unsigned int region){
+	return HpcMark(HPC_MARK_REGION, region | HPC_MARK_REGION_END);
+}
+
+#endif
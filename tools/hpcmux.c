@@ -0,0 +1,75 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Prints the estimated totals of every multiplexed event of a sample log,
+* with 95% error bounds, see muxest.h. The fixed counters count in every
+* window, so their totals are exact.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "logread.h"
+#include "muxest.h"
+
+static const char *fixedNames[MUX_FIRST_PMC] = { "ins", "l_cycle", "ref_cycle" };
+
+int main(int argc, char *argv[]){
+	LOG_READER reader;
+	static MUX_ESTIMATOR est;
+	MUX_RESULT result;
+	HPC_SAMPLE sample;
+	const char *error;
+	UINT32 base = 0, g, i;
+	int arg = 1, rc;
+
+	for(; arg < argc && argv[arg][0] == '-'; arg++){
+		if(strcmp(argv[arg], "-b") == 0 && arg + 1 < argc)
+			base = (UINT32)atoi(argv[++arg]);
+		else
+			break;
+	}
+	if(arg >= argc || argv[arg][0] == '-' || base >= MUX_FIRST_PMC){
+		fprintf(stderr, "usage: %s [-b 0|1|2] hpcoutput.bin\n", argv[0]);
+		fprintf(stderr, "  -b  fixed counter used as time base: 0 ins (default), 1 l_cycle, 2 ref_cycle\n");
+		return 2;
+	}
+
+	if(LogReaderOpen(&reader, argv[arg], &error) != 0){
+		if(error != NULL)
+			fprintf(stderr, "%s: %s (version %d)\n", argv[arg], error, SAMPLE_LOG_VERSION);
+		else
+			perror(argv[arg]);
+		return 1;
+	}
+	MuxEstimatorInit(&est, reader.header.groupCount, base);
+	while((rc = LogReaderNext(&reader, &sample)) == 1)
+		MuxEstimatorAdd(&est, &sample);
+	if(rc < 0){
+		fprintf(stderr, "corrupt block after %llu samples\n", (unsigned long long)reader.samples);
+		return 1;
+	}
+	MuxEstimatorFinish(&est);
+
+	printf("%llu windows in %llu visits, %u groups rotated every %u PMIs, base %s\n", (unsigned long long)est.windows,
+		(unsigned long long)est.visits, est.groupCount, reader.header.groupPeriod, fixedNames[base]);
+	for(i = 0; i < MUX_FIRST_PMC; i++)
+		printf("%-10s %20.0f (exact)\n", fixedNames[i], est.fixed[i]);
+
+	printf("\ngroup slot  eventsel    windows             raw             estimate     +/-95%%\n");
+	for(g = 0; g < est.groupCount; g++){
+		for(i = 0; i < MUX_NUM_PMCS; i++){
+			if(reader.header.groupEventSel[g][i] == 0)
+				continue;
+			MuxEstimate(&est, g, i, &result);
+			printf("%5u %4u  0x%08X %10llu %15.0f %20.0f ", g, i, reader.header.groupEventSel[g][i],
+				(unsigned long long)result.windows, result.raw, result.estimate);
+			if(result.stdError < 0)
+				printf("    n/a\n");
+			else
+				printf("%7.2f%%\n", result.estimate > 0 ? 100 * 1.96 * result.stdError / result.estimate : 0.0);
+		}
+	}
+	LogReaderClose(&reader);
+	return 0;
+}
@@ -0,0 +1,251 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Phases of a run: warm-up, steady states and pathological stretches, found by the
+* detector of phase.h in the samples of a CSV file (hpcdump, hpcrun or the original
+* driver), or in the samples of a running experiment as they are taken (live.h).
+* The samples are summed into frames of -w samples; csvscan parses a file into frames
+* on every CPU. For every phase it prints one CSV line:
+*	file,phase,cluster,first,rows,representative,ipc,features...,dominant
+* first and rows are the samples of the phase, counted from the first line after the
+* header, and representative is the first sample of its frame nearest to the phase's mean.
+* The features are the instructions per sample and every other counter per 1000
+* instructions, dominant lists the features that differ most from the whole run with
+* their ratio to it. Phases of the same cluster behave alike. A live stream prints every
+* phase when it ends, compared with the run so far.
+*/
+
+#if !defined(_WIN32)
+#define _GNU_SOURCE
+#include <unistd.h>
+#endif
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "live.h"
+#include "csvscan.h"
+#include "phase.h"
+
+//phases of a file printed at the end, the later ones are merged into the last
+#define MAX_PHASES		65536
+#define MAX_DOMINANT	3
+
+static volatile sig_atomic_t stopRequested;
+
+static void RequestStop(int signal){
+	(void)signal;
+	stopRequested = 1;
+}
+
+static void PrintTitle(UINT32 columns){
+	int c;
+
+	printf("file,phase,cluster,first,rows,representative,ipc,ins_per_sample");
+	for(c = 1; c < PHASE_FEATURES; c++){
+		if(columns & (1u << c))
+			printf(",%s_pki", csvCounterNames[c]);
+	}
+	printf(",dominant\r\n");
+}
+
+static void PrintPhase(const char *file, const PHASE_DETECTOR *det, const PHASE *phase){
+	double feature[PHASE_FEATURES], ratio[MAX_DOMINANT], ipc;
+	int dominant[MAX_DOMINANT], c, n;
+
+	printf("%s,%u,%u,%llu,%llu,%llu", file, phase->index, phase->cluster, (unsigned long long)phase->first,
+		(unsigned long long)phase->rows, (unsigned long long)phase->representative.first);
+	if(CsvDerive(phase->ctr, CSV_IPC, &ipc))
+		printf(",%.4f", ipc);
+	else
+		printf(",");
+	if(PhaseFeatures(phase->ctr, phase->rows, det->options.columns, feature)){
+		for(c = 0; c < PHASE_FEATURES; c++){
+			if(det->options.columns & (1u << c))
+				printf(",%.6g", feature[c]);
+		}
+	}else{
+		for(c = 0; c < PHASE_FEATURES; c++){
+			if(det->options.columns & (1u << c))
+				printf(",");
+		}
+	}
+	printf(",");
+	n = PhaseDominant(det, phase, dominant, ratio, MAX_DOMINANT);
+	for(c = 0; c < n; c++)
+		printf("%s%s%s x%.2f", c != 0 ? " " : "", csvCounterNames[dominant[c]], dominant[c] == 0 ? "_per_sample" : "_pki", ratio[c]);
+	printf("\r\n");
+}
+
+/*
+* Phases of a file; the frames are the windows of csvscan
+*/
+static int FilePhases(const char *path, const CSV_OPTIONS *csv, const PHASE_OPTIONS *options){
+	static PHASE phases[MAX_PHASES];
+	static PHASE_DETECTOR det;
+	PHASE_OPTIONS fileOptions = *options;
+	CSV_RESULT result;
+	PHASE_FRAME frame;
+	PHASE phase;
+	UINT64 w;
+	UINT32 count = 0, i;
+	int c;
+
+	if(CsvAnalyzeFile(path, csv, &result) != 0){
+		fprintf(stderr, "%s: cannot be read or lacks a counter column\n", path);
+		return -1;
+	}
+	if(result.bad != 0)
+		fprintf(stderr, "%s: %llu lines skipped\n", path, (unsigned long long)result.bad);
+	fileOptions.columns = result.columns;
+	PhaseInit(&det, &fileOptions);
+	for(w = 0; w < result.windowCount; w++){
+		frame.first = w * result.windowRows;
+		frame.rows = result.windows[w].rows;
+		for(c = 0; c < HPC_NUM_COUNTERS; c++)
+			frame.ctr[c] = result.windows[w].ctr[c];
+		if(PhaseAdd(&det, &frame, &phase) && count < MAX_PHASES)
+			phases[count++] = phase;
+	}
+	while(PhaseFinish(&det, &phase)){
+		if(count < MAX_PHASES)
+			phases[count++] = phase;
+	}
+	CsvFreeResult(&result);
+
+	PrintTitle(det.options.columns);
+	for(i = 0; i < count; i++)
+		PrintPhase(path, &det, &phases[i]);
+	if(count == MAX_PHASES)
+		fprintf(stderr, "%s: only the first %d phases are printed\n", path, MAX_PHASES);
+	fflush(stdout);
+	return 0;
+}
+
+/*
+* Phases of a running experiment, printed as they end
+*/
+static int LivePhases(UINT32 pid, INT32 threshold, UINT64 frameRows, const PHASE_OPTIONS *options){
+	static PHASE_DETECTOR det;
+	PHASE_OPTIONS liveOptions = *options;
+	LIVE_SOURCE source;
+	HPC_SAMPLE sample;
+	PHASE_FRAME frame;
+	PHASE phase;
+	UINT64 samples = 0;
+	char name[32];
+	int c;
+
+	if(LiveOpen(&source, pid, threshold, 0) != 0)
+		return -1;
+	if(source.header.flags & SAMPLE_LOG_FLAG_SOFTWARE)
+		fprintf(stderr, "warning: no hardware counters, the phases are those of the software events\n");
+	snprintf(name, sizeof(name), "live:%u", pid);
+	liveOptions.columns = source.header.columns;
+	PhaseInit(&det, &liveOptions);
+	signal(SIGINT, RequestStop);
+	PrintTitle(det.options.columns);
+	fflush(stdout);
+
+	memset(&frame, 0, sizeof(frame));
+	while(!stopRequested){
+		LiveWait(&source, 100);
+		while(LiveNext(&source, &sample) == 1){
+			if(frame.rows == 0)
+				frame.first = samples;
+			for(c = 0; c < HPC_NUM_COUNTERS; c++)
+				frame.ctr[c] += sample.ctr[c];
+			frame.rows++;
+			samples++;
+			if(frame.rows < frameRows)
+				continue;
+			if(PhaseAdd(&det, &frame, &phase)){
+				PrintPhase(name, &det, &phase);
+				fflush(stdout);
+			}
+			memset(&frame, 0, sizeof(frame));
+		}
+#if !defined(_WIN32)
+		if(kill((pid_t)pid, 0) != 0)
+			break;
+#endif
+	}
+	if(frame.rows != 0 && PhaseAdd(&det, &frame, &phase))
+		PrintPhase(name, &det, &phase);
+	while(PhaseFinish(&det, &phase))
+		PrintPhase(name, &det, &phase);
+	if(source.lost != 0)
+		fprintf(stderr, "%llu samples lost\n", (unsigned long long)source.lost);
+	LiveClose(&source);
+	return 0;
+}
+
+int main(int argc, char *argv[]){
+	CSV_OPTIONS csv;
+	PHASE_OPTIONS options;
+	INT32 threshold = -50000;
+	UINT32 pid = 0;
+	int opt, arg, live = 0, rc = 0;
+
+	memset(&csv, 0, sizeof(csv));
+	csv.windowRows = 100;
+#if !defined(_WIN32)
+	csv.threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	memset(&options, 0, sizeof(options));
+	options.drift = 0.5;
+	options.threshold = 8;
+	options.warmup = 16;
+	options.radius = 0.1;
+	while((opt = getopt(argc, argv, "j:w:d:h:m:r:lp:t:")) != -1){
+		switch(opt){
+		case 'j': csv.threads = atoi(optarg); break;
+		case 'w': csv.windowRows = strtoull(optarg, NULL, 0); break;
+		case 'd': options.drift = atof(optarg); break;
+		case 'h': options.threshold = atof(optarg); break;
+		case 'm': options.warmup = (UINT32)atoi(optarg); break;
+		case 'r': options.radius = atof(optarg); break;
+		case 'l': live = 1; break;
+		case 'p': pid = (UINT32)strtoul(optarg, NULL, 0); live = 1; break;
+		case 't': threshold = (INT32)strtol(optarg, NULL, 0); break;
+		default:
+			optind = argc + 1;
+			break;
+		}
+	}
+	if(optind > argc || (live ? optind != argc : optind == argc) || csv.windowRows == 0 || options.drift < 0 ||
+		options.threshold <= 0 || options.warmup < 2 || options.warmup > PHASE_HISTORY / 2 || options.radius <= 0){
+		fprintf(stderr, "usage: %s [-j threads] [-w samples] [-d drift] [-h threshold] [-m frames] [-r radius] file.csv...\n", argv[0]);
+#if defined(_WIN32)
+		fprintf(stderr, "       %s [options] -l\n", argv[0]);
+#else
+		fprintf(stderr, "       %s [options] [-t threshold] -p pid\n", argv[0]);
+#endif
+		fprintf(stderr, "  -j  parser threads, default one per CPU\n");
+		fprintf(stderr, "  -w  samples per frame (default 100)\n");
+		fprintf(stderr, "  -d  drift of the change detection in standard deviations (default 0.5)\n");
+		fprintf(stderr, "  -h  threshold of the change detection in standard deviations (default 8)\n");
+		fprintf(stderr, "  -m  frames of a phase before it is tested for a change (default 16, at most %d)\n", PHASE_HISTORY / 2);
+		fprintf(stderr, "  -r  largest relative distance of a phase to its cluster (default 0.1)\n");
+#if defined(_WIN32)
+		fprintf(stderr, "  -l  follow the samples of the running driver\n");
+#else
+		fprintf(stderr, "  -p  follow a running process, sampled every -t instructions (default -50000)\n");
+#endif
+		return 2;
+	}
+	if(live){
+#if !defined(_WIN32)
+		if(pid == 0){
+			fprintf(stderr, "-p pid is needed\n");
+			return 2;
+		}
+#endif
+		return LivePhases(pid, threshold, csv.windowRows, &options) == 0 ? 0 : 1;
+	}
+	for(arg = optind; arg < argc; arg++){
+		if(FilePhases(argv[arg], &csv, &options) != 0)
+			rc = 1;
+	}
+	return rc;
+}
@@ -0,0 +1,599 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Region markers that read the counters in user mode, without a trap into the collector.
+* HpcPmcBegin/HpcPmcEnd mark named, nested regions like the region traps of
+* drv/hpcregion.h and the markers of hpcmark.h, but every thread counts its own regions:
+* a marker reads the counters of the thread with rdpmc and adds the counts of the region
+* instance to an accumulator of its region and thread. No sample is written per instance;
+* the accumulators are appended to a CSV file in batches,
+*	region,tid,instances,ins,l_cycle,ref_cycle,event1,event2,event3,event4
+* every HPC_PMC_BATCH region ends, at HpcPmcFlush, when the thread exits and at exit for
+* the thread calling exit. A line holds the counts since the previous line of the same
+* region and thread, so lines are summed per region and thread. Counts are inclusive, a
+* region contains the counts of the regions nested in it.
+*
+* Linux: every thread opens its own perf_event group (instructions, cycles, ref-cycles and
+* the default events of hpcrun, user mode only) and maps the first page of each event,
+* which tells whether the event may be read with rdpmc and at which counter; the read
+* follows the seqlock protocol of perf_event_mmap_page. An event that is not on a counter
+* at that moment, or a kernel that does not allow rdpmc (/sys/devices/cpu/rdpmc), makes
+* the marker read the group with read() instead. HPC_PMC_MODE=read always uses read(),
+* to compare both. On machines without a PMU the software events of hpcrun are counted.
+*
+* Windows: the driver must run in the polling mode with rdpmc=on (hpcctl), which sets
+* CR4.PCE on all CPUs, and the program must be one of its test applications. The counters
+* themselves count every thread of the CPU, so with rdpmc=on the driver writes the counts of
+* a test thread into them whenever it is switched in: a region that spans a context switch or
+* a move to another CPU only counts its own thread, as long as the driver's table of threads
+* has room for it. Only 31 bits of a programmable counter can be written, so the counts of
+* event0..event3 are exact up to 2^31 per region instance. The markers read the fixed counters
+* and the programmable counters of event0..event3. They must not be mixed with the start/stop
+* traps, which start a new window of the thread, and the driver must not be stopped while the
+* program runs: without CR4.PCE, rdpmc in user mode raises an exception.
+*
+* The markers do nothing unless HPC_PMC_OUT names the output file. Every file including
+* this header has its own accumulators and counters. C++ code can use HPC_PMC_SCOPE(id),
+* which ends the region when the scope is left. Header only.
+*/
+
+#ifndef HPCPMC_H
+#define HPCPMC_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+	#include <windows.h>
+	#include <intrin.h>
+	#include "hpcconf.h"
+#else
+	#include <pthread.h>
+	#include <sched.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <sys/mman.h>
+	#include <sys/syscall.h>
+	#include <linux/perf_event.h>
+#endif
+
+#if defined(_MSC_VER)
+	#define HPC_PMC_INLINE	static __inline
+	#define HPC_PMC_TLS		__declspec(thread)
+#else
+	#define HPC_PMC_INLINE	static inline
+	#define HPC_PMC_TLS		__thread
+#endif
+
+#define HPC_PMC_OUT_ENV		"HPC_PMC_OUT"
+#define HPC_PMC_MODE_ENV	"HPC_PMC_MODE"		//"read" to read the counters with read() on Linux
+
+#define HPC_PMC_COUNTERS	7				//the base columns of the CSV of hpcdump
+#define HPC_PMC_MAX_DEPTH	32
+#define HPC_PMC_SLOTS		64				//regions of a thread between flushes, a power of two
+#define HPC_PMC_BATCH		65536			//region ends of a thread between flushes
+#define HPC_PMC_REGION_MAX	0x7FFFFFFFu		//ids are 1..0x7FFFFFFF as in hpcregion.h
+
+//how a thread reads its counters
+#define HPC_PMC_UNSET		0				//not set up yet
+#define HPC_PMC_RDPMC		1
+#define HPC_PMC_SYSCALL		2				//read() of the perf_event group
+#define HPC_PMC_OFF			3				//no output file or no counters
+
+//counts of one region of a thread since its last flush
+typedef struct _HPC_PMC_REGION {
+	unsigned int id;				//0 for a free slot
+	unsigned long long instances;
+	unsigned long long ctr[HPC_PMC_COUNTERS];
+} HPC_PMC_REGION;
+
+//an open region instance
+typedef struct _HPC_PMC_FRAME {
+	unsigned int id;
+	unsigned int slot;
+	unsigned long long start[HPC_PMC_COUNTERS];
+} HPC_PMC_FRAME;
+
+typedef struct _HPC_PMC_THREAD {
+	int state;						//HPC_PMC_*
+	unsigned int tid;
+	unsigned int count;				//counters read
+	unsigned int column[HPC_PMC_COUNTERS];	//column of the n-th counter
+	unsigned long long mask[HPC_PMC_COUNTERS];	//of the difference of two reads, what a counter keeps of the counts
+	const char *const *names;		//of the columns
+	unsigned int depth;
+	unsigned int skipped;			//open instances beyond HPC_PMC_MAX_DEPTH, not counted
+	unsigned int ends;				//since the last flush
+	unsigned int used;				//slots
+	unsigned long long overflows;	//instances nested too deep
+	unsigned long long mismatches;	//ends without the begin of the same region
+	HPC_PMC_FRAME stack[HPC_PMC_MAX_DEPTH];
+	HPC_PMC_REGION slots[HPC_PMC_SLOTS];
+#if defined(_WIN32)
+	unsigned int selector[HPC_PMC_COUNTERS];	//ecx of rdpmc
+#else
+	int fd[HPC_PMC_COUNTERS];		//fd[0] is the leader of the group
+	struct perf_event_mmap_page *page[HPC_PMC_COUNTERS];	//NULL if it could not be mapped
+#endif
+} HPC_PMC_THREAD;
+
+static HPC_PMC_TLS HPC_PMC_THREAD hpcPmcThread;
+
+static const char *const hpcPmcNames[HPC_PMC_COUNTERS] = {
+	"ins", "l_cycle", "ref_cycle", "event1", "event2", "event3", "event4"
+};
+
+HPC_PMC_INLINE void HpcPmcFlushThread(HPC_PMC_THREAD *t, int last);
+
+/*
+* Append text to the output file, after the header if the file is empty.
+* The flushes of all threads go through one lock, so lines are never interleaved.
+*/
+HPC_PMC_INLINE void HpcPmcWrite(const HPC_PMC_THREAD *t, const char *text, size_t len){
+	char header[256];
+	size_t n;
+	int c;
+#if defined(_WIN32)
+	static volatile LONG lock = 0;
+	static HANDLE file = NULL;
+	LARGE_INTEGER size;
+	DWORD written;
+
+	while(InterlockedExchange(&lock, 1) != 0)
+		SwitchToThread();
+	if(file == NULL)
+		file = CreateFileA(getenv(HPC_PMC_OUT_ENV), FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_ALWAYS,
+			FILE_ATTRIBUTE_NORMAL, NULL);
+#else
+	static volatile int lock = 0;
+	static int fd = -2;
+
+	while(__sync_lock_test_and_set(&lock, 1))
+		sched_yield();
+	if(fd == -2)
+		fd = open(getenv(HPC_PMC_OUT_ENV), O_WRONLY | O_CREAT | O_APPEND, 0644);
+#endif
+	n = (size_t)sprintf(header, "region,tid,instances");
+	for(c = 0; c < HPC_PMC_COUNTERS; c++)
+		n += (size_t)sprintf(header + n, ",%s", t->names[c]);
+	n += (size_t)sprintf(header + n, "\r\n");
+#if defined(_WIN32)
+	if(file != INVALID_HANDLE_VALUE){
+		if(GetFileSizeEx(file, &size) && size.QuadPart == 0)
+			WriteFile(file, header, (DWORD)n, &written, NULL);
+		WriteFile(file, text, (DWORD)len, &written, NULL);
+	}
+	InterlockedExchange(&lock, 0);
+#else
+	if(fd >= 0){
+		if(lseek(fd, 0, SEEK_END) == 0 && write(fd, header, n) != (ssize_t)n)
+			len = 0;
+		if(len != 0 && write(fd, text, len) != (ssize_t)len)
+			fd = -1;
+	}
+	__sync_lock_release(&lock);
+#endif
+}
+
+#if defined(_WIN32)
+
+static INIT_ONCE hpcPmcOnce = INIT_ONCE_STATIC_INIT;
+static DWORD hpcPmcFls = FLS_OUT_OF_INDEXES;
+static HPC_CONFIG hpcPmcConfig;
+static int hpcPmcEnabled;
+
+//thread exit
+HPC_PMC_INLINE VOID WINAPI HpcPmcThreadExit(PVOID data){
+	if(data != NULL)
+		HpcPmcFlushThread((HPC_PMC_THREAD*)data, 1);
+}
+
+HPC_PMC_INLINE void HpcPmcProcessExit(void){
+	HpcPmcFlushThread(&hpcPmcThread, 1);
+}
+
+//whether the driver runs and lets user mode read the counters, and its events
+HPC_PMC_INLINE BOOL CALLBACK HpcPmcInit(PINIT_ONCE once, PVOID parameter, PVOID *context){
+	HPC_STATUS status;
+	HANDLE device;
+	DWORD bytes;
+
+	device = CreateFileA(HPC_DEVICE_NAME, GENERIC_READ, 0, NULL, OPEN_EXISTING, 0, NULL);
+	if(device != INVALID_HANDLE_VALUE){
+		memset(&status, 0, sizeof(status));
+		if(DeviceIoControl(device, IOCTL_HPC_QUERY_STATUS, NULL, 0, &status, sizeof(status), &bytes, NULL) &&
+			bytes == sizeof(status) && status.state == HPC_STATE_RUNNING && status.config.rdpmc){
+			hpcPmcConfig = status.config;
+			hpcPmcEnabled = 1;
+		}
+		CloseHandle(device);
+	}
+	hpcPmcFls = FlsAlloc(HpcPmcThreadExit);
+	atexit(HpcPmcProcessExit);
+	return TRUE;
+}
+
+HPC_PMC_INLINE void HpcPmcSetup(HPC_PMC_THREAD *t){
+	unsigned int i;
+
+	t->state = HPC_PMC_OFF;
+	if(getenv(HPC_PMC_OUT_ENV) == NULL)
+		return;
+	InitOnceExecuteOnce(&hpcPmcOnce, HpcPmcInit, NULL, NULL);
+	if(!hpcPmcEnabled)
+		return;
+	//fixed counters with bit 30 set, then the programmable counters with an event
+	for(i = 0; i < 3; i++){
+		t->selector[t->count] = (1u << 30) | i;
+		t->column[t->count++] = i;
+	}
+	for(i = 0; i < HPC_PMC_COUNTERS - 3; i++){
+		if(hpcPmcConfig.eventSel[0][i] != 0){
+			t->selector[t->count] = i;
+			t->column[t->count++] = 3 + i;
+		}
+	}
+	//the driver writes the counts of the thread into the counters at every switch, the
+	//programmable counters modulo 2^31 (PmuRestoreWindow of drv/hpcpmu.c)
+	for(i = 0; i < HPC_PMC_COUNTERS; i++)
+		t->mask[i] = i < 3 ? ((unsigned long long)1 << 48) - 1 : 0x7FFFFFFFULL;
+	t->names = hpcPmcNames;
+	t->tid = (unsigned int)GetCurrentThreadId();
+	if(hpcPmcFls != FLS_OUT_OF_INDEXES)
+		FlsSetValue(hpcPmcFls, t);
+	t->state = HPC_PMC_RDPMC;
+}
+
+HPC_PMC_INLINE void HpcPmcRead(const HPC_PMC_THREAD *t, unsigned long long *values){
+	unsigned int i;
+
+	for(i = 0; i < HPC_PMC_COUNTERS; i++)
+		values[i] = 0;
+	for(i = 0; i < t->count; i++)
+		values[t->column[i]] = __readpmc(t->selector[i]);
+}
+
+HPC_PMC_INLINE void HpcPmcClose(HPC_PMC_THREAD *t){
+	t->state = HPC_PMC_OFF;
+}
+
+#else
+
+static pthread_once_t hpcPmcOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t hpcPmcKey;
+
+//as perfHardwareEvents and perfSoftwareEvents of perfev.c: type, config, counted in kernel mode too
+static const unsigned long long hpcPmcHardware[HPC_PMC_COUNTERS][3] = {
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, 0},
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, 0},
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_REF_CPU_CYCLES, 0},
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS, 0},
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, 0},
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES, 0},
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, 0}
+};
+static const unsigned long long hpcPmcSoftware[HPC_PMC_COUNTERS][3] = {
+	{PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, 1},
+	{PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, 1},
+	{PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS, 1},
+	{PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS_MIN, 1},
+	{PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS_MAJ, 1},
+	{PERF_TYPE_SOFTWARE, PERF_COUNT_SW_ALIGNMENT_FAULTS, 1},
+	{PERF_TYPE_SOFTWARE, PERF_COUNT_SW_EMULATION_FAULTS, 1}
+};
+static const char *const hpcPmcSoftwareNames[HPC_PMC_COUNTERS] = {
+	"task_clock", "context_switches", "cpu_migrations", "minor_faults", "major_faults", "alignment_faults", "emulation_faults"
+};
+
+HPC_PMC_INLINE void HpcPmcClose(HPC_PMC_THREAD *t){
+	unsigned int i;
+
+	for(i = 0; i < t->count; i++){
+		if(t->page[i] != NULL)
+			munmap(t->page[i], (size_t)sysconf(_SC_PAGESIZE));
+		close(t->fd[i]);
+	}
+	t->count = 0;
+	t->state = HPC_PMC_OFF;
+}
+
+//thread exit; the thread's variables live until its keys are destroyed
+HPC_PMC_INLINE void HpcPmcThreadExit(void *data){
+	HpcPmcFlushThread((HPC_PMC_THREAD*)data, 1);
+	HpcPmcClose((HPC_PMC_THREAD*)data);
+}
+
+HPC_PMC_INLINE void HpcPmcProcessExit(void){
+	HpcPmcFlushThread(&hpcPmcThread, 1);
+}
+
+HPC_PMC_INLINE void HpcPmcInit(void){
+	pthread_key_create(&hpcPmcKey, HpcPmcThreadExit);
+	atexit(HpcPmcProcessExit);
+}
+
+//open the group of the calling thread; returns 0 if at least the leader was opened
+HPC_PMC_INLINE int HpcPmcOpen(HPC_PMC_THREAD *t, const unsigned long long events[HPC_PMC_COUNTERS][3]){
+	struct perf_event_attr attr;
+	void *page;
+	int c, fd;
+
+	t->count = 0;
+	for(c = 0; c < HPC_PMC_COUNTERS; c++){
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = (unsigned int)events[c][0];
+		attr.config = events[c][1];
+		attr.exclude_kernel = !events[c][2];
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_GROUP;
+		fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, t->count != 0 ? t->fd[0] : -1, 0);
+		if(fd < 0){
+			if(c == 0)
+				return -1;
+			continue;
+		}
+		page = mmap(NULL, (size_t)sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, fd, 0);
+		t->page[t->count] = page != MAP_FAILED ? (struct perf_event_mmap_page*)page : NULL;
+		t->fd[t->count] = fd;
+		t->column[t->count++] = (unsigned int)c;
+	}
+	return 0;
+}
+
+HPC_PMC_INLINE void HpcPmcSetup(HPC_PMC_THREAD *t){
+#if defined(__x86_64__) || defined(__i386__)
+	const char *mode;
+	unsigned int i;
+#endif
+
+	t->state = HPC_PMC_OFF;
+	if(getenv(HPC_PMC_OUT_ENV) == NULL)
+		return;
+	pthread_once(&hpcPmcOnce, HpcPmcInit);
+	t->names = hpcPmcNames;
+	if(HpcPmcOpen(t, hpcPmcHardware) != 0){
+		t->names = hpcPmcSoftwareNames;
+		if(HpcPmcOpen(t, hpcPmcSoftware) != 0)
+			return;
+	}
+	memset(t->mask, 0xFF, sizeof(t->mask));
+	t->tid = (unsigned int)syscall(SYS_gettid);
+	pthread_setspecific(hpcPmcKey, t);
+	t->state = HPC_PMC_SYSCALL;
+#if defined(__x86_64__) || defined(__i386__)
+	mode = getenv(HPC_PMC_MODE_ENV);
+	if(mode != NULL && strcmp(mode, "read") == 0)
+		return;
+	for(i = 0; i < t->count; i++){
+		if(t->page[i] == NULL || !t->page[i]->cap_user_rdpmc)
+			return;
+	}
+	t->state = HPC_PMC_RDPMC;
+#endif
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/*
+* The total of one event from its page: the count of the counter, sign extended from its
+* width, plus the offset of the kernel; retried if the kernel changed the page meanwhile.
+* Returns -1 if the event is not on a counter.
+*/
+HPC_PMC_INLINE int HpcPmcReadPage(volatile struct perf_event_mmap_page *page, unsigned long long *value){
+	unsigned int seq, index, low, high, shift;
+	long long count;
+
+	do{
+		seq = page->lock;
+		__asm__ __volatile__("" ::: "memory");
+		index = page->index;
+		if(index == 0 || !page->cap_user_rdpmc)
+			return -1;
+		__asm__ __volatile__("rdpmc" : "=a"(low), "=d"(high) : "c"(index - 1));
+		shift = 64 - page->pmc_width;
+		count = (long long)((((unsigned long long)high << 32) | low) << shift) >> shift;
+		count += page->offset;
+		__asm__ __volatile__("" ::: "memory");
+	}while(page->lock != seq);
+	*value = (unsigned long long)count;
+	return 0;
+}
+#endif
+
+HPC_PMC_INLINE void HpcPmcRead(const HPC_PMC_THREAD *t, unsigned long long *values){
+	unsigned long long group[1 + HPC_PMC_COUNTERS];
+	unsigned int i;
+
+	for(i = 0; i < HPC_PMC_COUNTERS; i++)
+		values[i] = 0;
+#if defined(__x86_64__) || defined(__i386__)
+	if(t->state == HPC_PMC_RDPMC){
+		for(i = 0; i < t->count && HpcPmcReadPage(t->page[i], &values[t->column[i]]) == 0; i++)
+			;
+		if(i == t->count)
+			return;
+	}
+#endif
+	if(read(t->fd[0], group, sizeof(group)) < (ssize_t)sizeof(group[0]))
+		return;
+	for(i = 0; i < group[0] && i < t->count; i++)
+		values[t->column[i]] = group[1 + i];
+}
+
+#endif
+
+/*
+* Write the accumulators of a thread that have instances and clear them; last reports
+* the markers that could not be counted
+*/
+HPC_PMC_INLINE void HpcPmcFlushThread(HPC_PMC_THREAD *t, int last){
+	char text[HPC_PMC_SLOTS * 256];
+	HPC_PMC_REGION *r;
+	size_t len = 0;
+	unsigned int i, c;
+
+	if(t->state != HPC_PMC_RDPMC && t->state != HPC_PMC_SYSCALL)
+		return;
+	for(i = 0; i < HPC_PMC_SLOTS; i++){
+		r = &t->slots[i];
+		if(r->instances == 0)
+			continue;
+		len += (size_t)sprintf(text + len, "%u,%u,%llu", r->id, t->tid, r->instances);
+		for(c = 0; c < HPC_PMC_COUNTERS; c++)
+			len += (size_t)sprintf(text + len, ",%llu", r->ctr[c]);
+		len += (size_t)sprintf(text + len, "\r\n");
+		r->instances = 0;
+		memset(r->ctr, 0, sizeof(r->ctr));
+	}
+	t->ends = 0;
+	if(len != 0)
+		HpcPmcWrite(t, text, len);
+	if(last && (t->overflows != 0 || t->mismatches != 0 || t->depth != 0))
+		fprintf(stderr, "hpcpmc: thread %u: %llu regions nested too deep, %llu unmatched markers, %u still open\n",
+			t->tid, t->overflows, t->mismatches, t->depth);
+}
+
+/*
+* Slot of a region, claimed if the region has none; -1 if the table is full
+*/
+HPC_PMC_INLINE int HpcPmcSlot(HPC_PMC_THREAD *t, unsigned int id){
+	unsigned int i = (id * 2654435761u) & (HPC_PMC_SLOTS - 1);
+
+	while(t->slots[i].id != id){
+		if(t->slots[i].id == 0){
+			if(t->used >= HPC_PMC_SLOTS * 3 / 4)
+				return -1;
+			t->slots[i].id = id;
+			t->used++;
+			return (int)i;
+		}
+		i = (i + 1) & (HPC_PMC_SLOTS - 1);
+	}
+	return (int)i;
+}
+
+/*
+* Make room for more regions: flush, empty the table and claim the slots of the open instances again
+*/
+HPC_PMC_INLINE void HpcPmcRehash(HPC_PMC_THREAD *t){
+	unsigned int d;
+
+	HpcPmcFlushThread(t, 0);
+	memset(t->slots, 0, sizeof(t->slots));
+	t->used = 0;
+	for(d = 0; d < t->depth; d++)
+		t->stack[d].slot = (unsigned int)HpcPmcSlot(t, t->stack[d].id);
+}
+
+//returns 0 if the instance is counted
+HPC_PMC_INLINE int HpcPmcBegin(unsigned int region){
+	HPC_PMC_THREAD *t = &hpcPmcThread;
+	HPC_PMC_FRAME *frame;
+	int slot;
+
+	if(t->state != HPC_PMC_RDPMC && t->state != HPC_PMC_SYSCALL){
+		if(t->state == HPC_PMC_UNSET)
+			HpcPmcSetup(t);
+		if(t->state == HPC_PMC_OFF)
+			return -1;
+	}
+	//a bad id is counted as unmatched by its end
+	if(region == 0 || region > HPC_PMC_REGION_MAX)
+		return -1;
+	if(t->depth == HPC_PMC_MAX_DEPTH || t->skipped != 0){
+		t->skipped++;
+		t->overflows++;
+		return -1;
+	}
+	slot = HpcPmcSlot(t, region);
+	if(slot < 0){
+		HpcPmcRehash(t);
+		slot = HpcPmcSlot(t, region);
+	}
+	frame = &t->stack[t->depth++];
+	frame->id = region;
+	frame->slot = (unsigned int)slot;
+	//read last, so the counts of the region start with its code
+	HpcPmcRead(t, frame->start);
+	return 0;
+}
+
+HPC_PMC_INLINE int HpcPmcEnd(unsigned int region){
+	unsigned long long now[HPC_PMC_COUNTERS];
+	HPC_PMC_THREAD *t = &hpcPmcThread;
+	HPC_PMC_FRAME *frame;
+	HPC_PMC_REGION *r;
+	int c;
+
+	if(t->state != HPC_PMC_RDPMC && t->state != HPC_PMC_SYSCALL)
+		return -1;
+	HpcPmcRead(t, now);
+	if(t->skipped != 0){
+		t->skipped--;
+		return -1;
+	}
+	if(t->depth == 0 || t->stack[t->depth - 1].id != region){
+		t->mismatches++;
+		return -1;
+	}
+	frame = &t->stack[--t->depth];
+	r = &t->slots[frame->slot];
+	r->instances++;
+	for(c = 0; c < HPC_PMC_COUNTERS; c++)
+		r->ctr[c] += (now[c] - frame->start[c]) & t->mask[c];
+	if(++t->ends >= HPC_PMC_BATCH)
+		HpcPmcFlushThread(t, 0);
+	return 0;
+}
+
+//write the accumulators of the calling thread now
+HPC_PMC_INLINE void HpcPmcFlush(void){
+	HpcPmcFlushThread(&hpcPmcThread, 0);
+}
+
+/*
+* Counts of a region of the calling thread since its last flush; returns the instances
+*/
+HPC_PMC_INLINE unsigned long long HpcPmcGet(unsigned int region, unsigned long long ctr[HPC_PMC_COUNTERS]){
+	HPC_PMC_THREAD *t = &hpcPmcThread;
+	unsigned int i = (region * 2654435761u) & (HPC_PMC_SLOTS - 1);
+
+	memset(ctr, 0, sizeof(unsigned long long) * HPC_PMC_COUNTERS);
+	if(t->state != HPC_PMC_RDPMC && t->state != HPC_PMC_SYSCALL)
+		return 0;
+	while(t->slots[i].id != 0 && t->slots[i].id != region)
+		i = (i + 1) & (HPC_PMC_SLOTS - 1);
+	if(t->slots[i].id == 0)
+		return 0;
+	memcpy(ctr, t->slots[i].ctr, sizeof(t->slots[i].ctr));
+	return t->slots[i].instances;
+}
+
+//how the calling thread reads its counters, HPC_PMC_*
+HPC_PMC_INLINE int HpcPmcMode(void){
+	return hpcPmcThread.state;
+}
+
+#ifdef __cplusplus
+//ends its region when the scope is left, also by return or an exception
+class HpcPmcScope {
+public:
+	explicit HpcPmcScope(unsigned int region) : region_(region){
+		HpcPmcBegin(region);
+	}
+	~HpcPmcScope(){
+		HpcPmcEnd(region_);
+	}
+private:
+	HpcPmcScope(const HpcPmcScope&);
+	HpcPmcScope& operator=(const HpcPmcScope&);
+	unsigned int region_;
+};
+
+#define HPC_PMC_CONCAT2(a, b)	a##b
+#define HPC_PMC_CONCAT(a, b)	HPC_PMC_CONCAT2(a, b)
+#define HPC_PMC_SCOPE(region)	HpcPmcScope HPC_PMC_CONCAT(hpcPmcScope, __LINE__)(region)
+#endif
+
+#endif
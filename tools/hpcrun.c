@@ -0,0 +1,591 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Linux collector with the two modes of the driver, built on perf_event_open (perfev.h):
+*	- sampling: a sample every N instructions retired of the program, taken by the
+*	  overflow of the instructions counter and read from the perf mmap ring buffer
+*	- polling: the counts between the start/stop markers of hpcmark.h, or of the whole
+*	  run when the program has no markers (e.g. the programs of ../benchmarks), and
+*	  one sample per instance of the nested regions of hpcmark.h
+* The program is started by hpcrun and counting starts at its exec. Samples are written
+* in the log format of the driver (drv/hpclog.h), or as the CSV of hpcdump when the log
+* name ends in .csv. Samples carry the instruction pointer they interrupted; the code
+* mappings of the program are written next to a binary log as LOG.maps for hpcsym.
+* With output=stats only their distributions are kept (drv/hpcstats.h),
+* written at exit and whenever hpcrun gets a SIGUSR1. When the machine has no hardware counters (VMs, CI) the software
+* events of the kernel are counted instead and the log header says so.
+*/
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <linux/perf_event.h>
+#if defined(__i386__) || defined(__x86_64__)
+#include <cpuid.h>
+#endif
+#include "hpcconf.h"
+#include "hpclog.h"
+#include "perfev.h"
+#include "hpcmark.h"
+#include "hpcregion.h"
+#include "hpcstats.h"
+
+//event bits of IA32_PERFEVTSEL that perf takes in a raw config: event, umask, edge, inv, cmask
+#define RAW_CONFIG_MASK 0xFF84FFFF
+
+//where the samples go: a binary log with one stream per CPU, a CSV file or the stats
+typedef struct _OUTPUT {
+	FILE *csv;
+	FILE *maps;					//code mappings of a binary log, see hpcsym.c
+	PSAMPLE_STATS stats;
+	int fd;
+	SAMPLE_LOG log;
+	PSAMPLE_LOG_STREAM streams;
+	UINT8 *blocks;
+	UINT8 *scratch;
+	UINT32 cpus;
+	UINT32 extra;				//CSV: counter columns after those of the original driver
+	UINT64 samples;
+} OUTPUT, *POUTPUT;
+
+static const char *columnNames[HPC_NUM_COUNTERS] = HPC_COLUMN_NAMES;
+
+//totals of the previous sample of every thread, and its open regions in the polling mode at the same index
+static PERF_THREADS threads;
+static REGION_STACK regions[PERF_MAX_THREADS];
+
+//sum of the counts written in samples, what is left of the totals at exit is the last partial window
+static UINT64 sampled[HPC_NUM_COUNTERS];
+
+//set by SIGUSR1: write the stats collected so far
+static volatile sig_atomic_t statsRequested;
+
+static void RequestStats(int signal){
+	(void)signal;
+	statsRequested = 1;
+}
+
+static UINT64 Now(){
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (UINT64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int WriteFile(void *context, UINT64 offset, const void *buffer, UINT32 len){
+	return pwrite(*(int *)context, buffer, len, (off_t)offset) == (ssize_t)len ? 0 : -1;
+}
+
+/*
+* Describe the processor in the log header like the driver does
+*/
+static void FillCpuInfo(PSAMPLE_LOG_HEADER header){
+#if defined(__i386__) || defined(__x86_64__)
+	unsigned int regs[4], leaf;
+
+	if(__get_cpuid(1, &regs[0], &regs[1], &regs[2], &regs[3]))
+		header->cpuSignature = regs[0];
+	if(__get_cpuid(0x80000000, &regs[0], &regs[1], &regs[2], &regs[3]) && regs[0] >= 0x80000004){
+		for(leaf = 0; leaf < 3; leaf++){
+			__get_cpuid(0x80000002 + leaf, &regs[0], &regs[1], &regs[2], &regs[3]);
+			memcpy(header->cpuModel + 16 * leaf, regs, 16);
+		}
+		header->cpuModel[sizeof(header->cpuModel) - 1] = 0;
+	}
+#else
+	(void)header;
+#endif
+}
+
+static int OpenOutput(POUTPUT out, const char *path, const SAMPLE_LOG_HEADER *header, int stats){
+	char mapsPath[HPC_MAX_PATH + 8];
+	size_t len = strlen(path);
+	UINT32 cpu, i;
+
+	memset(out, 0, sizeof(*out));
+	out->fd = -1;
+	if(stats){
+		out->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		out->stats = malloc(StatsSize(header->groupCount));
+		if(out->fd < 0 || out->stats == NULL)
+			return -1;
+		StatsInit(out->stats, header);
+		return 0;
+	}
+	if(len > 4 && strcmp(path + len - 4, ".csv") == 0){
+		out->csv = fopen(path, "wb");
+		if(out->csv == NULL)
+			return -1;
+		out->extra = header->columns & ~HPC_BASE_COLUMNS;
+		fprintf(out->csv, "ins,l_cycle,ref_cycle,event1,event2,event3,event4");
+		for(i = 0; i < HPC_NUM_COUNTERS; i++){
+			if(out->extra & (1u << i))
+				fprintf(out->csv, ",%s", columnNames[i]);
+		}
+		fprintf(out->csv, "\r\n");
+		return 0;
+	}
+
+	out->cpus = header->cpuCount;
+	out->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	out->streams = calloc(out->cpus, sizeof(SAMPLE_LOG_STREAM));
+	out->blocks = aligned_alloc(SAMPLE_LOG_ALIGN, (size_t)out->cpus * header->blockSize + SAMPLE_LOG_ALIGN);
+	if(out->fd < 0 || out->streams == NULL || out->blocks == NULL)
+		return -1;
+	out->scratch = out->blocks + (size_t)out->cpus * header->blockSize;
+	if(header->mode == SAMPLE_LOG_MODE_SAMPLING){
+		snprintf(mapsPath, sizeof(mapsPath), "%s.maps", path);
+		out->maps = fopen(mapsPath, "wb");
+		if(out->maps == NULL)
+			return -1;
+	}
+	if(SampleLogOpen(&out->log, header, out->scratch, WriteFile, &out->fd) != 0)
+		return -1;
+	for(cpu = 0; cpu < out->cpus; cpu++)
+		SampleLogStreamInit(&out->streams[cpu], &out->log, cpu, out->blocks + (size_t)cpu * header->blockSize);
+	return 0;
+}
+
+static void WriteSample(POUTPUT out, const HPC_SAMPLE *sample){
+	int i;
+
+	out->samples++;
+	if(out->stats != NULL){
+		StatsAddSample(out->stats, sample);
+		return;
+	}
+	if(out->csv != NULL){
+		fprintf(out->csv, "%llu,%llu,%llu,%llu,%llu,%llu,%llu",
+			(unsigned long long)sample->ctr[0], (unsigned long long)sample->ctr[1], (unsigned long long)sample->ctr[2],
+			(unsigned long long)sample->ctr[3], (unsigned long long)sample->ctr[4], (unsigned long long)sample->ctr[5],
+			(unsigned long long)sample->ctr[6]);
+		for(i = 0; i < HPC_NUM_COUNTERS; i++){
+			if(out->extra & (1u << i))
+				fprintf(out->csv, ",%llu", (unsigned long long)sample->ctr[i]);
+		}
+		fprintf(out->csv, "\r\n");
+		return;
+	}
+	SampleLogAppend(&out->streams[sample->cpu < out->cpus ? sample->cpu : 0], sample);
+}
+
+/*
+* Replace the stats in the output file by the current ones
+*/
+static int WriteStats(POUTPUT out, UINT64 dropped){
+	UINT32 size = StatsSize(out->stats->groupCount);
+
+	out->stats->log.dropped = dropped;
+	if(WriteFile(&out->fd, 0, out->stats, size) != 0 || ftruncate(out->fd, size) != 0)
+		return -1;
+	return 0;
+}
+
+static int CloseOutput(POUTPUT out, UINT64 dropped){
+	UINT32 cpu;
+	int rc = 0;
+
+	if(out->csv != NULL)
+		return fclose(out->csv);
+	if(out->stats != NULL){
+		rc = WriteStats(out, dropped);
+		close(out->fd);
+		free(out->stats);
+		return rc;
+	}
+	for(cpu = 0; cpu < out->cpus; cpu++)
+		rc |= SampleLogFlush(&out->streams[cpu]);
+	rc |= SampleLogClose(&out->log, dropped);
+	if(out->maps != NULL)
+		rc |= fclose(out->maps);
+	close(out->fd);
+	free(out->streams);
+	free(out->blocks);
+	return rc;
+}
+
+/*
+* Turn the running totals of a sample into the counts since the previous sample of its thread,
+* which is what the driver records. Samples of threads the table has no room for are dropped;
+* their counts end up in the remainder of the program.
+*/
+static void RecordPerfSample(POUTPUT out, const PERF_SAMPLE *perf, UINT32 period){
+	HPC_SAMPLE sample;
+	UINT32 i;
+
+	if(PerfThreadWindow(&threads, perf, sample.ctr) != 0)
+		return;
+	for(i = 0; i < HPC_NUM_COUNTERS; i++)
+		sampled[i] += sample.ctr[i];
+	sample.tsc = perf->time;
+	sample.tid = perf->tid;
+	sample.cpu = (UINT16)perf->cpu;
+	sample.group = 0;
+	sample.region = 0;
+	sample.depth = 0;
+	sample.period = period;
+	sample.ip = perf->ip;
+	sample.cpl = (UINT16)perf->cpl;
+	WriteSample(out, &sample);
+}
+
+static void DrainRing(POUTPUT out, PPERF_GROUP group, UINT32 period){
+	PERF_SAMPLE perf;
+	PERF_MAPPING mapping;
+	int rc;
+
+	while((rc = PerfGroupNextSample(group, &perf, &mapping)) != 0){
+		if(rc == PERF_NEXT_SAMPLE)
+			RecordPerfSample(out, &perf, period);
+		else if(out->maps != NULL)
+			fprintf(out->maps, "%u,%llx,%llx,%llx,%s\r\n", mapping.pid, (unsigned long long)mapping.addr,
+				(unsigned long long)(mapping.addr + mapping.len), (unsigned long long)mapping.pgoff, mapping.path);
+	}
+}
+
+/*
+* Record the counts of a polling interval
+*/
+static void RecordInterval(POUTPUT out, PPERF_GROUP group, UINT32 tid){
+	HPC_SAMPLE sample;
+
+	memset(&sample, 0, sizeof(sample));
+	PerfGroupRead(group, sample.ctr);
+	sample.tsc = Now();
+	sample.tid = tid;
+	WriteSample(out, &sample);
+}
+
+/*
+* Region marker of a thread: push the counts of the program at the begin, record the counts
+* since at the end
+*/
+static void RecordRegion(POUTPUT out, PPERF_GROUP group, const HPC_MARK_REQUEST *request){
+	PPERF_THREAD thread = PerfThreadFind(&threads, request->tid);
+	PREGION_STACK stack;
+	UINT64 counts[HPC_NUM_COUNTERS];
+	UINT32 region = request->region & HPC_REGION_ID_MASK;
+	HPC_SAMPLE sample;
+
+	if(thread == NULL || PerfGroupRead(group, counts) != 0)
+		return;
+	stack = &regions[thread - threads.thread];
+	if(stack->tid != request->tid)
+		RegionStackInit(stack, request->tid);
+	if(!(request->region & HPC_MARK_REGION_END)){
+		RegionBegin(stack, region, counts);
+		return;
+	}
+
+	memset(&sample, 0, sizeof(sample));
+	sample.depth = (UINT16)RegionEnd(stack, region, counts, sample.ctr);
+	if(sample.depth == 0)
+		return;
+	sample.tsc = Now();
+	sample.tid = request->tid;
+	sample.region = region;
+	WriteSample(out, &sample);
+}
+
+/*
+* Open regions and unmatched region markers of all threads
+*/
+static void ReportRegionErrors(){
+	UINT32 i, open = 0, errors = 0;
+
+	for(i = 0; i < PERF_MAX_THREADS; i++){
+		if(threads.thread[i].used && regions[i].tid == threads.thread[i].tid){
+			open += regions[i].depth;
+			errors += regions[i].overflows + regions[i].mismatches;
+		}
+	}
+	if(open != 0 || errors != 0)
+		fprintf(stderr, "hpcrun: %u regions still open at exit, %u unmatched or nested too deep\n", open, errors);
+}
+
+/*
+* Record the counts after the last sample of every thread, like ReadFinalSample in the driver.
+* Exited threads are folded into the totals of the program, so the remainder of all threads
+* is written as one sample of the main thread.
+*/
+static void RecordRemainder(POUTPUT out, PPERF_GROUP group, UINT32 tid){
+	HPC_SAMPLE sample;
+	UINT32 i;
+
+	memset(&sample, 0, sizeof(sample));
+	if(PerfGroupRead(group, sample.ctr) != 0)
+		return;
+	for(i = 0; i < HPC_NUM_COUNTERS; i++)
+		sample.ctr[i] = sample.ctr[i] > sampled[i] ? sample.ctr[i] - sampled[i] : 0;
+	if(sample.ctr[0] == 0)
+		return;
+	sample.tsc = Now();
+	sample.tid = tid;
+	WriteSample(out, &sample);
+}
+
+/*
+* Open the group on the program: hardware events first, the software events when there is no PMU
+*/
+static int OpenCounters(PPERF_GROUP group, pid_t pid, const HPC_CONFIG *config, int *software){
+	PERF_EVENT events[HPC_NUM_COUNTERS];
+	UINT32 flags = PERF_GROUP_ON_EXEC | PERF_GROUP_INHERIT, sel, i;
+	UINT64 period = 0;
+	int rc;
+
+	if(config->mode == HPC_MODE_SAMPLING){
+		flags |= PERF_GROUP_SAMPLE;
+		period = (UINT64)-(INT64)config->pmiThreshold;
+	}
+
+	//programmable counters configured with IA32_PERFEVTSEL values are raw events, the others count the driver's defaults
+	memcpy(events, perfHardwareEvents, sizeof(events));
+	for(i = 0; i < HPC_MAX_PROGRAMMABLE; i++){
+		sel = config->eventSel[0][i];
+		if(sel == 0)
+			continue;
+		events[HPC_COLUMN_PMC0 + i].used = 1;
+		events[HPC_COLUMN_PMC0 + i].type = PERF_TYPE_RAW;
+		events[HPC_COLUMN_PMC0 + i].config = sel & RAW_CONFIG_MASK;
+		events[HPC_COLUMN_PMC0 + i].user = (sel & HPC_EVTSEL_USR) != 0;
+		events[HPC_COLUMN_PMC0 + i].kernel = (sel & HPC_EVTSEL_OS) != 0;
+		events[HPC_COLUMN_PMC0 + i].name = "raw";
+	}
+
+	*software = 0;
+	rc = PerfGroupOpen(group, pid, events, period, flags);
+	if(rc == -ENOENT || rc == -EOPNOTSUPP || rc == -ENODEV){
+		fprintf(stderr, "hpcrun: no hardware counters (%s), counting software events\n", strerror(-rc));
+		memcpy(events, perfSoftwareEvents, sizeof(events));
+		*software = 1;
+		rc = PerfGroupOpen(group, pid, events, period, flags);
+		if(rc == -EACCES || rc == -EPERM){
+			//perf_event_paranoid 2 only allows user-mode counting
+			for(i = 0; i < HPC_NUM_COUNTERS; i++)
+				events[i].kernel = 0;
+			rc = PerfGroupOpen(group, pid, events, period, flags);
+		}
+	}
+	if(rc == -EINVAL && (flags & PERF_GROUP_SAMPLE)){
+		//kernels without PERF_SAMPLE_READ support for inherited events reject the group
+		fprintf(stderr, "hpcrun: the kernel cannot sample inherited counters, measuring the main thread only\n");
+		rc = PerfGroupOpen(group, pid, events, period, flags & ~PERF_GROUP_INHERIT);
+	}
+	if(rc == 0){
+		for(i = 0; i < HPC_NUM_COUNTERS; i++){
+			if(group->missing & (1u << i))
+				fprintf(stderr, "hpcrun: %s is not supported, column %u stays 0\n", events[i].name, i);
+		}
+	}
+	return rc;
+}
+
+static void Usage(const char *name){
+	fprintf(stderr, "usage: %s [key=value...] [--] program [args...]\n", name);
+	fprintf(stderr, "  mode=sampling|polling  sample every -threshold instructions, or count between markers (default sampling)\n");
+	fprintf(stderr, "  threshold=N            sampling period as in the driver, e.g. -50000\n");
+	fprintf(stderr, "  event0..event7=N       IA32_PERFEVTSEL values; event0..event3 default to branches, branch misses,\n");
+	fprintf(stderr, "                         LLC references, LLC misses, event4..event7 count nothing unless set\n");
+	fprintf(stderr, "  log=PATH               binary log, or CSV if PATH ends in .csv (default hpcoutput.bin)\n");
+	fprintf(stderr, "  output=log|stats       every sample, or only their distributions, see hpcstats (SIGUSR1 saves them)\n");
+}
+
+int main(int argc, char *argv[]){
+	HPC_CONFIG config;
+	SAMPLE_LOG_HEADER header;
+	PERF_GROUP group;
+	OUTPUT out;
+	HPC_MARK_REQUEST request;
+	struct pollfd fds[2];
+	char logPath[HPC_MAX_PATH], env[32], ack = 1;
+	const char *app;
+	int go[2], ctl[2], reply[2], arg, i, rc, status = 0, software, thresholdSet = 0, intervals = 0, running = 1;
+	pid_t pid;
+
+	HpcConfigInit(&config);
+	config.mode = HPC_MODE_SAMPLING;
+	config.pmiThreshold = -50000;
+	HpcConfigSet(&config, "log=hpcoutput.bin");
+	for(arg = 1; arg < argc && strchr(argv[arg], '=') != NULL && argv[arg][0] != '-'; arg++){
+		rc = HpcConfigSet(&config, argv[arg]);
+		if(rc != HPC_CONFIG_OK){
+			fprintf(stderr, "%s: %s\n", argv[arg], HpcConfigErrorText(rc));
+			return 2;
+		}
+		if(strncmp(argv[arg], "threshold=", 10) == 0)
+			thresholdSet = 1;
+	}
+	if(arg < argc && strcmp(argv[arg], "--") == 0)
+		arg++;
+	if(arg >= argc){
+		Usage(argv[0]);
+		return 2;
+	}
+	if(config.mode == HPC_MODE_POLLING && !thresholdSet)
+		config.pmiThreshold = 0;
+
+	//the program is the test application
+	app = strrchr(argv[arg], '/') != NULL ? strrchr(argv[arg], '/') + 1 : argv[arg];
+	config.testAppCount = 0;
+	memset(config.testApps, 0, sizeof(config.testApps));
+	strncpy(config.testApps[0], app, HPC_APP_NAME_SIZE - 1);
+	config.testAppCount = 1;
+	rc = HpcConfigValidate(&config);
+	if(rc != HPC_CONFIG_OK){
+		fprintf(stderr, "invalid configuration: %s\n", HpcConfigErrorText(rc));
+		return 2;
+	}
+	if(config.groupCount > 1){
+		fprintf(stderr, "event groups are multiplexed by the driver only\n");
+		return 2;
+	}
+	if(config.freeze){
+		fprintf(stderr, "perf_event has no freeze on PMI, freeze=on needs the driver\n");
+		return 2;
+	}
+	//CR4.PCE is the driver's; on Linux hpcpmc.h opens its own counters, which perf lets it read with rdpmc
+	if(config.rdpmc){
+		fprintf(stderr, "rdpmc=on needs the driver, hpcpmc.h reads its own perf_event counters\n");
+		return 2;
+	}
+	//the period of a perf_event counter cannot be changed without cutting the running window short
+	if(config.jitter != 0 || config.target != 0 || config.budget != 0){
+		fprintf(stderr, "jittered and adapted periods need the driver\n");
+		return 2;
+	}
+	for(i = 0; i < HPC_MAX_PATH && config.logFile[i] != 0; i++)
+		logPath[i] = (char)config.logFile[i];
+	logPath[i] = 0;
+
+	//the child waits on go until its counters are open, then execs the program
+	if(pipe(go) != 0 || pipe(ctl) != 0 || pipe(reply) != 0){
+		perror("pipe");
+		return 1;
+	}
+	pid = fork();
+	if(pid < 0){
+		perror("fork");
+		return 1;
+	}
+	if(pid == 0){
+		close(go[1]);
+		close(ctl[0]);
+		close(reply[1]);
+		snprintf(env, sizeof(env), "%d,%d", ctl[1], reply[0]);
+		setenv(HPC_MARK_ENV, env, 1);
+		if(read(go[0], &ack, 1) != 1)
+			_exit(127);
+		close(go[0]);
+		execvp(argv[arg], argv + arg);
+		perror(argv[arg]);
+		_exit(127);
+	}
+	close(go[0]);
+	close(ctl[1]);
+	close(reply[0]);
+
+	rc = OpenCounters(&group, pid, &config, &software);
+	if(rc != 0){
+		fprintf(stderr, "perf_event_open: %s%s\n", strerror(-rc),
+			rc == -EACCES || rc == -EPERM ? " (see /proc/sys/kernel/perf_event_paranoid)" : "");
+		kill(pid, SIGKILL);
+		waitpid(pid, NULL, 0);
+		return 1;
+	}
+
+	SampleLogInitHeader(&header);
+	header.mode = config.mode;
+	header.pmiThreshold = config.pmiThreshold;
+	for(i = 0; i < HPC_MAX_PROGRAMMABLE; i++){
+		header.eventSel[i] = config.eventSel[0][i];
+		header.groupEventSel[0][i] = config.eventSel[0][i];
+	}
+	header.columns = 0;
+	for(i = 0; i < HPC_NUM_COUNTERS; i++){
+		if(group.fd[i] >= 0)
+			header.columns |= 1u << i;
+	}
+	memcpy(header.testApp, config.testApps[0], sizeof(header.testApp));
+	header.cpuCount = (UINT32)sysconf(_SC_NPROCESSORS_CONF);
+	header.flags = SAMPLE_LOG_FLAG_PERF | (software ? SAMPLE_LOG_FLAG_SOFTWARE : 0);
+	FillCpuInfo(&header);
+	if(OpenOutput(&out, logPath, &header, config.output == HPC_OUTPUT_STATS) != 0){
+		perror(logPath);
+		kill(pid, SIGKILL);
+		waitpid(pid, NULL, 0);
+		return 1;
+	}
+
+	if(write(go[1], &ack, 1) != 1){
+		perror("start");
+		return 1;
+	}
+	close(go[1]);
+	signal(SIGUSR1, RequestStats);
+
+	fds[0].fd = PerfGroupPollFd(&group);
+	fds[0].events = POLLIN;
+	fds[1].fd = ctl[0];
+	fds[1].events = POLLIN;
+	while(running){
+		poll(fds, 2, 10);
+		DrainRing(&out, &group, (UINT32)-config.pmiThreshold);
+
+		if(fds[1].revents & POLLIN){
+			if(read(ctl[0], &request, sizeof(request)) == (ssize_t)sizeof(request)){
+				//markers only delimit intervals in the polling mode, like the traps in the driver
+				if(config.mode == HPC_MODE_POLLING && request.op == HPC_MARK_START){
+					PerfGroupReset(&group);
+					PerfGroupEnable(&group);
+				}else if(config.mode == HPC_MODE_POLLING && request.op == HPC_MARK_STOP){
+					PerfGroupDisable(&group);
+					RecordInterval(&out, &group, request.tid);
+					intervals++;
+				}else if(config.mode == HPC_MODE_POLLING && request.op == HPC_MARK_REGION)
+					RecordRegion(&out, &group, &request);
+				if(write(reply[1], &ack, 1) != 1)
+					perror("marker");
+			}
+		}
+
+		if(statsRequested && out.stats != NULL){
+			statsRequested = 0;
+			if(WriteStats(&out, group.lost + threads.untracked) != 0)
+				fprintf(stderr, "%s: write error\n", logPath);
+		}
+		if(waitpid(pid, &status, WNOHANG) == pid)
+			running = 0;
+	}
+	DrainRing(&out, &group, (UINT32)-config.pmiThreshold);
+
+	//without markers the whole run is the interval
+	if(config.mode == HPC_MODE_SAMPLING)
+		RecordRemainder(&out, &group, (UINT32)pid);
+	else if(intervals == 0)
+		RecordInterval(&out, &group, (UINT32)pid);
+	if(config.mode == HPC_MODE_POLLING)
+		ReportRegionErrors();
+
+	rc = CloseOutput(&out, group.lost + threads.untracked);
+	if(rc != 0)
+		fprintf(stderr, "%s: write error\n", logPath);
+	fprintf(stderr, "hpcrun: %llu samples, %llu lost, written to %s\n", (unsigned long long)out.samples,
+		(unsigned long long)(group.lost + threads.untracked), logPath);
+	if(threads.untracked != 0)
+		fprintf(stderr, "hpcrun: %llu samples dropped, more than %u threads\n",
+			(unsigned long long)threads.untracked, PERF_MAX_THREADS);
+	PerfGroupClose(&group);
+	if(WIFEXITED(status) && WEXITSTATUS(status) != 0)
+		fprintf(stderr, "hpcrun: %s exited with status %d\n", argv[arg], WEXITSTATUS(status));
+	else if(WIFSIGNALED(status))
+		fprintf(stderr, "hpcrun: %s was killed by signal %d\n", argv[arg], WTERMSIG(status));
+	return rc != 0 ? 1 : 0;
+}
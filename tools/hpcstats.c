@@ -0,0 +1,205 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Prints the distributions of a run collected with output=stats (drv/hpcstats.h), as CSV:
+*	group,metric,count,mean,sd,min,p50,p90,p99,max
+* one line per counter and derived ratio of every event group. Several stats images of the
+* same events, e.g. of repeated runs, are merged into one; a sample log (drv/hpclog.h) given
+* instead of an image is aggregated first, so a log and a stats run are summarized alike.
+* -o writes the merged image, -q chooses other quantiles.
+* Only uses stdio, so it builds with the Windows SDK as well as on Linux.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "logread.h"
+#include "hpcstats.h"
+
+#define MAX_QUANTILES 16
+
+static const char *metricNames[STAT_METRICS] = {
+	"ins", "l_cycle", "ref_cycle", "event1", "event2", "event3", "event4", "ipc", "llc_miss_rate"
+};
+
+/*
+* Read a stats image; returns NULL and prints why if the file is not one
+*/
+static PSAMPLE_STATS ReadStats(const char *path){
+	PSAMPLE_STATS stats;
+	FILE *file;
+	long len;
+
+	file = fopen(path, "rb");
+	if(file == NULL || fseek(file, 0, SEEK_END) != 0 || (len = ftell(file)) < 0 || fseek(file, 0, SEEK_SET) != 0){
+		perror(path);
+		if(file != NULL)
+			fclose(file);
+		return NULL;
+	}
+	stats = malloc(len > (long)sizeof(SAMPLE_STATS) ? (size_t)len : sizeof(SAMPLE_STATS));
+	if(stats == NULL || fread(stats, 1, (size_t)len, file) != (size_t)len || StatsCheck(stats, (UINT32)len) != 0){
+		fprintf(stderr, "%s: not a stats file of version %d\n", path, SAMPLE_STATS_VERSION);
+		free(stats);
+		stats = NULL;
+	}
+	fclose(file);
+	return stats;
+}
+
+/*
+* Aggregate the samples of a log like a run with output=stats would have
+*/
+static PSAMPLE_STATS AggregateLog(const char *path){
+	LOG_READER reader;
+	HPC_SAMPLE sample;
+	PSAMPLE_STATS stats;
+	const char *error;
+	int rc;
+
+	if(LogReaderOpen(&reader, path, &error) != 0){
+		if(error != NULL)
+			fprintf(stderr, "%s: %s (version %d)\n", path, error, SAMPLE_LOG_VERSION);
+		else
+			perror(path);
+		return NULL;
+	}
+	stats = malloc(StatsSize(reader.header.groupCount));
+	if(stats == NULL){
+		LogReaderClose(&reader);
+		return NULL;
+	}
+	StatsInit(stats, &reader.header);
+	while((rc = LogReaderNext(&reader, &sample)) == 1)
+		StatsAddSample(stats, &sample);
+	if(rc < 0)
+		fprintf(stderr, "%s: corrupt block after %llu samples\n", path, (unsigned long long)reader.samples);
+	stats->log.dropped = reader.header.dropped;
+	LogReaderClose(&reader);
+	return stats;
+}
+
+static PSAMPLE_STATS Load(const char *path){
+	char magic[8] = { 0 };
+	FILE *file;
+
+	file = fopen(path, "rb");
+	if(file == NULL){
+		perror(path);
+		return NULL;
+	}
+	if(fread(magic, 1, sizeof(magic), file) != sizeof(magic))
+		magic[0] = 0;
+	fclose(file);
+	if(memcmp(magic, SAMPLE_LOG_MAGIC, sizeof(SAMPLE_LOG_MAGIC)) == 0)
+		return AggregateLog(path);
+	return ReadStats(path);
+}
+
+/*
+* Parse a comma separated list of quantiles in (0, 1)
+*/
+static int ParseQuantiles(const char *text, double *quantiles){
+	char *end;
+	int count = 0;
+
+	while(count < MAX_QUANTILES){
+		quantiles[count] = strtod(text, &end);
+		if(end == text || quantiles[count] <= 0 || quantiles[count] >= 1)
+			return -1;
+		count++;
+		if(*end == 0)
+			return count;
+		if(*end != ',')
+			return -1;
+		text = end + 1;
+	}
+	return -1;
+}
+
+static void PrintValue(double value, int ratio){
+	if(ratio)
+		printf(",%.4f", value / STAT_RATIO_SCALE);
+	else
+		printf(",%.1f", value);
+}
+
+int main(int argc, char *argv[]){
+	PSAMPLE_STATS merged = NULL, stats;
+	PSTAT_METRIC metric;
+	double quantiles[MAX_QUANTILES] = { 0.5, 0.9, 0.99 };
+	const char *outPath = NULL, *first;
+	FILE *out;
+	UINT32 g, m;
+	int quantileCount = 3, arg = 1, ratio, i;
+
+	for(; arg < argc && argv[arg][0] == '-'; arg++){
+		if(strcmp(argv[arg], "-o") == 0 && arg + 1 < argc)
+			outPath = argv[++arg];
+		else if(strcmp(argv[arg], "-q") == 0 && arg + 1 < argc){
+			quantileCount = ParseQuantiles(argv[++arg], quantiles);
+			if(quantileCount < 0){
+				fprintf(stderr, "%s: quantiles must be between 0 and 1, at most %d\n", argv[arg], MAX_QUANTILES);
+				return 2;
+			}
+		}else
+			break;
+	}
+	if(arg >= argc || argv[arg][0] == '-'){
+		fprintf(stderr, "usage: %s [-q 0.5,0.9,0.99] [-o merged.stats] file...\n", argv[0]);
+		fprintf(stderr, "  file  stats of hpcrun/hpcctl/the driver with output=stats, or a sample log\n");
+		fprintf(stderr, "  -q    quantiles to print\n");
+		fprintf(stderr, "  -o    write the merged stats of all files\n");
+		return 2;
+	}
+
+	for(first = argv[arg]; arg < argc; arg++){
+		stats = Load(argv[arg]);
+		if(stats == NULL)
+			return 1;
+		if(merged == NULL)
+			merged = stats;
+		else{
+			if(StatsMerge(merged, stats) != 0){
+				fprintf(stderr, "%s: counts other events than %s\n", argv[arg], first);
+				return 1;
+			}
+			free(stats);
+		}
+	}
+
+	printf("group,metric,count,mean,sd,min");
+	for(i = 0; i < quantileCount; i++)
+		printf(",p%g", quantiles[i] * 100);
+	printf(",max\r\n");
+	for(g = 0; g < merged->groupCount; g++){
+		for(m = 0; m < STAT_METRICS; m++){
+			metric = StatsMetric(merged, g, m);
+			if(metric->count == 0)
+				continue;
+			ratio = m >= HPC_NUM_COUNTERS;
+			printf("%u,%s,%llu", g, metricNames[m], (unsigned long long)metric->count);
+			PrintValue(metric->mean, ratio);
+			PrintValue(sqrt(StatVariance(metric)), ratio);
+			PrintValue((double)metric->min, ratio);
+			for(i = 0; i < quantileCount; i++)
+				PrintValue((double)StatQuantile(metric, quantiles[i]), ratio);
+			PrintValue((double)metric->max, ratio);
+			printf("\r\n");
+		}
+	}
+	if(merged->log.dropped != 0)
+		fprintf(stderr, "warning: %llu samples were dropped\n", (unsigned long long)merged->log.dropped);
+
+	if(outPath != NULL){
+		out = fopen(outPath, "wb");
+		if(out == NULL || fwrite(merged, 1, StatsSize(merged->groupCount), out) != StatsSize(merged->groupCount)
+			|| fclose(out) != 0){
+			perror(outPath);
+			return 1;
+		}
+	}
+	free(merged);
+	return 0;
+}
@@ -0,0 +1,457 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Hot spots of a sampling log: symbolizes the instruction pointers of the samples against
+* the code mappings of the program (LOG.maps of hpcrun) and the ELF files behind them
+* (elfsym.h), and prints the samples per function, or per source line with -l, most
+* first. -f writes folded stacks for flame graph tools (flamegraph.pl, speedscope):
+*	program;module;function[;file:line] weight
+* one line per frame path; samples in the kernel fold into [kernel] and addresses outside
+* the mappings into [unknown]. A sample weighs 1, or with -w the count of one counter
+* column of its window, which is the right weight for jittered or adapted periods (-w 0)
+* or for a profile of e.g. cache misses.
+*
+* Every distinct address is resolved once: the addresses of the log are collected first,
+* then the ELF files they fall into are loaded, each once however many mappings it has,
+* and the addresses resolved, both by -j threads. A mappings file is one line per mapping,
+*	pid,start,end,offset,path
+* with the addresses in hex; an address resolves in the last mapping that holds it, so
+* the mappings of a program that execs another one replace those before.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "elfsym.h"
+#include "logread.h"
+
+#define MAX_THREADS 64
+
+//addresses resolved by a thread at a time
+#define RESOLVE_CHUNK 256
+
+//an ELF file, loaded once for all of its mappings
+typedef struct _MODULE {
+	char *path;
+	const char *name;			//file name without the directory
+	int needed;					//an address falls into it
+	int loaded;					//image is valid
+	ELF_IMAGE image;
+} MODULE, *PMODULE;
+
+typedef struct _MAPPING {
+	UINT64 start, end, offset;
+	UINT32 module;
+} MAPPING, *PMAPPING;
+
+//a distinct instruction pointer of the log
+typedef struct _ADDRESS {
+	UINT64 ip;
+	UINT32 cpl;
+	UINT32 used;
+	UINT64 samples;
+	UINT64 weight;
+	INT32 mapping;				//-1 if no mapping holds it
+	const ELF_SYMBOL *symbol;
+	const ELF_LINE *line;
+} ADDRESS, *PADDRESS;
+
+typedef struct _PROFILE {
+	PMODULE modules;
+	UINT32 moduleCount;
+	PMAPPING mappings;
+	UINT32 mappingCount;
+	PADDRESS table;				//open addressing on ip
+	UINT32 tableSize;			//a power of two
+	UINT32 addressCount;
+	PADDRESS *addresses;		//the used entries of table
+	volatile UINT32 next;		//next work item of the threads
+} PROFILE, *PPROFILE;
+
+//a function or line of the output, the addresses that fold into it
+typedef struct _HOT_SPOT {
+	const char *module;
+	const char *function;
+	const char *file;
+	UINT32 line;
+	UINT64 samples;
+	UINT64 weight;
+} HOT_SPOT, *PHOT_SPOT;
+
+static int AddModule(PPROFILE p, const char *path){
+	PMODULE grown;
+	UINT32 i;
+
+	for(i = 0; i < p->moduleCount; i++){
+		if(strcmp(p->modules[i].path, path) == 0)
+			return (int)i;
+	}
+	grown = realloc(p->modules, (p->moduleCount + 1) * sizeof(MODULE));
+	if(grown == NULL)
+		return -1;
+	p->modules = grown;
+	memset(&p->modules[i], 0, sizeof(MODULE));
+	p->modules[i].path = strdup(path);
+	if(p->modules[i].path == NULL)
+		return -1;
+	p->modules[i].name = strrchr(p->modules[i].path, '/') != NULL ? strrchr(p->modules[i].path, '/') + 1 : p->modules[i].path;
+	p->moduleCount++;
+	return (int)i;
+}
+
+static int LoadMappings(PPROFILE p, const char *path){
+	char line[4096 + 128];
+	unsigned long long start, end, offset;
+	unsigned int pid;
+	PMAPPING grown;
+	FILE *file;
+	size_t len;
+	int n, module;
+
+	file = fopen(path, "rb");
+	if(file == NULL)
+		return -1;
+	while(fgets(line, sizeof(line), file) != NULL){
+		len = strcspn(line, "\r\n");
+		line[len] = 0;
+		if(sscanf(line, "%u,%llx,%llx,%llx,%n", &pid, &start, &end, &offset, &n) != 4 || line[n] == 0)
+			continue;
+		module = AddModule(p, line + n);
+		grown = realloc(p->mappings, (p->mappingCount + 1) * sizeof(MAPPING));
+		if(module < 0 || grown == NULL){
+			fclose(file);
+			return -1;
+		}
+		p->mappings = grown;
+		p->mappings[p->mappingCount].start = start;
+		p->mappings[p->mappingCount].end = end;
+		p->mappings[p->mappingCount].offset = offset;
+		p->mappings[p->mappingCount].module = (UINT32)module;
+		p->mappingCount++;
+	}
+	fclose(file);
+	return 0;
+}
+
+/*
+* Entry of an address in the table, a new one if it is not there yet
+*/
+static PADDRESS FindAddress(PPROFILE p, UINT64 ip, UINT32 cpl){
+	PADDRESS old, a;
+	UINT32 i, size;
+
+	if(2 * (p->addressCount + 1) > p->tableSize){
+		old = p->table;
+		size = p->tableSize;
+		p->tableSize = size ? 2 * size : 4096;
+		p->table = calloc(p->tableSize, sizeof(ADDRESS));
+		if(p->table == NULL)
+			return NULL;
+		p->addressCount = 0;
+		for(i = 0; i < size; i++){
+			if(old[i].used){
+				a = FindAddress(p, old[i].ip, old[i].cpl);
+				*a = old[i];
+			}
+		}
+		free(old);
+	}
+	i = (UINT32)((ip ^ cpl) * 0x9E3779B97F4A7C15ull >> 32) & (p->tableSize - 1);
+	while(p->table[i].used && (p->table[i].ip != ip || p->table[i].cpl != cpl))
+		i = (i + 1) & (p->tableSize - 1);
+	if(!p->table[i].used){
+		p->table[i].used = 1;
+		p->table[i].ip = ip;
+		p->table[i].cpl = cpl;
+		p->addressCount++;
+	}
+	return &p->table[i];
+}
+
+/*
+* Mapping of a user-mode address, the last one that holds it
+*/
+static INT32 FindMapping(const PROFILE *p, UINT64 ip){
+	UINT32 i;
+
+	for(i = p->mappingCount; i > 0; i--){
+		if(ip >= p->mappings[i - 1].start && ip < p->mappings[i - 1].end)
+			return (INT32)(i - 1);
+	}
+	return -1;
+}
+
+static UINT32 NextWork(PPROFILE p, UINT32 count){
+	return __atomic_fetch_add(&p->next, count, __ATOMIC_RELAXED);
+}
+
+/*
+* The modules the addresses fall into
+*/
+static void *MapThread(void *arg){
+	PPROFILE p = (PPROFILE)arg;
+	PADDRESS a;
+	UINT32 first, i;
+
+	while((first = NextWork(p, RESOLVE_CHUNK)) < p->addressCount){
+		for(i = first; i < first + RESOLVE_CHUNK && i < p->addressCount; i++){
+			a = p->addresses[i];
+			a->mapping = a->cpl == 0 ? -1 : FindMapping(p, a->ip);
+			if(a->mapping >= 0)
+				__atomic_store_n(&p->modules[p->mappings[a->mapping].module].needed, 1, __ATOMIC_RELAXED);
+		}
+	}
+	return NULL;
+}
+
+static void *LoadThread(void *arg){
+	PPROFILE p = (PPROFILE)arg;
+	PMODULE m;
+	UINT32 i;
+
+	while((i = NextWork(p, 1)) < p->moduleCount){
+		m = &p->modules[i];
+		if(m->needed)
+			m->loaded = ElfOpen(&m->image, m->path) == 0;
+	}
+	return NULL;
+}
+
+static void *ResolveThread(void *arg){
+	PPROFILE p = (PPROFILE)arg;
+	const MAPPING *map;
+	const ELF_IMAGE *image;
+	PADDRESS a;
+	UINT64 addr;
+	UINT32 first, i;
+
+	while((first = NextWork(p, RESOLVE_CHUNK)) < p->addressCount){
+		for(i = first; i < first + RESOLVE_CHUNK && i < p->addressCount; i++){
+			a = p->addresses[i];
+			if(a->mapping < 0)
+				continue;
+			map = &p->mappings[a->mapping];
+			if(!p->modules[map->module].loaded)
+				continue;
+			image = &p->modules[map->module].image;
+			if(ElfOffsetToAddr(image, a->ip - map->start + map->offset, &addr) != 0)
+				continue;
+			a->symbol = ElfFindSymbol(image, addr);
+			a->line = ElfFindLine(image, addr);
+		}
+	}
+	return NULL;
+}
+
+/*
+* Run a phase over the addresses or modules on threads
+*/
+static void RunPhase(PPROFILE p, void *(*phase)(void *), int threads){
+	pthread_t ids[MAX_THREADS];
+	int t, started = 0;
+
+	p->next = 0;
+	for(t = 1; t < threads; t++){
+		if(pthread_create(&ids[started], NULL, phase, p) == 0)
+			started++;
+	}
+	phase(p);
+	for(t = 0; t < started; t++)
+		pthread_join(ids[t], NULL);
+}
+
+static void Describe(const PROFILE *p, const ADDRESS *a, int lines, PHOT_SPOT spot){
+	const ELF_IMAGE *image;
+
+	memset(spot, 0, sizeof(*spot));
+	spot->module = a->cpl == 0 ? "[kernel]" : a->mapping < 0 ? "[unknown]" : p->modules[p->mappings[a->mapping].module].name;
+	spot->function = a->symbol != NULL ? a->symbol->name : a->cpl == 0 ? "" : "[unknown]";
+	if(lines && a->line != NULL){
+		image = &p->modules[p->mappings[a->mapping].module].image;
+		spot->file = image->files[a->line->file];
+		spot->line = a->line->line;
+	}
+	spot->samples = a->samples;
+	spot->weight = a->weight;
+}
+
+static int CompareSpots(const void *x, const void *y){
+	const HOT_SPOT *a = (const HOT_SPOT *)x, *b = (const HOT_SPOT *)y;
+	int c;
+
+	if((c = strcmp(a->module, b->module)) != 0 || (c = strcmp(a->function, b->function)) != 0)
+		return c;
+	if((c = strcmp(a->file != NULL ? a->file : "", b->file != NULL ? b->file : "")) != 0)
+		return c;
+	return a->line < b->line ? -1 : a->line > b->line;
+}
+
+static int CompareWeights(const void *x, const void *y){
+	const HOT_SPOT *a = (const HOT_SPOT *)x, *b = (const HOT_SPOT *)y;
+
+	if(a->weight != b->weight)
+		return a->weight > b->weight ? -1 : 1;
+	return CompareSpots(x, y);
+}
+
+/*
+* Fold the addresses into functions, or source lines; returns the number of spots
+*/
+static UINT32 Fold(const PROFILE *p, int lines, PHOT_SPOT spots){
+	UINT32 i, n = 0;
+
+	for(i = 0; i < p->addressCount; i++)
+		Describe(p, p->addresses[i], lines, &spots[i]);
+	qsort(spots, p->addressCount, sizeof(HOT_SPOT), CompareSpots);
+	for(i = 0; i < p->addressCount; i++){
+		if(n != 0 && CompareSpots(&spots[n - 1], &spots[i]) == 0){
+			spots[n - 1].samples += spots[i].samples;
+			spots[n - 1].weight += spots[i].weight;
+		}else
+			spots[n++] = spots[i];
+	}
+	return n;
+}
+
+static int WriteFolded(const char *path, const char *program, const HOT_SPOT *spots, UINT32 count){
+	FILE *out;
+	UINT32 i;
+
+	out = fopen(path, "wb");
+	if(out == NULL)
+		return -1;
+	for(i = 0; i < count; i++){
+		fprintf(out, "%s;%s", program, spots[i].module);
+		if(spots[i].function[0] != 0)
+			fprintf(out, ";%s", spots[i].function);
+		if(spots[i].file != NULL)
+			fprintf(out, ";%s:%u", spots[i].file, spots[i].line);
+		fprintf(out, " %llu\n", (unsigned long long)spots[i].weight);
+	}
+	return fclose(out);
+}
+
+int main(int argc, char *argv[]){
+	PROFILE profile;
+	LOG_READER reader;
+	HPC_SAMPLE sample;
+	PADDRESS a;
+	PHOT_SPOT spots;
+	char mapsPath[4096], program[17];
+	const char *error, *maps = NULL, *foldedPath = NULL;
+	UINT64 total = 0, samples = 0, noIp = 0;
+	UINT32 i, count, top = 30;
+	int opt, threads, column = -1, lines = 0, rc;
+
+	threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	while((opt = getopt(argc, argv, "j:w:lm:f:n:")) != -1){
+		switch(opt){
+		case 'j': threads = atoi(optarg); break;
+		case 'w': column = atoi(optarg); break;
+		case 'l': lines = 1; break;
+		case 'm': maps = optarg; break;
+		case 'f': foldedPath = optarg; break;
+		case 'n': top = (UINT32)strtoul(optarg, NULL, 0); break;
+		default:
+			optind = argc + 1;
+			break;
+		}
+	}
+	if(optind + 1 != argc || column >= HPC_NUM_COUNTERS){
+		fprintf(stderr, "usage: %s [-j threads] [-w column] [-l] [-n top] [-m LOG.maps] [-f out.folded] hpcoutput.bin\n", argv[0]);
+		fprintf(stderr, "  -j  threads, default one per CPU\n");
+		fprintf(stderr, "  -w  weigh samples by a counter column of their window (0 = ins ... 6 = event4), default 1\n");
+		fprintf(stderr, "  -l  per source line instead of per function, for files built with -g\n");
+		fprintf(stderr, "  -n  print the top N, 0 for all (default 30)\n");
+		fprintf(stderr, "  -m  code mappings, default the log name with .maps appended\n");
+		fprintf(stderr, "  -f  write folded stacks for flame graphs\n");
+		return 2;
+	}
+	if(threads < 1)
+		threads = 1;
+	if(threads > MAX_THREADS)
+		threads = MAX_THREADS;
+
+	memset(&profile, 0, sizeof(profile));
+	if(maps == NULL){
+		snprintf(mapsPath, sizeof(mapsPath), "%s.maps", argv[optind]);
+		maps = mapsPath;
+	}
+	if(LoadMappings(&profile, maps) != 0)
+		fprintf(stderr, "%s: no code mappings, only kernel samples resolve\n", maps);
+
+	if(LogReaderOpen(&reader, argv[optind], &error) != 0){
+		if(error != NULL)
+			fprintf(stderr, "%s: %s (version %d)\n", argv[optind], error, SAMPLE_LOG_VERSION);
+		else
+			perror(argv[optind]);
+		return 1;
+	}
+	memcpy(program, reader.header.testApp, 16);
+	program[16] = 0;
+	while((rc = LogReaderNext(&reader, &sample)) == 1){
+		//regions and the remainders at exit interrupted nothing
+		if(sample.ip == 0){
+			noIp++;
+			continue;
+		}
+		a = FindAddress(&profile, sample.ip, sample.cpl);
+		if(a == NULL){
+			fprintf(stderr, "out of memory\n");
+			return 1;
+		}
+		a->samples++;
+		a->weight += column >= 0 ? sample.ctr[column] : 1;
+		samples++;
+		total += column >= 0 ? sample.ctr[column] : 1;
+	}
+	LogReaderClose(&reader);
+	if(rc < 0){
+		fprintf(stderr, "%s: corrupt block\n", argv[optind]);
+		return 1;
+	}
+	if(samples == 0){
+		fprintf(stderr, "%s: no sample has an instruction pointer\n", argv[optind]);
+		return 1;
+	}
+
+	profile.addresses = malloc(profile.addressCount * sizeof(PADDRESS));
+	spots = malloc(profile.addressCount * sizeof(HOT_SPOT));
+	if(profile.addresses == NULL || spots == NULL){
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	for(i = 0, count = 0; i < profile.tableSize; i++){
+		if(profile.table[i].used)
+			profile.addresses[count++] = &profile.table[i];
+	}
+	RunPhase(&profile, MapThread, threads);
+	RunPhase(&profile, LoadThread, threads);
+	RunPhase(&profile, ResolveThread, threads);
+	for(i = 0; i < profile.moduleCount; i++){
+		if(profile.modules[i].needed && !profile.modules[i].loaded)
+			fprintf(stderr, "%s: not an ELF file that can be read, its addresses stay unresolved\n", profile.modules[i].path);
+	}
+
+	count = Fold(&profile, lines, spots);
+	if(foldedPath != NULL && WriteFolded(foldedPath, program[0] != 0 ? program : "program", spots, count) != 0){
+		perror(foldedPath);
+		return 1;
+	}
+
+	qsort(spots, count, sizeof(HOT_SPOT), CompareWeights);
+	printf("%llu samples, %u addresses, %llu without one%s\n", (unsigned long long)samples, profile.addressCount,
+		(unsigned long long)noIp, column >= 0 ? ", weighed by a counter" : "");
+	printf("%14s %7s %9s  %s\n", "weight", "percent", "samples", lines ? "function module file:line" : "function module");
+	for(i = 0; i < count && (top == 0 || i < top); i++){
+		printf("%14llu %6.2f%% %9llu  %s%s%s", (unsigned long long)spots[i].weight, total != 0 ? 100.0 * spots[i].weight / total : 0,
+			(unsigned long long)spots[i].samples, spots[i].function, spots[i].function[0] != 0 ? " " : "", spots[i].module);
+		if(spots[i].file != NULL)
+			printf(" %s:%u", spots[i].file, spots[i].line);
+		printf("\n");
+	}
+	return 0;
+}
@@ -0,0 +1,214 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Live samples of the driver or of perf_event, see live.h.
+*/
+
+#if !defined(_WIN32)
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "live.h"
+#include "hpcconf.h"
+
+#if defined(_WIN32)
+
+int LiveOpen(PLIVE_SOURCE source, UINT32 pid, INT32 pmiThreshold, UINT32 flags){
+	UINT64 address = 0;
+	DWORD bytes;
+
+	(void)pid;
+	(void)pmiThreshold;
+	(void)flags;
+	memset(source, 0, sizeof(*source));
+	source->device = CreateFileA(HPC_DEVICE_NAME, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+	if(source->device == INVALID_HANDLE_VALUE){
+		fprintf(stderr, "cannot open %s: error %lu (is the driver started?)\n", HPC_DEVICE_NAME, GetLastError());
+		return -1;
+	}
+	//the mapping lives as long as the handle
+	if(!DeviceIoControl(source->device, IOCTL_HPC_MAP_LIVE, NULL, 0, &address, sizeof(address), &bytes, NULL)){
+		fprintf(stderr, "IOCTL_HPC_MAP_LIVE failed: error %lu\n", GetLastError());
+		CloseHandle(source->device);
+		return -1;
+	}
+	source->live = (const HPC_LIVE_HEADER *)(UINT_PTR)address;
+	if(source->live->magic != HPC_LIVE_MAGIC || source->live->version != HPC_LIVE_VERSION){
+		fprintf(stderr, "the driver has live region version %u, this tool reads version %d\n", source->live->version, HPC_LIVE_VERSION);
+		CloseHandle(source->device);
+		return -1;
+	}
+	source->next = (UINT32 *)calloc(source->live->cpuCount, sizeof(UINT32));
+	if(source->next == NULL){
+		CloseHandle(source->device);
+		return -1;
+	}
+	//cursors at 0 fit a driver that has not started yet, else the first LiveNext follows the current run
+	source->run = 0;
+	source->header = source->live->log;
+	return 0;
+}
+
+void LiveClose(PLIVE_SOURCE source){
+	free(source->next);
+	CloseHandle(source->device);
+}
+
+/*
+* Start following a new run: from the current heads, so a viewer attached to a
+* running experiment does not count the samples taken before it came as lost
+*/
+static void FollowRun(PLIVE_SOURCE source, UINT32 run){
+	UINT32 cpu;
+
+	source->run = run;
+	source->header = source->live->log;
+	for(cpu = 0; cpu < source->live->cpuCount; cpu++)
+		source->next[cpu] = HpcLoadAcquire(&LiveCpu(source->live, cpu)->head);
+}
+
+int LiveNext(PLIVE_SOURCE source, PHPC_SAMPLE sample){
+	const HPC_LIVE_HEADER *live = source->live;
+	UINT32 run = HpcLoadAcquire((volatile UINT32 *)&live->run), i, cpu;
+
+	if(run != source->run){
+		FollowRun(source, run);
+		return 0;
+	}
+	for(i = 0; i < live->cpuCount; i++){
+		cpu = (source->cpu + i) % live->cpuCount;
+		if(LiveRead(live, cpu, &source->next[cpu], &source->lost, sample)){
+			//the heads are reset at a start; a sample read meanwhile may be from either run
+			if(HpcLoadAcquire((volatile UINT32 *)&live->run) != run){
+				FollowRun(source, live->run);
+				return 0;
+			}
+			source->cpu = cpu;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+void LiveWait(PLIVE_SOURCE source, int ms){
+	(void)source;
+	Sleep((DWORD)ms);
+}
+
+int LiveRunning(const LIVE_SOURCE *source){
+	return source->live->running != 0;
+}
+
+#else
+
+int LiveOpen(PLIVE_SOURCE source, UINT32 pid, INT32 pmiThreshold, UINT32 flags){
+	PERF_EVENT events[HPC_NUM_COUNTERS];
+	UINT32 perfFlags = PERF_GROUP_SAMPLE | PERF_GROUP_INHERIT, i;
+	char path[64];
+	FILE *comm;
+	int rc, software = 0;
+
+	memset(source, 0, sizeof(*source));
+	if(pmiThreshold >= 0){
+		fprintf(stderr, "live samples need a sampling period (a negative threshold)\n");
+		return -1;
+	}
+	source->threads = (PPERF_THREADS)calloc(1, sizeof(PERF_THREADS));
+	if(source->threads == NULL){
+		perror("calloc");
+		return -1;
+	}
+	if(flags & LIVE_OPEN_ON_EXEC)
+		perfFlags |= PERF_GROUP_ON_EXEC;
+	source->period = (UINT32)-pmiThreshold;
+
+	//hardware events first, the software events when there is no PMU, like hpcrun
+	memcpy(events, perfHardwareEvents, sizeof(events));
+	rc = PerfGroupOpen(&source->group, (pid_t)pid, events, source->period, perfFlags);
+	if(rc == -ENOENT || rc == -EOPNOTSUPP || rc == -ENODEV){
+		memcpy(events, perfSoftwareEvents, sizeof(events));
+		software = 1;
+		rc = PerfGroupOpen(&source->group, (pid_t)pid, events, source->period, perfFlags);
+		if(rc == -EACCES || rc == -EPERM){
+			for(i = 0; i < HPC_NUM_COUNTERS; i++)
+				events[i].kernel = 0;
+			rc = PerfGroupOpen(&source->group, (pid_t)pid, events, source->period, perfFlags);
+		}
+	}
+	if(rc == -EINVAL)
+		rc = PerfGroupOpen(&source->group, (pid_t)pid, events, source->period, perfFlags & ~PERF_GROUP_INHERIT);
+	if(rc != 0){
+		fprintf(stderr, "perf_event_open: %s%s\n", strerror(-rc),
+			rc == -EACCES || rc == -EPERM ? " (see /proc/sys/kernel/perf_event_paranoid)" : "");
+		free(source->threads);
+		return -1;
+	}
+
+	SampleLogInitHeader(&source->header);
+	source->header.mode = SAMPLE_LOG_MODE_SAMPLING;
+	source->header.pmiThreshold = pmiThreshold;
+	source->header.cpuCount = (UINT32)sysconf(_SC_NPROCESSORS_CONF);
+	source->header.flags = SAMPLE_LOG_FLAG_PERF | (software ? SAMPLE_LOG_FLAG_SOFTWARE : 0);
+	snprintf(path, sizeof(path), "/proc/%u/comm", pid);
+	comm = fopen(path, "r");
+	if(comm != NULL){
+		if(fgets(source->header.testApp, sizeof(source->header.testApp), comm) != NULL)
+			source->header.testApp[strcspn(source->header.testApp, "\n")] = 0;
+		fclose(comm);
+	}
+	return 0;
+}
+
+void LiveClose(PLIVE_SOURCE source){
+	PerfGroupClose(&source->group);
+	free(source->threads);
+}
+
+int LiveNext(PLIVE_SOURCE source, PHPC_SAMPLE sample){
+	PERF_SAMPLE perf;
+	PERF_MAPPING mapping;
+	int rc;
+
+	for(;;){
+		//the mappings are of no use to a viewer
+		while((rc = PerfGroupNextSample(&source->group, &perf, &mapping)) == PERF_NEXT_MAPPING)
+			;
+		if(rc != PERF_NEXT_SAMPLE || PerfThreadWindow(source->threads, &perf, sample->ctr) == 0)
+			break;
+		//a thread the table has no room for: its totals are no window, the sample counts as lost
+	}
+	source->lost = source->group.lost + source->threads->untracked;
+	if(rc != PERF_NEXT_SAMPLE)
+		return 0;
+
+	sample->tsc = perf.time;
+	sample->tid = perf.tid;
+	sample->cpu = (UINT16)perf.cpu;
+	sample->group = 0;
+	sample->region = 0;
+	sample->depth = 0;
+	sample->period = source->period;
+	sample->ip = perf.ip;
+	sample->cpl = (UINT16)perf.cpl;
+	return 1;
+}
+
+void LiveWait(PLIVE_SOURCE source, int ms){
+	struct pollfd fd;
+
+	fd.fd = PerfGroupPollFd(&source->group);
+	fd.events = POLLIN;
+	poll(&fd, 1, ms);
+}
+
+int LiveRunning(const LIVE_SOURCE *source){
+	(void)source;
+	return 1;
+}
+
+#endif
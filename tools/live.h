@@ -0,0 +1,63 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Samples of a running experiment as they are taken, for live viewers like hpclive.
+* On Windows the live region of the driver (drv/hpclive.h) is mapped into the process
+* by IOCTL_HPC_MAP_LIVE and the samples are read where the PMI handler wrote them,
+* following the heads the rings publish: no copy through the driver and no IOCTL per
+* sample. A new run of the driver restarts the source at the heads of the new rings.
+* On Linux the samples come from the perf mmap ring of a counter group on a process
+* (perfev.h), turned into the counts of each window like hpcrun does, so the same
+* viewer runs on both. Either way a viewer that falls behind loses samples instead
+* of slowing the collector down, and the source counts them.
+*/
+
+#ifndef LIVE_H
+#define LIVE_H
+
+#include "hpcring.h"
+#include "hpclog.h"
+#if defined(_WIN32)
+	#include "hpclive.h"
+#else
+	#include "perfev.h"
+#endif
+
+//LiveOpen flags
+#define LIVE_OPEN_ON_EXEC	0x01	//Linux: start counting at the next exec of the process
+
+typedef struct _LIVE_SOURCE {
+	SAMPLE_LOG_HEADER header;		//experiment of the samples
+	UINT64 lost;					//samples overwritten or dropped before they were read
+#if defined(_WIN32)
+	HANDLE device;
+	const HPC_LIVE_HEADER *live;	//the mapped region
+	UINT32 run;						//run the cursors belong to
+	UINT32 *next;					//cursor of every ring
+	UINT32 cpu;						//ring read last
+#else
+	PERF_GROUP group;
+	UINT32 period;
+	PPERF_THREADS threads;			//totals of the previous sample of every thread
+#endif
+} LIVE_SOURCE, *PLIVE_SOURCE;
+
+/*
+* Windows: attach to the driver, whose configuration decides what is sampled; pid,
+* pmiThreshold and flags are ignored. Linux: sample the process pid every -pmiThreshold
+* instructions, or every -pmiThreshold ns of its task clock if there is no PMU.
+* Returns 0 on success, else -1 with a message on stderr.
+*/
+int LiveOpen(PLIVE_SOURCE source, UINT32 pid, INT32 pmiThreshold, UINT32 flags);
+void LiveClose(PLIVE_SOURCE source);
+
+//returns 1 and the next sample, or 0 if there is none yet
+int LiveNext(PLIVE_SOURCE source, PHPC_SAMPLE sample);
+
+//wait at most ms milliseconds for new samples
+void LiveWait(PLIVE_SOURCE source, int ms);
+
+//1 while the experiment takes samples; on Linux the caller watches the process
+int LiveRunning(const LIVE_SOURCE *source);
+
+#endif
@@ -0,0 +1,196 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Merging reader of the binary sample log, see logread.h.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "logread.h"
+
+static int SeekTo(FILE *file, UINT64 offset){
+#if defined(_MSC_VER)
+	return _fseeki64(file, (__int64)offset, SEEK_SET);
+#else
+	return fseeko(file, (off_t)offset, SEEK_SET);
+#endif
+}
+
+/*
+* Order of the heap: earlier time stamp first, lower CPU first on ties
+*/
+static int StreamBefore(PLOG_READER reader, UINT32 a, UINT32 b){
+	const HPC_SAMPLE *x = &reader->streams[a].head, *y = &reader->streams[b].head;
+
+	if(x->tsc != y->tsc)
+		return x->tsc < y->tsc;
+	return a < b;
+}
+
+static void HeapDown(PLOG_READER reader, UINT32 i){
+	UINT32 child, tmp;
+
+	for(;;){
+		child = 2 * i + 1;
+		if(child >= reader->heapSize)
+			return;
+		if(child + 1 < reader->heapSize && StreamBefore(reader, reader->heap[child + 1], reader->heap[child]))
+			child++;
+		if(!StreamBefore(reader, reader->heap[child], reader->heap[i]))
+			return;
+		tmp = reader->heap[i];
+		reader->heap[i] = reader->heap[child];
+		reader->heap[child] = tmp;
+		i = child;
+	}
+}
+
+/*
+* Load the next sample of a stream into its head, reading its next block when needed.
+* Returns 1 if there is a sample, 0 if the stream is done and -1 on a corrupt block.
+*/
+static int StreamAdvance(PLOG_READER reader, PLOG_CPU_STREAM stream){
+	size_t len;
+	int rc;
+
+	while((rc = SampleLogBlockNext(&stream->cursor, &stream->head)) == 0){
+		if(stream->next == stream->count)
+			return 0;
+		if(SeekTo(reader->file, stream->offsets[stream->next]) != 0)
+			return -1;
+		stream->next++;
+		len = fread(stream->block, 1, reader->header.blockSize, reader->file);
+		if(SampleLogBlockBegin(&stream->cursor, stream->block, (UINT32)len) != 0)
+			return -1;
+	}
+	return rc;
+}
+
+static int AddBlock(PLOG_READER reader, UINT32 cpu, UINT64 offset){
+	PLOG_CPU_STREAM streams, stream;
+	UINT64 *offsets;
+	UINT32 count;
+
+	if(cpu >= reader->streamCount){
+		count = cpu + 1;
+		streams = (PLOG_CPU_STREAM)realloc(reader->streams, count * sizeof(LOG_CPU_STREAM));
+		if(streams == NULL)
+			return -1;
+		memset(streams + reader->streamCount, 0, (count - reader->streamCount) * sizeof(LOG_CPU_STREAM));
+		reader->streams = streams;
+		reader->streamCount = count;
+	}
+	stream = &reader->streams[cpu];
+	if(stream->count == stream->capacity){
+		stream->capacity = stream->capacity ? 2 * stream->capacity : 64;
+		offsets = (UINT64 *)realloc(stream->offsets, stream->capacity * sizeof(UINT64));
+		if(offsets == NULL)
+			return -1;
+		stream->offsets = offsets;
+	}
+	stream->offsets[stream->count++] = offset;
+	return 0;
+}
+
+/*
+* Open a log, index its blocks per CPU and load the first sample of every CPU
+*/
+int LogReaderOpen(PLOG_READER reader, const char *path, const char **error){
+	UINT8 first[SAMPLE_LOG_ALIGN];
+	SAMPLE_LOG_BLOCK block;
+	UINT64 offset;
+	UINT32 cpu;
+	int rc;
+
+	memset(reader, 0, sizeof(*reader));
+	*error = NULL;
+	reader->file = fopen(path, "rb");
+	if(reader->file == NULL)
+		return -1;
+
+	if(fread(first, 1, SAMPLE_LOG_ALIGN, reader->file) != SAMPLE_LOG_ALIGN ||
+		SampleLogReadHeader(first, SAMPLE_LOG_ALIGN, &reader->header) != 0){
+		*error = "not a sample log of this version";
+		goto fail;
+	}
+
+	//the block headers alone tell which CPU a block belongs to and where the next one starts
+	offset = SAMPLE_LOG_ALIGN;
+	while(SeekTo(reader->file, offset) == 0 && fread(&block, 1, sizeof(block), reader->file) == sizeof(block)){
+		if(block.magic != SAMPLE_LOG_BLOCK_MAGIC || block.bytes < sizeof(block) || block.bytes > reader->header.blockSize){
+			*error = "corrupt block header";
+			goto fail;
+		}
+		if(AddBlock(reader, block.cpu, offset) != 0){
+			*error = "out of memory";
+			goto fail;
+		}
+		reader->blocks++;
+		offset += (block.bytes + SAMPLE_LOG_ALIGN - 1) & ~(UINT64)(SAMPLE_LOG_ALIGN - 1);
+	}
+
+	reader->heap = (UINT32 *)malloc((reader->streamCount + 1) * sizeof(UINT32));
+	if(reader->heap == NULL){
+		*error = "out of memory";
+		goto fail;
+	}
+	for(cpu = 0; cpu < reader->streamCount; cpu++){
+		if(reader->streams[cpu].count == 0)
+			continue;
+		reader->streams[cpu].block = (UINT8 *)malloc(reader->header.blockSize);
+		if(reader->streams[cpu].block == NULL){
+			*error = "out of memory";
+			goto fail;
+		}
+		rc = StreamAdvance(reader, &reader->streams[cpu]);
+		if(rc < 0){
+			*error = "corrupt block";
+			goto fail;
+		}
+		if(rc == 1)
+			reader->heap[reader->heapSize++] = cpu;
+	}
+	for(cpu = reader->heapSize / 2; cpu-- > 0; )
+		HeapDown(reader, cpu);
+	return 0;
+
+fail:
+	LogReaderClose(reader);
+	return -1;
+}
+
+/*
+* Return the sample with the smallest time stamp among the heads of all CPUs
+*/
+int LogReaderNext(PLOG_READER reader, PHPC_SAMPLE sample){
+	PLOG_CPU_STREAM stream;
+	int rc;
+
+	if(reader->heapSize == 0)
+		return 0;
+
+	stream = &reader->streams[reader->heap[0]];
+	*sample = stream->head;
+	rc = StreamAdvance(reader, stream);
+	if(rc < 0)
+		return -1;
+	if(rc == 0)
+		reader->heap[0] = reader->heap[--reader->heapSize];
+	HeapDown(reader, 0);
+	reader->samples++;
+	return 1;
+}
+
+void LogReaderClose(PLOG_READER reader){
+	UINT32 cpu;
+
+	for(cpu = 0; cpu < reader->streamCount; cpu++){
+		free(reader->streams[cpu].offsets);
+		free(reader->streams[cpu].block);
+	}
+	free(reader->streams);
+	free(reader->heap);
+	if(reader->file != NULL)
+		fclose(reader->file);
+	memset(reader, 0, sizeof(*reader));
+}
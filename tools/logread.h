@@ -0,0 +1,47 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Reader of the binary sample log (drv/hpclog.h) for the user-mode tools.
+* The driver writes the samples of every CPU into their own blocks; the reader
+* indexes the blocks per CPU and merges the per-CPU streams by time stamp, so
+* the samples come out in the order they were taken across the whole machine.
+* Only uses stdio, so it builds with the Windows SDK as well as on Linux.
+*/
+
+#ifndef LOGREAD_H
+#define LOGREAD_H
+
+#include <stdio.h>
+#include "hpclog.h"
+
+//blocks of one CPU and the decoding position in them
+typedef struct _LOG_CPU_STREAM {
+	UINT64 *offsets;			//file offsets of the blocks of this CPU, in file order
+	UINT32 count;
+	UINT32 capacity;
+	UINT32 next;				//index of the next block to load
+	UINT8 *block;				//current block
+	SAMPLE_LOG_CURSOR cursor;
+	HPC_SAMPLE head;			//next sample of this CPU, valid while the stream is in the heap
+} LOG_CPU_STREAM, *PLOG_CPU_STREAM;
+
+typedef struct _LOG_READER {
+	FILE *file;
+	SAMPLE_LOG_HEADER header;
+	PLOG_CPU_STREAM streams;	//indexed by CPU number
+	UINT32 streamCount;
+	UINT32 *heap;				//min-heap of stream indices ordered by (head.tsc, cpu)
+	UINT32 heapSize;
+	UINT64 blocks;
+	UINT64 samples;				//samples returned so far
+} LOG_READER, *PLOG_READER;
+
+//returns 0 on success; on failure the reader is closed and errno or a message describes why
+int LogReaderOpen(PLOG_READER reader, const char *path, const char **error);
+
+//returns 1 if a sample was read, 0 at the end of the log and -1 if the log is corrupt
+int LogReaderNext(PLOG_READER reader, PHPC_SAMPLE sample);
+
+void LogReaderClose(PLOG_READER reader);
+
+#endif
@@ -0,0 +1,190 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Cost of the region markers: the user-mode reads of hpcpmc.h, with rdpmc and with
+* read() of the perf_event group, against the pipe markers of hpcmark.h, which stand in
+* for the traps into the collector. For each it times pairs of begin/end markers around
+* an empty region and reports the time and TSC cycles per pair; for hpcpmc.h also the
+* counts of the empty region itself, the part of a marker that a region counts. The
+* pipe markers are only timed when it runs under hpcrun in the polling mode:
+*	hpcrun mode=polling log=/dev/null ./markbench
+* It checks that nested regions of known sizes are counted in full and in order.
+* Linux only.
+*/
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "hpcpmc.h"
+#include "hpcmark.h"
+
+#define REGION_EMPTY	1
+#define REGION_OUTER	2
+#define REGION_INNER	3
+
+typedef struct _BENCH {
+	const char *name;
+	int pipe;						//time the markers of hpcmark.h instead
+	unsigned long long pairs;
+	int mode;						//HPC_PMC_* the thread read with
+	double ns;						//per pair
+	double tsc;
+	const char *const *names;		//of the counters
+	unsigned long long ctr[HPC_PMC_COUNTERS];	//counts of all empty regions
+	unsigned long long instances;
+	int failed;
+} BENCH, *PBENCH;
+
+static unsigned long long ReadTsc(){
+#if defined(__x86_64__) || defined(__i386__)
+	unsigned int low, high;
+
+	__asm__ __volatile__("rdtsc" : "=a"(low), "=d"(high));
+	return ((unsigned long long)high << 32) | low;
+#else
+	return 0;
+#endif
+}
+
+static double Seconds(const struct timespec *t0, const struct timespec *t1){
+	return (double)(t1->tv_sec - t0->tv_sec) + (double)(t1->tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+static volatile unsigned long long sink;
+
+static void Work(unsigned int n){
+	unsigned int i;
+
+	for(i = 0; i < n; i++)
+		sink += i;
+}
+
+/*
+* Outer regions of 4 inner regions each: the inner instances must add up to at most
+* the outer ones, and the instance counts must be exact
+*/
+static int CheckNesting(){
+	unsigned long long outer[HPC_PMC_COUNTERS], inner[HPC_PMC_COUNTERS];
+	unsigned long long outerCount, innerCount;
+	int i, j;
+
+	for(i = 0; i < 1000; i++){
+		HpcPmcBegin(REGION_OUTER);
+		for(j = 0; j < 4; j++){
+			HpcPmcBegin(REGION_INNER);
+			Work(10000);
+			HpcPmcEnd(REGION_INNER);
+		}
+		HpcPmcEnd(REGION_OUTER);
+	}
+	outerCount = HpcPmcGet(REGION_OUTER, outer);
+	innerCount = HpcPmcGet(REGION_INNER, inner);
+	if(outerCount != 1000 || innerCount != 4000 || inner[0] > outer[0] || outer[0] == 0){
+		printf("  nesting: %llu outer instances counting %llu, %llu inner counting %llu\n", outerCount, outer[0],
+			innerCount, inner[0]);
+		return 1;
+	}
+	return 0;
+}
+
+static void *Run(void *argument){
+	PBENCH bench = (PBENCH)argument;
+	struct timespec t0, t1;
+	unsigned long long i, tsc;
+
+	if(!bench->pipe){
+		//set up the counters of the thread before the clock starts
+		HpcPmcBegin(REGION_EMPTY);
+		HpcPmcEnd(REGION_EMPTY);
+		HpcPmcFlush();
+		bench->mode = HpcPmcMode();
+		bench->names = hpcPmcThread.names;
+		if(bench->mode == HPC_PMC_OFF)
+			return NULL;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	tsc = ReadTsc();
+	for(i = 0; i < bench->pairs; i++){
+		if(bench->pipe){
+			HpcRegionBegin(REGION_EMPTY);
+			HpcRegionEnd(REGION_EMPTY);
+		}else{
+			HpcPmcBegin(REGION_EMPTY);
+			HpcPmcEnd(REGION_EMPTY);
+		}
+	}
+	tsc = ReadTsc() - tsc;
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	bench->ns = Seconds(&t0, &t1) * 1e9 / (double)bench->pairs;
+	bench->tsc = (double)tsc / (double)bench->pairs;
+	if(!bench->pipe){
+		//HPC_PMC_BATCH is larger than the pairs, so nothing was flushed
+		bench->instances = HpcPmcGet(REGION_EMPTY, bench->ctr);
+		HpcPmcFlush();
+		bench->failed = CheckNesting();
+		HpcPmcFlush();
+	}
+	return NULL;
+}
+
+static int Measure(PBENCH bench){
+	pthread_t thread;
+	int c;
+
+	//every thread sets up its counters with the environment it finds
+	if(pthread_create(&thread, NULL, Run, bench) != 0)
+		return 1;
+	pthread_join(thread, NULL);
+	if(!bench->pipe && bench->mode == HPC_PMC_OFF){
+		printf("%-7s no counters\n", bench->name);
+		return 0;
+	}
+	printf("%-7s %8.1f ns %8.0f tsc per pair", bench->name, bench->ns, bench->tsc);
+	if(!bench->pipe && bench->instances != 0){
+		printf(", per empty region");
+		for(c = 0; c < HPC_PMC_COUNTERS; c++)
+			printf(" %s %.1f", bench->names[c], (double)bench->ctr[c] / (double)bench->instances);
+	}
+	printf("\n");
+	return bench->failed || (!bench->pipe && bench->instances != bench->pairs);
+}
+
+int main(int argc, char *argv[]){
+	BENCH bench[3];
+	unsigned long long pairs = 60000;
+	int failed = 0;
+
+	if(argc > 2 || (argc == 2 && ((pairs = strtoull(argv[1], NULL, 0)) == 0 || pairs >= HPC_PMC_BATCH))){
+		fprintf(stderr, "usage: %s [pairs]\n", argv[0]);
+		fprintf(stderr, "  begin/end pairs per run, below %u (default 60000)\n", HPC_PMC_BATCH);
+		return 2;
+	}
+	//the accumulators are written to HPC_PMC_OUT, the counts are taken from them before
+	setenv(HPC_PMC_OUT_ENV, "/dev/null", 0);
+	memset(bench, 0, sizeof(bench));
+	bench[0].name = "rdpmc";
+	bench[1].name = "read";
+	bench[2].name = "pipe";
+	bench[2].pipe = 1;
+
+	bench[0].pairs = pairs;
+	unsetenv(HPC_PMC_MODE_ENV);
+	failed |= Measure(&bench[0]);
+	if(bench[0].mode == HPC_PMC_SYSCALL)
+		printf("        rdpmc is not allowed, the markers read() the counters (see /sys/devices/cpu/rdpmc)\n");
+
+	bench[1].pairs = pairs;
+	setenv(HPC_PMC_MODE_ENV, "read", 1);
+	failed |= Measure(&bench[1]);
+
+	if(getenv(HPC_MARK_ENV) != NULL){
+		bench[2].pairs = pairs / 10 + 1;
+		failed |= Measure(&bench[2]);
+	}else
+		printf("pipe    not timed, run under hpcrun mode=polling\n");
+	printf("check: %s\n", failed ? "FAILED" : "ok");
+	return failed;
+}
@@ -0,0 +1,155 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Benchmark of the per-context-switch cost of finding the test process in the
+* SwapContext hook. It replays a synthetic trace of (exiting thread, incoming
+* thread) pairs over synthetic KTHREAD/EPROCESS records and compares
+*	old: allocate two 16-byte buffers, copy ImageFileName, strcmp against TEST_APP
+*	new: look up KTHREAD.ApcState.Process in the target set (drv/hpcmatch.h)
+* malloc/free stand in for ExAllocatePoolWithTag/ExFreePoolWithTag.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "hpcmatch.h"
+
+//synthetic records with the fields at the offsets the hook uses on Windows 7 x86
+typedef struct _SYN_PROCESS {
+	UINT8 pad[0x16c];
+	char ImageFileName[16];
+} SYN_PROCESS;
+
+typedef struct _SYN_THREAD {
+	UINT8 pad[0x50];
+	SYN_PROCESS *Process;		//KTHREAD.ApcState.Process
+} SYN_THREAD;
+
+#define THREADS_PER_PROCESS 4
+
+int processCount = 200;
+int targetCount = 1;
+int switchCount = 4000000;
+int targetPercent = 5;			//share of switches that involve a target thread
+char testApps[TARGET_SET_MAX][16];
+
+static UINT64 NowNs(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (UINT64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+* Old SaveRestoreCounters matching, one side of the switch
+*/
+static int MatchByName(SYN_THREAD *thread){
+	char *imageFileName;
+	int i, match = 0;
+
+	imageFileName = (char *)malloc(16);
+	if(imageFileName == NULL)
+		return 0;
+	strncpy(imageFileName, thread->Process->ImageFileName, 16);
+	for(i = 0; i < targetCount; i++){
+		if(!strcmp(imageFileName, testApps[i])){
+			match = 1;
+			break;
+		}
+	}
+	free(imageFileName);
+	return match;
+}
+
+/*
+* New SaveRestoreCounters matching, one side of the switch
+*/
+static int MatchByProcess(const TARGET_SET *set, SYN_THREAD *thread){
+	return TargetSetContains(set, (UINT_PTR)thread->Process);
+}
+
+int main(int argc, char *argv[]){
+	SYN_PROCESS *processes;
+	SYN_THREAD *threads;
+	UINT32 *trace;
+	TARGET_SET set;
+	UINT64 start, oldNs, newNs;
+	long oldMatches = 0, newMatches = 0;
+	int threadCount, opt, i, t;
+
+	while((opt = getopt(argc, argv, "p:t:n:m:")) != -1){
+		switch(opt){
+		case 'p': processCount = atoi(optarg); break;
+		case 't': targetCount = atoi(optarg); break;
+		case 'n': switchCount = atoi(optarg); break;
+		case 'm': targetPercent = atoi(optarg); break;
+		default:
+			fprintf(stderr, "usage: %s [-p processes] [-t target processes] [-n switches] [-m %% of switches to targets]\n", argv[0]);
+			return 2;
+		}
+	}
+	if(targetCount < 1 || targetCount > TARGET_SET_MAX || processCount <= targetCount || switchCount < 1){
+		fprintf(stderr, "need 1..%d targets and more processes than targets\n", TARGET_SET_MAX);
+		return 2;
+	}
+
+	threadCount = processCount * THREADS_PER_PROCESS;
+	processes = (SYN_PROCESS *)calloc(processCount, sizeof(SYN_PROCESS));
+	threads = (SYN_THREAD *)calloc(threadCount, sizeof(SYN_THREAD));
+	trace = (UINT32 *)malloc(sizeof(UINT32) * (switchCount + 1));
+	if(processes == NULL || threads == NULL || trace == NULL){
+		perror("malloc");
+		return 1;
+	}
+
+	//the first targetCount processes are the test apps
+	TargetSetInit(&set);
+	for(i = 0; i < processCount; i++){
+		if(i < targetCount){
+			snprintf(testApps[i], sizeof(testApps[i]), "test%d.exe", i % 100);
+			strcpy(processes[i].ImageFileName, testApps[i]);
+			TargetSetAdd(&set, (UINT_PTR)&processes[i], 4 * (UINT_PTR)(i + 1));
+		}else{
+			snprintf(processes[i].ImageFileName, 16, "svc%d.exe", i % 100000);
+		}
+	}
+	for(t = 0; t < threadCount; t++)
+		threads[t].Process = &processes[t / THREADS_PER_PROCESS];
+
+	//trace[k] is the thread running after switch k
+	srand(1);
+	for(i = 0; i <= switchCount; i++){
+		if(rand() % 100 < targetPercent)
+			trace[i] = rand() % (targetCount * THREADS_PER_PROCESS);
+		else
+			trace[i] = targetCount * THREADS_PER_PROCESS + rand() % (threadCount - targetCount * THREADS_PER_PROCESS);
+	}
+
+	start = NowNs();
+	for(i = 0; i < switchCount; i++){
+		oldMatches += MatchByName(&threads[trace[i]]);
+		oldMatches += MatchByName(&threads[trace[i + 1]]);
+	}
+	oldNs = NowNs() - start;
+
+	start = NowNs();
+	for(i = 0; i < switchCount; i++){
+		newMatches += MatchByProcess(&set, &threads[trace[i]]);
+		newMatches += MatchByProcess(&set, &threads[trace[i + 1]]);
+	}
+	newNs = NowNs() - start;
+
+	printf("%d switches, %d processes, %d targets, %d%% target threads\n", switchCount, processCount, targetCount, targetPercent);
+	printf("old (alloc + strcmp):     %8.2f ns/switch, %ld matches\n", (double)oldNs / switchCount, oldMatches);
+	printf("new (EPROCESS lookup):    %8.2f ns/switch, %ld matches\n", (double)newNs / switchCount, newMatches);
+
+	free(trace);
+	free(threads);
+	free(processes);
+	if(oldMatches != newMatches){
+		fprintf(stderr, "old and new matching disagree\n");
+		return 1;
+	}
+	return 0;
+}
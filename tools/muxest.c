@@ -0,0 +1,125 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Ratio estimates of multiplexed event totals, see muxest.h.
+*/
+
+#include <math.h>
+#include <string.h>
+#include "muxest.h"
+
+void MuxEstimatorInit(PMUX_ESTIMATOR est, UINT32 groupCount, UINT32 baseColumn){
+	memset(est, 0, sizeof(*est));
+	est->groupCount = groupCount < 1 ? 1 : groupCount > HPC_MAX_GROUPS ? HPC_MAX_GROUPS : groupCount;
+	est->baseColumn = baseColumn < MUX_FIRST_PMC ? baseColumn : 0;
+}
+
+/*
+* Account a finished visit as one sampling unit of its group
+*/
+static void CloseVisit(PMUX_ESTIMATOR est, PMUX_VISIT visit){
+	PMUX_COUNT count;
+	UINT32 i;
+
+	est->visits++;
+	est->groupVisits[visit->group]++;
+	est->groupBase[visit->group] += visit->base;
+	est->groupBase2[visit->group] += visit->base * visit->base;
+	for(i = 0; i < MUX_NUM_PMCS; i++){
+		count = &est->counts[visit->group][i];
+		count->sumCount += visit->count[i];
+		count->sumCount2 += visit->count[i] * visit->count[i];
+		count->sumCountBase += visit->count[i] * visit->base;
+	}
+	visit->used = 0;
+}
+
+/*
+* Account one window; samples of groups outside the schedule are ignored
+*/
+void MuxEstimatorAdd(PMUX_ESTIMATOR est, const HPC_SAMPLE *sample){
+	MUX_VISIT single;
+	PMUX_VISIT visit = NULL;
+	UINT32 i, probes;
+
+	if(sample->group >= est->groupCount)
+		return;
+	est->windows++;
+	est->groupWindows[sample->group]++;
+	est->totalBase += (double)sample->ctr[est->baseColumn];
+	for(i = 0; i < MUX_FIRST_PMC; i++)
+		est->fixed[i] += (double)sample->ctr[i];
+
+	//find the open visit of the thread, or a free slot for it
+	i = (sample->tid * 0x9E3779B1u) & (MUX_MAX_THREADS - 1);
+	for(probes = 0; probes < MUX_MAX_THREADS; probes++){
+		if(!est->open[i].used || est->open[i].tid == sample->tid){
+			visit = &est->open[i];
+			break;
+		}
+		i = (i + 1) & (MUX_MAX_THREADS - 1);
+	}
+	if(visit != NULL && visit->used && visit->group != sample->group)
+		CloseVisit(est, visit);
+	if(visit == NULL){
+		single.used = 0;
+		visit = &single;
+	}
+	if(!visit->used){
+		memset(visit, 0, sizeof(*visit));
+		visit->used = 1;
+		visit->tid = sample->tid;
+		visit->group = sample->group;
+	}
+
+	visit->base += (double)sample->ctr[est->baseColumn];
+	for(i = 0; i < MUX_NUM_PMCS; i++)
+		visit->count[i] += (double)sample->ctr[MUX_FIRST_PMC + i];
+	if(visit == &single)
+		CloseVisit(est, visit);
+}
+
+/*
+* Close the visits still open at the end of the log; call before MuxEstimate
+*/
+void MuxEstimatorFinish(PMUX_ESTIMATOR est){
+	UINT32 i;
+
+	for(i = 0; i < MUX_MAX_THREADS; i++){
+		if(est->open[i].used)
+			CloseVisit(est, &est->open[i]);
+	}
+}
+
+/*
+* Estimate the total of programmable counter slot (0-3) of a group over all windows
+*/
+void MuxEstimate(const MUX_ESTIMATOR *est, UINT32 group, UINT32 slot, PMUX_RESULT result){
+	const MUX_COUNT *count = &est->counts[group][slot];
+	double n, N, ratio, s2;
+
+	memset(result, 0, sizeof(*result));
+	result->stdError = -1;
+	result->windows = est->groupWindows[group];
+	result->visits = est->groupVisits[group];
+	result->raw = count->sumCount;
+	if(result->visits == 0 || est->groupBase[group] <= 0)
+		return;
+
+	n = (double)result->visits;
+	N = (double)est->visits;
+	ratio = count->sumCount / est->groupBase[group];
+	result->scale = est->totalBase / est->groupBase[group];
+	result->estimate = ratio * est->totalBase;
+	if(result->visits == est->visits){
+		result->stdError = 0;		//the group was always active, the count is exact
+		return;
+	}
+	if(result->visits < 2)
+		return;
+
+	s2 = (count->sumCount2 - 2 * ratio * count->sumCountBase + ratio * ratio * est->groupBase2[group]) / (n - 1);
+	if(s2 < 0)
+		s2 = 0;		//rounding when the counts are exactly proportional to the base
+	result->stdError = sqrt(N * N * (1 - n / N) * s2 / n);
+}
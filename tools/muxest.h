@@ -0,0 +1,74 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Estimates of event totals from multiplexed samples (drv/hpcmux.h).
+* Each group only counts while it is active. The sampling unit is a visit: the
+* consecutive windows one thread spends in one group before it rotates (a single
+* window when the group changes at every PMI). The total of an event is estimated
+* with a ratio estimator against a time base that counts in every window, by
+* default instructions retired (fixed counter 0, the PMI period):
+*	estimate = sum(count) / sum(base) * total base
+* The standard error is the one of a ratio estimator under simple random sampling
+* of the visits, with finite population correction:
+*	var = N^2 (1 - n/N) s^2 / n,  s^2 = sum((count - R base)^2) / (n - 1)
+* where N is the number of visits and n the number of visits of the group.
+*/
+
+#ifndef MUXEST_H
+#define MUXEST_H
+
+#include "hpcring.h"
+
+//first programmable counter in HPC_SAMPLE.ctr
+#define MUX_FIRST_PMC HPC_COLUMN_PMC0
+#define MUX_NUM_PMCS HPC_MAX_PROGRAMMABLE
+
+//threads with an open visit, a power of two; more threads make their windows count as single visits
+#define MUX_MAX_THREADS 1024
+
+//sums over the visits of one group for one programmable counter
+typedef struct _MUX_COUNT {
+	double sumCount;
+	double sumCount2;
+	double sumCountBase;
+} MUX_COUNT, *PMUX_COUNT;
+
+//the visit a thread is in
+typedef struct _MUX_VISIT {
+	UINT32 used;
+	UINT32 tid;
+	UINT32 group;
+	double base;
+	double count[MUX_NUM_PMCS];
+} MUX_VISIT, *PMUX_VISIT;
+
+typedef struct _MUX_ESTIMATOR {
+	UINT32 groupCount;
+	UINT32 baseColumn;			//counter of HPC_SAMPLE.ctr used as time base, one of the fixed counters
+	UINT64 windows;
+	UINT64 visits;
+	double totalBase;
+	UINT64 groupWindows[HPC_MAX_GROUPS];
+	UINT64 groupVisits[HPC_MAX_GROUPS];
+	double groupBase[HPC_MAX_GROUPS];
+	double groupBase2[HPC_MAX_GROUPS];
+	double fixed[MUX_FIRST_PMC];	//exact totals of the fixed counters, they count in every window
+	MUX_COUNT counts[HPC_MAX_GROUPS][MUX_NUM_PMCS];
+	MUX_VISIT open[MUX_MAX_THREADS];
+} MUX_ESTIMATOR, *PMUX_ESTIMATOR;
+
+typedef struct _MUX_RESULT {
+	UINT64 windows;				//windows the group was active in
+	UINT64 visits;
+	double raw;					//count over those windows
+	double scale;				//total base / base of the group's windows
+	double estimate;			//estimated total over all windows
+	double stdError;			//standard error of the estimate, <0 if it cannot be computed
+} MUX_RESULT, *PMUX_RESULT;
+
+void MuxEstimatorInit(PMUX_ESTIMATOR est, UINT32 groupCount, UINT32 baseColumn);
+void MuxEstimatorAdd(PMUX_ESTIMATOR est, const HPC_SAMPLE *sample);
+void MuxEstimatorFinish(PMUX_ESTIMATOR est);
+void MuxEstimate(const MUX_ESTIMATOR *est, UINT32 group, UINT32 slot, PMUX_RESULT result);
+
+#endif
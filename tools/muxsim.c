@@ -0,0 +1,114 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Checks the multiplexing estimates (muxest.c) against a simulated PMU with known
+* totals. A synthetic workload runs through phases with different event rates; every
+* PMI window counts all events, but like the driver only the events of the active
+* group are recorded, and the group rotates with MuxNextGroup from drv/hpcmux.h.
+* For every event the estimate is compared with the true total, and the share of
+* estimates whose true total lies within the 95% bound is reported.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "hpcmux.h"
+#include "muxest.h"
+
+#define MAX_EVENTS (HPC_MAX_GROUPS * 4)
+
+static UINT64 rngState;
+
+static double Uniform(){
+	rngState = rngState * 6364136223846793005ULL + 1442695040888963407ULL;
+	return (double)(rngState >> 11) / 9007199254740992.0;
+}
+
+int main(int argc, char *argv[]){
+	static MUX_ESTIMATOR est;
+	MUX_RESULT result;
+	HPC_SAMPLE sample;
+	double truth[MAX_EVENTS], rate[MAX_EVENTS], count[MAX_EVENTS];
+	double relErr, sumRelErr = 0, maxRelErr = 0, minCoverage;
+	UINT64 window, windows = 100000, phaseEnd;
+	UINT32 events = 12, period = 1, trials = 20, groups, group, pmis, trial, e;
+	UINT32 covered = 0, estimates = 0;
+	int opt;
+
+	for(opt = 1; opt + 1 < argc && argv[opt][0] == '-'; opt += 2){
+		switch(argv[opt][1]){
+		case 'e': events = (UINT32)atoi(argv[opt + 1]); break;
+		case 'w': windows = (UINT64)atoll(argv[opt + 1]); break;
+		case 'p': period = (UINT32)atoi(argv[opt + 1]); break;
+		case 't': trials = (UINT32)atoi(argv[opt + 1]); break;
+		case 's': rngState = (UINT64)atoll(argv[opt + 1]); break;
+		default:
+			fprintf(stderr, "usage: %s [-e events] [-w windows] [-p pmis per group] [-t trials] [-s seed]\n", argv[0]);
+			return 2;
+		}
+	}
+	if(events < 1 || events > MAX_EVENTS || period < 1 || windows < 2){
+		fprintf(stderr, "1 to %d events, at least 1 PMI per group and 2 windows\n", MAX_EVENTS);
+		return 2;
+	}
+	groups = (events + 3) / 4;
+
+	for(trial = 0; trial < trials; trial++){
+		MuxEstimatorInit(&est, groups, 0);
+		memset(truth, 0, sizeof(truth));
+		group = 0;
+		pmis = 0;
+		phaseEnd = 0;
+		for(window = 0; window < windows; window++){
+			//a new phase changes the rate of every event
+			if(window == phaseEnd){
+				phaseEnd = window + 50 + (UINT64)(Uniform() * 2000);
+				for(e = 0; e < events; e++)
+					rate[e] = (0.001 + 0.01 * e) * (0.2 + 1.8 * Uniform());
+			}
+
+			memset(&sample, 0, sizeof(sample));
+			sample.ctr[0] = 50000 + (UINT64)(Uniform() * 200);		//PMI period plus skid
+			sample.ctr[1] = (UINT64)(sample.ctr[0] * (0.5 + Uniform()));
+			sample.ctr[2] = sample.ctr[1];
+			for(e = 0; e < events; e++){
+				count[e] = floor(rate[e] * sample.ctr[0] * (0.8 + 0.4 * Uniform()));
+				truth[e] += count[e];
+			}
+
+			//the PMU only counts the events of the active group
+			for(e = 0; e < 4 && group * 4 + e < events; e++)
+				sample.ctr[MUX_FIRST_PMC + e] = (UINT64)count[group * 4 + e];
+			sample.group = (UINT16)group;
+			sample.tid = 4;
+			MuxEstimatorAdd(&est, &sample);
+			MuxNextGroup(&group, &pmis, groups, period);
+		}
+		MuxEstimatorFinish(&est);
+
+		for(e = 0; e < events; e++){
+			MuxEstimate(&est, e / 4, e % 4, &result);
+			relErr = fabs(result.estimate - truth[e]) / truth[e];
+			sumRelErr += relErr;
+			if(relErr > maxRelErr)
+				maxRelErr = relErr;
+			if(result.stdError >= 0 && fabs(result.estimate - truth[e]) <= 1.96 * result.stdError + 1e-9 * truth[e])
+				covered++;
+			estimates++;
+		}
+	}
+
+	printf("%u events in %u groups, %llu windows, rotate every %u PMIs, %u trials\n",
+		events, groups, (unsigned long long)windows, period, trials);
+	printf("relative error: mean %.4f%%, max %.4f%%\n", 100 * sumRelErr / estimates, 100 * maxRelErr);
+	printf("true total within the 95%% bound: %u of %u estimates (%.1f%%)\n", covered, estimates, 100.0 * covered / estimates);
+
+	//the bound assumes random windows; rotation samples systematically, which is never much worse
+	minCoverage = 0.90;
+	if(groups > 1 && (double)covered / estimates < minCoverage){
+		printf("FAILED: coverage below %.0f%%\n", 100 * minCoverage);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,55 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Report of the self stats of a run, see overhead.h.
+*/
+
+#include "overhead.h"
+
+static const char *handlerNames[SELF_HANDLERS] = {"pmi", "trap", "switch"};
+static const char *handlerLabels[SELF_HANDLERS] = {"pmi handler:", "trap handler:", "switch hook:"};
+
+int OverheadMeasured(const SELF_STATS *self){
+	return self->runCycles != 0;
+}
+
+void OverheadPrint(FILE *out, const SELF_STATS *self, UINT32 cpuCount, int width){
+	const SELF_HANDLER *handler;
+	double cycles = (double)self->runCycles * (cpuCount != 0 ? cpuCount : 1);
+	UINT32 h;
+
+	if(!OverheadMeasured(self)){
+		fprintf(out, "%-*s not measured\n", width, "overhead:");
+		return;
+	}
+	for(h = 0; h < SELF_HANDLERS; h++){
+		handler = &self->handler[h];
+		if(handler->calls == 0)
+			continue;
+		fprintf(out, "%-*s %llu calls, cycles mean %.0f p50 %llu p99 %llu max %llu, %.4f%% of the cycles", width,
+			handlerLabels[h], (unsigned long long)handler->calls, (double)handler->cycles / (double)handler->calls,
+			(unsigned long long)SelfQuantile(handler, 500), (unsigned long long)SelfQuantile(handler, 990),
+			(unsigned long long)handler->max, 100.0 * (double)handler->cycles / cycles);
+		if(h == SELF_SWITCH)
+			fprintf(out, ", %llu with a test process", (unsigned long long)self->matched);
+		fprintf(out, "\n");
+	}
+}
+
+void OverheadWriteCsv(FILE *out, const SELF_STATS *self){
+	UINT64 low, width;
+	UINT32 h, i;
+
+	fprintf(out, "handler,low,high,calls\r\n");
+	for(h = 0; h < SELF_HANDLERS; h++){
+		for(i = 0; i < SELF_BUCKETS; i++){
+			if(self->handler[h].buckets[i] == 0)
+				continue;
+			SelfBucketRange(i, &low, &width);
+			//the last bucket holds everything from its low end on
+			fprintf(out, "%s,%llu,%llu,%llu\r\n", handlerNames[h], (unsigned long long)low,
+				(unsigned long long)(i == SELF_BUCKETS - 1 ? self->handler[h].max : low + width - 1),
+				(unsigned long long)self->handler[h].buckets[i]);
+		}
+	}
+}
@@ -0,0 +1,24 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Report of the cost of the collector's own handlers, the self stats a run of the driver
+* keeps in its log header and returns with its status (drv/hpcself.h).
+*/
+
+#ifndef OVERHEAD_H
+#define OVERHEAD_H
+
+#include <stdio.h>
+#include "hpcself.h"
+
+//1 if the collector measured its handlers; logs of hpcrun and of older drivers have no self stats
+int OverheadMeasured(const SELF_STATS *self);
+
+//one line per handler that ran: calls, mean, median, 99th percentile and largest cost, and the share
+//of the cycles of the cpuCount CPUs it took; the labels are padded to width
+void OverheadPrint(FILE *out, const SELF_STATS *self, UINT32 cpuCount, int width);
+
+//the histograms as CSV: handler,low,high,calls, one line per bucket that holds calls of costs low..high cycles
+void OverheadWriteCsv(FILE *out, const SELF_STATS *self);
+
+#endif
@@ -0,0 +1,289 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* perf_event_open counter groups, see perfev.h.
+*/
+
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "perfev.h"
+
+//PERF_RECORD_SAMPLE with PERF_SAMPLE_IP | PERF_SAMPLE_TID | PERF_SAMPLE_TIME | PERF_SAMPLE_CPU | PERF_SAMPLE_READ
+typedef struct _PERF_SAMPLE_RECORD {
+	struct perf_event_header header;
+	UINT64 ip;
+	UINT32 pid, tid;
+	UINT64 time;
+	UINT32 cpu, res;
+	UINT64 nr;					//PERF_FORMAT_GROUP: number of values, in the order the events were opened
+	UINT64 values[HPC_NUM_COUNTERS];
+} PERF_SAMPLE_RECORD;
+
+//PERF_RECORD_MMAP of an executable mapping
+typedef struct _PERF_MMAP_RECORD {
+	struct perf_event_header header;
+	UINT32 pid, tid;
+	UINT64 addr, len, pgoff;
+	char filename[PATH_MAX];
+} PERF_MMAP_RECORD;
+
+typedef struct _PERF_LOST_RECORD {
+	struct perf_event_header header;
+	UINT64 id, lost;
+} PERF_LOST_RECORD;
+
+typedef union _PERF_RECORD {
+	struct perf_event_header header;
+	PERF_SAMPLE_RECORD sample;
+	PERF_MMAP_RECORD mmap;
+	PERF_LOST_RECORD lost;
+} PERF_RECORD;
+
+//what the fixed counters and the default events of the driver count (EVENT0-3)
+const PERF_EVENT perfHardwareEvents[HPC_NUM_COUNTERS] = {
+	{1, PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, 1, 0, "instructions"},
+	{1, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, 1, 0, "cycles"},
+	{1, PERF_TYPE_HARDWARE, PERF_COUNT_HW_REF_CPU_CYCLES, 1, 0, "ref-cycles"},
+	{1, PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS, 1, 0, "branches"},
+	{1, PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, 1, 0, "branch-misses"},
+	{1, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES, 1, 0, "cache-references"},
+	{1, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, 1, 0, "cache-misses"},
+};
+
+//fallback without a PMU; the leader is the task clock, so the sampling period is in ns
+const PERF_EVENT perfSoftwareEvents[HPC_NUM_COUNTERS] = {
+	{1, PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, 1, 1, "task-clock"},
+	{1, PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, 1, 1, "context-switches"},
+	{1, PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS, 1, 1, "cpu-migrations"},
+	{1, PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS_MIN, 1, 1, "minor-faults"},
+	{1, PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS_MAJ, 1, 1, "major-faults"},
+	{1, PERF_TYPE_SOFTWARE, PERF_COUNT_SW_ALIGNMENT_FAULTS, 1, 1, "alignment-faults"},
+	{1, PERF_TYPE_SOFTWARE, PERF_COUNT_SW_EMULATION_FAULTS, 1, 1, "emulation-faults"},
+};
+
+static int OpenEvent(struct perf_event_attr *attr, pid_t pid, int groupFd){
+	return (int)syscall(__NR_perf_event_open, attr, pid, -1, groupFd, PERF_FLAG_FD_CLOEXEC);
+}
+
+int PerfGroupOpen(PPERF_GROUP group, pid_t pid, const PERF_EVENT events[HPC_NUM_COUNTERS], UINT64 period, UINT32 flags){
+	struct perf_event_attr attr;
+	long page = sysconf(_SC_PAGESIZE);
+	int i, fd, leader = -1, err;
+
+	memset(group, 0, sizeof(*group));
+	for(i = 0; i < HPC_NUM_COUNTERS; i++)
+		group->fd[i] = -1;
+
+	for(i = 0; i < HPC_NUM_COUNTERS; i++){
+		if(!events[i].used)
+			continue;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = events[i].type;
+		attr.config = events[i].config;
+		attr.exclude_user = !events[i].user;
+		attr.exclude_kernel = !events[i].kernel;
+		attr.exclude_hv = 1;
+		attr.inherit = (flags & PERF_GROUP_INHERIT) != 0;
+		attr.read_format = PERF_FORMAT_GROUP;
+		attr.use_clockid = 1;				//the whole group must use the same clock
+		attr.clockid = CLOCK_MONOTONIC;
+		if(leader < 0){
+			attr.disabled = (flags & PERF_GROUP_ON_EXEC) != 0;
+			attr.enable_on_exec = attr.disabled;
+			if(flags & PERF_GROUP_SAMPLE){
+				attr.sample_period = period;
+				attr.sample_type = PERF_SAMPLE_IP | PERF_SAMPLE_TID | PERF_SAMPLE_TIME | PERF_SAMPLE_CPU | PERF_SAMPLE_READ;
+				attr.mmap = 1;				//the code mappings, to symbolize the instruction pointers
+				attr.watermark = 1;
+				attr.wakeup_watermark = (UINT32)(PERF_RING_PAGES * page / 4);
+			}
+		}
+
+		fd = OpenEvent(&attr, pid, leader);
+		if(fd < 0){
+			err = errno;
+			if(leader < 0)
+				return -err;
+			//the event does not exist on this PMU, leave the column empty
+			group->missing |= 1u << i;
+			continue;
+		}
+		if(leader < 0)
+			leader = fd;
+		group->fd[i] = fd;
+		group->column[group->count++] = (UINT32)i;
+	}
+	if(leader < 0)
+		return -ENOENT;
+
+	if(flags & PERF_GROUP_SAMPLE){
+		group->ringLen = (size_t)(PERF_RING_PAGES + 1) * page;
+		group->ring = mmap(NULL, group->ringLen, PROT_READ | PROT_WRITE, MAP_SHARED, leader, 0);
+		if(group->ring == MAP_FAILED){
+			err = errno;
+			group->ring = NULL;
+			PerfGroupClose(group);
+			return -err;
+		}
+	}
+	return 0;
+}
+
+void PerfGroupClose(PPERF_GROUP group){
+	int i;
+
+	if(group->ring != NULL)
+		munmap(group->ring, group->ringLen);
+	group->ring = NULL;
+	//members first, the leader is the first open column
+	for(i = HPC_NUM_COUNTERS - 1; i >= 0; i--){
+		if(group->fd[i] >= 0)
+			close(group->fd[i]);
+		group->fd[i] = -1;
+	}
+	group->count = 0;
+}
+
+static int LeaderIoctl(PPERF_GROUP group, unsigned long request){
+	if(group->count == 0)
+		return -1;
+	return ioctl(group->fd[group->column[0]], request, PERF_IOC_FLAG_GROUP);
+}
+
+int PerfGroupEnable(PPERF_GROUP group){
+	return LeaderIoctl(group, PERF_EVENT_IOC_ENABLE);
+}
+
+int PerfGroupDisable(PPERF_GROUP group){
+	return LeaderIoctl(group, PERF_EVENT_IOC_DISABLE);
+}
+
+int PerfGroupReset(PPERF_GROUP group){
+	return LeaderIoctl(group, PERF_EVENT_IOC_RESET);
+}
+
+int PerfGroupRead(PPERF_GROUP group, UINT64 ctr[HPC_NUM_COUNTERS]){
+	UINT64 buffer[1 + HPC_NUM_COUNTERS];
+	ssize_t len;
+	UINT32 i;
+
+	memset(ctr, 0, HPC_NUM_COUNTERS * sizeof(UINT64));
+	if(group->count == 0)
+		return -1;
+	len = read(group->fd[group->column[0]], buffer, sizeof(buffer));
+	if(len < (ssize_t)sizeof(UINT64) || buffer[0] != group->count)
+		return -1;
+	for(i = 0; i < group->count; i++)
+		ctr[group->column[i]] = buffer[1 + i];
+	return 0;
+}
+
+int PerfGroupNextSample(PPERF_GROUP group, PPERF_SAMPLE sample, PPERF_MAPPING mapping){
+	struct perf_event_mmap_page *meta;
+	PERF_RECORD record;
+	UINT8 *data;
+	UINT64 head, tail, size, offset, len, first;
+	UINT32 i;
+	int found = 0;
+
+	if(group->ring == NULL)
+		return 0;
+	meta = (struct perf_event_mmap_page *)group->ring;
+	data = group->ring + (meta->data_offset ? meta->data_offset : (UINT64)sysconf(_SC_PAGESIZE));
+	size = meta->data_size ? meta->data_size : (UINT64)PERF_RING_PAGES * sysconf(_SC_PAGESIZE);
+
+	//the kernel publishes data_head after writing the records before it
+	head = __atomic_load_n(&meta->data_head, __ATOMIC_ACQUIRE);
+	tail = meta->data_tail;
+	while(!found && tail < head){
+		offset = tail % size;
+		memcpy(&record.header, data + offset, sizeof(record.header));		//headers are 8-byte aligned and never wrap
+		len = record.header.size;
+		if(len < sizeof(record.header))
+			break;
+
+		//copy the record out, it may wrap around the end of the ring
+		if(len > sizeof(record))
+			len = sizeof(record);
+		first = size - offset < len ? size - offset : len;
+		memcpy(&record, data + offset, (size_t)first);
+		memcpy((UINT8 *)&record + first, data, (size_t)(len - first));
+
+		if(record.header.type == PERF_RECORD_SAMPLE && record.sample.nr <= HPC_NUM_COUNTERS){
+			sample->pid = record.sample.pid;
+			sample->tid = record.sample.tid;
+			sample->time = record.sample.time;
+			sample->cpu = record.sample.cpu;
+			sample->ip = record.sample.ip;
+			sample->cpl = (record.header.misc & PERF_RECORD_MISC_CPUMODE_MASK) == PERF_RECORD_MISC_KERNEL ? 0 : 3;
+			memset(sample->ctr, 0, sizeof(sample->ctr));
+			for(i = 0; i < record.sample.nr && i < group->count; i++)
+				sample->ctr[group->column[i]] = record.sample.values[i];
+			found = PERF_NEXT_SAMPLE;
+		}else if(record.header.type == PERF_RECORD_MMAP && len > offsetof(PERF_MMAP_RECORD, filename)){
+			mapping->pid = record.mmap.pid;
+			mapping->addr = record.mmap.addr;
+			mapping->len = record.mmap.len;
+			mapping->pgoff = record.mmap.pgoff;
+			len -= offsetof(PERF_MMAP_RECORD, filename);
+			memcpy(mapping->path, record.mmap.filename, (size_t)len);
+			mapping->path[len < sizeof(mapping->path) ? len : sizeof(mapping->path) - 1] = 0;
+			found = PERF_NEXT_MAPPING;
+		}else if(record.header.type == PERF_RECORD_LOST){
+			group->lost += record.lost.lost;
+		}
+		tail += record.header.size;
+	}
+
+	//hand the space back to the kernel once the records are copied
+	__atomic_store_n(&meta->data_tail, tail, __ATOMIC_RELEASE);
+	return found;
+}
+
+int PerfGroupPollFd(const PERF_GROUP *group){
+	return group->ring != NULL ? group->fd[group->column[0]] : -1;
+}
+
+PPERF_THREAD PerfThreadFind(PPERF_THREADS threads, UINT32 tid){
+	UINT32 i = (tid * 0x9E3779B1u) & (PERF_MAX_THREADS - 1), probes;
+
+	for(probes = 0; probes < PERF_MAX_THREADS; probes++){
+		if(!threads->thread[i].used){
+			threads->thread[i].used = 1;
+			threads->thread[i].tid = tid;
+			return &threads->thread[i];
+		}
+		if(threads->thread[i].tid == tid)
+			return &threads->thread[i];
+		i = (i + 1) & (PERF_MAX_THREADS - 1);
+	}
+	return NULL;
+}
+
+/*
+* perf reports running totals and the counters of the driver run free as well, its window being the
+* difference from the counts at the window start (cpu->base); here a window is the difference from the
+* previous totals of the same thread
+*/
+int PerfThreadWindow(PPERF_THREADS threads, const PERF_SAMPLE *sample, UINT64 ctr[HPC_NUM_COUNTERS]){
+	PPERF_THREAD prev = PerfThreadFind(threads, sample->tid);
+	UINT32 i;
+
+	if(prev == NULL){
+		threads->untracked++;
+		return -1;
+	}
+	for(i = 0; i < HPC_NUM_COUNTERS; i++){
+		ctr[i] = sample->ctr[i] - prev->ctr[i];
+		prev->ctr[i] = sample->ctr[i];
+	}
+	return 0;
+}
@@ -0,0 +1,117 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Counter groups of the Linux perf_event_open interface, the user-space counterpart
+* of the driver's fixed and programmable counters. A group holds up to
+* HPC_NUM_COUNTERS events, one per column of HPC_SAMPLE.ctr; the first event is the
+* leader and, in the sampling mode, overflows every period and writes a sample with
+* the values of the whole group into the mmap ring buffer of the leader, along with the
+* instruction pointer and the executable mappings of the task to symbolize it.
+* Linux only.
+*/
+
+#ifndef PERFEV_H
+#define PERFEV_H
+
+#include <limits.h>
+#include <sys/types.h>
+#include "hpcring.h"
+
+//PERF_GROUP_OPEN flags
+#define PERF_GROUP_SAMPLE		0x01	//the leader overflows every period and writes samples to the ring
+#define PERF_GROUP_INHERIT		0x02	//count the threads created by the task as well
+#define PERF_GROUP_ON_EXEC		0x04	//start disabled, enable at the next exec of the task
+
+//what PerfGroupNextSample read
+#define PERF_NEXT_SAMPLE		1
+#define PERF_NEXT_MAPPING		2
+
+//data pages of the ring buffer, a power of two
+#define PERF_RING_PAGES			256
+
+//threads whose totals are kept to turn the running totals of their samples into windows, a power of two
+#define PERF_MAX_THREADS		4096
+
+//one column of the group; type is a PERF_TYPE_* value
+typedef struct _PERF_EVENT {
+	int used;
+	UINT32 type;
+	UINT64 config;
+	int user;					//count in user mode
+	int kernel;					//count in kernel mode
+	const char *name;
+} PERF_EVENT, *PPERF_EVENT;
+
+typedef struct _PERF_GROUP {
+	int fd[HPC_NUM_COUNTERS];		//-1 for columns that are not counted
+	UINT32 column[HPC_NUM_COUNTERS];	//column of the n-th value of a group read
+	UINT32 count;					//events opened
+	UINT32 missing;					//bit mask of the used columns the kernel refused
+	UINT8 *ring;					//metadata page followed by the data pages, NULL when not sampling
+	size_t ringLen;
+	UINT64 lost;					//samples the kernel dropped because the ring was full
+} PERF_GROUP, *PPERF_GROUP;
+
+//a sample read from the ring; ctr holds the running totals of the thread, time is CLOCK_MONOTONIC in ns
+typedef struct _PERF_SAMPLE {
+	UINT32 pid;
+	UINT32 tid;
+	UINT64 time;
+	UINT32 cpu;
+	UINT64 ip;
+	UINT32 cpl;						//0 if the ip is in the kernel, 3 in user mode
+	UINT64 ctr[HPC_NUM_COUNTERS];
+} PERF_SAMPLE, *PPERF_SAMPLE;
+
+//totals of the previous sample of a thread
+typedef struct _PERF_THREAD {
+	UINT32 used;
+	UINT32 tid;
+	UINT64 ctr[HPC_NUM_COUNTERS];
+} PERF_THREAD, *PPERF_THREAD;
+
+//open-addressed table of the threads of a group, zeroed before use
+typedef struct _PERF_THREADS {
+	PERF_THREAD thread[PERF_MAX_THREADS];
+	UINT64 untracked;				//samples dropped because the table had no room for their thread
+} PERF_THREADS, *PPERF_THREADS;
+
+//an executable file mapped by the task, PERF_RECORD_MMAP
+typedef struct _PERF_MAPPING {
+	UINT32 pid;
+	UINT64 addr;
+	UINT64 len;
+	UINT64 pgoff;					//file offset of addr
+	char path[PATH_MAX];
+} PERF_MAPPING, *PPERF_MAPPING;
+
+//what the fixed counters and the default events of the driver count, and the software
+//events counted instead on machines without a PMU (the leader is the task clock, in ns)
+extern const PERF_EVENT perfHardwareEvents[HPC_NUM_COUNTERS];
+extern const PERF_EVENT perfSoftwareEvents[HPC_NUM_COUNTERS];
+
+//returns 0 on success or -errno of the leader; members the kernel does not support are left out
+int PerfGroupOpen(PPERF_GROUP group, pid_t pid, const PERF_EVENT events[HPC_NUM_COUNTERS], UINT64 period, UINT32 flags);
+void PerfGroupClose(PPERF_GROUP group);
+
+int PerfGroupEnable(PPERF_GROUP group);
+int PerfGroupDisable(PPERF_GROUP group);
+int PerfGroupReset(PPERF_GROUP group);
+
+//totals of all columns, 0 for columns that are not counted; returns 0 on success
+int PerfGroupRead(PPERF_GROUP group, UINT64 ctr[HPC_NUM_COUNTERS]);
+
+//returns PERF_NEXT_SAMPLE or PERF_NEXT_MAPPING for the record read from the ring, 0 if the ring is empty
+int PerfGroupNextSample(PPERF_GROUP group, PPERF_SAMPLE sample, PPERF_MAPPING mapping);
+
+//fd to poll for ring data, -1 if there is no ring
+int PerfGroupPollFd(const PERF_GROUP *group);
+
+//previous totals of a thread, zero the first time it is seen; NULL if the table is full
+PPERF_THREAD PerfThreadFind(PPERF_THREADS threads, UINT32 tid);
+
+//counts of a sample since the previous sample of its thread; returns -1 and counts the
+//sample as untracked if the table is full, since its totals are not the counts of a window
+int PerfThreadWindow(PPERF_THREADS threads, const PERF_SAMPLE *sample, UINT64 ctr[HPC_NUM_COUNTERS]);
+
+#endif
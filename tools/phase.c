@@ -0,0 +1,471 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Incremental phase detection, see phase.h.
+*/
+
+#include <math.h>
+#include <string.h>
+#include "phase.h"
+
+//smallest standard deviation of a feature: relative to its mean, and absolute
+#define PHASE_MIN_SD		0.01
+#define PHASE_MIN_SD_ABS	1e-3
+
+//part of a feature over the stream added to the scale of the distance to a cluster
+#define PHASE_FLOOR			0.05
+
+int PhaseFeatures(const UINT64 *ctr, UINT64 rows, UINT32 columns, double *feature){
+	int c;
+
+	if(rows == 0 || ctr[0] == 0)
+		return 0;
+	feature[0] = (double)ctr[0] / (double)rows;
+	for(c = 1; c < PHASE_FEATURES; c++)
+		feature[c] = (columns & (1u << c)) ? 1000.0 * (double)ctr[c] / (double)ctr[0] : 0;
+	return 1;
+}
+
+static void SegmentReset(PPHASE_SEGMENT seg, UINT64 seq){
+	memset(seg, 0, sizeof(*seg));
+	seg->firstSeq = seq;
+	seg->stride = 1;
+}
+
+/*
+* Add (sign 1) or remove (sign -1) a frame; removed frames are the last ones of the segment
+*/
+static void SegmentUpdate(const PHASE_DETECTOR *det, PPHASE_SEGMENT seg, const PHASE_FRAME *frame, UINT64 seq, int sign){
+	double feature[PHASE_FEATURES], previous[PHASE_FEATURES], d;
+	const PHASE_FRAME *before = &det->history[(seq - 1) & (PHASE_HISTORY - 1)];
+	UINT32 i, kept, columns = det->options.columns;
+	int c, lag;
+
+	if(seg->frames == 0)
+		seg->first = frame->first;
+	seg->frames += sign;
+	seg->rows += sign * frame->rows;
+	for(c = 0; c < HPC_NUM_COUNTERS; c++)
+		seg->ctr[c] += sign * frame->ctr[c];
+	if(PhaseFeatures(frame->ctr, frame->rows, columns, feature)){
+		if(seg->valid == 0)
+			memcpy(seg->ref, feature, sizeof(feature));
+		seg->valid += sign;
+		//the frame before is still in the history
+		lag = seq > seg->firstSeq && PhaseFeatures(before->ctr, before->rows, columns, previous);
+		seg->lags += lag ? sign : 0;
+		for(c = 0; c < PHASE_FEATURES; c++){
+			d = feature[c] - seg->ref[c];
+			seg->sum[c] += sign * d;
+			seg->sum2[c] += sign * d * d;
+			if(lag)
+				seg->lag[c] += sign * d * (previous[c] - seg->ref[c]);
+		}
+	}
+
+	if(sign < 0){
+		//the candidates are in frame order, a removed frame is the last one if it is one
+		if(seg->candidates != 0 && seg->candidate[seg->candidates - 1].seq == seq)
+			seg->candidates--;
+		return;
+	}
+	//every stride-th frame is a candidate; when they run out of room, every other one is dropped
+	if((seq - seg->firstSeq) % seg->stride != 0)
+		return;
+	if(seg->candidates == PHASE_CANDIDATES){
+		seg->stride *= 2;
+		for(i = 0, kept = 0; i < seg->candidates; i++){
+			if((seg->candidate[i].seq - seg->firstSeq) % seg->stride == 0)
+				seg->candidate[kept++] = seg->candidate[i];
+		}
+		seg->candidates = kept;
+		if((seq - seg->firstSeq) % seg->stride != 0)
+			return;
+	}
+	seg->candidate[seg->candidates].seq = seq;
+	seg->candidate[seg->candidates].frame = *frame;
+	seg->candidates++;
+}
+
+/*
+* Largest distance of two feature vectors over the features of the samples, each relative
+* to the size of the feature plus a floor taken from the whole stream
+*/
+static double Distance(const double *a, const double *b, const double *stream, UINT32 columns){
+	double d, scale, max = 0;
+	int c;
+
+	for(c = 0; c < PHASE_FEATURES; c++){
+		if(!(columns & (1u << c)))
+			continue;
+		scale = 0.5 * (fabs(a[c]) + fabs(b[c])) + PHASE_FLOOR * fabs(stream[c]);
+		if(scale == 0)
+			continue;
+		d = fabs(a[c] - b[c]) / scale;
+		if(d > max)
+			max = d;
+	}
+	return max;
+}
+
+static UINT32 AssignCluster(PPHASE_DETECTOR det, const double *feature, UINT64 rows, const double *stream){
+	PHASE_CLUSTER *cluster;
+	double d, best = 0;
+	UINT32 i, nearest = 0;
+	int c;
+
+	for(i = 0; i < det->clusterCount; i++){
+		d = Distance(feature, det->clusters[i].feature, stream, det->options.columns);
+		if(i == 0 || d < best){
+			best = d;
+			nearest = i;
+		}
+	}
+	if(det->clusterCount == 0 || (best > det->options.radius && det->clusterCount < PHASE_MAX_CLUSTERS)){
+		cluster = &det->clusters[det->clusterCount];
+		memcpy(cluster->feature, feature, sizeof(cluster->feature));
+		cluster->rows = rows;
+		return det->clusterCount++;
+	}
+	cluster = &det->clusters[nearest];
+	for(c = 0; c < PHASE_FEATURES; c++)
+		cluster->feature[c] += (feature[c] - cluster->feature[c]) * (double)rows / (double)(cluster->rows + rows);
+	cluster->rows += rows;
+	return nearest;
+}
+
+/*
+* Close the segment: it joins the phase before it if it falls into the same cluster,
+* else it starts a new phase and the one before is completed
+*/
+static int CloseSegment(PPHASE_DETECTOR det, const PHASE_SEGMENT *seg, PPHASE completed){
+	double feature[PHASE_FEATURES], stream[PHASE_FEATURES], candidate[PHASE_FEATURES], d, best = 0;
+	const PHASE_FRAME *representative = NULL;
+	PPHASE phase = &det->phase;
+	UINT32 cluster, i;
+	int c, done = 0;
+
+	if(!PhaseFeatures(det->ctr, det->rows, det->options.columns, stream))
+		memset(stream, 0, sizeof(stream));
+	if(PhaseFeatures(seg->ctr, seg->rows, det->options.columns, feature)){
+		cluster = AssignCluster(det, feature, seg->rows, stream);
+		for(i = 0; i < seg->candidates; i++){
+			const PHASE_FRAME *frame = &seg->candidate[i].frame;
+
+			if(!PhaseFeatures(frame->ctr, frame->rows, det->options.columns, candidate))
+				continue;
+			d = Distance(candidate, feature, stream, det->options.columns);
+			if(representative == NULL || d < best){
+				best = d;
+				representative = frame;
+			}
+		}
+	}else
+		//a segment without instructions has no features, it stays with the phase before
+		cluster = det->open ? phase->cluster : AssignCluster(det, stream, seg->rows, stream);
+	if(representative == NULL && seg->candidates != 0)
+		representative = &seg->candidate[0].frame;
+
+	if(det->open && phase->cluster != cluster){
+		*completed = *phase;
+		det->open = 0;
+		done = 1;
+	}
+	if(!det->open){
+		memset(phase, 0, sizeof(*phase));
+		phase->index = det->phases++;
+		phase->cluster = cluster;
+		phase->first = seg->first;
+		det->open = 1;
+	}
+	phase->rows += seg->rows;
+	phase->frames += seg->frames;
+	for(c = 0; c < HPC_NUM_COUNTERS; c++)
+		phase->ctr[c] += seg->ctr[c];
+	if(representative != NULL && seg->frames > phase->representativeFrames){
+		phase->representative = *representative;
+		phase->representativeFrames = seg->frames;
+	}
+	return done;
+}
+
+void PhaseInit(PPHASE_DETECTOR det, const PHASE_OPTIONS *options){
+	memset(det, 0, sizeof(*det));
+	det->options = *options;
+	//instructions are the base of the other features
+	det->options.columns |= 1;
+	if(det->options.warmup < 2)
+		det->options.warmup = 2;
+	SegmentReset(&det->segment, 0);
+}
+
+/*
+* Mean and standard deviation of every feature over the frames of the current segment
+*/
+static void Moments(const PHASE_DETECTOR *det, double *mean, double *sd){
+	const PHASE_SEGMENT *seg = &det->segment;
+	double n = (double)seg->valid, v, m, r;
+	int c;
+
+	for(c = 0; c < PHASE_FEATURES; c++){
+		m = seg->sum[c] / n;
+		mean[c] = seg->ref[c] + m;
+		v = (seg->sum2[c] - seg->sum[c] * m) / (n - 1);
+		sd[c] = v > 0 ? sqrt(v) : 0;
+		//neighboring frames are correlated, a sum of z drifts by the long-run deviation
+		if(v > 0 && seg->lags > 1){
+			r = (seg->lag[c] / (double)seg->lags - m * m) / v;
+			r = r < 0 ? 0 : r > 0.9 ? 0.9 : r;
+			sd[c] *= sqrt((1 + r) / (1 - r));
+		}
+		if(sd[c] < PHASE_MIN_SD * fabs(mean[c]))
+			sd[c] = PHASE_MIN_SD * fabs(mean[c]);
+		if(sd[c] < PHASE_MIN_SD_ABS)
+			sd[c] = PHASE_MIN_SD_ABS;
+	}
+}
+
+/*
+* Test the features of a frame against the current segment; returns 1 and the earliest
+* frame a sum that crossed the threshold started at, 0 if none crossed it
+*/
+static int Test(PPHASE_DETECTOR det, const double *feature, const double *mean, const double *sd, UINT64 seq, UINT64 *start){
+	double z, p;
+	int c, found = 0;
+
+	for(c = 0; c < PHASE_FEATURES; c++){
+		if(!(det->options.columns & (1u << c)))
+			continue;
+		z = (feature[c] - mean[c]) / sd[c];
+
+		//a sum that leaves 0 starts at this frame
+		p = det->pos[c] + z - det->options.drift;
+		if(p <= 0)
+			det->pos[c] = 0;
+		else{
+			if(det->pos[c] == 0)
+				det->posStart[c] = seq;
+			det->pos[c] = p;
+		}
+		p = det->neg[c] - z - det->options.drift;
+		if(p <= 0)
+			det->neg[c] = 0;
+		else{
+			if(det->neg[c] == 0)
+				det->negStart[c] = seq;
+			det->neg[c] = p;
+		}
+
+		if(det->pos[c] > det->options.threshold && (!found || det->posStart[c] < *start)){
+			*start = det->posStart[c];
+			found = 1;
+		}
+		if(det->neg[c] > det->options.threshold && (!found || det->negStart[c] < *start)){
+			*start = det->negStart[c];
+			found = 1;
+		}
+	}
+	return found;
+}
+
+/*
+* The change point between start and the frame seq. A sum can start a few frames early by
+* chance, so the point is the one that splits the segment and the frames after it into
+* the two parts whose means differ most, the most likely place of a shift of the mean:
+*	k = argmax  nb na / (nb + na) |mean before k - mean from k|^2, in standard deviations
+* It lies within the history, after the first frame of the segment.
+*/
+static UINT64 ChangePoint(const PHASE_DETECTOR *det, const double *feature, const double *sd, UINT64 seq, UINT64 start){
+	const PHASE_SEGMENT *seg = &det->segment;
+	double after[PHASE_FEATURES], f[PHASE_FEATURES], nb, na, d, score, best = -1;
+	const PHASE_FRAME *frame;
+	UINT64 k, change = seq, frames = 0;
+	int c;
+
+	//the sums may start well before the change
+	start = start > det->options.warmup ? start - det->options.warmup : 0;
+	if(start + PHASE_HISTORY <= seq)
+		start = seq - PHASE_HISTORY + 1;
+	if(start <= seg->firstSeq)
+		start = seg->firstSeq + 1;
+	memset(after, 0, sizeof(after));
+	for(k = seq + 1; k-- > start; ){
+		if(k == seq)
+			memcpy(f, feature, sizeof(f));
+		else{
+			frame = &det->history[k & (PHASE_HISTORY - 1)];
+			if(!PhaseFeatures(frame->ctr, frame->rows, det->options.columns, f))
+				continue;
+		}
+		frames++;
+		//the frames before k are those of the segment less the ones from k on, the frame seq is not in it
+		na = (double)frames;
+		nb = (double)(seg->valid - (frames - 1));
+		if(nb < 1)
+			break;
+		score = 0;
+		for(c = 0; c < PHASE_FEATURES; c++){
+			if(!(det->options.columns & (1u << c)))
+				continue;
+			after[c] += f[c] - seg->ref[c];
+			d = ((seg->sum[c] - (after[c] - (feature[c] - seg->ref[c]))) / nb - after[c] / na) / sd[c];
+			score += d * d;
+		}
+		score *= nb * na / (nb + na);
+		if(score > best){
+			best = score;
+			change = k;
+		}
+	}
+	return change;
+}
+
+/*
+* A false alarm shortly before a change leaves the start of the next phase in a segment
+* that is not tested until it has warmup frames. Once it has, it is split at its most likely
+* change point if the two parts differ by more than threshold^2 per feature: the sum over
+* the features of the squared t statistics of their means, against the variance within
+* the parts. The split is tested late, so it takes a clear shift.
+* Returns 1 and the change point if it is split.
+*/
+static int Recheck(const PHASE_DETECTOR *det, UINT64 *change){
+	const PHASE_SEGMENT *seg = &det->segment;
+	double after[PHASE_FEATURES], f[PHASE_FEATURES], nb, na, n = (double)seg->valid, d, between, within, score, best = -1;
+	const PHASE_FRAME *frame;
+	UINT64 k, frames = 0;
+	int c, features = 0;
+
+	if(seg->frames > PHASE_HISTORY)
+		return 0;
+	memset(after, 0, sizeof(after));
+	for(k = det->seq; k-- > seg->firstSeq + 1; ){
+		frame = &det->history[k & (PHASE_HISTORY - 1)];
+		if(!PhaseFeatures(frame->ctr, frame->rows, det->options.columns, f))
+			continue;
+		frames++;
+		na = (double)frames;
+		nb = n - na;
+		if(nb < 2)
+			break;
+		score = 0;
+		for(c = 0; c < PHASE_FEATURES; c++){
+			if(!(det->options.columns & (1u << c)))
+				continue;
+			after[c] += f[c] - seg->ref[c];
+			d = (seg->sum[c] - after[c]) / nb - after[c] / na;
+			between = d * d * nb * na / n;
+			within = (seg->sum2[c] - seg->sum[c] * seg->sum[c] / n - between) / (n - 2);
+			if(within < PHASE_MIN_SD_ABS * PHASE_MIN_SD_ABS)
+				within = PHASE_MIN_SD_ABS * PHASE_MIN_SD_ABS;
+			score += between / within;
+		}
+		if(na >= 2 && score > best){
+			best = score;
+			*change = k;
+		}
+	}
+	for(c = 0; c < PHASE_FEATURES; c++)
+		features += (det->options.columns >> c) & 1;
+	return best > det->options.threshold * det->options.threshold * features;
+}
+
+/*
+* Move the frames of the segment from change to end into the next segment and close it
+*/
+static int Split(PPHASE_DETECTOR det, UINT64 change, UINT64 end, PPHASE completed){
+	PHASE_SEGMENT next;
+	double mean[PHASE_FEATURES];
+	UINT64 s;
+
+	SegmentReset(&next, change);
+	for(s = change; s < end; s++){
+		SegmentUpdate(det, &det->segment, &det->history[s & (PHASE_HISTORY - 1)], s, -1);
+		SegmentUpdate(det, &next, &det->history[s & (PHASE_HISTORY - 1)], s, 1);
+	}
+	//the noise of a segment that was tested is the scale of the next recheck
+	if(det->segment.valid >= det->options.warmup){
+		Moments(det, mean, det->scale);
+		det->scaled = 1;
+	}
+	next.checked = !det->scaled;
+	memset(det->pos, 0, sizeof(det->pos));
+	memset(det->neg, 0, sizeof(det->neg));
+	s = CloseSegment(det, &det->segment, completed);
+	det->segment = next;
+	return (int)s;
+}
+
+int PhaseAdd(PPHASE_DETECTOR det, const PHASE_FRAME *frame, PPHASE completed){
+	double feature[PHASE_FEATURES], mean[PHASE_FEATURES], sd[PHASE_FEATURES];
+	UINT64 seq = det->seq, start = seq, change = seq;
+	int c, done = 0;
+
+	det->rows += frame->rows;
+	for(c = 0; c < HPC_NUM_COUNTERS; c++)
+		det->ctr[c] += frame->ctr[c];
+
+	if(det->segment.valid >= det->options.warmup && PhaseFeatures(frame->ctr, frame->rows, det->options.columns, feature)){
+		Moments(det, mean, sd);
+		if(Test(det, feature, mean, sd, seq, &start))
+			//the frames from the change on start the next segment
+			done = Split(det, ChangePoint(det, feature, sd, seq, start), seq, completed);
+	}
+	det->history[seq & (PHASE_HISTORY - 1)] = *frame;
+	SegmentUpdate(det, &det->segment, frame, seq, 1);
+	det->seq++;
+
+	//a phase completed above is returned first, the recheck waits for the next frame
+	if(!done && !det->segment.checked && det->segment.valid >= det->options.warmup){
+		det->segment.checked = 1;
+		if(Recheck(det, &change))
+			done = Split(det, change, det->seq, completed);
+	}
+	return done;
+}
+
+int PhaseFinish(PPHASE_DETECTOR det, PPHASE last){
+	int done = 0;
+
+	//closing the segment may complete the phase before it, the next call returns the last one
+	if(det->segment.frames != 0){
+		done = CloseSegment(det, &det->segment, last);
+		SegmentReset(&det->segment, det->seq);
+		if(done)
+			return 1;
+	}
+	if(!det->open)
+		return 0;
+	*last = det->phase;
+	det->open = 0;
+	return 1;
+}
+
+int PhaseDominant(const PHASE_DETECTOR *det, const PHASE *phase, int *feature, double *ratio, int max){
+	double stream[PHASE_FEATURES], value[PHASE_FEATURES], r[PHASE_FEATURES];
+	int order[PHASE_FEATURES], c, i, j, k, n = 0;
+
+	if(!PhaseFeatures(det->ctr, det->rows, det->options.columns, stream) ||
+		!PhaseFeatures(phase->ctr, phase->rows, det->options.columns, value))
+		return 0;
+	//changes below 5% do not count
+	for(c = 0; c < PHASE_FEATURES; c++){
+		if(!(det->options.columns & (1u << c)) || stream[c] == 0)
+			continue;
+		r[c] = value[c] / stream[c];
+		if(r[c] <= 1 / 1.05 || r[c] >= 1.05)
+			order[n++] = c;
+	}
+	//the largest log ratios first
+	for(i = 0; i < n && i < max; i++){
+		for(j = i + 1; j < n; j++){
+			if(fabs(log(r[order[j]] + 1e-9)) > fabs(log(r[order[i]] + 1e-9))){
+				k = order[i];
+				order[i] = order[j];
+				order[j] = k;
+			}
+		}
+		feature[i] = order[i];
+		ratio[i] = r[order[i]];
+	}
+	return i;
+}
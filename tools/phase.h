@@ -0,0 +1,126 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Incremental detection of program phases in a stream of sample windows.
+* Samples are summed into frames of consecutive samples, and every frame becomes a vector
+* of features: the instructions per sample, and every other counter per 1000 instructions.
+* A two-sided CUSUM per feature, in standard deviations of the frames of the current
+* segment, finds the frame where the stream leaves the segment:
+*	S+ = max(0, S+ + z - drift),  S- = max(0, S- - z - drift),  change when S > threshold
+* Neighboring frames are correlated, so the deviation is the long-run one, widened by the
+* lag-1 autocorrelation of the segment. The change point is the frame, from a little before
+* the sum that crossed the threshold last left 0, that splits the frames into the two parts
+* whose means differ most. The frames after it move into the next segment, which is not
+* tested until it has warmup frames; then it is split once more if it still holds a clear
+* shift, the start of a phase that followed a false alarm. A closed segment joins the
+* nearest cluster of the segments before it if all of its features lie within radius of
+* the cluster's (relative to their size, plus a floor of 5% of the feature over the whole
+* stream), else it opens a new cluster. Segments of the same cluster that follow each
+* other make up a phase.
+*
+* Every step only looks at the current segment and the last PHASE_HISTORY frames, so the
+* detector keeps up with a live stream in constant memory; the parsing of files into
+* frames is what runs in parallel (csvscan.h).
+*/
+
+#ifndef PHASE_H
+#define PHASE_H
+
+#include "hpcring.h"
+
+#define PHASE_FEATURES		HPC_NUM_COUNTERS
+#define PHASE_HISTORY		256		//frames a change point can lie back, a power of two
+#define PHASE_CANDIDATES	32		//frames of a segment kept as its representative
+#define PHASE_MAX_CLUSTERS	64		//a segment joins the nearest cluster once there are this many
+
+typedef struct _PHASE_OPTIONS {
+	UINT32 columns;					//counters the samples have, must include instructions
+	double drift;					//CUSUM drift in standard deviations (0.5)
+	double threshold;				//CUSUM threshold in standard deviations (8)
+	UINT32 warmup;					//frames of a segment before it is tested (16)
+	double radius;					//relative distance of a segment to its cluster (0.1)
+} PHASE_OPTIONS, *PPHASE_OPTIONS;
+
+//consecutive samples summed
+typedef struct _PHASE_FRAME {
+	UINT64 first;					//number of the first sample in the stream
+	UINT64 rows;
+	UINT64 ctr[HPC_NUM_COUNTERS];
+} PHASE_FRAME, *PPHASE_FRAME;
+
+typedef struct _PHASE {
+	UINT32 index;
+	UINT32 cluster;
+	UINT64 first;					//first sample
+	UINT64 rows;					//samples
+	UINT64 frames;
+	UINT64 ctr[HPC_NUM_COUNTERS];	//counter sums
+	PHASE_FRAME representative;		//frame nearest the mean of the longest segment of the phase
+	UINT64 representativeFrames;	//frames of that segment
+} PHASE, *PPHASE;
+
+typedef struct _PHASE_CANDIDATE {
+	UINT64 seq;
+	PHASE_FRAME frame;
+} PHASE_CANDIDATE;
+
+//frames of the current segment
+typedef struct _PHASE_SEGMENT {
+	UINT64 firstSeq;				//frame number of the first frame
+	UINT64 frames;
+	UINT64 valid;					//frames with instructions, in the moments
+	UINT64 rows;
+	UINT64 first;
+	UINT64 ctr[HPC_NUM_COUNTERS];
+	double ref[PHASE_FEATURES];		//features of the first valid frame, the moments are taken around them
+	double sum[PHASE_FEATURES];
+	double sum2[PHASE_FEATURES];
+	double lag[PHASE_FEATURES];		//sum of the products of the features of neighboring frames
+	UINT64 lags;					//neighboring frames that both have instructions
+	PHASE_CANDIDATE candidate[PHASE_CANDIDATES];
+	UINT32 candidates;
+	UINT64 stride;					//every stride-th frame is a candidate
+	int checked;					//the segment had its recheck
+} PHASE_SEGMENT, *PPHASE_SEGMENT;
+
+typedef struct _PHASE_CLUSTER {
+	double feature[PHASE_FEATURES];	//sample-weighted mean of its segments
+	UINT64 rows;
+} PHASE_CLUSTER;
+
+typedef struct _PHASE_DETECTOR {
+	PHASE_OPTIONS options;
+	UINT64 seq;						//frames added
+	PHASE_FRAME history[PHASE_HISTORY];
+	PHASE_SEGMENT segment;
+	double pos[PHASE_FEATURES], neg[PHASE_FEATURES];
+	UINT64 posStart[PHASE_FEATURES], negStart[PHASE_FEATURES];
+	double scale[PHASE_FEATURES];	//standard deviations of the last segment that was tested
+	int scaled;
+	PHASE_CLUSTER clusters[PHASE_MAX_CLUSTERS];
+	UINT32 clusterCount;
+	PHASE phase;					//the phase of the segments closed last
+	int open;						//phase holds segments
+	UINT32 phases;					//phases completed
+	UINT64 rows;					//samples and counters of the whole stream
+	UINT64 ctr[HPC_NUM_COUNTERS];
+} PHASE_DETECTOR, *PPHASE_DETECTOR;
+
+void PhaseInit(PPHASE_DETECTOR det, const PHASE_OPTIONS *options);
+
+//add the next frame; returns 1 and the phase it completed, else 0
+int PhaseAdd(PPHASE_DETECTOR det, const PHASE_FRAME *frame, PPHASE completed);
+
+//close the stream; call until it returns 0, each call returns 1 and one of its last phases
+int PhaseFinish(PPHASE_DETECTOR det, PPHASE last);
+
+//features of summed counters; returns 0 if they have no instructions
+int PhaseFeatures(const UINT64 *ctr, UINT64 rows, UINT32 columns, double *feature);
+
+/*
+* The count features of a phase that differ most from the whole stream, by their ratio
+* to it; returns how many were found, at most max
+*/
+int PhaseDominant(const PHASE_DETECTOR *det, const PHASE *phase, int *feature, double *ratio, int max);
+
+#endif
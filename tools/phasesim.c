@@ -0,0 +1,163 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Checks the phase detector (phase.c) on synthetic streams with known phases. A stream
+* cycles at random through a few behaviors, each with its own CPI and event rates per
+* 1000 instructions, for a random number of frames each; the counts of every frame are
+* drawn around the rates of its behavior with autocorrelated noise. Every boundary of the
+* stream must be found within a few frames, no other boundary may be reported, and
+* phases of the same behavior must fall into the same cluster, phases of different
+* behaviors into different ones. It also reports the frames the detector takes per second.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "phase.h"
+
+#define BEHAVIORS		4
+#define MAX_PHASES		4096
+#define FRAME_ROWS		100
+#define PERIOD			50000
+
+//CPI in thousandths, then events 1-4 per 1000 instructions
+static const double behaviors[BEHAVIORS][5] = {
+	{ 700, 200, 2.0, 15, 1.0 },			//compute
+	{ 2500, 150, 1.5, 60, 25 },			//memory bound
+	{ 1400, 220, 12.0, 20, 2.0 },		//branchy
+	{ 900, 180, 2.5, 35, 6.0 },			//mixed
+};
+
+static UINT64 rngState;
+
+static double Uniform(){
+	rngState = rngState * 6364136223846793005ULL + 1442695040888963407ULL;
+	return ((double)(rngState >> 11) + 0.5) / 9007199254740992.0;
+}
+
+static double Gaussian(){
+	return sqrt(-2 * log(Uniform())) * cos(6.283185307179586 * Uniform());
+}
+
+//the true phases of the stream
+static UINT32 label[MAX_PHASES];
+static UINT64 start[MAX_PHASES];
+
+//the phases found
+static PHASE found[MAX_PHASES];
+static UINT32 foundCount;
+
+static void Found(const PHASE *phase){
+	if(foundCount < MAX_PHASES)
+		found[foundCount++] = *phase;
+}
+
+int main(int argc, char *argv[]){
+	static PHASE_DETECTOR det;
+	PHASE_OPTIONS options;
+	PHASE_FRAME frame;
+	PHASE phase;
+	UINT32 phases = 40, minFrames = 100, maxFrames = 2000, p, b, i, tolerance = 3;
+	UINT32 clusterOf[BEHAVIORS], behaviorOf[PHASE_MAX_CLUSTERS];
+	UINT64 frames = 0, f, length, seed = 1;
+	double noise = 0.03, ar = 0, rate, maxError = 0, seconds;
+	struct timespec t0, t1;
+	int c, errors = 0;
+
+	for(c = 1; c < argc; c++){
+		if(strcmp(argv[c], "-n") == 0 && c + 1 < argc)
+			phases = (UINT32)atoi(argv[++c]);
+		else if(strcmp(argv[c], "-r") == 0 && c + 1 < argc)
+			noise = atof(argv[++c]);
+		else if(strcmp(argv[c], "-f") == 0 && c + 1 < argc)
+			maxFrames = (UINT32)atoi(argv[++c]);
+		else if(strcmp(argv[c], "-s") == 0 && c + 1 < argc)
+			seed = strtoull(argv[++c], NULL, 0);
+		else{
+			fprintf(stderr, "usage: %s [-n phases] [-f max frames per phase] [-r noise] [-s seed]\n", argv[0]);
+			fprintf(stderr, "  phases of %d to -f frames (default 2000) of %d samples, noise of the counts relative to their mean (0.03)\n", minFrames, FRAME_ROWS);
+			return 2;
+		}
+	}
+	if(phases < 1 || phases > MAX_PHASES || maxFrames < minFrames || noise < 0 || noise > 0.2){
+		fprintf(stderr, "bad parameters\n");
+		return 2;
+	}
+	rngState = seed;
+
+	memset(&options, 0, sizeof(options));
+	options.columns = 0x7F;
+	options.drift = 0.5;
+	options.threshold = 8;
+	options.warmup = 16;
+	options.radius = 0.1;
+	PhaseInit(&det, &options);
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for(p = 0; p < phases; p++){
+		//a behavior other than the one before
+		do
+			label[p] = (UINT32)(Uniform() * BEHAVIORS);
+		while(p != 0 && label[p] == label[p - 1]);
+		start[p] = frames * FRAME_ROWS;
+		length = minFrames + (UINT64)(Uniform() * (maxFrames - minFrames));
+		for(f = 0; f < length; f++, frames++){
+			memset(&frame, 0, sizeof(frame));
+			frame.first = frames * FRAME_ROWS;
+			frame.rows = FRAME_ROWS;
+			frame.ctr[0] = (UINT64)PERIOD * FRAME_ROWS;
+			ar = 0.7 * ar + sqrt(1 - 0.49) * Gaussian();
+			for(c = 0; c < 5; c++){
+				rate = behaviors[label[p]][c] * (1 + noise * (c == 0 ? ar : Gaussian()));
+				frame.ctr[c == 0 ? 1 : 2 + c] = (UINT64)(rate * PERIOD * FRAME_ROWS / 1000 + 0.5);
+			}
+			frame.ctr[2] = frame.ctr[1];
+			if(PhaseAdd(&det, &frame, &phase))
+				Found(&phase);
+		}
+	}
+	while(PhaseFinish(&det, &phase))
+		Found(&phase);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	seconds = (double)(t1.tv_sec - t0.tv_sec) + (double)(t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+	//the boundaries, matched in order
+	if(foundCount != phases){
+		printf("%u phases found, %u in the stream\n", foundCount, phases);
+		errors++;
+	}
+	for(p = 0; p < phases && p < foundCount; p++){
+		double error = fabs((double)found[p].first - (double)start[p]) / FRAME_ROWS;
+
+		if(error > maxError)
+			maxError = error;
+		if(error > tolerance){
+			printf("phase %u starts at frame %llu, found at %llu\n", p, (unsigned long long)(start[p] / FRAME_ROWS),
+				(unsigned long long)(found[p].first / FRAME_ROWS));
+			errors++;
+		}
+	}
+	//one cluster per behavior
+	for(b = 0; b < BEHAVIORS; b++)
+		clusterOf[b] = ~0u;
+	for(i = 0; i < PHASE_MAX_CLUSTERS; i++)
+		behaviorOf[i] = ~0u;
+	for(p = 0; p < phases && p < foundCount; p++){
+		if(clusterOf[label[p]] == ~0u)
+			clusterOf[label[p]] = found[p].cluster;
+		if(behaviorOf[found[p].cluster] == ~0u)
+			behaviorOf[found[p].cluster] = label[p];
+		if(clusterOf[label[p]] != found[p].cluster || behaviorOf[found[p].cluster] != label[p]){
+			printf("phase %u of behavior %u is in cluster %u\n", p, label[p], found[p].cluster);
+			errors++;
+		}
+	}
+
+	printf("%u phases, %llu frames of %d samples, noise %.3f\n", phases, (unsigned long long)frames, FRAME_ROWS, noise);
+	printf("  found %u phases in %u clusters, boundaries off by up to %.0f frames\n", foundCount, det.clusterCount, maxError);
+	printf("  %.1f M frames/s\n", (double)frames / seconds / 1e6);
+	printf("  check: %s\n", errors == 0 ? "ok" : "FAILED");
+	return errors == 0 ? 0 : 1;
+}
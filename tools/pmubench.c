@@ -0,0 +1,578 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Benchmark and check of the PMI and trap handlers of the driver (drv/hpcpmu.c),
+* driven through millions of interrupts of the simulated PMU in simpmu.c.
+* The check runs the handlers against the modeled workload and verifies that
+* the samples add up to the events the PMU counted, that every sampling window
+* is one period plus the skid (exactly one period with -f, freeze on PMI), that
+* every PMI leaves GLOBAL_STATUS clear and that the handlers time themselves
+* (drv/hpcself.h) to the modeled cycles. In the sampling mode it also calibrates the
+* windows like hpccal, with a polling run as the reference, and checks that the skid
+* and the overhead of a PMI (-o) come out as modeled.
+* The benchmark reports the cost of a handler in ns of this host, i.e. of the
+* counter logic and the PMU_OPS calls, measured against a loop that only
+* re-arms the simulated counter (the fastest of interleaved runs of both, never
+* below 0), and in cycles of the modeled MSR latencies.
+*
+* It compares the handlers (after) with those of the original driver (before),
+* which read every counter with its own rdmsr into one of seven column arrays
+* 8 MB apart and reset all counters. With -x, the string operation of one of the
+* benchmarks/ programs runs on this host between two interrupts, so the cost also
+* includes the cache lines the handler takes away from the workload.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "calib.h"
+#include "simpmu.h"
+
+//samples between two drains of the ring, well below its capacity
+#define DRAIN_EVERY 4096
+
+//timed runs of every handler, interleaved with those of the others so that all see the same
+//state of the host; the fastest one counts
+#define TIME_RUNS 5
+
+//samples per column array of the original driver (MAXVAL), which had seven of them
+#define LEGACY_SAMPLES 1000000
+#define LEGACY_COLUMNS 7
+
+//traps of the polling run that gives the reference rates of the calibration
+#define REFERENCE_TRAPS 100000
+
+//size of the buffers of the benchmarks/ programs
+#define WORKLOAD_BUFFER 2000000
+
+//handler taken at every interrupt
+#define HANDLER_NONE	0		//only re-arm the simulated PMU
+#define HANDLER_LEGACY	1		//handler of the original driver
+#define HANDLER_PMU		2		//PmuHandlePmi/PmuHandleTrap of drv/hpcpmu.c
+#define HANDLERS		3
+
+//interrupted code passed to the handlers: an address in a 32-bit user-mode program, its CS
+#define BENCH_IP		0x0040A5C3
+#define BENCH_CS		0x1B
+
+typedef struct _BENCH {
+	HPC_CONFIG config;
+	SIM_PMU sim;
+	PMU_OPS ops;
+	CPU_STATE cpu;
+	THREAD_CONTEXT thread;
+	UINT64 sums[HPC_NUM_COUNTERS];		//of the drained samples
+	UINT64 samples;
+	UINT64 badWindows;					//sampling windows outside [period, period + skid]
+	UINT64 badStatus;					//PMIs that left the overflow flag set
+	UINT64 badIps;						//samples without the instruction pointer and privilege level passed
+	UINT64 handlerCycles;				//modeled cycles spent in the handlers
+	UINT32 legacyCount;					//next row of the column arrays
+	UINT64 expected;					//interrupts of the run
+	UINT64 badPeriods;					//windows whose period is not the configured one or out of its range
+	UINT64 periods, periodSum, periodMin, periodMax;
+	UINT64 settledWindows, settledRefCycles;	//in the second half of the run
+	PCALIBRATION cal;					//takes the windows of group 0 when checking, NULL for none
+} BENCH, *PBENCH;
+
+//string operation of a benchmarks/ program on count elements
+typedef void (*WORKLOAD)(UINT8 *dst, UINT8 *src, size_t count);
+
+typedef struct _WORKLOAD_INFO {
+	const char *name;
+	WORKLOAD run;
+	UINT32 size;					//bytes per element
+} WORKLOAD_INFO;
+
+static HPC_RECORD slots[SAMPLE_RING_CAPACITY];
+static BENCH bench;
+static UINT64 legacyData[LEGACY_COLUMNS][LEGACY_SAMPLES + 1];
+static UINT8 buffer[WORKLOAD_BUFFER], buffer1[WORKLOAD_BUFFER];
+
+#if defined(__x86_64__) || defined(__i386__)
+//the loops of benchmarks/*.s; al and both buffers are 0, so scas and cmps run to the end
+#define REP_WORKLOAD(name, op) \
+	static void name(UINT8 *dst, UINT8 *src, size_t count){ \
+		size_t a = 0; \
+		__asm__ volatile("rep " op : "+D"(dst), "+S"(src), "+c"(count), "+a"(a) : : "memory", "cc"); \
+	}
+#define LOOP_WORKLOAD(name, op) \
+	static void name(UINT8 *dst, UINT8 *src, size_t count){ \
+		size_t a = 0; \
+		if(count != 0) \
+			__asm__ volatile("1:\n\t" op "\n\tloop 1b" : "+D"(dst), "+S"(src), "+c"(count), "+a"(a) : : "memory", "cc"); \
+	}
+
+REP_WORKLOAD(RepLodsb, "lodsb") REP_WORKLOAD(RepStosb, "stosb") REP_WORKLOAD(RepCmpsb, "cmpsb")
+REP_WORKLOAD(RepMovsb, "movsb") REP_WORKLOAD(RepScasb, "scasb")
+REP_WORKLOAD(RepLodsw, "lodsw") REP_WORKLOAD(RepStosw, "stosw") REP_WORKLOAD(RepCmpsw, "cmpsw")
+REP_WORKLOAD(RepMovsw, "movsw") REP_WORKLOAD(RepScasw, "scasw")
+LOOP_WORKLOAD(LoopLodsb, "lodsb") LOOP_WORKLOAD(LoopStosb, "stosb") LOOP_WORKLOAD(LoopCmpsb, "cmpsb")
+LOOP_WORKLOAD(LoopMovsb, "movsb") LOOP_WORKLOAD(LoopScasb, "scasb")
+LOOP_WORKLOAD(LoopLodsw, "lodsw") LOOP_WORKLOAD(LoopStosw, "stosw") LOOP_WORKLOAD(LoopCmpsw, "cmpsw")
+LOOP_WORKLOAD(LoopMovsw, "movsw") LOOP_WORKLOAD(LoopScasw, "scasw")
+
+static const WORKLOAD_INFO workloads[] = {
+	{ "rep_lodsb", RepLodsb, 1 }, { "rep_stosb", RepStosb, 1 }, { "rep_cmpsb", RepCmpsb, 1 },
+	{ "rep_movsb", RepMovsb, 1 }, { "rep_scasb", RepScasb, 1 },
+	{ "rep_lodsw", RepLodsw, 2 }, { "rep_stosw", RepStosw, 2 }, { "rep_cmpsw", RepCmpsw, 2 },
+	{ "rep_movsw", RepMovsw, 2 }, { "rep_scasw", RepScasw, 2 },
+	{ "loop_lodsb", LoopLodsb, 1 }, { "loop_stosb", LoopStosb, 1 }, { "loop_cmpsb", LoopCmpsb, 1 },
+	{ "loop_movsb", LoopMovsb, 1 }, { "loop_scasb", LoopScasb, 1 },
+	{ "loop_lodsw", LoopLodsw, 2 }, { "loop_stosw", LoopStosw, 2 }, { "loop_cmpsw", LoopCmpsw, 2 },
+	{ "loop_movsw", LoopMovsw, 2 }, { "loop_scasw", LoopScasw, 2 },
+	{ NULL, NULL, 0 }
+};
+#else
+static const WORKLOAD_INFO workloads[] = { { NULL, NULL, 0 } };
+#endif
+
+static const WORKLOAD_INFO *workload = NULL;
+static size_t workloadCount = 1000;		//elements per interrupt
+static size_t workloadOffset = 0;
+
+static double Seconds(){
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void Setup(PBENCH b, const HPC_CONFIG *config, const SIM_PMU *model){
+	memset(b, 0, sizeof(*b));
+	b->config = *config;
+	b->sim = *model;
+	SimPmuOps(&b->sim, &b->ops);
+	SampleRingInit(&b->cpu.ring, slots, SAMPLE_RING_CAPACITY);
+	b->thread.tid = 4;
+	b->thread.state = THREAD_STATE_RUNNING;
+	b->cpu.isTestThread = 1;
+	b->cpu.thread = &b->thread;
+	b->cpu.tid = b->thread.tid;
+	PmuStart(&b->ops, &b->config, &b->cpu);
+	workloadOffset = 0;
+}
+
+/*
+* Run the workload on the next elements of the buffers, from the start once they are used up
+*/
+static void Workload(){
+	size_t bytes = workloadCount * workload->size;
+
+	if(workloadOffset + bytes > WORKLOAD_BUFFER)
+		workloadOffset = 0;
+	workload->run(buffer + workloadOffset, buffer1 + workloadOffset, workloadCount);
+	workloadOffset += bytes;
+}
+
+/*
+* Handler of the original driver: one rdmsr per counter into the column arrays, then every counter reset
+*/
+static void LegacyHandler(PBENCH b, int pmi){
+	const PMU_OPS *pmu = &b->ops;
+	UINT64 value;
+	int i;
+
+	if(b->cpu.isTestThread){
+		for(i = 0; i < LEGACY_COLUMNS; i++){
+			value = pmu->read(pmu->context, pmuCounterMsr[i]) & pmu->caps->mask[i];
+			legacyData[i][b->legacyCount] = PmuCounterValue(pmu->caps, &b->config, i, value);
+		}
+		b->legacyCount = (b->legacyCount + 1) % LEGACY_SAMPLES;
+	}
+	for(i = 0; i < LEGACY_COLUMNS; i++)
+		pmu->write(pmu->context, pmuCounterMsr[i], PmuPreload(pmu->caps, &b->config, i));
+	if(pmi)
+		pmu->write(pmu->context, MSR_PERF_GLOBAL_OVF_CTRL, PMU_STATUS_FIXED0);
+	if(pmi && b->config.freeze)
+		pmu->write(pmu->context, MSR_PERF_GLOBAL_CTRL, pmu->caps->globalEnable);		//it had no freeze, but has to count on
+}
+
+/*
+* The period of a window must be the configured one, or within its jitter, or within the
+* limits when it is adapted; the second half of the windows shows where the adaption settled
+*/
+static void CheckPeriod(PBENCH b, const HPC_SAMPLE *sample, int settled){
+	UINT64 mean = (UINT64)-(INT64)b->config.pmiThreshold;
+
+	if(b->config.target != 0 || b->config.budget != 0){
+		if(sample->period < HPC_MIN_PMI_PERIOD)
+			b->badPeriods++;
+	}else if(sample->period + b->config.jitter < mean || sample->period > mean + b->config.jitter)
+		b->badPeriods++;
+	if(b->periods == 0 || sample->period < b->periodMin)
+		b->periodMin = sample->period;
+	if(sample->period > b->periodMax)
+		b->periodMax = sample->period;
+	b->periods++;
+	b->periodSum += sample->period;
+	if(settled){
+		b->settledWindows++;
+		b->settledRefCycles += sample->ctr[2];
+	}
+}
+
+/*
+* Empty the ring like the drain thread; with check set, account the samples
+*/
+static void Drain(PBENCH b, int check){
+	PHPC_RECORD first;
+	HPC_SAMPLE sample;
+	UINT32 count, i;
+	int j;
+
+	while((count = SampleRingPeek(&b->cpu.ring, &first)) != 0){
+		if(check){
+			for(i = 0; i < count; i++){
+				SampleRecordUnpack(&first[i], 0, &sample);
+				if(sample.ip != BENCH_IP || sample.cpl != (BENCH_CS & 3))
+					b->badIps++;
+				for(j = 0; j < HPC_NUM_COUNTERS; j++)
+					b->sums[j] += sample.ctr[j];
+				if(b->config.mode == HPC_MODE_SAMPLING){
+					if(sample.ctr[0] < sample.period || sample.ctr[0] > sample.period + (b->config.freeze ? 0 : b->sim.maxSkid))
+						b->badWindows++;
+					CheckPeriod(b, &sample, b->samples + i >= b->expected / 2);
+				}
+				if(b->cal != NULL && sample.group == 0)
+					CalibAddWindow(b->cal, sample.ctr, sample.period);
+			}
+		}
+		b->samples += count;
+		SampleRingRelease(&b->cpu.ring, count);
+	}
+}
+
+/*
+* Take count PMIs, or traps every interval instructions in the polling mode.
+* HANDLER_NONE only re-arms the simulated PMU, to subtract the cost of the model and the workload.
+*/
+static void Run(PBENCH b, int handler, UINT64 count, UINT64 interval, int check){
+	int sampling = b->config.mode == HPC_MODE_SAMPLING;
+	UINT64 n, before;
+
+	b->expected = count;
+	for(n = 0; n < count; n++){
+		if(workload != NULL)
+			Workload();
+		if(sampling){
+			while(!b->sim.pmiPending)
+				SimPmuRun(&b->sim, (UINT64)1 << 40);
+			b->sim.pmiPending = 0;
+		}else
+			SimPmuRun(&b->sim, interval);
+
+		before = b->sim.tsc;
+		if(handler == HANDLER_PMU){
+			if(sampling)
+				PmuHandlePmi(&b->ops, &b->config, &b->cpu, BENCH_IP, BENCH_CS);
+			else
+				PmuHandleTrap(&b->ops, &b->config, &b->cpu, 1, b->cpu.tid, BENCH_IP, BENCH_CS);
+		}else if(handler == HANDLER_LEGACY)
+			LegacyHandler(b, sampling);
+		else{
+			b->sim.counter[0] = PmuPreload(&b->sim.caps, &b->config, 0);
+			b->sim.globalStatus = 0;
+			b->sim.globalCtrl = b->sim.caps.globalEnable;
+		}
+		b->handlerCycles += b->sim.tsc - before;
+		if(sampling && (b->sim.globalStatus & PMU_STATUS_FIXED0))
+			b->badStatus++;
+
+		if((n + 1) % DRAIN_EVERY == 0)
+			Drain(b, check);
+	}
+	Drain(b, check);
+}
+
+/*
+* Samples plus what is left in the counters must equal what the PMU counted
+*/
+static int Check(PBENCH b, UINT64 count){
+	const SELF_HANDLER *self = &b->cpu.self.handler[b->config.mode == HPC_MODE_SAMPLING ? SELF_PMI : SELF_TRAP];
+	UINT64 left;
+	int i, errors = 0;
+
+	for(i = 0; i < HPC_NUM_COUNTERS; i++){
+		left = (b->sim.counter[i] - b->cpu.base[i]) & b->sim.caps.mask[i];
+		if(b->sums[i] + left != b->sim.counted[i]){
+			printf("  counter %d: samples %llu + left %llu != counted %llu\n", i, (unsigned long long)b->sums[i],
+				(unsigned long long)left, (unsigned long long)b->sim.counted[i]);
+			errors++;
+		}
+	}
+	if(b->samples != count || b->cpu.ring.dropped != 0){
+		printf("  %llu samples for %llu interrupts, %u dropped\n", (unsigned long long)b->samples,
+			(unsigned long long)count, b->cpu.ring.dropped);
+		errors++;
+	}
+	if(b->badWindows != 0){
+		printf("  %llu windows are not one period plus skid\n", (unsigned long long)b->badWindows);
+		errors++;
+	}
+	if(b->badPeriods != 0){
+		printf("  %llu windows have a period out of the configured range\n", (unsigned long long)b->badPeriods);
+		errors++;
+	}
+	if(b->badIps != 0){
+		printf("  %llu samples lost the instruction pointer or privilege level\n", (unsigned long long)b->badIps);
+		errors++;
+	}
+	if(b->badStatus != 0){
+		printf("  %llu PMIs left the overflow flag set\n", (unsigned long long)b->badStatus);
+		errors++;
+	}
+	//the handler reads the time stamp after the first rdtsc of the model and before the last one is counted
+	if(self->calls != count || self->cycles + 25 * count != b->handlerCycles){
+		printf("  the handler timed %llu calls of %llu cycles, modeled %llu of %llu\n", (unsigned long long)self->calls,
+			(unsigned long long)self->cycles, (unsigned long long)count, (unsigned long long)b->handlerCycles);
+		errors++;
+	}
+	if(b->sim.unknown != 0){
+		printf("  %llu accesses to MSRs that are not modeled\n", (unsigned long long)b->sim.unknown);
+		errors++;
+	}
+	return errors;
+}
+
+/*
+* Adapted periods must settle where the windows hold the target reference cycles, or where
+* the handler takes its budget of the cycles
+*/
+static int CheckAdaption(PBENCH b, UINT64 count, double *refPerWindow, double *share){
+	const HPC_CONFIG *config = &b->config;
+	int errors = 0;
+
+	*refPerWindow = b->settledWindows != 0 ? (double)b->settledRefCycles / b->settledWindows : 0;
+	*share = *refPerWindow != 0 ? (double)b->handlerCycles / count / *refPerWindow : 0;
+	if(config->target != 0 && config->budget == 0 && (*refPerWindow < config->target * 0.95 || *refPerWindow > config->target * 1.05))
+		errors++;
+	if(config->budget != 0 && config->target == 0 && (*share * 1000 < config->budget * 0.9 || *share * 1000 > config->budget * 1.1))
+		errors++;
+	if(config->budget != 0 && config->target != 0 && (*refPerWindow < config->target * 0.95 || *share * 1000 > config->budget * 1.1))
+		errors++;
+	if(errors)
+		printf("  the adapted period did not settle: %.0f reference cycles per window, handler %.2f%% of the cycles\n",
+			*refPerWindow, *share * 100);
+	return errors;
+}
+
+/*
+* Rates of the events of group 0 for the calibration, from a polling run of the same model
+*/
+static void Reference(const HPC_CONFIG *config, const SIM_PMU *model, UINT64 interval, PCALIBRATION cal){
+	HPC_CONFIG polling = *config;
+
+	polling.mode = HPC_MODE_POLLING;
+	polling.pmiThreshold = 0;
+	polling.groupCount = 1;
+	polling.freeze = 0;
+	Setup(&bench, &polling, model);
+	Run(&bench, HANDLER_PMU, REFERENCE_TRAPS, interval, 1);
+	CalibInit(cal, (UINT64)-(INT64)config->pmiThreshold, config->eventSel[0], config->freeze);
+	CalibReference(cal, bench.sums);
+}
+
+/*
+* The calibration must find the skid and the overhead the model adds, up to the
+* events the model carries over between windows
+*/
+static int CheckCalibration(const CALIBRATION *cal, const SIM_PMU *model, double *minOverhead, double *maxOverhead){
+	int c, errors = 0;
+
+	if(cal->skid.count == 0 || cal->skidMax > (cal->freeze ? 0 : model->maxSkid)){
+		printf("  calibration: %llu windows, skid up to %llu\n", (unsigned long long)cal->skid.count, (unsigned long long)cal->skidMax);
+		errors++;
+	}
+	*minOverhead = *maxOverhead = cal->overhead[1].mean;
+	for(c = 1; c < HPC_NUM_COUNTERS; c++){
+		if(!(model->caps.columns & (1u << c)))
+			continue;
+		if(cal->overhead[c].mean < *minOverhead)
+			*minOverhead = cal->overhead[c].mean;
+		if(cal->overhead[c].mean > *maxOverhead)
+			*maxOverhead = cal->overhead[c].mean;
+		if(cal->overhead[c].mean < model->pmiOverhead - 1.0 || cal->overhead[c].mean > model->pmiOverhead + 1.0){
+			printf("  counter %d: calibrated overhead %.2f per PMI, modeled %u\n", c, cal->overhead[c].mean, model->pmiOverhead);
+			errors++;
+		}
+	}
+	return errors;
+}
+
+/*
+* Time count interrupts taken by a handler; fills the modeled cycles and PMU accesses per interrupt
+*/
+static double Time(const HPC_CONFIG *config, const SIM_PMU *model, int handler, UINT64 count, UINT64 interval, double *perInterrupt){
+	double start, elapsed;
+
+	Setup(&bench, config, model);
+	bench.sim.reads = bench.sim.writes = bench.sim.rdpmcs = 0;
+	start = Seconds();
+	Run(&bench, handler, count, interval, 0);
+	elapsed = Seconds() - start;
+	perInterrupt[0] = (double)bench.handlerCycles / count;
+	perInterrupt[1] = (double)bench.sim.reads / count;
+	perInterrupt[2] = (double)bench.sim.rdpmcs / count;
+	perInterrupt[3] = (double)bench.sim.writes / count;
+	return elapsed;
+}
+
+/*
+* ns per interrupt a handler adds to the loop without handler; 0 if it is within the noise of the host
+*/
+static double Cost(double elapsed, double baseline, UINT64 count){
+	return elapsed > baseline ? (elapsed - baseline) * 1e9 / count : 0;
+}
+
+static int Measure(const HPC_CONFIG *config, const SIM_PMU *model, UINT64 count, UINT64 interval){
+	const char *what = config->mode == HPC_MODE_SAMPLING ? "PMI" : "trap";
+	double best[HANDLERS], each[HANDLERS][4], elapsed, minOverhead = 0, maxOverhead = 0;
+	double refPerWindow = 0, share = 0, meanPeriod;
+	UINT64 minPeriod, maxPeriod;
+	const SELF_HANDLER *self;
+	CALIBRATION cal;
+	int run, handler, sampling = config->mode == HPC_MODE_SAMPLING, errors;
+	int variable = config->jitter != 0 || config->target != 0 || config->budget != 0;
+
+	if(sampling)
+		Reference(config, model, interval, &cal);
+	Setup(&bench, config, model);
+	bench.cal = sampling ? &cal : NULL;
+	Run(&bench, HANDLER_PMU, count, interval, 1);
+	errors = Check(&bench, count);
+	if(sampling)
+		errors += CheckCalibration(&cal, model, &minOverhead, &maxOverhead);
+	if(variable)
+		errors += CheckAdaption(&bench, count, &refPerWindow, &share);
+	meanPeriod = bench.periods != 0 ? (double)bench.periodSum / bench.periods : 0;
+	minPeriod = bench.periodMin;
+	maxPeriod = bench.periodMax;
+
+	for(run = 0; run < TIME_RUNS; run++){
+		for(handler = 0; handler < HANDLERS; handler++){
+			elapsed = Time(config, model, handler, count, interval, each[handler]);
+			if(run == 0 || elapsed < best[handler])
+				best[handler] = elapsed;
+		}
+	}
+
+	printf("%s: %llu %ss, %s %lld, %u groups", config->mode == HPC_MODE_SAMPLING ? "sampling" : "polling",
+		(unsigned long long)count, what, config->mode == HPC_MODE_SAMPLING ? "period" : "interval",
+		config->mode == HPC_MODE_SAMPLING ? -(long long)config->pmiThreshold : (long long)interval, config->groupCount);
+	if(workload != NULL)
+		printf(", %s on %llu elements per %s", workload->name, (unsigned long long)workloadCount, what);
+	printf("\n  loop without handler: %.1f ns/%s\n", best[HANDLER_NONE] * 1e9 / count, what);
+	printf("  before: %6.1f ns/%s, %4.0f cycles, %.1f rdmsr, %.1f rdpmc, %.1f wrmsr\n", Cost(best[HANDLER_LEGACY], best[HANDLER_NONE], count),
+		what, each[HANDLER_LEGACY][0], each[HANDLER_LEGACY][1], each[HANDLER_LEGACY][2], each[HANDLER_LEGACY][3]);
+	printf("  after:  %6.1f ns/%s, %4.0f cycles, %.1f rdmsr, %.1f rdpmc, %.1f wrmsr\n", Cost(best[HANDLER_PMU], best[HANDLER_NONE], count),
+		what, each[HANDLER_PMU][0], each[HANDLER_PMU][1], each[HANDLER_PMU][2], each[HANDLER_PMU][3]);
+	self = &bench.cpu.self.handler[sampling ? SELF_PMI : SELF_TRAP];
+	printf("  self:   p50 %llu, p99 %llu, max %llu cycles as the handler timed itself\n", (unsigned long long)SelfQuantile(self, 500),
+		(unsigned long long)SelfQuantile(self, 990), (unsigned long long)self->max);
+	if(variable)
+		printf("  period: mean %.0f, %llu to %llu; %.0f reference cycles per window, handler %.2f%% of the cycles\n", meanPeriod,
+			(unsigned long long)minPeriod, (unsigned long long)maxPeriod, refPerWindow, share * 100);
+	if(sampling)
+		printf("  calib:  skid %.2f (max %llu), overhead %.2f to %.2f per PMI (modeled %u)%s\n", cal.skid.mean,
+			(unsigned long long)cal.skidMax, minOverhead, maxOverhead, model->pmiOverhead, config->freeze ? ", frozen" : "");
+	printf("  check:  %s\n", errors ? "FAILED" : "ok");
+	return errors;
+}
+
+int main(int argc, char *argv[]){
+	HPC_CONFIG config;
+	SIM_PMU model;
+	UINT64 count = 5000000, interval = 50000;
+	INT32 threshold = -50000;
+	UINT32 groups = 1, g, i;
+	UINT32 jitter = 0, target = 0, budget = 0, programmable = 4, fixed = 3, width = 48;
+	int c, modes = 3, freeze = 0, errors = 0;
+
+	SimPmuInit(&model);
+	while((c = getopt(argc, argv, "n:m:t:i:g:k:fo:j:a:b:r:w:p:x:c:e:F:W:")) != -1){
+		switch(c){
+		case 'n': count = strtoull(optarg, NULL, 0); break;
+		case 'm': modes = strcmp(optarg, "sampling") == 0 ? 1 : strcmp(optarg, "polling") == 0 ? 2 : 3; break;
+		case 't': threshold = (INT32)strtol(optarg, NULL, 0); break;
+		case 'i': interval = strtoull(optarg, NULL, 0); break;
+		case 'g': groups = (UINT32)atoi(optarg); break;
+		case 'k': model.maxSkid = (UINT32)atoi(optarg); break;
+		case 'f': freeze = 1; break;
+		case 'o': model.pmiOverhead = (UINT32)atoi(optarg); break;
+		case 'j': jitter = (UINT32)strtoul(optarg, NULL, 0); break;
+		case 'a': target = (UINT32)strtoul(optarg, NULL, 0); break;
+		case 'b': budget = (UINT32)strtoul(optarg, NULL, 0); break;
+		case 'r': model.readLatency = (UINT32)atoi(optarg); break;
+		case 'w': model.writeLatency = (UINT32)atoi(optarg); break;
+		case 'p': model.rdpmcLatency = (UINT32)atoi(optarg); break;
+		case 'x':
+			for(i = 0; workloads[i].name != NULL && strcmp(workloads[i].name, optarg) != 0; i++)
+				;
+			if(workloads[i].name == NULL){
+				fprintf(stderr, "unknown workload %s\n", optarg);
+				return 2;
+			}
+			workload = &workloads[i];
+			break;
+		case 'c': workloadCount = (size_t)strtoull(optarg, NULL, 0); break;
+		case 'e': programmable = (UINT32)atoi(optarg); break;
+		case 'F': fixed = (UINT32)atoi(optarg); break;
+		case 'W': width = (UINT32)atoi(optarg); break;
+		default:
+			fprintf(stderr, "usage: %s [-n interrupts] [-m sampling|polling|both] [-t threshold] [-i interval]\n", argv[0]);
+			fprintf(stderr, "       [-g groups] [-k max skid] [-f] [-o PMI overhead] [-r rdmsr cycles] [-w wrmsr cycles] [-p rdpmc cycles]\n");
+			fprintf(stderr, "       [-j jitter] [-a target reference cycles per window] [-b budget per mille]\n");
+			fprintf(stderr, "       [-x rep_movsb|loop_stosw|... workload] [-c elements per interrupt]\n");
+			fprintf(stderr, "       [-e programmable counters 1..%d] [-F fixed counters 3|4] [-W counter bits 33..48]\n", HPC_MAX_PROGRAMMABLE);
+			return 2;
+		}
+	}
+	if(programmable < 1 || programmable > HPC_MAX_PROGRAMMABLE || (fixed != 3 && fixed != 4) || width < 33 || width > 48){
+		fprintf(stderr, "bad PMU\n");
+		return 2;
+	}
+	//the PMU of the model
+	PmuCapsInit(&model.caps, model.caps.version, programmable, width, (1u << fixed) - 1, width);
+	if(groups < 1 || groups > HPC_MAX_GROUPS || threshold > -HPC_MIN_PMI_PERIOD || count == 0 ||
+		(workload != NULL && (workloadCount == 0 || workloadCount * workload->size > WORKLOAD_BUFFER))){
+		fprintf(stderr, "bad arguments\n");
+		return 2;
+	}
+
+	//user-mode events with a different code in every slot and group
+	HpcConfigInit(&config);
+	config.testAppCount = 1;
+	config.groupCount = groups;
+	for(g = 0; g < groups; g++){
+		for(i = 0; i < model.caps.usedProgrammable; i++)
+			config.eventSel[g][i] = HPC_EVTSEL_EN | HPC_EVTSEL_USR | (0x2E + 16 * g + i);
+	}
+
+	if(modes & 1){
+		config.mode = HPC_MODE_SAMPLING;
+		config.pmiThreshold = threshold;
+		config.freeze = freeze;
+		config.jitter = jitter;
+		config.target = target;
+		config.budget = budget;
+		if(HpcConfigValidate(&config) == HPC_CONFIG_BAD_PERIOD){
+			fprintf(stderr, "bad jitter, target or budget\n");
+			return 2;
+		}
+		errors += Measure(&config, &model, count, interval);
+	}
+	if(modes & 2){
+		config.mode = HPC_MODE_POLLING;
+		config.pmiThreshold = 0;
+		config.groupCount = 1;
+		config.freeze = 0;
+		config.jitter = config.target = config.budget = 0;
+		errors += Measure(&config, &model, count, interval);
+	}
+	return errors ? 1 : 0;
+}
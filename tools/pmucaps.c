@@ -0,0 +1,177 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Checks the PMU discovery of drv/hpccaps.c without the processors it runs on.
+* Without arguments it decodes CPUID leaves recorded on a set of processors (and a few
+* made-up edge cases) and compares the counters found with the ones the processor has.
+* With a file it decodes a dump of the first CPU in the format of cpuid -r, with -c the
+* processor it runs on, and prints the counters and sample columns the driver would use.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__i386__) || defined(__x86_64__)
+#include <cpuid.h>
+#endif
+#include "hpccaps.h"
+
+static const char *columnNames[HPC_NUM_COUNTERS] = HPC_COLUMN_NAMES;
+
+typedef struct _RECORDED {
+	const char *name;
+	UINT32 leaf0[4], leaf1[4], leafA[4];
+
+	//expected
+	int result;
+	UINT32 version, programmable, programmableWidth, fixedMask, fixedWidth, columns, unavailable;
+} RECORDED;
+
+#define INTEL 0x756E6547, 0x6C65746E, 0x49656E69
+#define AMD 0x68747541, 0x444D4163, 0x69746E65
+#define VM 0x80000000
+
+static const RECORDED recorded[] = {
+	//eax ebx ecx edx of leaf 0, leaf 1 (only ecx matters) and leaf 0xA
+	{"Core 2 (Merom)", {0xA, INTEL}, {0, 0, 0x0000E3BD, 0}, {0x07280202, 0, 0, 0x00000503},
+		0, 2, 2, 40, 0x7, 40, 0x1F, 0xFFFFFF80},
+	{"Nehalem", {0xB, INTEL}, {0, 0, 0x0098E3BD, 0}, {0x07300403, 0x44, 0, 0x00000603},
+		0, 3, 4, 48, 0x7, 48, 0x7F, 0xFFFFFFC4},
+	{"Sandy Bridge, hyperthreading off", {0xD, INTEL}, {0, 0, 0x1FBAE3FF, 0}, {0x07300803, 0, 0, 0x00000603},
+		0, 3, 8, 48, 0x7, 48, 0x7FF, 0xFFFFFF80},
+	{"Skylake, hyperthreading on", {0x16, INTEL}, {0, 0, 0x7FFAFBBF, 0}, {0x07300404, 0, 0, 0x00000603},
+		0, 4, 4, 48, 0x7, 48, 0x7F, 0xFFFFFF80},
+	{"Ice Lake", {0x1B, INTEL}, {0, 0, 0x7FFAFBFF, 0}, {0x08300805, 0, 0, 0x00008604},
+		0, 5, 8, 48, 0xF, 48, 0xFFF, 0xFFFFFF00},
+	{"Atom (Silvermont)", {0xB, INTEL}, {0, 0, 0x43D8E3BF, 0}, {0x07280203, 0, 0, 0x00000503},
+		0, 3, 2, 40, 0x7, 40, 0x1F, 0xFFFFFF80},
+	//edge cases
+	{"AMD", {0xD, AMD}, {0, 0, 0x7ED8320B, 0}, {0, 0, 0, 0},
+		-1, 0, 0, 0, 0, 0, 0, 0},
+	{"VM without PMU", {0xD, INTEL}, {0, 0, VM | 0x02, 0}, {0, 0, 0, 0},
+		-1, 0, 0, 0, 0, 0, 0, 0},
+	{"max leaf below 0xA", {0x5, INTEL}, {0, 0, 0, 0}, {0x07300403, 0, 0, 0x603},
+		-1, 0, 0, 0, 0, 0, 0, 0},
+	{"version 2 without fixed counters", {0xD, INTEL}, {0, 0, 0, 0}, {0x07300402, 0, 0, 0},
+		0, 2, 4, 48, 0x7, 48, 0x7F, 0xFFFFFF80},
+	{"VM, version 2 without fixed counters", {0xD, INTEL}, {0, 0, VM, 0}, {0x07300402, 0, 0, 0},
+		0, 2, 4, 48, 0, 48, 0x78, 0xFFFFFF80},
+	{"version 1", {0xD, INTEL}, {0, 0, 0, 0}, {0x07280201, 0, 0, 0},
+		0, 1, 2, 40, 0, 0, 0x18, 0xFFFFFF80},
+	{"version 5, fixed counters 0, 1 and 3", {0x1B, INTEL}, {0, 0, 0, 0}, {0x08300605, 0, 0xB, 0x00000602},
+		0, 5, 6, 48, 0xB, 48, 0x9FB, 0xFFFFFF00},
+	{"16 programmable counters", {0x1B, INTEL}, {0, 0, 0, 0}, {0x08301005, 0, 0, 0x00008604},
+		0, 5, 16, 48, 0xF, 48, 0xFFF, 0xFFFFFF00},
+};
+
+static void Print(const PMU_CAPS *caps){
+	UINT32 i;
+
+	printf("version %u, %u programmable counters of %u bits, fixed counters 0x%X of %u bits%s\n",
+		caps->version, caps->programmable, caps->programmableWidth, caps->fixedMask, caps->fixedWidth,
+		caps->hypervisor ? ", hypervisor" : "");
+	printf("unavailable events 0x%08X of %u\n", caps->unavailable, caps->eventCount);
+	printf("columns 0x%03X:", caps->columns);
+	for(i = 0; i < caps->count; i++)
+		printf(" %s (msr 0x%X, rdpmc 0x%X)", columnNames[caps->counter[i].column], caps->counter[i].msr, caps->counter[i].rdpmc);
+	printf("\n");
+}
+
+/*
+* Decodes the recorded leaves and compares them with what the processor has
+*/
+static int Check(){
+	PMU_CAPS caps;
+	size_t n;
+	int result, errors = 0;
+
+	for(n = 0; n < sizeof(recorded) / sizeof(recorded[0]); n++){
+		const RECORDED *r = &recorded[n];
+
+		result = PmuCapsFromCpuid(&caps, r->leaf0, r->leaf1, r->leafA);
+		if(result != r->result || caps.version != r->version || caps.programmable != r->programmable ||
+			caps.programmableWidth != r->programmableWidth || caps.fixedMask != r->fixedMask ||
+			caps.fixedWidth != r->fixedWidth || caps.columns != r->columns || caps.unavailable != r->unavailable){
+			printf("%s: wrong\n", r->name);
+			printf("  expected version %u, %u programmable counters of %u bits, fixed counters 0x%X of %u bits\n",
+				r->version, r->programmable, r->programmableWidth, r->fixedMask, r->fixedWidth);
+			printf("  columns 0x%03X, unavailable events 0x%08X\n  found ", r->columns, r->unavailable);
+			Print(&caps);
+			errors++;
+		}
+	}
+	printf("%u processors, check: %s\n", (unsigned)n, errors == 0 ? "ok" : "FAILED");
+	return errors == 0 ? 0 : 1;
+}
+
+/*
+* Leaves 0, 1 and 0xA of the first CPU of a dump of cpuid -r, lines of the form
+*    0x0000000a 0x00: eax=0x07300403 ebx=0x00000000 ecx=0x00000000 edx=0x00000603
+*/
+static int ReadDump(const char *path, UINT32 leaf0[4], UINT32 leaf1[4], UINT32 leafA[4]){
+	FILE *file;
+	char line[256];
+	unsigned int leaf, subleaf, r[4];
+	int found = 0, cpus = 0;
+
+	file = fopen(path, "r");
+	if(file == NULL){
+		perror(path);
+		return -1;
+	}
+	while(fgets(line, sizeof(line), file) != NULL){
+		if(strncmp(line, "CPU ", 4) == 0 && ++cpus > 1)
+			break;
+		if(sscanf(line, " 0x%x 0x%x: eax=0x%x ebx=0x%x ecx=0x%x edx=0x%x", &leaf, &subleaf, &r[0], &r[1], &r[2], &r[3]) != 6 || subleaf != 0)
+			continue;
+		if(leaf == 0)
+			memcpy(leaf0, r, sizeof(r));
+		else if(leaf == 1)
+			memcpy(leaf1, r, sizeof(r));
+		else if(leaf == 0xA)
+			memcpy(leafA, r, sizeof(r));
+		if(leaf <= 1)
+			found |= 1 << leaf;
+	}
+	fclose(file);
+	//leaf 0xA may be missing, the maximum leaf of leaf 0 tells the decoder
+	if(found != 3){
+		fprintf(stderr, "%s: no leaf 0 or 1\n", path);
+		return -1;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[]){
+	UINT32 leaf0[4] = {0}, leaf1[4] = {0}, leafA[4] = {0};
+	PMU_CAPS caps;
+
+	if(argc == 1)
+		return Check();
+	if(argc != 2 || (argv[1][0] == '-' && strcmp(argv[1], "-c") != 0)){
+		fprintf(stderr, "usage: %s [-c | cpuid-dump]\n", argv[0]);
+		fprintf(stderr, "  without arguments, checks the decoding of the CPUID leaves of known processors\n");
+		fprintf(stderr, "  -c  decodes the leaves of this processor\n");
+		fprintf(stderr, "  cpuid-dump  decodes the leaves of the first CPU of the output of cpuid -r\n");
+		return 2;
+	}
+	if(strcmp(argv[1], "-c") == 0){
+#if defined(__i386__) || defined(__x86_64__)
+		__cpuid(0, leaf0[0], leaf0[1], leaf0[2], leaf0[3]);
+		__cpuid(1, leaf1[0], leaf1[1], leaf1[2], leaf1[3]);
+		if(leaf0[0] >= 0xA)
+			__cpuid_count(0xA, 0, leafA[0], leafA[1], leafA[2], leafA[3]);
+#else
+		fprintf(stderr, "not an x86 processor\n");
+		return 1;
+#endif
+	}else if(ReadDump(argv[1], leaf0, leaf1, leafA) != 0)
+		return 1;
+
+	if(PmuCapsFromCpuid(&caps, leaf0, leaf1, leafA) != 0){
+		printf("no architectural performance monitoring%s\n", caps.hypervisor ? " (hypervisor)" : "");
+		return 1;
+	}
+	Print(&caps);
+	return 0;
+}
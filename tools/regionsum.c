@@ -0,0 +1,230 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Summary of the regions of a polling-mode log (see drv/hpcregion.h): for every region id
+* the number of instances and the sums of their inclusive and exclusive counts, as CSV.
+* With -x it prints one line per region instance instead.
+*
+* A sample holds the inclusive counts of one region instance. The regions nested in it
+* end before it on the same thread, so the samples of a thread arrive in the order their
+* regions ended and a region's direct children are the samples one level deeper since its
+* previous sibling. The exclusive counts are the inclusive counts minus those of the children.
+* A region nested in itself is counted in the inclusive sum of its id once per level.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "logread.h"
+#include "hpcregion.h"
+
+//threads and region ids tracked, powers of two
+#define MAX_THREADS 1024
+#define MAX_REGIONS 4096
+
+#define NAME_SIZE 64
+
+typedef struct _THREAD_STATE {
+	UINT32 used;
+	UINT32 tid;
+	UINT64 children[HPC_REGION_DEPTH + 2][HPC_NUM_COUNTERS];	//inclusive counts of the ended regions at each depth whose parent is open
+} THREAD_STATE, *PTHREAD_STATE;
+
+typedef struct _REGION_TOTAL {
+	UINT32 used;
+	UINT32 region;
+	UINT32 maxDepth;
+	UINT64 instances;
+	UINT64 inclusive[HPC_NUM_COUNTERS];
+	UINT64 exclusive[HPC_NUM_COUNTERS];
+	char name[NAME_SIZE];
+} REGION_TOTAL, *PREGION_TOTAL;
+
+static THREAD_STATE threads[MAX_THREADS];
+static REGION_TOTAL regions[MAX_REGIONS];
+static const char *columns[HPC_NUM_COUNTERS] = { "ins", "l_cycle", "ref_cycle", "event1", "event2", "event3", "event4" };
+
+static PTHREAD_STATE FindThread(UINT32 tid){
+	UINT32 i = (tid * 0x9E3779B1u) & (MAX_THREADS - 1), probes;
+
+	for(probes = 0; probes < MAX_THREADS; probes++){
+		if(!threads[i].used){
+			threads[i].used = 1;
+			threads[i].tid = tid;
+			return &threads[i];
+		}
+		if(threads[i].tid == tid)
+			return &threads[i];
+		i = (i + 1) & (MAX_THREADS - 1);
+	}
+	return NULL;
+}
+
+static PREGION_TOTAL FindRegion(UINT32 region){
+	UINT32 i = (region * 0x9E3779B1u) & (MAX_REGIONS - 1), probes;
+
+	for(probes = 0; probes < MAX_REGIONS; probes++){
+		if(!regions[i].used){
+			regions[i].used = 1;
+			regions[i].region = region;
+			return &regions[i];
+		}
+		if(regions[i].region == region)
+			return &regions[i];
+		i = (i + 1) & (MAX_REGIONS - 1);
+	}
+	return NULL;
+}
+
+/*
+* Read "id name" lines
+*/
+static int ReadNames(const char *path){
+	PREGION_TOTAL total;
+	char line[256], name[NAME_SIZE];
+	unsigned long id;
+	FILE *file;
+
+	file = fopen(path, "r");
+	if(file == NULL)
+		return -1;
+	while(fgets(line, sizeof(line), file) != NULL){
+		if(sscanf(line, "%lu %63s", &id, name) != 2 || id == 0 || id > HPC_REGION_ID_MASK)
+			continue;
+		total = FindRegion((UINT32)id);
+		if(total != NULL)
+			strcpy(total->name, name);
+	}
+	fclose(file);
+	return 0;
+}
+
+/*
+* Exclusive counts of a region instance; returns -1 if its thread or depth cannot be tracked
+*/
+static int Exclusive(const HPC_SAMPLE *sample, UINT64 *exclusive){
+	PTHREAD_STATE thread = FindThread(sample->tid);
+	UINT32 d = sample->depth;
+	int i;
+
+	if(thread == NULL || d == 0 || d > HPC_REGION_DEPTH)
+		return -1;
+	for(i = 0; i < HPC_NUM_COUNTERS; i++){
+		exclusive[i] = sample->ctr[i] > thread->children[d + 1][i] ? sample->ctr[i] - thread->children[d + 1][i] : 0;
+		thread->children[d + 1][i] = 0;
+		thread->children[d][i] += sample->ctr[i];
+	}
+	return 0;
+}
+
+static int CompareRegions(const void *a, const void *b){
+	const REGION_TOTAL *x = (const REGION_TOTAL *)a, *y = (const REGION_TOTAL *)b;
+
+	if(x->used != y->used)
+		return x->used ? -1 : 1;
+	return x->region < y->region ? -1 : x->region > y->region;
+}
+
+int main(int argc, char *argv[]){
+	LOG_READER reader;
+	HPC_SAMPLE sample;
+	PREGION_TOTAL total;
+	UINT64 exclusive[HPC_NUM_COUNTERS], outside = 0, untracked = 0;
+	const char *error, *names = NULL;
+	int instances = 0, arg = 1, rc, i, r;
+
+	for(; arg < argc && argv[arg][0] == '-'; arg++){
+		if(strcmp(argv[arg], "-x") == 0)
+			instances = 1;
+		else if(strcmp(argv[arg], "-n") == 0 && arg + 1 < argc)
+			names = argv[++arg];
+		else
+			break;
+	}
+	if(arg >= argc || argv[arg][0] == '-'){
+		fprintf(stderr, "usage: %s [-x] [-n names.txt] hpcoutput.bin\n", argv[0]);
+		fprintf(stderr, "  -x  one line per region instance instead of one per region\n");
+		fprintf(stderr, "  -n  names of the regions, one \"id name\" line each\n");
+		return 2;
+	}
+	if(names != NULL && ReadNames(names) != 0){
+		perror(names);
+		return 1;
+	}
+
+	if(LogReaderOpen(&reader, argv[arg], &error) != 0){
+		if(error != NULL)
+			fprintf(stderr, "%s: %s (version %d)\n", argv[arg], error, SAMPLE_LOG_VERSION);
+		else
+			perror(argv[arg]);
+		return 1;
+	}
+
+	if(instances){
+		printf("region,name,tid,depth,tsc");
+		for(i = 0; i < HPC_NUM_COUNTERS; i++)
+			printf(",incl_%s", columns[i]);
+		for(i = 0; i < HPC_NUM_COUNTERS; i++)
+			printf(",excl_%s", columns[i]);
+		printf("\r\n");
+	}
+	while((rc = LogReaderNext(&reader, &sample)) == 1){
+		if(sample.region == 0){
+			outside++;
+			continue;
+		}
+		total = FindRegion(sample.region);
+		if(total == NULL || Exclusive(&sample, exclusive) != 0){
+			untracked++;
+			continue;
+		}
+		total->instances++;
+		if(sample.depth > total->maxDepth)
+			total->maxDepth = sample.depth;
+		for(i = 0; i < HPC_NUM_COUNTERS; i++){
+			total->inclusive[i] += sample.ctr[i];
+			total->exclusive[i] += exclusive[i];
+		}
+		if(instances){
+			printf("%u,%s,%u,%u,%llu", sample.region, total->name, sample.tid, sample.depth, (unsigned long long)sample.tsc);
+			for(i = 0; i < HPC_NUM_COUNTERS; i++)
+				printf(",%llu", (unsigned long long)sample.ctr[i]);
+			for(i = 0; i < HPC_NUM_COUNTERS; i++)
+				printf(",%llu", (unsigned long long)exclusive[i]);
+			printf("\r\n");
+		}
+	}
+	if(rc < 0){
+		fprintf(stderr, "corrupt block after %llu samples\n", (unsigned long long)reader.samples);
+		return 1;
+	}
+
+	if(!instances){
+		qsort(regions, MAX_REGIONS, sizeof(REGION_TOTAL), CompareRegions);
+		printf("region,name,instances,max_depth");
+		for(i = 0; i < HPC_NUM_COUNTERS; i++)
+			printf(",incl_%s", columns[i]);
+		for(i = 0; i < HPC_NUM_COUNTERS; i++)
+			printf(",excl_%s", columns[i]);
+		printf("\r\n");
+		for(r = 0; r < MAX_REGIONS && regions[r].used; r++){
+			if(regions[r].instances == 0)
+				continue;		//only named
+			printf("%u,%s,%llu,%u", regions[r].region, regions[r].name, (unsigned long long)regions[r].instances, regions[r].maxDepth);
+			for(i = 0; i < HPC_NUM_COUNTERS; i++)
+				printf(",%llu", (unsigned long long)regions[r].inclusive[i]);
+			for(i = 0; i < HPC_NUM_COUNTERS; i++)
+				printf(",%llu", (unsigned long long)regions[r].exclusive[i]);
+			printf("\r\n");
+		}
+	}
+	if(outside != 0)
+		fprintf(stderr, "%llu samples outside regions\n", (unsigned long long)outside);
+	if(untracked != 0)
+		fprintf(stderr, "%llu region samples of too many threads or regions were skipped\n", (unsigned long long)untracked);
+	if(reader.header.dropped != 0)
+		fprintf(stderr, "warning: %llu samples were dropped, exclusive counts of their parents are too high\n",
+			(unsigned long long)reader.header.dropped);
+	LogReaderClose(&reader);
+	return 0;
+}
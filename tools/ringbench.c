@@ -0,0 +1,258 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Stress test and benchmark for the per-CPU sample rings (drv/hpcring.c) in user mode.
+* Each producer thread simulates the PMI handler of one CPU and writes numbered
+* samples into its own ring; one consumer thread drains all rings like the
+* driver's drain thread and checks that every sample arrives intact, in order,
+* and that received + dropped == produced.
+* With -l the rings live in a live region (drv/hpclive.h) and publish their heads,
+* and an observer thread follows them like a mapped live consumer; it checks that
+* every sample it accepts is intact and newer than the one before, and that
+* observed + lost == committed at the end.
+*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "hpcring.h"
+#include "hpclive.h"
+
+#define MAX_PRODUCERS 64
+
+typedef struct _PRODUCER {
+	SAMPLE_RING ring;
+	pthread_t thread;
+	UINT64 samples;			//samples to produce
+	UINT64 nsec;			//time spent producing
+	volatile int done;
+} PRODUCER;
+
+PRODUCER producers[MAX_PRODUCERS];
+int producerCount = 4;
+UINT64 samplesPerProducer = 10000000;
+UINT32 capacity = SAMPLE_RING_CAPACITY;
+useconds_t drainIntervalUs = 0;
+UINT64 pmiIntervalNs = 0;		//simulated time between two PMIs, 0 = back to back
+PHPC_LIVE_HEADER live = NULL;	//-l: the region of the rings
+
+//reader of the live region, which never writes to it
+typedef struct _OBSERVER {
+	pthread_t thread;
+	UINT64 observed;
+	UINT64 lost;
+	int errors;
+} OBSERVER;
+
+/*
+* Value stored in counter i (> 0) of sample seq, so the consumer can detect torn samples;
+* counter 0 holds seq itself. Counters are 48 bits wide.
+*/
+static UINT64 SampleValue(UINT64 seq, int i){
+	return (seq * 0x9E3779B97F4A7C15ULL + (UINT64)i) & 0xFFFFFFFFFFFFULL;
+}
+
+static UINT64 NowNs(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (UINT64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+* Simulated PMI handler: one sample per iteration, never blocks
+*/
+void *ProducerThread(void *arg){
+	PRODUCER *p = (PRODUCER *)arg;
+	PHPC_RECORD record;
+	UINT64 seq, start, spent = 0, t;
+	int i;
+
+	start = NowNs();
+	for(seq = 0; seq < p->samples; seq++){
+		if(pmiIntervalNs != 0){
+			t = NowNs();
+			while(NowNs() - t < pmiIntervalNs)
+				;
+			spent += NowNs() - t;
+		}
+		record = SampleRingReserve(&p->ring);
+		if(record == NULL)
+			continue;
+		SampleRecordSetCounter(record, 0, seq);
+		for(i = 1; i < HPC_NUM_COUNTERS; i++)
+			SampleRecordSetCounter(record, i, SampleValue(seq, i));
+		SampleRingCommit(&p->ring);
+	}
+	p->nsec = NowNs() - start - spent;
+	HpcStoreRelease((volatile UINT32 *)&p->done, 1);
+	return NULL;
+}
+
+/*
+* Live consumer: follows the published heads of all rings until the producers are done
+*/
+void *ObserverThread(void *arg){
+	OBSERVER *o = (OBSERVER *)arg;
+	UINT32 next[MAX_PRODUCERS];
+	UINT64 lastSeq[MAX_PRODUCERS];
+	HPC_SAMPLE sample;
+	int cpu, i, active;
+
+	memset(next, 0, sizeof(next));
+	memset(lastSeq, 0, sizeof(lastSeq));
+	do{
+		active = 0;
+		for(cpu = 0; cpu < producerCount; cpu++){
+			if(!HpcLoadAcquire((volatile UINT32 *)&producers[cpu].done))
+				active = 1;
+		}
+		for(cpu = 0; cpu < producerCount; cpu++){
+			while(LiveRead(live, (UINT32)cpu, &next[cpu], &o->lost, &sample)){
+				if(sample.cpu != cpu || sample.ctr[0] < lastSeq[cpu]){
+					o->errors++;
+					continue;
+				}
+				for(i = 1; i < HPC_NUM_COUNTERS; i++){
+					if(sample.ctr[i] != SampleValue(sample.ctr[0], i)){
+						o->errors++;
+						break;
+					}
+				}
+				lastSeq[cpu] = sample.ctr[0] + 1;
+				o->observed++;
+			}
+		}
+	}while(active);
+	return NULL;
+}
+
+int main(int argc, char *argv[]){
+	PHPC_RECORD slots, first;
+	UINT64 received[MAX_PRODUCERS], nextSeq[MAX_PRODUCERS];
+	UINT64 start, elapsed, totalReceived = 0, totalDropped = 0;
+	UINT64 committed = 0;
+	UINT32 count, k, cpuOffset, slotOffset;
+	OBSERVER observer;
+	size_t size;
+	int opt, cpu, i, active, errors = 0, observe = 0;
+
+	while((opt = getopt(argc, argv, "p:n:c:d:i:l")) != -1){
+		switch(opt){
+		case 'p': producerCount = atoi(optarg); break;
+		case 'n': samplesPerProducer = strtoull(optarg, NULL, 0); break;
+		case 'c': capacity = (UINT32)strtoul(optarg, NULL, 0); break;
+		case 'd': drainIntervalUs = (useconds_t)atoi(optarg); break;
+		case 'i': pmiIntervalNs = strtoull(optarg, NULL, 0); break;
+		case 'l': observe = 1; break;
+		default:
+			fprintf(stderr, "usage: %s [-p producers] [-n samples per producer] [-c ring capacity] [-d drain interval us] [-i pmi interval ns] [-l]\n", argv[0]);
+			fprintf(stderr, "  -l: publish the heads into a live region and follow them with an observer thread\n");
+			return 2;
+		}
+	}
+	if(producerCount < 1 || producerCount > MAX_PRODUCERS || capacity == 0 || (capacity & (capacity - 1)) != 0){
+		fprintf(stderr, "producers must be 1..%d and capacity a power of two\n", MAX_PRODUCERS);
+		return 2;
+	}
+
+	//the slots are cache lines like the nonpaged pool allocation of the driver, in pages for the live region
+	if(observe){
+		size = LiveLayout((UINT32)producerCount, capacity, &cpuOffset, &slotOffset);
+		live = (PHPC_LIVE_HEADER)aligned_alloc(HPC_LIVE_PAGE, size);
+		if(live == NULL){
+			perror("aligned_alloc");
+			return 1;
+		}
+		memset(live, 0, size);
+		LiveInit(live, (UINT32)producerCount, capacity);
+		slots = LiveSlots(live, 0);
+	}else{
+		slots = (PHPC_RECORD)aligned_alloc(HPC_CACHE_LINE, (size_t)producerCount * capacity * sizeof(HPC_RECORD));
+		if(slots == NULL){
+			perror("aligned_alloc");
+			return 1;
+		}
+		memset(slots, 0, (size_t)producerCount * capacity * sizeof(HPC_RECORD));
+	}
+
+	for(cpu = 0; cpu < producerCount; cpu++){
+		SampleRingInit(&producers[cpu].ring, slots + (size_t)cpu * capacity, capacity);
+		if(observe)
+			SampleRingPublish(&producers[cpu].ring, &LiveCpu(live, (UINT32)cpu)->head);
+		producers[cpu].samples = samplesPerProducer;
+		received[cpu] = 0;
+		nextSeq[cpu] = 0;
+	}
+	memset(&observer, 0, sizeof(observer));
+	if(observe)
+		pthread_create(&observer.thread, NULL, ObserverThread, &observer);
+	start = NowNs();
+	for(cpu = 0; cpu < producerCount; cpu++)
+		pthread_create(&producers[cpu].thread, NULL, ProducerThread, &producers[cpu]);
+
+	//drain thread: round-robin over the rings until every producer is done and its ring is empty
+	do{
+		active = 0;
+		for(cpu = 0; cpu < producerCount; cpu++){
+			if(!HpcLoadAcquire((volatile UINT32 *)&producers[cpu].done))
+				active = 1;
+			while((count = SampleRingPeek(&producers[cpu].ring, &first)) != 0){
+				for(k = 0; k < count; k++){
+					UINT64 seq = SampleRecordCounter(&first[k], 0);
+					if(seq < nextSeq[cpu] || seq >= samplesPerProducer){
+						errors++;
+						continue;
+					}
+					for(i = 1; i < HPC_NUM_COUNTERS; i++){
+						if(SampleRecordCounter(&first[k], i) != SampleValue(seq, i)){
+							errors++;
+							break;
+						}
+					}
+					nextSeq[cpu] = seq + 1;
+				}
+				received[cpu] += count;
+				SampleRingRelease(&producers[cpu].ring, count);
+			}
+		}
+		if(active && drainIntervalUs != 0)
+			usleep(drainIntervalUs);
+	}while(active);
+	elapsed = NowNs() - start;
+
+	for(cpu = 0; cpu < producerCount; cpu++){
+		pthread_join(producers[cpu].thread, NULL);
+		if(received[cpu] + producers[cpu].ring.dropped != samplesPerProducer){
+			fprintf(stderr, "ring %d: received %llu + dropped %u != produced %llu\n", cpu,
+				(unsigned long long)received[cpu], producers[cpu].ring.dropped, (unsigned long long)samplesPerProducer);
+			errors++;
+		}
+		printf("ring %d: %llu received, %u dropped, %.1f ns/sample in producer\n", cpu,
+			(unsigned long long)received[cpu], producers[cpu].ring.dropped,
+			(double)producers[cpu].nsec / (double)samplesPerProducer);
+		totalReceived += received[cpu];
+		totalDropped += producers[cpu].ring.dropped;
+		committed += producers[cpu].ring.head;
+	}
+	printf("total: %llu received, %llu dropped, %.2f Msamples/s drained, %d errors\n",
+		(unsigned long long)totalReceived, (unsigned long long)totalDropped,
+		(double)totalReceived * 1000.0 / (double)elapsed, errors);
+
+	if(observe){
+		pthread_join(observer.thread, NULL);
+		if(observer.observed + observer.lost != committed){
+			fprintf(stderr, "observer: observed %llu + lost %llu != committed %llu\n", (unsigned long long)observer.observed,
+				(unsigned long long)observer.lost, (unsigned long long)committed);
+			observer.errors++;
+		}
+		printf("observer: %llu observed, %llu lost, %d errors\n", (unsigned long long)observer.observed,
+			(unsigned long long)observer.lost, observer.errors);
+		errors += observer.errors;
+		free(live);
+	}else
+		free(slots);
+	return errors != 0;
+}
@@ -0,0 +1,229 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Simulated PMU, see simpmu.h.
+*/
+
+#include <string.h>
+#include "simpmu.h"
+
+#define EVTSEL_INT	0x00100000
+
+void SimPmuInit(PSIM_PMU sim){
+	memset(sim, 0, sizeof(*sim));
+	sim->cpiMilli = 800;
+	sim->refMilli = 1000;
+	sim->maxSkid = 8;
+	sim->readLatency = 100;
+	sim->writeLatency = 150;
+	sim->rdpmcLatency = 35;
+	sim->seed = 1;
+	PmuCapsInit(&sim->caps, 3, 4, 48, 0x7, 48);
+}
+
+UINT32 SimPmuEventRate(UINT64 evtsel){
+	//between 1 and 256 events per 1000 instructions, fixed for an event/umask pair
+	return ((UINT32)(evtsel & 0xFFFF) * 2654435761u >> 24) + 1;
+}
+
+/*
+* Column of the counter of an MSR, -1 if it is not a counter of caps
+*/
+static int CounterIndex(const SIM_PMU *sim, UINT32 msr){
+	UINT32 i;
+
+	for(i = 0; i < sim->caps.count; i++){
+		if(sim->caps.counter[i].msr == msr)
+			return (int)sim->caps.counter[i].column;
+	}
+	return -1;
+}
+
+/*
+* Fixed counter of a column, -1 for the programmable counters
+*/
+static int FixedIndex(int i){
+	if(i < HPC_COLUMN_PMC0)
+		return i;
+	return i == HPC_COLUMN_FIXED3 ? 3 : -1;
+}
+
+static int IsEvtsel(const SIM_PMU *sim, UINT32 msr){
+	return msr >= MSR_PERFEVTSEL0 && msr < MSR_PERFEVTSEL0 + sim->caps.usedProgrammable;
+}
+
+static int IsCounting(const SIM_PMU *sim, int i){
+	int fixed = FixedIndex(i);
+
+	if(!(sim->caps.columns & (1u << i)))
+		return 0;
+	if(fixed >= 0)
+		return ((sim->globalCtrl >> (32 + fixed)) & 1) && ((sim->fixedCtrl >> (4 * fixed)) & 0x3);
+	i -= HPC_COLUMN_PMC0;
+	return ((sim->globalCtrl >> i) & 1) && (sim->evtsel[i] & HPC_EVTSEL_EN) &&
+		(sim->evtsel[i] & (HPC_EVTSEL_USR | HPC_EVTSEL_OS));
+}
+
+static int RaisesPmi(const SIM_PMU *sim, int i){
+	int fixed = FixedIndex(i);
+
+	if(fixed >= 0)
+		return (sim->fixedCtrl >> (4 * fixed)) & 0x8;
+	return (sim->evtsel[i - HPC_COLUMN_PMC0] & EVTSEL_INT) != 0;
+}
+
+static UINT32 Rate(const SIM_PMU *sim, int i){
+	switch(i){
+	case 0:					return 1000;
+	case 1:					return sim->cpiMilli;
+	case 2:					return sim->refMilli;
+	case HPC_COLUMN_FIXED3:	return 4 * sim->cpiMilli;
+	default:				return SimPmuEventRate(sim->evtsel[i - HPC_COLUMN_PMC0]);
+	}
+}
+
+static UINT64 StatusBit(int i){
+	int fixed = FixedIndex(i);
+
+	return fixed >= 0 ? (UINT64)1 << (32 + fixed) : (UINT64)1 << (i - HPC_COLUMN_PMC0);
+}
+
+/*
+* Retire count instructions; returns 1 if a counter that raises PMIs wrapped around
+*/
+static int Advance(PSIM_PMU sim, UINT64 count){
+	UINT64 add;
+	int i, pmi = 0;
+
+	for(i = 0; i < HPC_NUM_COUNTERS; i++){
+		if(!IsCounting(sim, i))
+			continue;
+		add = count * Rate(sim, i) + sim->carry[i];
+		sim->carry[i] = add % 1000;
+		add /= 1000;
+		sim->counted[i] += add;
+		sim->counter[i] += add;
+		if(sim->counter[i] > sim->caps.mask[i]){
+			sim->counter[i] &= sim->caps.mask[i];
+			sim->globalStatus |= StatusBit(i);
+			if(RaisesPmi(sim, i))
+				pmi = 1;
+		}
+	}
+	add = count * sim->refMilli + sim->tscCarry;
+	sim->tscCarry = add % 1000;
+	sim->tsc += add / 1000;
+	sim->instructions += count;
+	return pmi;
+}
+
+/*
+* Events of the return from a PMI handler
+*/
+static void ReturnFromPmi(PSIM_PMU sim){
+	int i;
+
+	for(i = 1; i < HPC_NUM_COUNTERS; i++){
+		if(!IsCounting(sim, i))
+			continue;
+		sim->counted[i] += sim->pmiOverhead;
+		sim->counter[i] = (sim->counter[i] + sim->pmiOverhead) & sim->caps.mask[i];
+	}
+}
+
+UINT64 SimPmuRun(PSIM_PMU sim, UINT64 count){
+	UINT64 chunk, skid;
+
+	if(sim->pmiPending)
+		return 0;
+	if(sim->pmiTaken){
+		ReturnFromPmi(sim);
+		sim->pmiTaken = 0;
+	}
+
+	//fixed counter 0 counts instructions, so the instruction that overflows it is known exactly
+	chunk = count;
+	if(IsCounting(sim, 0) && RaisesPmi(sim, 0) && sim->caps.mask[0] + 1 - sim->counter[0] < chunk)
+		chunk = sim->caps.mask[0] + 1 - sim->counter[0];
+	if(!Advance(sim, chunk))
+		return chunk;
+
+	//the PMI arrives a few instructions after the overflow, uncounted if it froze the counters
+	if(sim->debugCtl & PMU_DEBUGCTL_FREEZE)
+		sim->globalCtrl = 0;
+	sim->seed = sim->seed * 1103515245 + 12345;
+	skid = sim->maxSkid ? (sim->seed >> 16) % (sim->maxSkid + 1) : 0;
+	Advance(sim, skid);
+	sim->pmiPending = 1;
+	sim->pmiTaken = 1;
+	return chunk + skid;
+}
+
+static UINT64 SimRead(void *context, UINT32 msr){
+	PSIM_PMU sim = (PSIM_PMU)context;
+	int i = CounterIndex(sim, msr);
+
+	sim->reads++;
+	sim->tsc += sim->readLatency;
+	if(i >= 0)
+		return sim->counter[i];
+	if(IsEvtsel(sim, msr))
+		return sim->evtsel[msr - MSR_PERFEVTSEL0];
+	switch(msr){
+	case MSR_FIXED_CTR_CTRL:		return sim->fixedCtrl;
+	case MSR_PERF_GLOBAL_STATUS:	return sim->globalStatus;
+	case MSR_PERF_GLOBAL_CTRL:		return sim->globalCtrl;
+	case MSR_DEBUGCTL:				return sim->debugCtl;
+	}
+	sim->unknown++;
+	return 0;
+}
+
+static void SimWrite(void *context, UINT32 msr, UINT64 value){
+	PSIM_PMU sim = (PSIM_PMU)context;
+	int i = CounterIndex(sim, msr);
+
+	sim->writes++;
+	sim->tsc += sim->writeLatency;
+	if(i >= 0){
+		sim->counter[i] = value & sim->caps.mask[i];
+		return;
+	}
+	if(IsEvtsel(sim, msr)){
+		sim->evtsel[msr - MSR_PERFEVTSEL0] = value;
+		return;
+	}
+	switch(msr){
+	case MSR_FIXED_CTR_CTRL:		sim->fixedCtrl = value; return;
+	case MSR_PERF_GLOBAL_CTRL:		sim->globalCtrl = value; return;
+	case MSR_PERF_GLOBAL_OVF_CTRL:	sim->globalStatus &= ~value; return;
+	case MSR_DEBUGCTL:				sim->debugCtl = value; return;
+	}
+	sim->unknown++;		//includes writes to the read-only GLOBAL_STATUS
+}
+
+static void SimReadCounters(void *context, UINT64 *values){
+	PSIM_PMU sim = (PSIM_PMU)context;
+	UINT32 i;
+
+	for(i = 0; i < sim->caps.count; i++)
+		values[sim->caps.counter[i].column] = sim->counter[sim->caps.counter[i].column];
+	sim->rdpmcs += sim->caps.count;
+	sim->tsc += sim->caps.count * sim->rdpmcLatency;
+}
+
+static UINT64 SimTsc(void *context){
+	PSIM_PMU sim = (PSIM_PMU)context;
+
+	sim->tsc += 25;		//rdtsc
+	return sim->tsc;
+}
+
+void SimPmuOps(PSIM_PMU sim, PPMU_OPS ops){
+	ops->read = SimRead;
+	ops->write = SimWrite;
+	ops->readCounters = SimReadCounters;
+	ops->tsc = SimTsc;
+	ops->context = sim;
+	ops->caps = &sim->caps;
+}
@@ -0,0 +1,68 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Simulated PMU behind the PMU_OPS interface of drv/hpcpmu.h.
+* It models the MSRs the handlers use: the fixed and programmable counters of caps,
+* which wrap around at their width (by default three fixed and four programmable
+* counters of 48 bits, as on Nehalem), IA32_FIXED_CTR_CTRL, IA32_PERFEVTSELx,
+* IA32_PERF_GLOBAL_CTRL, IA32_PERF_GLOBAL_STATUS, IA32_PERF_GLOBAL_OVF_CTRL and
+* IA32_DEBUGCTL, of which only FREEZE_PERFMON_ON_PMI has an effect.
+* The workload retires instructions at a fixed CPI; every programmable event occurs
+* at a rate derived from its event select value, fixed counter 3 at four slots per
+* cycle. Accesses to counters caps does not have count as unknown. A counter that wraps sets its bit in
+* GLOBAL_STATUS and, if its PMI bit is set, raises a PMI after a few instructions of
+* skid, which the counters count unless the PMI froze them. The return from a PMI
+* adds pmiOverhead events to every counter but fixed counter 0, which stands for the
+* events of the interrupt path that user-mode counters see. The time stamp counter advances with the cycles of the workload and with a
+* configurable latency for every MSR access and rdpmc, so the cost of a handler can be given
+* in cycles of the modeled machine as well as in ns of the host.
+*/
+
+#ifndef SIMPMU_H
+#define SIMPMU_H
+
+#include "hpcpmu.h"
+
+typedef struct _SIM_PMU {
+	PMU_CAPS caps;						//counters modeled, set with PmuCapsInit after SimPmuInit
+	UINT64 counter[HPC_NUM_COUNTERS];	//in sample column order, see HPC_COLUMN_NAMES
+	UINT64 evtsel[HPC_MAX_PROGRAMMABLE];
+	UINT64 fixedCtrl;
+	UINT64 globalCtrl;
+	UINT64 globalStatus;
+	UINT64 debugCtl;
+	UINT64 tsc;
+
+	//workload model
+	UINT32 cpiMilli;					//cycles per 1000 instructions
+	UINT32 refMilli;					//reference cycles per 1000 instructions
+	UINT32 maxSkid;						//instructions retired between an overflow and its PMI, 0..maxSkid
+	UINT32 pmiOverhead;					//events added to every counter but fixed counter 0 when the handler of a PMI returns
+	UINT32 readLatency;					//cycles of an MSR read
+	UINT32 writeLatency;				//cycles of an MSR write
+	UINT32 rdpmcLatency;				//cycles of an rdpmc
+	UINT32 seed;
+
+	//events and reference cycles left over from fractional rates, in thousandths
+	UINT64 carry[HPC_NUM_COUNTERS];
+	UINT64 tscCarry;
+
+	UINT64 counted[HPC_NUM_COUNTERS];	//events added to each counter since SimPmuInit, the ground truth
+	UINT64 instructions;				//instructions retired in total
+	UINT64 reads, writes;				//MSR accesses
+	UINT64 rdpmcs;						//counters read with rdpmc
+	UINT64 unknown;						//accesses to MSRs that are not modeled
+	int pmiPending;						//a PMI is raised and not yet taken
+	int pmiTaken;						//the PMI is taken, its overhead is added by the next SimPmuRun
+} SIM_PMU, *PSIM_PMU;
+
+void SimPmuInit(PSIM_PMU sim);
+void SimPmuOps(PSIM_PMU sim, PPMU_OPS ops);
+
+//events per 1000 instructions of a programmable counter programmed with evtsel
+UINT32 SimPmuEventRate(UINT64 evtsel);
+
+//retire up to count instructions, stopping when a PMI is raised; returns the instructions retired
+UINT64 SimPmuRun(PSIM_PMU sim, UINT64 count);
+
+#endif
@@ -0,0 +1,164 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Accuracy and cost of the online aggregation of drv/hpcstats.h. For synthetic
+* distributions shaped like counter values (uniform, lognormal, bimodal, Pareto and
+* small integers) it adds the values to one metric per part of the input, merges the
+* parts like hpcstats merges runs, and compares with the exact values of the sorted input:
+*	- quantiles: relative error at most 1/(2*STAT_SUB_BUCKETS), the bound of the sketch
+*	- mean and standard deviation: relative error below 1e-9 of the two-pass values
+*	- min, max and count: exact, and the merged buckets equal those of one metric of all values
+* and reports the ns per added value. Exits with 1 if a check fails.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "hpcstats.h"
+
+#define MAX_PARTS 64
+
+static const double quantiles[] = { 0.001, 0.01, 0.1, 0.25, 0.5, 0.75, 0.9, 0.99, 0.999 };
+#define QUANTILES ((int)(sizeof(quantiles) / sizeof(quantiles[0])))
+
+static const char *distributions[] = { "uniform", "lognormal", "bimodal", "pareto", "small" };
+#define DISTRIBUTIONS ((int)(sizeof(distributions) / sizeof(distributions[0])))
+
+static UINT64 rngState = 0x9E3779B97F4A7C15ull;
+
+static UINT64 NowNs(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (UINT64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//xorshift64*, uniform in (0, 1)
+static double Uniform(){
+	rngState ^= rngState >> 12;
+	rngState ^= rngState << 25;
+	rngState ^= rngState >> 27;
+	return ((double)((rngState * 0x2545F4914F6CDD1Dull) >> 11) + 0.5) / 9007199254740992.0;
+}
+
+static double Normal(){
+	return sqrt(-2 * log(Uniform())) * cos(6.283185307179586 * Uniform());
+}
+
+/*
+* One value of a distribution, in the range of the counts of a 50000-instruction window
+*/
+static UINT64 Draw(int distribution){
+	double x;
+
+	switch(distribution){
+	case 0:		x = 1000 + Uniform() * 99000; break;							//ins around the period
+	case 1:		x = exp(log(60000) + 0.6 * Normal()); break;					//cycles
+	case 2:		x = Uniform() < 0.7 ? 2000 + 300 * Normal() : 40000 + 5000 * Normal(); break;	//cache misses of two phases
+	case 3:		x = 1000 / pow(Uniform(), 1 / 1.2); break;						//heavy tail
+	default:	x = -log(Uniform()) * 4; break;									//rare events, mostly below the exact range
+	}
+	if(x < 0)
+		x = 0;
+	if(x > 1e14)
+		x = 1e14;
+	return (UINT64)x;
+}
+
+static int CompareValues(const void *a, const void *b){
+	UINT64 x = *(const UINT64 *)a, y = *(const UINT64 *)b;
+	return x < y ? -1 : x > y;
+}
+
+int main(int argc, char *argv[]){
+	static STAT_METRIC parts[MAX_PARTS], merged, single;
+	UINT64 *values, start, elapsed = 0, exact, estimate;
+	double mean, m2, delta, error, maxError, bound = 1.0 / (2 * STAT_SUB_BUCKETS);
+	long count = 1000000, i;
+	int partCount = 8, opt, d, p, q, errors = 0;
+
+	while((opt = getopt(argc, argv, "n:p:")) != -1){
+		switch(opt){
+		case 'n': count = atol(optarg); break;
+		case 'p': partCount = atoi(optarg); break;
+		default:
+			fprintf(stderr, "usage: %s [-n values per distribution] [-p parts merged]\n", argv[0]);
+			return 2;
+		}
+	}
+	if(count < 2 || partCount < 1 || partCount > MAX_PARTS){
+		fprintf(stderr, "at least 2 values and 1..%d parts\n", MAX_PARTS);
+		return 2;
+	}
+	values = malloc(count * sizeof(UINT64));
+	if(values == NULL){
+		perror("malloc");
+		return 1;
+	}
+
+	printf("metric: %u bytes, %d buckets, quantile error bound %.4f\n", (unsigned)sizeof(STAT_METRIC), STAT_BUCKETS, bound);
+	printf("distribution,values,ns/value,max_quantile_error,mean_error,sd_error,check\n");
+	for(d = 0; d < DISTRIBUTIONS; d++){
+		for(i = 0; i < count; i++)
+			values[i] = Draw(d);
+
+		//every part is a run of its own, merged afterwards
+		StatInit(&single);
+		StatInit(&merged);
+		for(p = 0; p < partCount; p++)
+			StatInit(&parts[p]);
+		start = NowNs();
+		for(i = 0; i < count; i++)
+			StatAdd(&parts[i * partCount / count], values[i]);
+		elapsed = NowNs() - start;
+		for(p = 0; p < partCount; p++)
+			StatMerge(&merged, &parts[p]);
+		for(i = 0; i < count; i++)
+			StatAdd(&single, values[i]);
+
+		//exact values: two-pass mean and variance, quantiles of the sorted values
+		mean = 0;
+		for(i = 0; i < count; i++)
+			mean += (double)values[i];
+		mean /= (double)count;
+		m2 = 0;
+		for(i = 0; i < count; i++){
+			delta = (double)values[i] - mean;
+			m2 += delta * delta;
+		}
+		qsort(values, count, sizeof(UINT64), CompareValues);
+
+		p = 1;
+		maxError = 0;
+		for(q = 0; q < QUANTILES; q++){
+			exact = values[(long)(quantiles[q] * (double)(count - 1))];
+			estimate = StatQuantile(&merged, quantiles[q]);
+			error = exact != 0 ? fabs((double)estimate - (double)exact) / (double)exact : (double)estimate;
+			if(error > maxError)
+				maxError = error;
+			if(error > bound + 1e-12){
+				fprintf(stderr, "%s: p%g is %llu instead of %llu\n", distributions[d], quantiles[q] * 100,
+					(unsigned long long)estimate, (unsigned long long)exact);
+				p = 0;
+			}
+		}
+		if(merged.count != (UINT64)count || merged.min != values[0] || merged.max != values[count - 1]
+			|| memcmp(merged.buckets, single.buckets, sizeof(merged.buckets)) != 0){
+			fprintf(stderr, "%s: merged count, min, max or buckets differ\n", distributions[d]);
+			p = 0;
+		}
+		delta = fabs(merged.mean - mean) / mean;
+		error = fabs(sqrt(StatVariance(&merged)) - sqrt(m2 / (double)(count - 1))) / sqrt(m2 / (double)(count - 1));
+		if(delta > 1e-9 || error > 1e-9){
+			fprintf(stderr, "%s: mean or standard deviation off\n", distributions[d]);
+			p = 0;
+		}
+		printf("%s,%ld,%.1f,%.5f,%.2e,%.2e,%s\n", distributions[d], count, (double)elapsed / (double)count,
+			maxError, delta, error, p ? "ok" : "FAILED");
+		errors += !p;
+	}
+	free(values);
+	return errors != 0;
+}
@@ -0,0 +1,568 @@
+/*
+* Copyright University of North Carolina, 2018
+*
+* Check of the per-thread counter virtualization of the driver (drv/hpcvirt.c) against a
+* simulated scheduler. Test threads are created, run in slices on SIM_CPUS CPUs with a
+* simulated PMU each (simpmu.c) and exit, in a random but reproducible order. The CPUs also
+* run slices of other programs in between. The trace goes through the same calls the
+* driver makes:
+*	- the SwapContext hook: CounterVirtSwitchOut of the exiting thread, CounterVirtSwitchIn
+*	  of the incoming one, then its event group and sampling window
+*	- the PMI handler (sampling) or the traps of the thread (polling)
+*	- the thread notify routine: PmuThreadExit, while the thread still runs; sometimes another
+*	  CPU switches in a new thread, which may take the freed slot, and PMIs or traps come
+*	  before the exiting thread is switched out, and must not touch any context
+*	- at the end, the leftover windows of the saved threads, as ReadFinalSample
+* Every thread's samples plus its leftover windows must add up, in every counter, to
+* the events its PMU counted while the thread ran. The driver drops the last, partial
+* window of a thread that exits or still runs at the end; the simulator takes those from
+* the counters itself, so the check also covers the windows the driver does not record.
+*
+* The table of thread contexts is small, and the number of live threads moves above its
+* size and back below it, so it covers the full table (the thread shares the live counters
+* and is not checked, but every slot must then hold a live thread) and the reuse of the
+* tombstones of exited threads. KTHREAD addresses are reused by later threads, and some exit
+* notifications are missed, so a stale context must be reset for the new thread.
+* With rdpmc=on (polling, without traps) the counters a thread reads itself must also go on
+* where they stood at its last switch-out, whichever CPU it comes back on and whatever ran
+* there in between; programmable counters modulo 2^31, the bits the driver can write.
+* Exits with 1 if a check fails.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "hpcvirt.h"
+#include "simpmu.h"
+
+#define SIM_CPUS		4
+#define MAX_THREADS		65536			//threads over the whole trace
+#define MAX_TABLE		1024
+#define ADDRESS_RATIO	4				//KTHREAD addresses per slot of the table, reused by later threads
+#define ADDRESS_BASE	0x85A31000u
+#define ADDRESS_STEP	0x2C0			//sizeof(ETHREAD) on 32-bit Windows 7, rounded
+#define SLICE_LENGTH	60000			//longest time slice in instructions, three periods of the sampling run
+
+//thread state in the simulator
+#define SIM_READY		0
+#define SIM_RUNNING		1
+#define SIM_EXITED		2
+
+typedef struct _SIM_CPU {
+	SIM_PMU sim;
+	PMU_OPS ops;
+	CPU_STATE cpu;
+	int running;						//thread index, -1 while another program runs
+} SIM_CPU, *PSIM_CPU;
+
+typedef struct _SIM_THREAD {
+	UINT_PTR kthread;
+	UINT32 tid;
+	int state;							//SIM_*
+	int shared;							//ran without a context once: its counts are not virtualized
+	int lost;							//its exit was missed and its address taken by a new thread
+	int notified;						//CounterVirtThreadExit was called
+	UINT64 truth[HPC_NUM_COUNTERS];		//events the PMU counted while it ran
+	UINT64 recorded[HPC_NUM_COUNTERS];	//its samples and leftover windows
+	UINT64 user[HPC_NUM_COUNTERS];		//rdpmc=on: the counters it read at its last switch-out, 0 before
+} SIM_THREAD, *PSIM_THREAD;
+
+typedef struct _TRACE {
+	UINT64 switches;
+	UINT64 samples;
+	UINT64 full;						//switch-ins that found the table full
+	UINT64 tombstones;					//contexts inserted into the slot of an exited thread
+	UINT64 stale;						//switch-ins that reset the context of a missed exit
+	UINT64 tails;						//exited threads that ran on after a switch-in on another CPU
+	UINT64 resumed;						//rdpmc=on: switch-ins whose counters were compared
+	UINT64 checked;
+	UINT64 errors;
+} TRACE, *PTRACE;
+
+static HPC_CONFIG config;
+static SIM_CPU cpus[SIM_CPUS];
+static HPC_RECORD slots[SIM_CPUS][SAMPLE_RING_CAPACITY];
+static SIM_THREAD threads[MAX_THREADS];
+static UINT32 threadCount;
+static int live[MAX_TABLE * 2];			//threads that did not exit
+static UINT32 liveCount;
+static int addressOwner[MAX_TABLE * ADDRESS_RATIO];	//thread index last using the address, -1 if none
+static COUNTER_VIRT virt;
+static PTHREAD_CONTEXT contexts;
+static UINT32 tableSize = 32;
+static UINT32 currentCpu;				//KeGetCurrentProcessorNumber of the COUNTER_OPS
+static UINT64 rngState = 1;
+
+static UINT32 Random(UINT32 n){
+	rngState = rngState * 6364136223846793005ULL + 1442695040888963407ULL;
+	return (UINT32)((rngState >> 33) % n);
+}
+
+static void ReadCounters(void *context, UINT64 *values){
+	(void)context;
+	PmuSaveWindow(&cpus[currentCpu].ops, &config, &cpus[currentCpu].cpu, values);
+}
+
+static void WriteCounters(void *context, const UINT64 *values){
+	(void)context;
+	PmuRestoreWindow(&cpus[currentCpu].ops, &config, &cpus[currentCpu].cpu, values);
+}
+
+static int ThreadOfTid(UINT32 tid){
+	return (int)(tid / 4) - 1;
+}
+
+static UINT32 CountSlots(UINT_PTR key){
+	UINT32 i, count = 0;
+
+	for(i = 0; i < tableSize; i++)
+		count += contexts[i].thread == key;
+	return count;
+}
+
+/*
+* Hand the samples of a CPU to their threads, like the drain thread
+*/
+static void Drain(PTRACE trace, UINT32 c){
+	PHPC_RECORD first;
+	HPC_SAMPLE sample;
+	UINT32 count, i;
+	int j, t;
+
+	while((count = SampleRingPeek(&cpus[c].cpu.ring, &first)) != 0){
+		for(i = 0; i < count; i++){
+			SampleRecordUnpack(&first[i], (UINT16)c, &sample);
+			t = ThreadOfTid(sample.tid);
+			if(t < 0 || (UINT32)t >= threadCount){
+				printf("  sample of unknown thread %u\n", sample.tid);
+				trace->errors++;
+				continue;
+			}
+			for(j = 0; j < HPC_NUM_COUNTERS; j++)
+				threads[t].recorded[j] += sample.ctr[j];
+		}
+		trace->samples += count;
+		SampleRingRelease(&cpus[c].cpu.ring, count);
+	}
+}
+
+/*
+* Retire instructions on a CPU, taking its PMIs, or its traps in the polling mode (none
+* once the notify routine ran, the thread is in the kernel then);
+* the events belong to the thread that runs
+*/
+static void RunSlice(UINT32 c, UINT64 instructions){
+	PSIM_CPU s = &cpus[c];
+	UINT64 before[HPC_NUM_COUNTERS], done, step;
+	int i;
+
+	memcpy(before, s->sim.counted, sizeof(before));
+	while(instructions != 0){
+		step = config.mode == HPC_MODE_POLLING ? 1 + Random((UINT32)instructions) : instructions;
+		done = SimPmuRun(&s->sim, step);
+		instructions -= done < instructions ? done : instructions;
+		if(s->sim.pmiPending){
+			s->sim.pmiPending = 0;
+			PmuHandlePmi(&s->ops, &config, &s->cpu, 0x00401000, 0x1B);
+		}else if(config.mode == HPC_MODE_POLLING && !config.rdpmc && s->running >= 0 && !threads[s->running].notified && Random(4) == 0)
+			PmuHandleTrap(&s->ops, &config, &s->cpu, 1, s->cpu.tid, 0x00401000, 0x1B);
+	}
+	//after the notify routine the driver drops the counts of the thread
+	if(s->running >= 0 && !threads[s->running].notified){
+		for(i = 0; i < HPC_NUM_COUNTERS; i++)
+			threads[s->running].truth[i] += s->sim.counted[i] - before[i];
+	}
+}
+
+/*
+* The part of the current window that no sample holds yet
+*/
+static void TakeWindow(UINT32 c, UINT64 *counts){
+	PSIM_CPU s = &cpus[c];
+	UINT64 raw[HPC_NUM_COUNTERS];
+	int i;
+
+	PmuReadCounters(&s->ops, raw);
+	for(i = 0; i < HPC_NUM_COUNTERS; i++)
+		counts[i] += (raw[i] - s->cpu.base[i]) & s->sim.caps.mask[i];
+}
+
+/*
+* rdpmc=on: the counters as the running thread reads them must go on from its last switch-out
+*/
+static void CheckUserCounters(PTRACE trace, UINT32 c, const SIM_THREAD *thread){
+	PSIM_CPU s = &cpus[c];
+	UINT64 raw[HPC_NUM_COUNTERS], mask;
+	int i;
+
+	PmuReadCounters(&s->ops, raw);
+	trace->resumed++;
+	for(i = 0; i < HPC_NUM_COUNTERS; i++){
+		mask = i >= HPC_COLUMN_PMC0 && i < HPC_COLUMN_FIXED3 ? PMU_PMC_WRITE_MASK : s->sim.caps.mask[i];
+		if(((raw[i] ^ thread->user[i]) & mask) != 0 && trace->errors++ < 5)
+			printf("  thread %u reads counter %d as %llx on CPU %u, left it at %llx\n", thread->tid, i,
+				(unsigned long long)(raw[i] & mask), c, (unsigned long long)(thread->user[i] & mask));
+	}
+}
+
+/*
+* Every slot holds a thread that is alive or whose exit was missed
+*/
+static int TableIsFull(){
+	UINT32 i;
+	int t;
+
+	for(i = 0; i < tableSize; i++){
+		if(contexts[i].thread == THREAD_SLOT_EMPTY || contexts[i].thread == THREAD_SLOT_REMOVED)
+			return 0;
+		t = ThreadOfTid(contexts[i].tid);
+		if(t < 0 || (threads[t].state == SIM_EXITED && threads[t].notified))
+			return 0;
+	}
+	return 1;
+}
+
+/*
+* The SwapContext hook of the driver, SaveRestoreCounters: next is -1 for another program
+*/
+static void Switch(PTRACE trace, UINT32 c, int next){
+	PSIM_CPU s = &cpus[c];
+	PSIM_THREAD thread;
+	PTHREAD_CONTEXT ctx;
+	UINT32 removed;
+	int prev = s->running;
+
+	currentCpu = c;
+	trace->switches++;
+	if(prev >= 0){
+		if(config.rdpmc && s->cpu.thread != NULL)
+			PmuReadCounters(&s->ops, threads[prev].user);
+		ctx = CounterVirtSwitchOut(&virt, threads[prev].kthread);
+		if(threads[prev].state == SIM_EXITED && threads[prev].notified && ctx != NULL){
+			printf("  thread %u was saved after its exit\n", threads[prev].tid);
+			trace->errors++;
+		}
+		if(threads[prev].state == SIM_RUNNING)
+			threads[prev].state = SIM_READY;
+	}
+
+	s->running = next;
+	if(next < 0){
+		s->cpu.isTestThread = 0;
+		s->cpu.thread = NULL;
+		return;
+	}
+	thread = &threads[next];
+	thread->state = SIM_RUNNING;
+	removed = CountSlots(THREAD_SLOT_REMOVED);
+	ctx = CounterVirtFind(&virt, thread->kthread);
+	if(ctx != NULL && ctx->tid != thread->tid)
+		trace->stale++;
+
+	s->cpu.isTestThread = 1;
+	s->cpu.tid = thread->tid;
+	s->cpu.thread = CounterVirtSwitchIn(&virt, thread->kthread, thread->tid);
+	if(s->cpu.thread == NULL){
+		trace->full++;
+		thread->shared = 1;
+		if(!TableIsFull()){
+			printf("  thread %u got no context, but the table has room\n", thread->tid);
+			trace->errors++;
+		}
+		return;
+	}
+	if(ctx == NULL && CountSlots(THREAD_SLOT_REMOVED) < removed)
+		trace->tombstones++;
+	if(s->cpu.thread->tid != thread->tid || CounterVirtFind(&virt, thread->kthread) != s->cpu.thread){
+		printf("  thread %u switched in with the context of %u\n", thread->tid, s->cpu.thread->tid);
+		trace->errors++;
+	}
+	if(s->cpu.thread->group != s->cpu.group)
+		PmuProgramGroup(&s->ops, &config, &s->cpu, s->cpu.thread->group);
+	PmuResumeWindow(&s->sim.caps, &config, &s->cpu, s->cpu.thread->period);
+	if(config.rdpmc)
+		CheckUserCounters(trace, c, thread);
+}
+
+/*
+* The KTHREAD of an exited thread is only freed after its last switch-out
+*/
+static int IsRunning(int t){
+	UINT32 c;
+
+	for(c = 0; c < SIM_CPUS; c++){
+		if(cpus[c].running == t)
+			return 1;
+	}
+	return 0;
+}
+
+/*
+* A new thread at a free KTHREAD address
+*/
+static int CreateThread(){
+	PSIM_THREAD thread;
+	UINT32 addresses = tableSize * ADDRESS_RATIO, a;
+	int owner;
+
+	if(threadCount == MAX_THREADS || liveCount == sizeof(live) / sizeof(live[0]))
+		return -1;
+	for(a = Random(addresses); ; a = (a + 1) % addresses){
+		owner = addressOwner[a];
+		if(owner < 0 || (threads[owner].state == SIM_EXITED && !IsRunning(owner)))
+			break;
+	}
+	//a missed exit leaves a stale context that the new thread takes over
+	if(owner >= 0 && !threads[owner].notified && CounterVirtFind(&virt, threads[owner].kthread) != NULL)
+		threads[owner].lost = 1;
+	addressOwner[a] = (int)threadCount;
+	thread = &threads[threadCount];
+	memset(thread, 0, sizeof(*thread));
+	thread->kthread = ADDRESS_BASE + a * ADDRESS_STEP;
+	thread->tid = 4 * (threadCount + 1);
+	thread->state = SIM_READY;
+	live[liveCount++] = (int)threadCount;
+	return (int)threadCount++;
+}
+
+/*
+* The running thread of a CPU exits: the notify routine runs in its context, then it is switched out
+*/
+static void ExitThread(PTRACE trace, UINT32 c){
+	PSIM_THREAD thread = &threads[cpus[c].running];
+	UINT32 i;
+
+	currentCpu = c;
+	//the driver drops the last window, the simulator keeps it; a missed exit saves it at the switch-out instead
+	thread->notified = Random(20) != 0;
+	if(thread->notified){
+		if(cpus[c].cpu.thread != NULL)
+			TakeWindow(c, thread->recorded);
+		PmuThreadExit(&virt, &cpus[c].cpu, thread->kthread);
+		if(CounterVirtFind(&virt, thread->kthread) != NULL){
+			printf("  thread %u keeps its context after its exit\n", thread->tid);
+			trace->errors++;
+		}
+	}
+	thread->state = SIM_EXITED;
+	for(i = 0; live[i] != cpus[c].running; i++)
+		;
+	live[i] = live[--liveCount];
+}
+
+static int PickReady(){
+	int t, tries;
+
+	for(tries = 0; tries < 16 && liveCount != 0; tries++){
+		t = live[Random(liveCount)];
+		if(threads[t].state == SIM_READY)
+			return t;
+	}
+	return -1;
+}
+
+/*
+* Between the notify routine and the switch-out of an exited thread, another CPU switches in
+* a thread, new if there is room, and the exited one runs on: its PMIs and traps must leave
+* every context alone, also the one a new thread may have taken over from it
+*/
+static void ExitTail(PTRACE trace, UINT32 c){
+	THREAD_CONTEXT before[MAX_TABLE];
+	UINT32 other = (c + 1 + Random(SIM_CPUS - 1)) % SIM_CPUS;
+	int t;
+
+	t = CreateThread();
+	if(t < 0)
+		t = PickReady();
+	Switch(trace, other, t);
+	Drain(trace, other);
+	memcpy(before, contexts, tableSize * sizeof(THREAD_CONTEXT));
+	currentCpu = c;
+	RunSlice(c, 1000 + Random(SLICE_LENGTH));
+	if(memcmp(before, contexts, tableSize * sizeof(THREAD_CONTEXT)) != 0){
+		printf("  thread %u changed a context after its exit\n", threads[cpus[c].running].tid);
+		trace->errors++;
+	}
+	trace->tails++;
+}
+
+/*
+* Leftover windows of the saved threads at the end of the run, as ReadFinalSample
+*/
+static void FinalWindows(){
+	PTHREAD_CONTEXT ctx;
+	UINT32 i;
+	int j, t;
+
+	for(i = 0; i < tableSize; i++){
+		ctx = &contexts[i];
+		if(ctx->thread == THREAD_SLOT_EMPTY || ctx->thread == THREAD_SLOT_REMOVED || ctx->state != THREAD_STATE_SAVED)
+			continue;
+		t = ThreadOfTid(ctx->tid);
+		for(j = 0; j < HPC_NUM_COUNTERS; j++)
+			threads[t].recorded[j] += PmuCounterValue(&cpus[0].sim.caps, &config, j, ctx->ctr[j]);
+	}
+}
+
+static int Simulate(const SIM_PMU *model, UINT64 switches){
+	COUNTER_OPS ops;
+	UINT64 initial[HPC_NUM_COUNTERS] = { 0 };
+	TRACE trace;
+	UINT32 c, target;
+	UINT64 n;
+	int t, j, bad;
+
+	memset(&trace, 0, sizeof(trace));
+	memset(addressOwner, 0xFF, sizeof(addressOwner));
+	threadCount = 0;
+	liveCount = 0;
+	for(c = 0; c < SIM_CPUS; c++){
+		memset(&cpus[c], 0, sizeof(cpus[c]));
+		cpus[c].sim = *model;
+		cpus[c].sim.seed = c + 1;
+		SimPmuOps(&cpus[c].sim, &cpus[c].ops);
+		SampleRingInit(&cpus[c].cpu.ring, slots[c], SAMPLE_RING_CAPACITY);
+		cpus[c].cpu.number = (UINT16)c;
+		cpus[c].running = -1;
+		PmuStart(&cpus[c].ops, &config, &cpus[c].cpu);
+	}
+	initial[0] = PmuPreload(&model->caps, &config, 0);
+	ops.read = ReadCounters;
+	ops.write = WriteCounters;
+	ops.context = NULL;
+	CounterVirtInit(&virt, contexts, tableSize, &ops, initial);
+
+	for(n = 0; n < switches; n++){
+		//the live threads move around the size of the table: below, above, far below
+		target = (n * 6 / switches) % 3 == 0 ? tableSize * 3 / 4 : (n * 6 / switches) % 3 == 1 ? tableSize * 3 / 2 : tableSize / 4;
+		if(liveCount < target)
+			CreateThread();
+
+		c = Random(SIM_CPUS);
+		RunSlice(c, 1000 + Random(SLICE_LENGTH));
+		if(cpus[c].running >= 0 && Random(liveCount > target ? 2 : 16) == 0){
+			ExitThread(&trace, c);
+			if(threads[cpus[c].running].notified && Random(2) == 0)
+				ExitTail(&trace, c);
+		}
+		t = Random(5) == 0 ? -1 : PickReady();
+		Switch(&trace, c, t);
+		Drain(&trace, c);
+	}
+
+	//the run stops: the running threads are switched out one last time
+	for(c = 0; c < SIM_CPUS; c++){
+		if(cpus[c].running >= 0){
+			currentCpu = c;
+			TakeWindow(c, threads[cpus[c].running].recorded);
+			cpus[c].running = -1;
+		}
+		Drain(&trace, c);
+	}
+	FinalWindows();
+
+	for(t = 0; t < (int)threadCount; t++){
+		if(threads[t].shared || threads[t].lost)
+			continue;
+		trace.checked++;
+		for(j = 0, bad = 0; j < HPC_NUM_COUNTERS; j++)
+			bad |= threads[t].recorded[j] != threads[t].truth[j];
+		if(bad && trace.errors++ < 5){
+			printf("  thread %u:", threads[t].tid);
+			for(j = 0; j < HPC_NUM_COUNTERS; j++){
+				if(threads[t].recorded[j] != threads[t].truth[j])
+					printf(" counter %d recorded %llu counted %llu", j, (unsigned long long)threads[t].recorded[j],
+						(unsigned long long)threads[t].truth[j]);
+			}
+			printf("\n");
+		}
+	}
+	if(virt.overflows != trace.full){
+		printf("  %u overflows counted by the table, %llu seen\n", virt.overflows, (unsigned long long)trace.full);
+		trace.errors++;
+	}
+	//the trace must reach the cases it is there for
+	if(trace.full == 0 || trace.tombstones == 0 || trace.stale == 0 || trace.tails == 0){
+		printf("  the trace did not cover a full table, tombstone reuse, stale contexts and exiting threads that run on\n");
+		trace.errors++;
+	}
+	for(c = 0; c < SIM_CPUS; c++){
+		if(cpus[c].cpu.ring.dropped != 0 || cpus[c].sim.unknown != 0){
+			printf("  CPU %u: %u samples dropped, %llu unknown MSRs\n", c, cpus[c].cpu.ring.dropped,
+				(unsigned long long)cpus[c].sim.unknown);
+			trace.errors++;
+		}
+	}
+
+	if(config.rdpmc && trace.resumed == 0){
+		printf("  no switch-in compared the counters a thread reads\n");
+		trace.errors++;
+	}
+
+	printf("%s: %llu switches of %u threads on %d CPUs, table of %u, %u groups\n",
+		config.mode == HPC_MODE_SAMPLING ? "sampling" : config.rdpmc ? "polling, rdpmc=on" : "polling",
+		(unsigned long long)trace.switches, threadCount, SIM_CPUS, tableSize, config.groupCount);
+	printf("  %llu samples, %llu switch-ins to a full table, %llu tombstones reused, %llu stale contexts reset, %llu exits run on\n",
+		(unsigned long long)trace.samples, (unsigned long long)trace.full, (unsigned long long)trace.tombstones,
+		(unsigned long long)trace.stale, (unsigned long long)trace.tails);
+	printf("  %llu threads checked: %s\n", (unsigned long long)trace.checked, trace.errors ? "FAILED" : "ok");
+	return trace.errors != 0;
+}
+
+int main(int argc, char *argv[]){
+	SIM_PMU model;
+	UINT64 switches = 200000;
+	UINT32 groups = 2, g, i;
+	int c, modes = 7, errors = 0;
+
+	while((c = getopt(argc, argv, "n:m:s:g:")) != -1){
+		switch(c){
+		case 'n': switches = strtoull(optarg, NULL, 0); break;
+		case 'm': modes = strcmp(optarg, "sampling") == 0 ? 1 : strcmp(optarg, "polling") == 0 ? 2 : strcmp(optarg, "rdpmc") == 0 ? 4 : 7; break;
+		case 's': tableSize = (UINT32)strtoul(optarg, NULL, 0); break;
+		case 'g': groups = (UINT32)atoi(optarg); break;
+		default:
+			fprintf(stderr, "usage: %s [-n switches] [-m sampling|polling|rdpmc|all] [-s table size] [-g groups]\n", argv[0]);
+			return 2;
+		}
+	}
+	if(switches == 0 || tableSize < 8 || tableSize > MAX_TABLE || (tableSize & (tableSize - 1)) != 0 ||
+		groups < 1 || groups > HPC_MAX_GROUPS){
+		fprintf(stderr, "bad arguments: the table size is a power of two from 8 to %d\n", MAX_TABLE);
+		return 2;
+	}
+	contexts = (PTHREAD_CONTEXT)malloc(tableSize * sizeof(THREAD_CONTEXT));
+	if(contexts == NULL)
+		return 1;
+
+	SimPmuInit(&model);
+	HpcConfigInit(&config);
+	config.testAppCount = 1;
+	config.groupCount = groups;
+	config.groupPeriod = 3;
+	for(g = 0; g < groups; g++){
+		for(i = 0; i < model.caps.usedProgrammable; i++)
+			config.eventSel[g][i] = HPC_EVTSEL_EN | HPC_EVTSEL_USR | (0x2E + 16 * g + i);
+	}
+	if(modes & 1){
+		config.mode = HPC_MODE_SAMPLING;
+		config.pmiThreshold = -20000;
+		rngState = 1;
+		errors += Simulate(&model, switches);
+	}
+	if(modes & 2){
+		config.mode = HPC_MODE_POLLING;
+		rngState = 2;
+		errors += Simulate(&model, switches);
+	}
+	if(modes & 4){
+		config.mode = HPC_MODE_POLLING;
+		config.rdpmc = 1;
+		rngState = 3;
+		errors += Simulate(&model, switches);
+	}
+	printf("check: %s\n", errors ? "FAILED" : "ok");
+	free(contexts);
+	return errors != 0;
+}